@@ -3,6 +3,8 @@
 #include <wx/msgdlg.h>
 #include <wx/filename.h>
 #include "MainFrame.h"
+#include "../net/ConnectionPool.h"
+#include "../utils/Logger.h"
 
 wxBEGIN_EVENT_TABLE(FileExplorerFrame, wxFrame)
     EVT_TREE_SEL_CHANGED(wxID_ANY, FileExplorerFrame::OnDirSelected)
@@ -15,11 +17,11 @@ wxBEGIN_EVENT_TABLE(FileExplorerFrame, wxFrame)
     EVT_CLOSE(FileExplorerFrame::OnClose)
 wxEND_EVENT_TABLE()
 
-FileExplorerFrame::FileExplorerFrame(wxWindow* parent, const ServerInfo& server, HwRdma *hwrdma, StreamControl *stream_control, LocalConf *localConf)
+FileExplorerFrame::FileExplorerFrame(wxWindow* parent, const ServerInfo& server, Transport *transport)
     : wxFrame(parent, wxID_ANY, 
               wxString::Format("File Explorer - %s", server.name),
               wxDefaultPosition, wxSize(900, 700)),
-      m_serverInfo(server), m_progressDialog(nullptr), m_hwrdma(hwrdma), m_streamControl(stream_control), m_localConf(localConf) {
+      m_serverInfo(server), m_progressDialog(nullptr), m_transport(transport) {
     InitializeUI();
     PopulateDirectoryTree();
     
@@ -40,25 +42,13 @@ FileExplorerFrame::~FileExplorerFrame() {
         wxString* path = reinterpret_cast<wxString*>(m_fileList->GetItemData(i));
         delete path;
     }
-    if(m_serverInfo.fd > 0)
-    {
-        printf("FileExplorerFrame destructor called, closing socket fd: %d\n", m_serverInfo.fd);
-        close(m_serverInfo.fd);
+    // 会话（socket、QP和MR）交还连接池，下次连接同一服务器时直接复用
+    if (m_transport) {
+        LOGI << "FileExplorerFrame destructor called, releasing session fd: " << m_serverInfo.fd;
+        ConnectionPool::instance().release(m_transport, m_serverInfo.ip.ToStdString(), m_serverInfo.port);
+        m_transport = nullptr;
         m_serverInfo.fd = -1;
     }
-
-    if(m_localConf) {
-        delete m_localConf;
-        m_localConf = nullptr;
-    }
-    if (m_streamControl) {
-        delete m_streamControl;
-        m_streamControl = nullptr;
-    }
-    if (m_hwrdma) {
-        delete m_hwrdma;
-        m_hwrdma = nullptr;
-    }
 }
 
 void FileExplorerFrame::InitializeUI() {
@@ -201,7 +191,7 @@ void FileExplorerFrame::PopulateFileList(const wxString& path) {
     //m_currentPath = path;
     wxDir dir(m_currentPath);
     if (!dir.IsOpened()) {
-        printf("PopulateFileList: Cannot open directory: %s\n", m_currentPath.ToStdString().c_str());
+        LOGI << "PopulateFileList: Cannot open directory: " << m_currentPath.ToStdString();
         UpdateStatus("Cannot access root dir: " + m_currentPath);
         return;
     }
@@ -363,7 +353,7 @@ void FileExplorerFrame::OnFileSelected(wxListEvent& event) {
     wxString* fullPath = reinterpret_cast<wxString*>(m_fileList->GetItemData(index));
     
     if (!fullPath) {
-        printf("OnFileSelected: fullPath is null\n");
+        LOGI << "OnFileSelected: fullPath is null";
         return;
     }
     
@@ -381,7 +371,7 @@ void FileExplorerFrame::OnFileSelected(wxListEvent& event) {
     } else {
         m_uploadBtn->Enable(false);
         UpdateStatus("Please select a file to upload");
-        printf("OnFileSelected: Invalid path: %s\n", fullPath->ToStdString().c_str());
+        LOGI << "OnFileSelected: Invalid path: " << fullPath->ToStdString();
     }
 }
 
@@ -390,7 +380,7 @@ void FileExplorerFrame::OnFileDoubleClick(wxListEvent& event) {
     wxString fullPath = *reinterpret_cast<wxString*>(m_fileList->GetItemData(index));
 
     if (fullPath.IsEmpty()) {
-        printf("OnFileDoubleClick: fullPath is null\n");
+        LOGI << "OnFileDoubleClick: fullPath is null";
         return;
     }
 
@@ -417,7 +407,7 @@ void FileExplorerFrame::OnFileDoubleClick(wxListEvent& event) {
         m_uploadBtn->Enable(true);
         UpdateStatus("Selected file: " + wxFileName(fullPath).GetFullName());
     } else {
-        printf("OnFileDoubleClick: Path does not exist: %s\n", fullPath.ToStdString().c_str());
+        LOGI << "OnFileDoubleClick: Path does not exist: " << fullPath.ToStdString();
     }
 }
 
@@ -428,8 +418,8 @@ void FileExplorerFrame::OnUpload(wxCommandEvent& event) {
     }
     
     // 创建上传进度对话框
-    m_progressDialog = new UploadProgressDialog(this, m_selectedFile, m_streamControl);
-    printf("progress dialog created\n");
+    m_progressDialog = new UploadProgressDialog(this, m_selectedFile, m_transport);
+    LOGI << "progress dialog created";
     // 先启动上传线程
     if (!m_progressDialog->StartUpload()) {
         wxMessageBox("Unable to start upload task", "Error", wxOK | wxICON_ERROR);
@@ -437,13 +427,13 @@ void FileExplorerFrame::OnUpload(wxCommandEvent& event) {
         m_progressDialog = nullptr;
         return;
     }
-    printf("progress dialog started\n");
+    LOGI << "progress dialog started";
     // 显示进度对话框并等待结果
     int result = m_progressDialog->ShowModal();
-    printf("progress dialog modal shown\n");
+    LOGI << "progress dialog modal shown";
     // 安全地销毁进度对话框
     if (m_progressDialog) {
-        printf("progress dialog cleanup thread\n");
+        LOGI << "progress dialog cleanup thread";
         m_progressDialog->Destroy();
         m_progressDialog = nullptr;
 }
@@ -453,7 +443,7 @@ void FileExplorerFrame::OnUpload(wxCommandEvent& event) {
         wxMessageBox("Upload Success", "Complete", wxOK | wxICON_INFORMATION);
         // 直接返回主界面，不使用 CallAfter
         //ReturnToMainFrame();
-        printf("complete\n");
+        LOGI << "complete";
     } else if (result == 0 || result == wxID_CANCEL){
         wxMessageBox("Upload Canceled", "Cancel", wxOK | wxICON_INFORMATION);
     }
@@ -463,7 +453,7 @@ void FileExplorerFrame::OnUpload(wxCommandEvent& event) {
     }
     else  
         wxMessageBox("Upload Error", "Error", wxOK | wxICON_ERROR);
-    printf("finish upload\n");
+    LOGI << "finish upload";
 }
 
 void FileExplorerFrame::OnBack(wxCommandEvent& event) {
@@ -476,7 +466,7 @@ void FileExplorerFrame::ReturnToMainFrame() {
 
 void FileExplorerFrame::OnClose(wxCloseEvent& event) {
     // 显示主窗口
-    printf("back to main frame\n");
+    LOGI << "back to main frame";
     auto parent = GetParent();
     if (parent) {
         parent->Show(true);
@@ -9,7 +9,7 @@
 #include "ServerConfig.h"
 #include "../utils/LocalConf.h"
 #include "../net/HwRdma.h"
-#include "../net/StreamControl.h"
+#include "../net/Transport.h"
 class UploadProgressDialog;
 
 /**
@@ -28,7 +28,7 @@ private:
  */
 class FileExplorerFrame : public wxFrame {
 public:
-    FileExplorerFrame(wxWindow* parent, const ServerInfo& server, HwRdma *hwrdma, StreamControl *stream_control, LocalConf *localConf);
+    FileExplorerFrame(wxWindow* parent, const ServerInfo& server, Transport *transport);
     virtual ~FileExplorerFrame();
 
 private:
@@ -44,9 +44,7 @@ private:
     // 数据
     ServerInfo m_serverInfo;
 
-    HwRdma *m_hwrdma;  // 添加HwRdma成员
-    StreamControl *m_streamControl;
-    LocalConf *m_localConf;  // 添加LocalConf成员
+    Transport *m_transport;  // 连接池中的会话（RDMA或TCP），关闭窗口时交还
 
     wxString m_currentPath;
     wxString m_selectedFile;
@@ -13,6 +13,8 @@
 #include <iostream>
 #include "../utils/LocalConf.h"
 #include "../net/StreamControl.h"
+#include "../net/ConnectionPool.h"
+#include "../utils/Logger.h"
 
 wxBEGIN_EVENT_TABLE(MainFrame, wxFrame)
     EVT_BUTTON(ID_ADD_SERVER, MainFrame::OnAdd)
@@ -176,91 +178,45 @@ void MainFrame::OnConnect(wxCommandEvent& event) {
     ServerInfo& server = m_config->GetServer(index);
     // 如果已有文件浏览器窗口，先关闭它
     if (m_explorerFrame) {
-        printf("OnConnect: %s\n", "close");
+        LOGI << "OnConnect: close";
         m_explorerFrame->Destroy();
         m_explorerFrame = nullptr;
     }
-    struct sockaddr_in addr;
-    bzero(&addr, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = inet_addr(server.ip.ToStdString().c_str());
-    addr.sin_port = htons(server.port);
-    int peer_fd = socket(AF_INET, SOCK_STREAM, 0);
-    auto ret = connect(peer_fd, (struct sockaddr *)&addr, sizeof(addr));
-    if (ret != 0)
+    // 会话来自进程级连接池：设备上下文只打开一次，已连接或预建的QP/MR可直接复用；无可用RDMA设备时自动改用TCP传输
+    int error_code = 0;
+    Transport* transport = ConnectionPool::instance().acquire(server.ip.ToStdString(), server.port, error_code);
+    if (error_code == ConnectionPool::ERR_CONNECT)
     {
-        std::cout << "ERROR: connecting to server: " << server.ip.ToStdString().c_str() << std::endl;
-        
-        // 关闭socket文件描述符
-        close(peer_fd);
         // 弹出错误消息框
         wxMessageBox(_T("连接失败，请检查服务器配置"), _T("连接错误"), wxOK | wxICON_ERROR, this);
         // 更新状态栏
         SetStatusText("Connection failed");
         return;
     }
-    LocalConf* local_conf = new LocalConf(getConfigPath());
-    local_conf->loadConf();
-    HwRdma* hwrdma = new HwRdma(local_conf->getRdmaGidIndex(), (uint64_t)-1);
-    if(hwrdma->init())
-    {
-        wxMessageBox(_T("RDMA初始化失败，请检查配置"), _T("初始化错误"), wxOK | wxICON_ERROR, this);
-        close(peer_fd);
-        SetStatusText("RDMA initialization failed");
-        delete local_conf;
-        delete hwrdma;
-        return;
-    }
-    StreamControl* stream_control = new StreamControl(hwrdma, peer_fd, local_conf);
-    int error_code = 0;
-    do{
-        if (stream_control->createLucpContext() == -1){
-            error_code = -1;
-            break;
-        }
-        ret = stream_control->connectPeer();
-        if(ret < 0)
-        {
-            error_code = ret;
-            break;
-        }
-        if (stream_control->bindMemoryRegion() == -1){
-            error_code = -1;
-            break;
-        }
-        if (stream_control->createBufferPool() == -1){
-            error_code = -1;
-            break;
-        }    
-    }while(0);
-    if(error_code == -2) 
+    else if (error_code == ConnectionPool::ERR_HANDSHAKE)
     {
         wxMessageBox(_T("连接失败，服务器未在线"), _T("连接错误"), wxOK | wxICON_ERROR, this);
-        close(peer_fd);
         SetStatusText("Connection failed");
-        delete local_conf;
-        delete stream_control;
-        delete hwrdma;
         return;
     }
-    else if(error_code == -1)
+    else if (error_code == ConnectionPool::ERR_SETUP)
     {
         wxMessageBox(_T("连接失败，请检查参数配置"), _T("创建错误"), wxOK | wxICON_ERROR, this);
-        close(peer_fd);
         SetStatusText("Connection failed");
-        delete local_conf;
-        delete stream_control;
-        delete hwrdma;
         return;
     }
 
-    std::cout << "Connected to " << server.ip.ToStdString().c_str() << ":" << server.port << std::endl;
-    server.fd = peer_fd;
+    LOGI << "Connected to " << server.ip.ToStdString() << ":" << server.port;
+    server.fd = transport->peer_fd;
     // 创建新的文件浏览器窗口
-    m_explorerFrame = new FileExplorerFrame(this, server, hwrdma, stream_control, local_conf);
+    m_explorerFrame = new FileExplorerFrame(this, server, transport);
     m_explorerFrame->Show(true);
     // 隐藏主窗口
     Hide();
+    // 窗口显示后空闲时为该服务器预建下一个会话
+    std::string ip = server.ip.ToStdString();
+    int port = server.port;
+    CallAfter([ip, port]() { ConnectionPool::instance().prepare(ip, port); });
 
     SetStatusText(wxString::Format("Connected to %s", server.name));
 }
@@ -285,10 +241,10 @@ void MainFrame::OnFileExplorerFrameClose()
 }
 
 void MainFrame::OnClose(wxCloseEvent& event) {
-    printf("main OnClose: %s\n", "close");
+    LOGI << "main OnClose: close";
     // 确保清理所有子窗口
     if (m_explorerFrame) {
-        printf("main explore OnClose: %s\n", "close");
+        LOGI << "main explore OnClose: close";
         m_explorerFrame->Destroy();
         m_explorerFrame = nullptr;
     }
@@ -3,6 +3,7 @@
 #include <wx/filename.h>
 #include <wx/textfile.h>
 #include <wx/tokenzr.h>  // 添加这行来支持 wxStringTokenizer
+#include "../utils/Logger.h"
 
 ServerConfig::ServerConfig() {
     // 获取配置文件路径
@@ -14,7 +15,7 @@ ServerConfig::ServerConfig() {
     }
 
     m_configPath = configDir + wxFileName::GetPathSeparator() + "servers.save";
-    printf("config path: %s\n", std::string(m_configPath).c_str());
+    LOGI << "config path: " << std::string(m_configPath);
 }
 
 ServerConfig::~ServerConfig() {
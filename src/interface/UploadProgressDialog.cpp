@@ -2,23 +2,24 @@
 #include <wx/filename.h>
 #include <wx/msgdlg.h>
 #include "../net/StreamControl.h"
+#include "../utils/Logger.h"
 
 // 定义自定义事件
-wxDEFINE_EVENT(wxEVT_UPLOAD_PROGRESS, wxCommandEvent);
 wxDEFINE_EVENT(wxEVT_UPLOAD_COMPLETE, wxCommandEvent);
 
 wxBEGIN_EVENT_TABLE(UploadProgressDialog, wxDialog)
     EVT_BUTTON(wxID_CANCEL, UploadProgressDialog::OnCancel)
-    EVT_COMMAND(wxID_ANY, wxEVT_UPLOAD_PROGRESS, UploadProgressDialog::OnProgress)
+    EVT_TIMER(ID_PROGRESS_TIMER, UploadProgressDialog::OnProgressTimer)
     EVT_COMMAND(wxID_ANY, wxEVT_UPLOAD_COMPLETE, UploadProgressDialog::OnComplete)
     EVT_CLOSE(UploadProgressDialog::OnClose)
 wxEND_EVENT_TABLE()
 
-UploadProgressDialog::UploadProgressDialog(wxWindow* parent, const wxString& filepath, StreamControl* streamControl)
+UploadProgressDialog::UploadProgressDialog(wxWindow* parent, const wxString& filepath, Transport* transport)
     : wxDialog(parent, wxID_ANY, "Upload Progress", 
                wxDefaultPosition, wxSize(280, 210),
                wxCAPTION | wxSYSTEM_MENU), // 固定大小样式
-      m_filepath(filepath), m_uploadThread(nullptr), m_cancelled(false), m_streamControl(streamControl) {
+      m_filepath(filepath), m_uploadThread(nullptr), m_cancelled(false), m_transport(transport),
+      m_progressTimer(this, ID_PROGRESS_TIMER) {
     
     // 获取文件大小
     wxFileName fn(m_filepath);
@@ -35,7 +36,8 @@ UploadProgressDialog::UploadProgressDialog(wxWindow* parent, const wxString& fil
 }
 
 UploadProgressDialog::~UploadProgressDialog() {
-    printf("UploadProgressDialog destructor called\n");
+    LOGI << "UploadProgressDialog destructor called";
+    m_progressTimer.Stop();
     cleanupThread();
 }
 
@@ -164,21 +166,22 @@ wxString UploadProgressDialog::FormatTime(int seconds) {
 
 bool UploadProgressDialog::StartUpload() {
     // 创建上传线程
-    m_uploadThread = new UploadThread(this, m_filepath, m_streamControl);
+    m_uploadThread = new UploadThread(this, m_filepath, m_transport);
     
     if (m_uploadThread->Create() != wxTHREAD_NO_ERROR) {
-        printf("Failed to create upload thread\n");
+        LOGE << "Failed to create upload thread";
         delete m_uploadThread;
         m_uploadThread = nullptr;
         return false;
     }
     
     if (m_uploadThread->Run() != wxTHREAD_NO_ERROR) {
-        printf("Failed to run upload thread\n");
+        LOGE << "Failed to run upload thread";
         delete m_uploadThread;
         m_uploadThread = nullptr;
         return false;
     }
+    m_progressTimer.Start(PROGRESS_UI_INTERVAL_MS);
     
     return true;
 }
@@ -196,27 +199,29 @@ void UploadProgressDialog::UpdateProgress(const ProgressInfo& info) {
     // 更新传输速率
     m_speedText->SetLabel(FormatTransferRate(info.transferRate));
 
-    // 计算剩余时间
-    if (info.transferRate > 0 && info.percentage > 0) {
-        wxULongLong remainingBytes = info.totalBytes - info.bytesTransferred;
-        int remainingSeconds = static_cast<int>(remainingBytes.ToDouble() / info.transferRate);
-        m_timeText->SetLabel(FormatTime(remainingSeconds));
-    } else {
-        m_timeText->SetLabel(FormatTime(-1));
-    }
+    // 剩余时间
+    m_timeText->SetLabel(FormatTime(info.remainingSeconds));
 }
 
-void UploadProgressDialog::OnProgress(wxCommandEvent& event) {
-    // 从事件中获取进度信息
-    ProgressInfo* info = reinterpret_cast<ProgressInfo*>(event.GetClientData());
-    if (info) {
-        UpdateProgress(*info);
-        delete info; // 清理内存
-    }
+void UploadProgressDialog::OnProgressTimer(wxTimerEvent& event) {
+    uint64_t bytes = m_progress.bytesTransferred.load(std::memory_order_relaxed);
+    uint64_t total = m_totalFileSize.GetValue();
+
+    // 传输停顿时速率会下降，所以每次都重绘
+    ProgressInfo info;
+    info.percentage = total > 0 ? (double)bytes / total * 100.0 : 0;
+    info.bytesTransferred = wxULongLong(bytes);
+    info.totalBytes = m_totalFileSize;
+    info.transferRate = m_progress.meter.rate() * 8;
+    double eta = m_progress.meter.eta(total > bytes ? total - bytes : 0);
+    info.remainingSeconds = eta < 0 ? -1 : (int)(eta + 0.5);
+    info.status = _T("正在上传...");
+    UpdateProgress(info);
 }
 
 void UploadProgressDialog::OnComplete(wxCommandEvent& event) {
     bool success = event.GetInt() == 1;
+    m_progressTimer.Stop();
     
     if (success) {
         ProgressInfo finalInfo;
@@ -225,17 +230,17 @@ void UploadProgressDialog::OnComplete(wxCommandEvent& event) {
         finalInfo.totalBytes = m_totalFileSize;
         finalInfo.status = _T("上传完成!");
         finalInfo.transferRate = 0;
+        finalInfo.remainingSeconds = 0;
         
         UpdateProgress(finalInfo);
-        m_timeText->SetLabel(_T("00:00"));
         
         // 延迟一点时间让用户看到完成状态
         wxMilliSleep(500);
-        printf("Upload completed successfully\n");
+        LOGI << "Upload completed successfully";
         EndModal(wxID_OK);
     } else {
         m_statusText->SetLabel(_T("上传失败!"));
-        printf("Upload failed\n");
+        LOGI << "Upload failed";
         if(this->IsModal() && this->IsShown())
             EndModal(event.GetInt());
     }
@@ -252,21 +257,21 @@ void UploadProgressDialog::cleanupThread() {
 
 void UploadProgressDialog::OnCancel(wxCommandEvent& event) {
     m_cancelled = true;
-    printf("Upload cancelled by user\n");
+    LOGI << "Upload cancelled by user";
     // if(this->IsModal() && this->IsShown())
     //     EndModal(wxID_CANCEL);
 }
 
 void UploadProgressDialog::OnClose(wxCloseEvent& event) {
     m_cancelled = true;
-    printf("Upload dialog closed by user\n"); 
+    LOGI << "Upload dialog closed by user";
     if(this->IsModal() && this->IsShown())
         EndModal(wxID_CANCEL);
 }
 
 // 上传线程实现
-UploadThread::UploadThread(UploadProgressDialog* dialog, const wxString& filepath, StreamControl* stream_control)
-    : wxThread(wxTHREAD_DETACHED), m_dialog(dialog), m_filepath(filepath), m_streamControl(stream_control) {
+UploadThread::UploadThread(UploadProgressDialog* dialog, const wxString& filepath, Transport* transport)
+    : wxThread(wxTHREAD_DETACHED), m_dialog(dialog), m_filepath(filepath), m_transport(transport) {
     
     wxFileName fn(m_filepath);
     m_totalSize = fn.GetSize();
@@ -274,20 +279,12 @@ UploadThread::UploadThread(UploadProgressDialog* dialog, const wxString& filepat
 
 UploadThread::~UploadThread() {
     m_dialog->m_uploadThread = nullptr;
-    printf("UploadThread destructor called\n");
-}
-
-void UploadThread::SendProgressUpdate(const ProgressInfo& info) {
-    wxCommandEvent evt(wxEVT_UPLOAD_PROGRESS);
-    ProgressInfo* infoPtr = new ProgressInfo(info);
-    evt.SetClientData(infoPtr);
-    wxQueueEvent(m_dialog, evt.Clone());
+    LOGI << "UploadThread destructor called";
 }
 
 wxThread::ExitCode UploadThread::Entry() {
-    printf("Starting upload for file: %s, size: %s\n", 
-           wxFileName(m_filepath).GetFullName().ToStdString().c_str(), 
-           FormatFileSize(m_totalSize).ToStdString().c_str());
+    LOGI << "Starting upload for file: " << wxFileName(m_filepath).GetFullName().ToStdString()
+         << ", size: " << FormatFileSize(m_totalSize).ToStdString();
     
     if (m_totalSize == wxInvalidSize) {
         wxCommandEvent evt(wxEVT_UPLOAD_COMPLETE);
@@ -296,6 +293,10 @@ wxThread::ExitCode UploadThread::Entry() {
         return (wxThread::ExitCode)0;
     }
 
+    // 读文件和发送都在 NIC 所在 NUMA 节点的 IO 核上进行
+    if (this->m_transport->pinIoThread(pthread_self()) != 0)
+        LOGW << "unable to pin upload thread to io cores";
+
     int error_code = 1;
     int ret;
     do{
@@ -304,7 +305,7 @@ wxThread::ExitCode UploadThread::Entry() {
             error_code = 0;
             break;
         }
-        ret = this->m_streamControl->postSendFile(
+        ret = this->m_transport->postSendFile(
             wxFileName(m_filepath).GetFullPath().ToStdString().c_str(),
             wxFileName(m_filepath).GetFullName().ToStdString().c_str(),
             this
@@ -317,33 +318,16 @@ wxThread::ExitCode UploadThread::Entry() {
     wxCommandEvent evt(wxEVT_UPLOAD_COMPLETE);
     evt.SetInt(error_code);
     wxQueueEvent(m_dialog, evt.Clone());
-    printf("UploadThread Entry end\n");
+    LOGI << "UploadThread Entry end";
     return (wxThread::ExitCode)0;
 }
-int UploadThread::caculateTransferInfo(unsigned long bytesTransferred, double duration, unsigned long bytes) {
+int UploadThread::caculateTransferInfo(unsigned long bytesTransferred, double /*duration*/, unsigned long bytes) {
     if (TestDestroy() || m_dialog->m_cancelled)
         return -1;
-        // 计算传输速率
-    
-    double transferRate = 0.0;
-    if (duration > 0) {
-        transferRate = bytes * 8 / duration; // bytes per second
-    }
-    
-    // 创建进度信息
-    ProgressInfo info;
-    info.percentage = (double)bytesTransferred / m_totalSize.ToULong() * 100.0;
-    info.bytesTransferred = wxULongLong(bytesTransferred);
-    info.totalBytes = m_totalSize;
-    info.transferRate = transferRate;
-    info.status = wxString::Format(_T("正在上传..."));
-    cout << "UploadThread: bytes" << bytes << endl;
-    cout << "UploadThread: Transfer rate: " << transferRate / 1024 << " Kb/s" << endl;
-    cout << "UploadThread: Bytes transferred: " << bytesTransferred << endl;
-    cout << "UploadThread: Percentage: " << info.percentage << "%" << endl;
-    // cout << "UploadThread: Duration: " << duration << " seconds" << endl;
-    // 发送进度更新
-    SendProgressUpdate(info);
+    LOGD << "UploadThread: bytes " << bytes << ", bytes transferred: " << bytesTransferred;
+    // 只更新快照，速率和界面由对话框的定时器计算
+    m_dialog->m_progress.meter.add(bytes);
+    m_dialog->m_progress.bytesTransferred.store(bytesTransferred, std::memory_order_relaxed);
     return 0;
 }
 
@@ -5,21 +5,40 @@ class UploadThread;
 #include <wx/gauge.h>
 #include <wx/thread.h>
 #include <wx/file.h>
+#include <wx/timer.h>
 #include <chrono>
-#include "../net/StreamControl.h"
+#include <atomic>
+#include "../net/Transport.h"
+#include "../net/ThroughputMeter.h"
 // 自定义事件声明
-wxDECLARE_EVENT(wxEVT_UPLOAD_PROGRESS, wxCommandEvent);
 wxDECLARE_EVENT(wxEVT_UPLOAD_COMPLETE, wxCommandEvent);
 
+// 进度刷新定时器
+enum {
+    ID_PROGRESS_TIMER = 1100
+};
+// 界面刷新间隔，与块的完成速度无关
+static const int PROGRESS_UI_INTERVAL_MS = 100;
+
 // 进度信息结构体
 struct ProgressInfo {
     double percentage;
     wxULongLong bytesTransferred;
     wxULongLong totalBytes;
-    double transferRate; // KB/s
+    double transferRate; // b/s
+    int remainingSeconds; // -1: 未知
     wxString status;
 
-    ProgressInfo() : percentage(0), bytesTransferred(0), totalBytes(0), transferRate(0.0) {}
+    ProgressInfo() : percentage(0), bytesTransferred(0), totalBytes(0), transferRate(0.0), remainingSeconds(-1) {}
+};
+
+// 上传线程每个块只做原子写，对话框的定时器按固定频率读取
+// 速率用 EWMA 平滑，单个块的快慢不会让速率和剩余时间跳动
+struct ProgressSnapshot {
+    std::atomic<uint64_t> bytesTransferred;
+    ThroughputMeter meter;
+
+    ProgressSnapshot() : bytesTransferred(0), meter(ThroughputMeter::THROUGHPUT_EWMA, 4.0) {}
 };
 
 /**
@@ -27,7 +46,7 @@ struct ProgressInfo {
  */
 class UploadProgressDialog : public wxDialog {
 public:
-    UploadProgressDialog(wxWindow* parent, const wxString& filepath, StreamControl *streamControl);
+    UploadProgressDialog(wxWindow* parent, const wxString& filepath, Transport *transport);
     ~UploadProgressDialog();
     
     /**
@@ -50,7 +69,9 @@ private:
     bool m_cancelled;
     UploadThread* m_uploadThread;
     wxULongLong m_totalFileSize;      // 新增：总文件大小
-    StreamControl *m_streamControl;
+    Transport *m_transport;
+    ProgressSnapshot m_progress;      // 上传线程写入的最新进度
+    wxTimer m_progressTimer;
     // 私有方法
     wxString FormatFileSize(wxULongLong size);
     wxString FormatTransferRate(double rate);
@@ -61,7 +82,7 @@ private:
     // 事件处理方法
     void OnCancel(wxCommandEvent& event);
     void OnClose(wxCloseEvent& event);
-    void OnProgress(wxCommandEvent& event);
+    void OnProgressTimer(wxTimerEvent& event);
     void OnComplete(wxCommandEvent& event);
     friend class UploadThread;
     
@@ -71,12 +92,12 @@ private:
 /**
  * @brief 上传线程类
  */
-class UploadThread : public wxThread {
+class UploadThread : public wxThread, public TransferProgress {
 public:
-    UploadThread(UploadProgressDialog* dialog, const wxString& filepath, StreamControl *streamControl);
+    UploadThread(UploadProgressDialog* dialog, const wxString& filepath, Transport *transport);
     ~UploadThread();
-    int caculateTransferInfo(unsigned long bytesTransferred, double duration, unsigned long piece_size);
-    bool checkCancel();
+    int caculateTransferInfo(unsigned long bytesTransferred, double duration, unsigned long piece_size) override;
+    bool checkCancel() override;
 protected:
     virtual ExitCode Entry() override;
     
@@ -85,10 +106,9 @@ private:
     wxString m_filepath;
     wxULongLong m_totalSize;
     std::chrono::steady_clock::time_point m_startTime;
-    StreamControl *m_streamControl;
+    Transport *m_transport;
 
     wxString FormatFileSize(wxULongLong size);
-    void SendProgressUpdate(const ProgressInfo& info);
 };
 
 #endif
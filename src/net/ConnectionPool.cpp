@@ -0,0 +1,213 @@
+#include <iostream>
+#include <chrono>
+#include <string.h>
+#include "ConnectionPool.h"
+#include "../utils/Logger.h"
+
+using namespace std;
+
+ConnectionPool &ConnectionPool::instance()
+{
+    // outlives every window, sessions are handed back from frame destructors
+    static ConnectionPool pool(getConfigPath());
+    return pool;
+}
+
+ConnectionPool::ConnectionPool(const std::string &conf_path)
+    : conf_path(conf_path)
+{
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    shutdown();
+}
+
+void ConnectionPool::shutdown()
+{
+    stopped = true;
+    for (auto &server : servers)
+    {
+        for (auto &conn : server.second.idle)
+            closeSession(conn);
+        server.second.prepared.reset();
+    }
+    servers.clear();
+    hwrdma.reset();
+    // LocalConf saves on destruction, pick up edits made since the last connect
+    if (local_conf)
+        local_conf->loadConf();
+    local_conf.reset();
+}
+
+std::string ConnectionPool::serverKey(const std::string &ip, int port)
+{
+    return ip + ":" + std::to_string(port);
+}
+
+void ConnectionPool::init()
+{
+    if (!local_conf)
+        local_conf.reset(new LocalConf(conf_path));
+    // cheap, keeps block num and rates of new sessions up to date
+    local_conf->loadConf();
+    if (hwrdma || rdma_failed)
+        return;
+    // device, gid and port settings take effect on the next start
+    std::unique_ptr<HwRdma> rdma(new HwRdma(local_conf->getRdmaGidIndex(), (uint64_t)-1));
+    rdma->placement.configure(local_conf->getNumaNode(), local_conf->getPollCores(), local_conf->getIoCores());
+    rdma->setPortFilter(local_conf->getRdmaPorts());
+    if (rdma->init())
+    {
+        LOGW << "no usable RDMA device, using the tcp transport.";
+        rdma_failed = true;
+        return;
+    }
+    hwrdma = std::move(rdma);
+}
+
+bool ConnectionPool::isAlive(Transport *conn) const
+{
+    if (!conn->isReusable() || conn->peer_fd < 0)
+        return false;
+    // the server greets an idle session with one READY_TO_RECEIVE FileInfo,
+    // sent when the session opens and after every file; nothing waiting yet
+    // is fine too. Eof, an error or any other bytes mean the server is gone
+    // or the protocol is out of step. One byte more than the header shows
+    // whether anything follows it.
+    char peek[sizeof(FileInfo) + 1];
+    ssize_t n = recv(conn->peer_fd, peek, sizeof(peek), MSG_PEEK | MSG_DONTWAIT);
+    if (n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    FileInfo ready;
+    memcpy(&ready, peek, sizeof(ready));
+    if (n == (ssize_t)sizeof(ready) && strncmp(ready.file_path, "READY_TO_RECEIVE", sizeof(ready.file_path)) == 0)
+        return true;
+    if (n > 0)
+        LOGW << "unexpected data on an idle session.";
+    return false;
+}
+
+template <class T>
+void ConnectionPool::closeSession(std::unique_ptr<T> &conn)
+{
+    if (!conn)
+        return;
+    if (conn->peer_fd >= 0)
+        close(conn->peer_fd);
+    conn.reset();
+}
+
+Transport *ConnectionPool::acquire(const std::string &ip, int port, int &error_code)
+{
+    auto start = chrono::high_resolution_clock::now();
+    error_code = 0;
+    init();
+    std::string key = serverKey(ip, port);
+    ServerSlot &slot = servers[key];
+    const char *path = "warm";
+    std::unique_ptr<Transport> session;
+    // 1. a session of a closed window that is still connected
+    while (!slot.idle.empty() && !session)
+    {
+        session = std::move(slot.idle.back());
+        slot.idle.pop_back();
+        if (!isAlive(session.get()))
+        {
+            LOGI << "Dropping stale session to " << key;
+            closeSession(session);
+        }
+    }
+    if (!session)
+    {
+        // 2. a new tcp connection, QPs and buffers from the prepared session if any
+        struct sockaddr_in addr;
+        bzero(&addr, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = inet_addr(ip.c_str());
+        addr.sin_port = htons(port);
+        int peer_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (peer_fd < 0 || connect(peer_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        {
+            LOGE << "connecting to server: " << key;
+            if (peer_fd >= 0)
+                close(peer_fd);
+            error_code = ERR_CONNECT;
+            return nullptr;
+        }
+        int ret = 0;
+        if (hwrdma)
+        {
+            path = slot.prepared ? "prepared" : "cold";
+            std::unique_ptr<StreamControl> conn = std::move(slot.prepared);
+            if (!conn)
+            {
+                conn.reset(new StreamControl(hwrdma.get(), -1, local_conf.get()));
+                if (conn->createLucpContext() == -1)
+                {
+                    close(peer_fd);
+                    error_code = ERR_SETUP;
+                    return nullptr;
+                }
+            }
+            StreamControl *rdma_conn = conn.get();
+            session = Transport::negotiate(peer_fd, std::move(conn), local_conf.get(), ret);
+            if (session.get() == rdma_conn)
+                slot.block_size = rdma_conn->getBlockSize();
+            else if (session)
+                path = "tcp";
+        }
+        else
+        {
+            path = "tcp";
+            session = Transport::negotiate(peer_fd, nullptr, local_conf.get(), ret);
+        }
+        if (!session)
+        {
+            close(peer_fd);
+            error_code = ret == -2 ? ERR_HANDSHAKE : ERR_SETUP;
+            return nullptr;
+        }
+    }
+    auto end = chrono::high_resolution_clock::now();
+    LOGI << "Session to " << key << " ready in "
+         << chrono::duration_cast<chrono::microseconds>(end - start).count() / 1000.0
+         << " ms (" << path << ", " << session->getName() << ")";
+    return session.release();
+}
+
+void ConnectionPool::release(Transport *conn, const std::string &ip, int port)
+{
+    std::unique_ptr<Transport> session(conn);
+    if (!session)
+        return;
+    ServerSlot &slot = servers[serverKey(ip, port)];
+    if (stopped || slot.idle.size() >= max_idle || !isAlive(session.get()))
+    {
+        closeSession(session);
+        return;
+    }
+    slot.idle.push_back(std::move(session));
+}
+
+void ConnectionPool::prepare(const std::string &ip, int port)
+{
+    auto it = servers.find(serverKey(ip, port));
+    if (!hwrdma || it == servers.end())
+        return;
+    ServerSlot &slot = it->second;
+    if (slot.prepared || slot.block_size == 0)
+        return;
+    auto start = chrono::high_resolution_clock::now();
+    std::unique_ptr<StreamControl> conn(new StreamControl(hwrdma.get(), -1, local_conf.get()));
+    conn->setBlockSize(slot.block_size);
+    if (conn->createLucpContext() == -1 || conn->bindMemoryRegion() == -1 || conn->createBufferPool() == -1)
+    {
+        LOGW << "unable to prepare a session for " << ip << ":" << port;
+        return;
+    }
+    slot.prepared = std::move(conn);
+    auto end = chrono::high_resolution_clock::now();
+    LOGI << "Prepared session for " << ip << ":" << port << " in "
+         << chrono::duration_cast<chrono::microseconds>(end - start).count() / 1000.0 << " ms";
+}
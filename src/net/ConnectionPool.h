@@ -0,0 +1,68 @@
+#ifndef CONNECTION_POOL_H
+#define CONNECTION_POOL_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "HwRdma.h"
+#include "StreamControl.h"
+#include "TcpTransport.h"
+#include "../utils/LocalConf.h"
+
+// Process wide RDMA state of the GUI client.
+// The devices and PDs are opened once on the first connect. Per server the
+// pool keeps the sessions of closed windows connected (TCP socket, QPs and
+// registered buffers) and one prepared session whose QPs and buffers exist
+// already, so a connect only needs the TCP and QP handshake.
+// Without a usable RDMA port, or when the server has none, sessions use the
+// tcp transport.
+class ConnectionPool
+{
+public:
+    static ConnectionPool &instance();
+    // a pool of its own reading conf_path, for headless tests
+    explicit ConnectionPool(const std::string &conf_path);
+    ~ConnectionPool();
+    // closes every session and saves the conf; called from wxApp::OnExit, the
+    // static instance is destroyed after wx is torn down
+    void shutdown();
+
+    // error codes of acquire()
+    enum
+    {
+        ERR_SETUP = -1,    // QP or buffer setup failed
+        ERR_HANDSHAKE = -2, // server did not answer the handshake
+        ERR_CONNECT = -3    // tcp connect failed
+    };
+    // connected session for ip:port, nullptr and error_code on failure
+    Transport *acquire(const std::string &ip, int port, int &error_code);
+    // takes back the session of a closed window
+    void release(Transport *conn, const std::string &ip, int port);
+    // builds the prepared session of a server that was connected before
+    void prepare(const std::string &ip, int port);
+
+private:
+    struct ServerSlot
+    {
+        std::vector<std::unique_ptr<Transport>> idle;
+        std::unique_ptr<StreamControl> prepared;
+        uint64_t block_size = 0; // learned from the last handshake
+    };
+    std::string conf_path;
+    std::unique_ptr<LocalConf> local_conf;
+    std::unique_ptr<HwRdma> hwrdma;
+    bool rdma_failed = false; // no usable RDMA port, tcp only
+    bool stopped = false; // after shutdown() released sessions are closed
+    std::map<std::string, ServerSlot> servers;
+    // idle sessions kept per server, each one holds a connection slot on the server
+    const size_t max_idle = 1;
+
+    void init();
+    bool isAlive(Transport *conn) const;
+    template <class T>
+    void closeSession(std::unique_ptr<T> &conn);
+    static std::string serverKey(const std::string &ip, int port);
+};
+
+#endif
@@ -0,0 +1,180 @@
+#include <iostream>
+#include <iomanip>
+#include <arpa/inet.h>
+#include "CreditScheduler.h"
+#include "../utils/Logger.h"
+
+CreditScheduler::CreditScheduler(uint32_t budget, uint32_t demand_cap, const std::vector<std::string> &weight_rules)
+{
+    this->budget = budget;
+    this->demand_cap = demand_cap;
+    for (auto &rule : weight_rules)
+    {
+        auto colon = rule.rfind(':');
+        if (colon == std::string::npos)
+        {
+            LOGE << "Invalid client weight rule: " << rule;
+            continue;
+        }
+        std::string addr = rule.substr(0, colon);
+        int prefix = 32;
+        auto slash = addr.find('/');
+        WeightRule r;
+        try
+        {
+            r.weight = std::stod(rule.substr(colon + 1));
+            if (slash != std::string::npos)
+            {
+                prefix = std::stoi(addr.substr(slash + 1));
+                addr = addr.substr(0, slash);
+            }
+        }
+        catch (const std::exception &e)
+        {
+            LOGE << "Invalid client weight rule: " << rule;
+            continue;
+        }
+        struct in_addr in;
+        if (inet_pton(AF_INET, addr.c_str(), &in) != 1 || prefix < 0 || prefix > 32 || r.weight <= 0)
+        {
+            LOGE << "Invalid client weight rule: " << rule;
+            continue;
+        }
+        r.prefix = prefix;
+        r.mask = prefix == 0 ? 0 : (0xFFFFFFFFu << (32 - prefix));
+        r.net = ntohl(in.s_addr) & r.mask;
+        rules.push_back(r);
+    }
+}
+
+double CreditScheduler::lookupWeight(uint32_t ip) const
+{
+    uint32_t host_ip = ntohl(ip);
+    int best_prefix = -1;
+    double weight = 1.0;
+    for (auto &r : rules)
+    {
+        if ((host_ip & r.mask) == r.net && r.prefix > best_prefix)
+        {
+            best_prefix = r.prefix;
+            weight = r.weight;
+        }
+    }
+    return weight;
+}
+
+std::shared_ptr<CreditScheduler::Account> CreditScheduler::addConnection(int fd, uint32_t ip)
+{
+    auto account = std::make_shared<Account>(fd, ip, lookupWeight(ip));
+    std::lock_guard<std::mutex> lock(accounts_mutex);
+    accounts[fd] = account;
+    return account;
+}
+
+std::shared_ptr<CreditScheduler::Account> CreditScheduler::getAccount(int fd)
+{
+    std::lock_guard<std::mutex> lock(accounts_mutex);
+    auto it = accounts.find(fd);
+    if (it == accounts.end())
+        return nullptr;
+    return it->second;
+}
+
+void CreditScheduler::removeConnection(int fd)
+{
+    std::lock_guard<std::mutex> lock(accounts_mutex);
+    auto it = accounts.find(fd);
+    if (it == accounts.end())
+        return;
+    bool was_active = it->second->active.load();
+    closed_bytes += it->second->bytes.load();
+    closed_blocks += it->second->blocks.load();
+    closed_writes += it->second->writes.load();
+    accounts.erase(it);
+    if (was_active)
+        rebalance();
+}
+
+void CreditScheduler::setActive(const std::shared_ptr<Account> &account, bool active)
+{
+    std::lock_guard<std::mutex> lock(accounts_mutex);
+    if (account->active.exchange(active) == active)
+        return;
+    if (!active)
+        account->share.store(0);
+    rebalance();
+}
+
+void CreditScheduler::snapshot(std::vector<std::shared_ptr<Account>> &live, uint64_t &closed_bytes, uint64_t &closed_blocks, uint64_t &closed_writes)
+{
+    std::lock_guard<std::mutex> lock(accounts_mutex);
+    live.clear();
+    for (auto &it : accounts)
+        live.push_back(it.second);
+    closed_bytes = this->closed_bytes;
+    closed_blocks = this->closed_blocks;
+    closed_writes = this->closed_writes;
+}
+
+// weighted water-filling, must be called with accounts_mutex held
+void CreditScheduler::rebalance()
+{
+    std::vector<Account *> pending;
+    for (auto &it : accounts)
+        if (it.second->active.load())
+            pending.push_back(it.second.get());
+
+    double remain = budget;
+    bool frozen = true;
+    while (frozen && !pending.empty())
+    {
+        frozen = false;
+        double total_weight = 0;
+        for (auto a : pending)
+            total_weight += a->weight;
+        for (auto it = pending.begin(); it != pending.end();)
+        {
+            if (remain * (*it)->weight / total_weight >= demand_cap)
+            {
+                (*it)->share.store(demand_cap);
+                remain -= demand_cap;
+                it = pending.erase(it);
+                frozen = true;
+            }
+            else
+                ++it;
+        }
+    }
+    double total_weight = 0;
+    for (auto a : pending)
+        total_weight += a->weight;
+    for (auto a : pending)
+    {
+        uint32_t share = remain > 0 ? (uint32_t)(remain * a->weight / total_weight) : 0;
+        a->share.store(share < 1 ? 1 : share);
+    }
+}
+
+void CreditScheduler::report(std::ostream &os)
+{
+    std::lock_guard<std::mutex> lock(accounts_mutex);
+    if (accounts.empty())
+        return;
+    os << "---------------- credit shares (budget " << budget << " blocks) ----------------" << std::endl;
+    for (auto &it : accounts)
+    {
+        auto &a = it.second;
+        struct in_addr in;
+        in.s_addr = a->ip;
+        uint64_t bytes = a->bytes.load();
+        double rate = a->meter.rate() * 8 / 1e9;
+        os << std::setw(16) << inet_ntoa(in)
+           << "  fd=" << a->fd
+           << "  weight=" << a->weight
+           << "  share=" << a->share.load()
+           << "  outstanding=" << a->outstanding.load()
+           << "  received=" << bytes / 1e9 << "GB"
+           << "  rate=" << rate << "Gbps"
+           << (a->active.load() ? "  [RECEIVING]" : "  [IDLE]") << std::endl;
+    }
+}
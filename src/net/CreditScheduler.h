@@ -0,0 +1,71 @@
+#ifndef CREDIT_SCHEDULER_H
+#define CREDIT_SCHEDULER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <ostream>
+#include "ThroughputMeter.h"
+
+// Server side receive credit scheduler.
+// A credit is a posted receive buffer announced to the sender. All connections
+// share one budget (in blocks) which is split among the receiving connections by
+// weighted max-min fairness; a share never exceeds BlockNum and is at least 1.
+// Weight rules look like "10.0.0.5:4" or "10.0.1.0/24:2" (longest prefix wins,
+// default weight is 1).
+class CreditScheduler
+{
+public:
+    struct Account
+    {
+        int fd;
+        uint32_t ip; // network byte order
+        double weight;
+        std::atomic<bool> active{false};
+        std::atomic<uint32_t> share{0};
+        std::atomic<uint32_t> outstanding{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> blocks{0};
+        std::atomic<uint64_t> writes{0};    // write syscalls that put the received data on disk
+        std::atomic<bool> receiving{false}; // a file is being written, over any transport
+        ThroughputMeter meter;              // fed with bytes, over the last 2 s
+        Account(int f, uint32_t i, double w) : fd(f), ip(i), weight(w) {}
+    };
+
+    CreditScheduler(uint32_t budget, uint32_t demand_cap, const std::vector<std::string> &weight_rules);
+
+    std::shared_ptr<Account> addConnection(int fd, uint32_t ip);
+    std::shared_ptr<Account> getAccount(int fd);
+    void removeConnection(int fd);
+    // called when a connection starts/finishes receiving a file
+    void setActive(const std::shared_ptr<Account> &account, bool active);
+    uint32_t getBudget() const { return budget; }
+    // print weight, share, outstanding credits and recent rate of every connection
+    void report(std::ostream &os);
+    // the live accounts plus what the closed connections received, for the metrics endpoint
+    void snapshot(std::vector<std::shared_ptr<Account>> &live, uint64_t &closed_bytes, uint64_t &closed_blocks, uint64_t &closed_writes);
+
+private:
+    struct WeightRule
+    {
+        uint32_t net;  // host byte order
+        uint32_t mask; // host byte order
+        int prefix;
+        double weight;
+    };
+    uint32_t budget;
+    uint32_t demand_cap;
+    std::vector<WeightRule> rules;
+    std::unordered_map<int, std::shared_ptr<Account>> accounts;
+    std::mutex accounts_mutex;
+    uint64_t closed_bytes = 0, closed_blocks = 0, closed_writes = 0;
+
+    double lookupWeight(uint32_t ip) const;
+    void rebalance();
+};
+
+#endif
@@ -6,13 +6,17 @@
 #include <vector>
 #include <map>
 #include <mutex>
-using std::cout, std::endl;
+#include <string>
+#include <algorithm>
+#include <sys/mman.h>
+#include "NumaPlacement.h"
+#include "../utils/Logger.h"
 class HwRdma
 {
 public:
     HwRdma(int gid_idx, uint64_t buffer_size)
     {
-        cout << "buffer_size: " << buffer_size << endl;
+        LOGI << "buffer_size: " << buffer_size;
         this->gid_idx = gid_idx;
         this->buffer_size = buffer_size;
         this->free_size = buffer_size;
@@ -21,17 +25,35 @@ public:
     {
         this->free_size = size;
     }
+    // registered memory left under buffer_size, readable while others register
+    uint64_t getFreeSize()
+    {
+        std::lock_guard<std::mutex> lock(this->mr_mutex);
+        return this->free_size;
+    }
+    // "dev" or "dev:port" entries, empty means every eligible port
+    void setPortFilter(const std::vector<std::string> &filter)
+    {
+        this->port_filter = filter;
+    }
     int init()
     {
-        cout << "Looking for IB devices ..." << endl;
+        LOGI << "Looking for IB devices ...";
         int num_devices = 0;
         struct ibv_device **devs = ibv_get_device_list(&num_devices);
+        if (devs == nullptr)
+        {
+            // no verbs provider at all, callers fall back to tcp
+            LOGE << "ibv_get_device_list failed, errno: " << errno;
+            return -1;
+        }
+        std::vector<std::pair<struct ibv_device *, int>> candidates;
 
         // List devices
-        cout << endl
-             << "=============================================" << endl;
-        cout << "Found " << num_devices << " devices" << endl;
-        cout << "---------------------------------------------" << endl;
+        LOGI << std::endl
+             << "=============================================";
+        LOGI << "Found " << num_devices << " devices";
+        LOGI << "---------------------------------------------";
         for (int i = 0; i < num_devices; i++)
         {
 
@@ -51,99 +73,139 @@ public:
                 transport_type = "UNKNOWN";
                 break;
             }
-            cout << "   device " << i
+            LOGI << "   device " << i
                  << " : " << devs[i]->name
                  << " : " << devs[i]->dev_name
                  << " : " << transport_type
-                 << " : " << ibv_node_type_str(devs[i]->node_type)
-                 << endl;
+                 << " : " << ibv_node_type_str(devs[i]->node_type);
 
-             // Open device
+            // Collect every active Ethernet port of the device
+            struct ibv_context *local_ctx = ibv_open_device(devs[i]);
+            if(local_ctx == nullptr)
+            {
+                LOGE << "opening device " << devs[i]->name;
+                continue;
+            }
+            struct ibv_device_attr local_attr;
+            struct ibv_port_attr local_port_attr;
+            auto ret = ibv_query_device(local_ctx, &local_attr);
+            if(ret != 0)
+            {
+                LOGE << "ibv_query_device failed for device " << i;
+                ibv_close_device(local_ctx);
+                continue;
+            }
+            for(int j = 0; j < local_attr.phys_port_cnt; j++)
+            {
+                auto ret = ibv_query_port(local_ctx, j + 1, &local_port_attr);
+                if(ret != 0)
+                {
+                    LOGE << "ibv_query_port failed for device " << devs[i]->name << " port " << j + 1;
+                    continue;
+                }
+                if(local_port_attr.state == IBV_PORT_ACTIVE &&
+                   local_port_attr.link_layer == IBV_LINK_LAYER_ETHERNET &&
+                   portSelected(devs[i]->name, j + 1))
+                {
+                    candidates.emplace_back(devs[i], j + 1);
+                }
+            }
+            ibv_close_device(local_ctx);
+            // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+        }
+        LOGI << "=============================================";
 
-            if (this->dev == nullptr)
+        // Open each device once, its ports share the context and pd
+        for (auto &candidate : candidates)
+        {
+            RdmaPort port;
+            port.dev = candidate.first;
+            port.port_num = candidate.second;
+            port.owns_ctx = true;
+            for (auto &opened : this->ports)
+            {
+                if (opened.dev == port.dev)
+                {
+                    port.ctx = opened.ctx;
+                    port.pd = opened.pd;
+                    port.attr = opened.attr;
+                    port.owns_ctx = false;
+                    break;
+                }
+            }
+            if (port.owns_ctx)
             {
-                struct ibv_context *local_ctx = ibv_open_device(devs[i]);
-                if(local_ctx == nullptr)
+                port.ctx = ibv_open_device(port.dev);
+                if (!port.ctx)
                 {
-                    cout << "ERROR: opening device " << devs[i]->name << endl;
+                    LOGE << "opening IB device context " << port.dev->name << "!";
                     continue;
                 }
-                struct ibv_device_attr local_attr;
-                struct ibv_port_attr local_port_attr;
-                auto ret = ibv_query_device(local_ctx, &local_attr);
-                if(ret != 0)
+                ibv_query_device(port.ctx, &port.attr);
+                port.pd = ibv_alloc_pd(port.ctx);
+                if (!port.pd)
                 {
-                    cout << "ERROR: ibv_query_device failed for device " << i << endl;
-                    ibv_close_device(local_ctx);
+                    LOGE << "allocation protection domain on " << port.dev->name << "!";
+                    ibv_close_device(port.ctx);
                     continue;
                 }
-                for(int j = 0; j < local_attr.phys_port_cnt; j++)
+            }
+            ibv_query_port(port.ctx, port.port_num, &port.port_attr);
+            if(this->gid_idx < 0 || this->gid_idx >= port.port_attr.gid_tbl_len ||
+               ibv_query_gid(port.ctx, port.port_num, this->gid_idx, &port.gid) != 0)
+            {
+                LOGW << "gid index " << this->gid_idx << " not usable on " << port.dev->name
+                     << " port " << port.port_num << ", skipped.";
+                if (port.owns_ctx)
                 {
-                    auto ret = ibv_query_port(local_ctx, j + 1, &local_port_attr);
-                    if(ret != 0)
-                    {
-                        cout << "ERROR: ibv_query_port failed for device " << devs[i]->name << " port " << j + 1 << endl;
-                        continue;
-                    }
-                    if(local_port_attr.state == IBV_PORT_ACTIVE &&
-                       local_port_attr.link_layer == IBV_LINK_LAYER_ETHERNET)
-                    {
-                        this->dev = devs[i];
-                        this->port_num = j + 1;
-                        break;
-                    }
+                    ibv_dealloc_pd(port.pd);
+                    ibv_close_device(port.ctx);
                 }
-                ibv_close_device(local_ctx);
+                continue;
             }
-            // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+            port.rate_mbps = portRateMbps(port.port_attr);
+            this->ports.push_back(port);
         }
-        cout << "=============================================" << endl
-             << endl;
-        if(this->dev == nullptr)
-        {
-            cout << "ERROR: No suitable IB device found!" << endl;
-            ibv_free_device_list(devs);
-            return -1;
-        }   
-        // Open device
-        this->ctx = ibv_open_device(this->dev);
         ibv_free_device_list(devs);
-        if (!this->ctx)
+        if(this->ports.empty())
         {
-            cout << "ERROR: opening IB device context!" << endl;
+            LOGE << "No suitable IB device found!";
             return -1;
         }
-        // Get device and port attributes
-        ibv_query_device(this->ctx, &this->attr);
-        ibv_query_port(this->ctx, this->port_num, &this->port_attr);
-        ibv_query_gid(this->ctx, this->port_num, this->gid_idx, &this->gid);
-        if(this->gid_idx < 0 || this->gid_idx >= this->port_attr.gid_tbl_len)
+        // the first port is the primary one for single port users (SRQ, shared CQs)
+        RdmaPort &primary = this->ports[0];
+        this->dev = primary.dev;
+        this->ctx = primary.ctx;
+        this->attr = primary.attr;
+        this->pd = primary.pd;
+        this->port_num = primary.port_num;
+        this->port_attr = primary.port_attr;
+        this->gid = primary.gid;
+
+        for (auto &port : this->ports)
         {
-            cout << "ERROR: gid index" << this->gid_idx << " out of range." << endl;
-            ibv_close_device(this->ctx);
-            return -1;
-        }
-        cout << "Device " << this->dev->name << " opened,"
-            << " gid_idx=" << this->gid_idx << endl;
+            LOGI << "Device " << port.dev->name << " opened,"
+                << " gid_idx=" << this->gid_idx;
 
-        // Print some of the port attributes
-        cout << "Port " << this->port_num << " attributes:" << endl;
-        cout << "           state: " << port_attr.state << endl;
-        cout << "         max_mtu: " << port_attr.max_mtu << endl;
-        cout << "      active_mtu: " << port_attr.active_mtu << endl;
-        cout << "  port_cap_flags: " << port_attr.port_cap_flags << endl;
-        cout << "      max_msg_sz: " << port_attr.max_msg_sz << endl;
-        cout << "    active_width: " << (uint64_t)port_attr.active_width << endl;
-        cout << "    active_speed: " << (uint64_t)port_attr.active_speed << endl;
-        cout << "      phys_state: " << (uint64_t)port_attr.phys_state << endl;
-        cout << "      link_layer: " << (uint64_t)port_attr.link_layer << endl;
+            // Print some of the port attributes
+            LOGI << "Port " << port.port_num << " attributes:";
+            LOGI << "           state: " << port.port_attr.state;
+            LOGI << "         max_mtu: " << port.port_attr.max_mtu;
+            LOGI << "      active_mtu: " << port.port_attr.active_mtu;
+            LOGI << "  port_cap_flags: " << port.port_attr.port_cap_flags;
+            LOGI << "      max_msg_sz: " << port.port_attr.max_msg_sz;
+            LOGI << "    active_width: " << (uint64_t)port.port_attr.active_width;
+            LOGI << "    active_speed: " << (uint64_t)port.port_attr.active_speed;
+            LOGI << "      phys_state: " << (uint64_t)port.port_attr.phys_state;
+            LOGI << "      link_layer: " << (uint64_t)port.port_attr.link_layer;
+            LOGI << "            rate: " << port.rate_mbps / 1000.0 << "Gbps";
+        }
 
-        // Allocate protection domain
-        this->pd = ibv_alloc_pd(this->ctx);
-        if (!this->pd)
+        // place buffers and threads next to the primary device
+        this->placement.init(this->dev->name);
         {
-            cout << "ERROR: allocation protection domain!" << endl;
-            return -1;
+            Logger::Line line(LOG_LEVEL_INFO);
+            this->placement.report(line.stream());
         }
         return 0;
     }
@@ -151,46 +213,103 @@ public:
     {
         if(length <= 0)
         {
-            cout << "ERROR: wrong size expected to create mr." <<endl;
+            LOGE << "wrong size expected to create mr.";
             return -1;
         }
-        //for client, init only one mr dynamically
-        if(this->free_size == uint64_t(-1))
-            this->free_size = length;
-        if (this->free_size < length)
+        //for client, buffer_size -1 registers on demand without a limit,
+        //one process wide HwRdma serves every session
         {
-            cout << "ERROR: the remain free space is not enough!" << endl;
-            return -1;
+            // reserved before the mmap, concurrent callers (spare refills,
+            // accepts) must not both pass the check
+            std::lock_guard<std::mutex> lock(this->mr_mutex);
+            if (this->buffer_size != uint64_t(-1) && this->free_size < length)
+            {
+                LOGE << "the remain free space is not enough!";
+                return -1;
+            }
+            this->free_size -= length;
         }
-        *buffer_ptr = new uint8_t[length];
-        if (!(*buffer_ptr))
+        auto unreserve = [this, length]()
+        {
+            std::lock_guard<std::mutex> lock(this->mr_mutex);
+            this->free_size += length;
+        };
+        // mmap so the pages can be bound to the device's node before
+        // ibv_reg_mr faults them in
+        void *addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED)
         {
-            cout << "ERROR: Unable to allocate buffer!" << endl;
+            LOGE << "Unable to allocate buffer!";
+            unreserve();
             return -1;
         }
+        if (NumaPlacement::bindMemory(addr, length, this->placement.getNode()) != 0)
+            LOGW << "unable to bind buffer to numa node " << this->placement.getNode();
+        *buffer_ptr = (uint8_t *)addr;
         auto access = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE;
         *mr = ibv_reg_mr(pd, *buffer_ptr, length, access);
         if (!(*mr))
         {
-            cout << "ERROR: Unable to register memory region!" << endl;
-            delete[] (*buffer_ptr);
+            LOGE << "Unable to register memory region!";
+            munmap(*buffer_ptr, length);
+            unreserve();
             return -1;
         }
+        // the same buffer is registered once per device for the other ports
+        std::vector<ibv_mr *> mrs;
+        for (auto &port : this->ports)
+        {
+            ibv_mr *port_mr = port.pd == this->pd ? *mr : nullptr;
+            for (size_t j = 0; j < mrs.size() && port_mr == nullptr; j++)
+                if (this->ports[j].pd == port.pd)
+                    port_mr = mrs[j];
+            if (port_mr == nullptr)
+                port_mr = ibv_reg_mr(port.pd, *buffer_ptr, length, access);
+            if (!port_mr)
+            {
+                LOGE << "Unable to register memory region on " << port.dev->name << "!";
+                std::vector<ibv_mr *> done(1, *mr);
+                for (auto registered : mrs)
+                {
+                    if (std::find(done.begin(), done.end(), registered) != done.end())
+                        continue;
+                    ibv_dereg_mr(registered);
+                    done.push_back(registered);
+                }
+                ibv_dereg_mr(*mr);
+                munmap(*buffer_ptr, length);
+                unreserve();
+                return -1;
+            }
+            mrs.push_back(port_mr);
+        }
         std::lock_guard<std::mutex> lock(this->mr_mutex);
-        this->free_size -= length;
         mr_set.insert(std::make_pair((uint64_t)(*buffer_ptr), *mr));
+        port_mrs[*mr] = mrs;
 
         return 0;
     }
+    // registration of mr (from create_mr) valid on ports[port]; takes mr_mutex,
+    // callers keep the lkey instead of asking per work request
+    struct ibv_mr *portMr(struct ibv_mr *mr, size_t port)
+    {
+        std::lock_guard<std::mutex> lock(this->mr_mutex);
+        auto it = port_mrs.find(mr);
+        if (it == port_mrs.end() || port >= it->second.size())
+            return mr;
+        return it->second[port];
+    }
     int destroy_mr(struct ibv_mr* mr)
     {
         std::lock_guard<std::mutex> lock(this->mr_mutex);
         for(auto it = mr_set.begin();it != mr_set.end(); ++it)
         {
             if(it->second == mr){
-                delete[] (uint8_t*)(it->first);
-                this->free_size += it->second->length;
+                size_t length = it->second->length;
+                this->free_size += length;
+                deregPortMrs(it->second);
                 ibv_dereg_mr(it->second);
+                munmap((void *)(it->first), length);
                 mr_set.erase(it);  
                 return 0;
                 break;
@@ -202,14 +321,33 @@ public:
     {
         for(auto it = mr_set.begin();it != mr_set.end(); ++it)
         {
-            delete[] (uint8_t*)(it->first);
+            size_t length = it->second->length;
+            deregPortMrs(it->second);
             ibv_dereg_mr(it->second);
+            munmap((void *)(it->first), length);
+        }
+        for (auto &port : this->ports)
+        {
+            if (!port.owns_ctx)
+                continue;
+            ibv_dealloc_pd(port.pd);
+            ibv_close_device(port.ctx);
         }
-        if (pd != nullptr)
-            ibv_dealloc_pd(pd);
-        if (ctx != nullptr)
-            ibv_close_device(ctx);
     }
+    // one eligible port, ports sharing a device share ctx and pd
+    struct RdmaPort
+    {
+        struct ibv_device *dev = nullptr;
+        struct ibv_context *ctx = nullptr;
+        struct ibv_pd *pd = nullptr;
+        struct ibv_device_attr attr;
+        int port_num;
+        struct ibv_port_attr port_attr;
+        ibv_gid gid;
+        uint32_t rate_mbps = 0;
+        bool owns_ctx = false;
+    };
+    std::vector<RdmaPort> ports;
     // device
     struct ibv_device *dev = nullptr;
     struct ibv_device_attr attr;
@@ -227,6 +365,65 @@ public:
     // gid
     int gid_idx;
     ibv_gid gid;
+    // numa placement, configure() before init()
+    NumaPlacement placement;
+
+private:
+    std::vector<std::string> port_filter;
+    // extra registrations of each mr on the other devices, indexed by port
+    std::map<ibv_mr *, std::vector<ibv_mr *>> port_mrs;
+
+    bool portSelected(const char *dev_name, int port) const
+    {
+        if (port_filter.empty())
+            return true;
+        for (auto &entry : port_filter)
+        {
+            if (entry == dev_name || entry == std::string(dev_name) + ":" + std::to_string(port))
+                return true;
+        }
+        return false;
+    }
+    // called with mr_mutex held
+    void deregPortMrs(ibv_mr *mr)
+    {
+        auto it = port_mrs.find(mr);
+        if (it == port_mrs.end())
+            return;
+        std::vector<ibv_mr *> done;
+        for (auto port_mr : it->second)
+        {
+            if (port_mr == mr || std::find(done.begin(), done.end(), port_mr) != done.end())
+                continue;
+            ibv_dereg_mr(port_mr);
+            done.push_back(port_mr);
+        }
+        port_mrs.erase(it);
+    }
+    static uint32_t portRateMbps(const struct ibv_port_attr &attr)
+    {
+        uint32_t lanes = 1, lane_mbps = 0;
+        switch (attr.active_width)
+        {
+        case 1: lanes = 1; break;
+        case 2: lanes = 4; break;
+        case 4: lanes = 8; break;
+        case 8: lanes = 12; break;
+        case 16: lanes = 2; break;
+        }
+        switch (attr.active_speed)
+        {
+        case 1: lane_mbps = 2500; break;
+        case 2: lane_mbps = 5000; break;
+        case 4: case 8: lane_mbps = 10000; break;
+        case 16: lane_mbps = 14000; break;
+        case 32: lane_mbps = 25000; break;
+        case 64: lane_mbps = 50000; break;
+        case 128: lane_mbps = 100000; break;
+        }
+        // unknown encodings count as 1Gbps so weights stay positive
+        return lane_mbps > 0 ? lanes * lane_mbps : 1000;
+    }
 };
 
 #endif
\ No newline at end of file
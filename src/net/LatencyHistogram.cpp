@@ -0,0 +1,164 @@
+#include <math.h>
+#include <iomanip>
+#include "LatencyHistogram.h"
+
+static double calibrateTicks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    // spin for a few ms, that is precise enough for latencies
+    auto t0 = std::chrono::steady_clock::now();
+    uint64_t c0 = __rdtsc();
+    std::chrono::steady_clock::duration elapsed;
+    do
+        elapsed = std::chrono::steady_clock::now() - t0;
+    while (elapsed < std::chrono::milliseconds(5));
+    uint64_t c1 = __rdtsc();
+    if (c1 > c0)
+        return std::chrono::duration<double, std::nano>(elapsed).count() / (c1 - c0);
+#endif
+    return 1.0;
+}
+
+// calibrated before main() so the first block does not pay for it
+static const double ns_per_tick = calibrateTicks();
+
+double CycleClock::nsPerTick()
+{
+    return ns_per_tick;
+}
+
+int LatencyHistogram::bucketOf(uint64_t ns)
+{
+    if (ns < (2u << SUB_BITS))
+        return (int)ns;
+    int exp = 63 - __builtin_clzll(ns);
+    if (exp >= MAX_EXP)
+        return BUCKET_NUM - 1;
+    int sub = (int)(ns >> (exp - SUB_BITS)) & ((1 << SUB_BITS) - 1);
+    return (2 << SUB_BITS) + (exp - SUB_BITS - 1) * (1 << SUB_BITS) + sub;
+}
+
+uint64_t LatencyHistogram::bucketHigh(int bucket)
+{
+    if (bucket < (2 << SUB_BITS))
+        return bucket;
+    bucket -= 2 << SUB_BITS;
+    int exp = bucket / (1 << SUB_BITS) + SUB_BITS + 1;
+    uint64_t sub = bucket % (1 << SUB_BITS);
+    uint64_t low = ((1ULL << SUB_BITS) + sub) << (exp - SUB_BITS);
+    return low + (1ULL << (exp - SUB_BITS)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+    counts[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum_ns.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t old = max_ns.load(std::memory_order_relaxed);
+    while (ns > old && !max_ns.compare_exchange_weak(old, ns, std::memory_order_relaxed))
+        ;
+}
+
+void LatencyHistogram::reset()
+{
+    for (auto &c : counts)
+        c.store(0, std::memory_order_relaxed);
+    total.store(0, std::memory_order_relaxed);
+    sum_ns.store(0, std::memory_order_relaxed);
+    max_ns.store(0, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::mean() const
+{
+    uint64_t n = count();
+    return n ? (double)sum_ns.load(std::memory_order_relaxed) / n : 0;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    // the buckets are read one by one while the recorder goes on, so sum them
+    // up instead of trusting total
+    uint64_t n = 0;
+    for (auto &c : counts)
+        n += c.load(std::memory_order_relaxed);
+    if (n == 0)
+        return 0;
+    uint64_t rank = (uint64_t)ceil(p * n);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_NUM; i++)
+    {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            uint64_t high = bucketHigh(i);
+            uint64_t top = max();
+            return top != 0 && top < high ? top : high;
+        }
+    }
+    return max();
+}
+
+void StageLatency::record(LatencyStage stage, uint64_t ticks)
+{
+    uint64_t ns = CycleClock::toNs(ticks);
+    hist[stage].record(ns);
+    if (this != &global())
+        global().hist[stage].record(ns);
+}
+
+void StageLatency::reset()
+{
+    for (auto &h : hist)
+        h.reset();
+}
+
+void StageLatency::report(std::ostream &os, const char *title) const
+{
+    std::ios::fmtflags flags = os.flags();
+    std::streamsize precision = os.precision();
+    bool header = false;
+    for (int s = 0; s < STAGE_NUM; s++)
+    {
+        const LatencyHistogram &h = hist[s];
+        if (h.count() == 0)
+            continue;
+        if (!header)
+        {
+            os << title << " (us):" << std::endl;
+            header = true;
+        }
+        os << "  " << std::left << std::setw(16) << stageName((LatencyStage)s) << std::right
+           << " n " << h.count() << std::fixed << std::setprecision(1)
+           << "  p50 " << h.percentile(0.5) / 1e3
+           << "  p99 " << h.percentile(0.99) / 1e3
+           << "  p999 " << h.percentile(0.999) / 1e3
+           << "  max " << h.max() / 1e3 << std::endl;
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
+
+StageLatency &StageLatency::global()
+{
+    static StageLatency latency;
+    return latency;
+}
+
+const char *StageLatency::stageName(LatencyStage stage)
+{
+    switch (stage)
+    {
+    case STAGE_DISK_READ:
+        return "disk read";
+    case STAGE_SEND_COMPLETION:
+        return "send completion";
+    case STAGE_CREDIT_RTT:
+        return "credit rtt";
+    case STAGE_RECV_WRITE:
+        return "recv write";
+    default:
+        return "unknown";
+    }
+}
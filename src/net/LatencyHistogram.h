@@ -0,0 +1,91 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Cheap timestamps for the per-block hot path: the TSC on x86 (assumed
+// invariant, calibrated once against steady_clock at startup), steady_clock
+// nanoseconds elsewhere.
+class CycleClock
+{
+public:
+    static inline uint64_t now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+    static double nsPerTick();
+    static inline uint64_t toNs(uint64_t ticks) { return (uint64_t)(ticks * nsPerTick()); }
+};
+
+// HDR-style latency histogram in nanoseconds: values below 64 have their own
+// bucket, above that every power of two is split into 32 linear sub-buckets,
+// so a percentile is within 1/32 (~3%) of the recorded value. Values above
+// 2^42 ns (~73 min) land in the last bucket.
+// Counters are relaxed atomics: one thread records, any thread may query or
+// reset while it does.
+class LatencyHistogram
+{
+public:
+    static const int SUB_BITS = 5;
+    static const int MAX_EXP = 42;
+    static const int BUCKET_NUM = (2 << SUB_BITS) + (MAX_EXP - SUB_BITS - 1) * (1 << SUB_BITS);
+
+    void record(uint64_t ns);
+    void reset();
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_ns.load(std::memory_order_relaxed); }
+    uint64_t sumNs() const { return sum_ns.load(std::memory_order_relaxed); }
+    double mean() const;
+    // upper bound of the bucket holding the p-th fraction (0..1) of the values
+    uint64_t percentile(double p) const;
+
+    static int bucketOf(uint64_t ns);
+    static uint64_t bucketHigh(int bucket);
+
+private:
+    std::atomic<uint64_t> counts[BUCKET_NUM] = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> sum_ns{0};
+    std::atomic<uint64_t> max_ns{0};
+};
+
+// stages of one block on its way through the pipeline
+enum LatencyStage
+{
+    STAGE_DISK_READ,       // sender: pread of the block
+    STAGE_SEND_COMPLETION, // sender: ibv_post_send to its send completion
+    STAGE_CREDIT_RTT,      // sender: post of the block to the return of its credit
+    STAGE_RECV_WRITE,      // receiver: receive completion to pwrite done
+    STAGE_NUM
+};
+
+// One histogram per stage. Every StreamControl keeps its own (reset per file)
+// and also records into global(), the totals of the process.
+class StageLatency
+{
+public:
+    void record(LatencyStage stage, uint64_t ticks);
+    void reset();
+    const LatencyHistogram &get(LatencyStage stage) const { return hist[stage]; }
+    // count, p50/p99/p999/max in us of every stage that has values
+    void report(std::ostream &os, const char *title) const;
+
+    static StageLatency &global();
+    static const char *stageName(LatencyStage stage);
+
+private:
+    LatencyHistogram hist[STAGE_NUM];
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "NumaPlacement.h"
+#include "../utils/Logger.h"
+
+int NumaPlacement::detectDeviceNode(const char *ibdev_name)
+{
+    std::ifstream file(std::string("/sys/class/infiniband/") + ibdev_name + "/device/numa_node");
+    int node = -1;
+    if (!(file >> node))
+        return -1;
+    return node;
+}
+
+std::vector<int> NumaPlacement::nodeCpus(int node)
+{
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    if (node < 0 || !std::getline(file, list))
+        return std::vector<int>();
+    return parseCpuList(list);
+}
+
+std::vector<int> NumaPlacement::parseCpuList(const std::string &list)
+{
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        item.erase(0, item.find_first_not_of(" \t"));
+        item.erase(item.find_last_not_of(" \t") + 1);
+        if (item.empty())
+            continue;
+        try
+        {
+            auto dash = item.find('-');
+            int first = std::stoi(item.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++)
+                cpus.push_back(cpu);
+        }
+        catch (const std::exception &e)
+        {
+            LOGE << "Invalid cpu list item: " << item;
+        }
+    }
+    return cpus;
+}
+
+int NumaPlacement::bindMemory(void *addr, size_t length, int node)
+{
+    if (node < 0)
+        return 0;
+    const unsigned long bits = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> nodemask(node / bits + 1, 0);
+    nodemask[node / bits] |= 1UL << (node % bits);
+    // MPOL_PREFERRED falls back to other nodes instead of failing the allocation
+    return syscall(SYS_mbind, addr, length, MPOL_PREFERRED, nodemask.data(), nodemask.size() * bits + 1, 0);
+}
+
+int NumaPlacement::pinThread(pthread_t thr, const std::vector<int> &cpus)
+{
+    if (cpus.empty())
+        return 0;
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int cpu : cpus)
+        CPU_SET(cpu, &cpuset);
+    return pthread_setaffinity_np(thr, sizeof(cpuset), &cpuset);
+}
+
+void NumaPlacement::configure(const std::string &numa_node, const std::string &poll_cores, const std::string &io_cores)
+{
+    this->node_setting = numa_node;
+    this->poll_setting = poll_cores;
+    this->io_setting = io_cores;
+}
+
+void NumaPlacement::init(const char *ibdev_name)
+{
+    device = ibdev_name;
+    if (node_setting == "off")
+        node = -1;
+    else if (node_setting == "auto" || node_setting.empty())
+    {
+        node = detectDeviceNode(ibdev_name);
+        detected = true;
+    }
+    else
+        node = std::stoi(node_setting);
+    node_cpus = nodeCpus(node);
+    poll_cores = poll_setting.empty() ? node_cpus : parseCpuList(poll_setting);
+    io_cores = io_setting.empty() ? node_cpus : parseCpuList(io_setting);
+}
+
+static void printCpus(std::ostream &os, const std::vector<int> &cpus)
+{
+    if (cpus.empty())
+    {
+        os << "any";
+        return;
+    }
+    for (size_t i = 0; i < cpus.size(); i++)
+        os << (i ? "," : "") << cpus[i];
+}
+
+void NumaPlacement::report(std::ostream &os) const
+{
+    os << "NUMA placement for " << device << ":" << std::endl;
+    os << "        nic node: ";
+    if (node < 0)
+        os << (node_setting == "off" ? "disabled" : "unknown");
+    else
+        os << node << (detected ? " (detected from sysfs)" : " (configured)");
+    os << std::endl;
+    os << "       node cpus: ";
+    printCpus(os, node_cpus);
+    os << std::endl;
+    os << "      poll cores: ";
+    printCpus(os, poll_cores);
+    os << (poll_setting.empty() ? " (nic node)" : " (configured)") << std::endl;
+    os << "        io cores: ";
+    printCpus(os, io_cores);
+    os << (io_setting.empty() ? " (nic node)" : " (configured)") << std::endl;
+    os << "       mr memory: ";
+    if (node < 0)
+        os << "default policy";
+    else
+        os << "preferred on node " << node;
+    os << std::endl;
+}
+
+int NumaPlacement::pinPollThread(pthread_t thr, int index) const
+{
+    if (poll_cores.empty())
+        return 0;
+    return pinThread(thr, std::vector<int>(1, poll_cores[index % poll_cores.size()]));
+}
+
+int NumaPlacement::pinPollThread(pthread_t thr) const
+{
+    return pinThread(thr, poll_cores);
+}
+
+int NumaPlacement::pinIoThread(pthread_t thr) const
+{
+    return pinThread(thr, io_cores);
+}
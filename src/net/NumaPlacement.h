@@ -0,0 +1,51 @@
+#ifndef NUMA_PLACEMENT_H
+#define NUMA_PLACEMENT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// NUMA placement of registered memory and threads relative to the NIC.
+// The NIC's node is read from /sys/class/infiniband/<dev>/device/numa_node
+// unless NumaNode is set explicitly ("auto", "off" or a node number).
+// PollCores / IoCores are cpu lists like "0-7,16"; when empty they default
+// to all cpus of the NIC's node.
+class NumaPlacement
+{
+public:
+    static int detectDeviceNode(const char *ibdev_name);
+    static std::vector<int> nodeCpus(int node);
+    static std::vector<int> parseCpuList(const std::string &list);
+    // prefer pages of [addr, addr + length) on node, before they are touched
+    static int bindMemory(void *addr, size_t length, int node);
+    static int pinThread(pthread_t thr, const std::vector<int> &cpus);
+
+    void configure(const std::string &numa_node, const std::string &poll_cores, const std::string &io_cores);
+    // resolve the placement once the device is known
+    void init(const char *ibdev_name);
+    void report(std::ostream &os) const;
+
+    int getNode() const { return node; }
+    const std::vector<int> &getPollCores() const { return poll_cores; }
+    const std::vector<int> &getIoCores() const { return io_cores; }
+    // pin the index-th polling thread to one poll core
+    int pinPollThread(pthread_t thr, int index) const;
+    // pin a polling thread to the whole poll core set
+    int pinPollThread(pthread_t thr) const;
+    int pinIoThread(pthread_t thr) const;
+
+private:
+    std::string node_setting = "auto";
+    std::string poll_setting;
+    std::string io_setting;
+    std::string device;
+    int node = -1;
+    bool detected = false;
+    std::vector<int> node_cpus;
+    std::vector<int> poll_cores;
+    std::vector<int> io_cores;
+};
+
+#endif
@@ -0,0 +1,193 @@
+#include <iostream>
+#include <chrono>
+#include <sys/epoll.h>
+#include <pthread.h>
+#include "Reactor.h"
+#include "../utils/Logger.h"
+
+Reactor::Reactor(HwRdma *hwrdma, ServerContext *server_ctx, int id, int cq_size)
+{
+    this->hwrdma = hwrdma;
+    this->server_ctx = server_ctx;
+    this->id = id;
+    this->cq_size = cq_size;
+}
+
+Reactor::~Reactor()
+{
+    stop();
+    // QPs have to go before the cq they are attached to
+    for (auto &it : conns)
+    {
+        int fd = it.first;
+        it.second.reset();
+        closePeer(server_ctx, fd);
+    }
+    conns.clear();
+    for (auto &conn : pending)
+    {
+        int fd = conn->peer_fd;
+        conn.reset();
+        closePeer(server_ctx, fd);
+    }
+    pending.clear();
+    for (auto cq : cqs)
+        ibv_destroy_cq(cq);
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+}
+
+int Reactor::init()
+{
+    for (auto &port : hwrdma->ports)
+    {
+        int size = cq_size < port.attr.max_cqe ? cq_size : port.attr.max_cqe;
+        if (size < cq_size)
+            LOGW << "reactor " << id << ": " << port.dev->name << " allows " << size << " cq entries, "
+                 << cq_size << " receives may complete on it.";
+        struct ibv_cq *cq = ibv_create_cq(port.ctx, size, NULL, NULL, 0);
+        if (!cq)
+        {
+            LOGE << "Unable to create shared Completion Queue for reactor " << id;
+            return -1;
+        }
+        cqs.push_back(cq);
+    }
+    qp_conns.resize(cqs.size());
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0)
+    {
+        LOGE << "epoll_create1 failed for reactor " << id << ", errno: " << errno;
+        return -1;
+    }
+    return 0;
+}
+
+void Reactor::start()
+{
+    thr = std::thread(&Reactor::run, this);
+    // named for top -H and the per-thread cpu accounting of the benchmark
+    std::string name = "reactor-" + std::to_string(id);
+    pthread_setname_np(thr.native_handle(), name.c_str());
+    if (hwrdma->placement.pinPollThread(thr.native_handle(), id) != 0)
+        LOGW << "unable to pin reactor " << id;
+}
+
+void Reactor::stop()
+{
+    stopped = true;
+    if (thr.joinable())
+        thr.join();
+}
+
+void Reactor::attach(std::unique_ptr<StreamControl> conn)
+{
+    conn_num++;
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    pending.push_back(std::move(conn));
+}
+
+void Reactor::adoptPending()
+{
+    std::vector<std::unique_ptr<StreamControl>> adopted;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        if (pending.empty())
+            return;
+        adopted.swap(pending);
+    }
+    for (auto &conn : adopted)
+    {
+        StreamControl *c = conn.get();
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = c->peer_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->peer_fd, &ev);
+        for (size_t k = 0; k < c->getLaneNum(); k++)
+            qp_conns[c->getLanePort(k)][c->getLaneQpNum(k)] = c;
+        conns[c->peer_fd] = std::move(conn);
+        handleResult(c, c->startRecvFile());
+    }
+}
+
+void Reactor::handleResult(StreamControl *conn, int ret)
+{
+    if (ret >= 0 && conn->getRecvStage() == RECV_STAGE_IDLE)
+        ret = conn->startRecvFile();
+    if (ret < 0)
+        closeConn(conn);
+}
+
+void Reactor::closeConn(StreamControl *conn)
+{
+    int fd = conn->peer_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    for (size_t k = 0; k < conn->getLaneNum(); k++)
+        qp_conns[conn->getLanePort(k)].erase(conn->getLaneQpNum(k));
+    conns.erase(fd);
+    closePeer(server_ctx, fd);
+    conn_num--;
+}
+
+void Reactor::run()
+{
+    const int batch = 64;
+    struct ibv_wc wcs[batch];
+    struct epoll_event events[batch];
+    int idle_loops = 0;
+    bool receiving = false;
+    auto last_tick = std::chrono::steady_clock::now();
+    while (!stopped)
+    {
+        adoptPending();
+        int n = 0;
+        for (size_t port = 0; port < cqs.size() && n >= 0; port++)
+        {
+            int polled = ibv_poll_cq(cqs[port], batch, wcs);
+            if (polled < 0)
+            {
+                LOGE << "ibv_poll_cq returned " << polled << " in reactor " << id;
+                n = -1;
+                break;
+            }
+            for (int i = 0; i < polled; i++)
+            {
+                auto it = qp_conns[port].find(wcs[i].qp_num);
+                if (it == qp_conns[port].end())
+                    continue; // connection already closed
+                handleResult(it->second, it->second->onRecvCompletion(wcs[i]));
+            }
+            n += polled;
+        }
+        if (n < 0)
+            break;
+        // spin while data is flowing, otherwise sleep in epoll
+        int timeout = (n > 0 || receiving || idle_loops < 1024) ? 0 : 1;
+        int ne = epoll_wait(epoll_fd, events, batch, timeout);
+        for (int i = 0; i < ne; i++)
+        {
+            auto it = conns.find(events[i].data.fd);
+            if (it == conns.end())
+                continue;
+            handleResult(it->second.get(), it->second->onRecvReadable());
+        }
+        idle_loops = (n > 0 || ne > 0) ? 0 : idle_loops + 1;
+
+        // timeouts and credit regrants once per millisecond
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_tick >= std::chrono::milliseconds(1))
+        {
+            last_tick = now;
+            receiving = false;
+            std::vector<StreamControl *> ticking;
+            for (auto &it : conns)
+                ticking.push_back(it.second.get());
+            for (auto conn : ticking)
+            {
+                handleResult(conn, conn->onRecvIdle());
+            }
+            for (auto &it : conns)
+                receiving |= it.second->getRecvStage() == RECV_STAGE_RECEIVING;
+        }
+    }
+}
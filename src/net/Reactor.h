@@ -0,0 +1,60 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <infiniband/verbs.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+#include "HwRdma.h"
+#include "StreamControl.h"
+
+// Reactor thread for ServerMode = reactor.
+// Every connection attached to a reactor creates its QPs on the reactor's
+// shared CQs, one per RDMA port. The reactor polls them, dispatches
+// completions by port and qp_num and
+// watches the control sockets with epoll, driving each connection's receive
+// state machine (see StreamControl::onRecvCompletion/onRecvReadable).
+class Reactor
+{
+public:
+    Reactor(HwRdma *hwrdma, ServerContext *server_ctx, int id, int cq_size);
+    ~Reactor();
+    int init();
+    void start();
+    void stop();
+
+    // indexed like hwrdma->ports
+    const std::vector<struct ibv_cq *> &getCqs() const { return cqs; }
+    int getId() const { return id; }
+    size_t getConnNum() const { return conn_num.load(); }
+    // hand over a connected StreamControl (QPs on getCqs(), receives posted)
+    void attach(std::unique_ptr<StreamControl> conn);
+
+private:
+    HwRdma *hwrdma;
+    ServerContext *server_ctx;
+    int id;
+    int cq_size;
+    std::vector<struct ibv_cq *> cqs;
+    int epoll_fd = -1;
+    std::thread thr;
+    std::atomic<bool> stopped{false};
+    std::atomic<size_t> conn_num{0};
+
+    std::mutex pending_mutex;
+    std::vector<std::unique_ptr<StreamControl>> pending;
+    // owned only by the reactor thread
+    std::unordered_map<int, std::unique_ptr<StreamControl>> conns;
+    // qp numbers are only unique per device, one map per port
+    std::vector<std::unordered_map<uint32_t, StreamControl *>> qp_conns;
+
+    void run();
+    void adoptPending();
+    void handleResult(StreamControl *conn, int ret);
+    void closeConn(StreamControl *conn);
+};
+
+#endif
@@ -0,0 +1,312 @@
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <algorithm>
+#include <climits>
+#include <chrono>
+#include <thread>
+#include "ReceiveServer.h"
+#include "TcpTransport.h"
+#include "ZeroScan.h"
+#include "../utils/Logger.h"
+
+ReceiveServer::ReceiveServer(HwRdma *hwrdma, LocalConf *local_conf, bool rdma)
+    : hwrdma(hwrdma), local_conf(local_conf), rdma(rdma)
+{
+}
+
+ReceiveServer::~ReceiveServer()
+{
+    stop();
+}
+
+int ReceiveServer::start()
+{
+    started = true;
+    uint64_t block_size = 1024UL * local_conf->getBlockSize();
+    server_ctx.client_list = &client_list;
+    server_ctx.errors = &server_errors;
+    // receivers never touch local_conf, they re-read the file into snapshots
+    shared_conf.reset(new SharedConf(*local_conf));
+    server_ctx.conf = shared_conf.get();
+    if (rdma && local_conf->getUseSrq())
+    {
+        srq_pool.reset(new SharedRecvPool(hwrdma, block_size, local_conf->getSrqBlockNum()));
+        if (srq_pool->init())
+        {
+            LOGE << "initializing shared receive queue!";
+            failed_stage = "srq";
+            return -1;
+        }
+        server_ctx.srq_pool = srq_pool.get();
+    }
+    uint32_t credit_budget = local_conf->getCreditBudget();
+    if (credit_budget == 0)
+        credit_budget = srq_pool ? srq_pool->getLimit() : (uint32_t)local_conf->getBlockNum() * local_conf->getConnSlots();
+    credit_scheduler.reset(new CreditScheduler(credit_budget, local_conf->getBlockNum(), local_conf->getClientWeights()));
+    server_ctx.credit_scheduler = credit_scheduler.get();
+    LOGI << "Receive credit budget: " << credit_budget << " blocks";
+    if (!local_conf->getStorageTargets().empty())
+    {
+        storage.configure(local_conf->getStorageTargets());
+        server_ctx.storage = &storage;
+        for (size_t k = 0; k < storage.size(); k++)
+        {
+            if (access(storage.get(k).path.c_str(), W_OK) != 0)
+                LOGW << "Storage target " << storage.get(k).path << " is not writable, errno = " << errno;
+            else
+                LOGI << "Storage target " << storage.get(k).path << ": " << storage.freeBytes(k) / 1e9 << " GB free";
+        }
+    }
+    if (local_conf->getSparseWrites())
+        LOGI << "Sparse writes: zero blocks found with " << zeroScanImpl();
+    // reactor mode: all connections share ReactorNum CQs polled by reactor threads
+    if (rdma && local_conf->getServerMode() == "reactor")
+    {
+        // only receives complete on the server, but credits do not bound them:
+        // a QP that fails flushes every receive posted on it. A cq is per port
+        // and a connection has one lane per port, so it holds at most every
+        // posted receive: BlockNum per connection or spare (getConnSlots() of
+        // them, the registered memory allows no more), or the whole SRQ
+        uint64_t cq_size = srq_pool ? srq_pool->getBlockNum()
+                                    : (uint64_t)local_conf->getBlockNum() * local_conf->getConnSlots();
+        cq_size += local_conf->getBlockNum();
+        cq_size = std::min<uint64_t>(cq_size, INT_MAX);
+        for (int i = 0; i < local_conf->getReactorNum(); i++)
+        {
+            reactors.emplace_back(new Reactor(hwrdma, &server_ctx, i, cq_size));
+            if (reactors.back()->init())
+            {
+                LOGE << "initializing reactor " << i << "!";
+                failed_stage = "reactor";
+                return -1;
+            }
+            reactors.back()->start();
+        }
+        LOGI << "Server mode: reactor x " << reactors.size();
+    }
+    // pool mode: MaxThreadNum pinned workers own all connections
+    if (rdma && local_conf->getServerMode() == "pool")
+    {
+        worker_pool.reset(new WorkerPool(&server_ctx, local_conf->getMaxThreadNum(), local_conf->getConnSlots(), &hwrdma->placement));
+        worker_pool->start();
+    }
+    // hot spares: QPs in INIT with receives posted, taken by accepted connections
+    std::vector<const std::vector<struct ibv_cq *> *> spare_cq_sets;
+    for (auto &reactor : reactors)
+        spare_cq_sets.push_back(&reactor->getCqs());
+    spare_pool.reset(new SparePool(hwrdma, local_conf, &server_ctx, rdma ? local_conf->getSpareNum() : 0,
+                                   local_conf->getConnSlots(), spare_cq_sets));
+    spare_pool->start();
+    return 0;
+}
+
+void ReceiveServer::serve(int listen_fd, const std::atomic<bool> &stopped, int max_clients)
+{
+    // accepted clients whose hello is not all there yet, polled together with
+    // the listen socket so a slow or silent client does not hold up the others
+    struct PendingPeer
+    {
+        int fd;
+        std::chrono::steady_clock::time_point deadline;
+    };
+    std::vector<PendingPeer> pending;
+    std::vector<struct pollfd> pfds;
+    int clients = 0;
+    while (!stopped)
+    {
+        bool accepting = max_clients < 0 || clients < max_clients;
+        if (!accepting && pending.empty())
+            break;
+        // backpressure: leave further clients in the listen backlog, the
+        // pending ones count as they will take slots too
+        if (accepting && worker_pool)
+            accepting = worker_pool->waitForSlot(pending.empty() ? 500 : 0, pending.size());
+        if (!accepting && pending.empty())
+            continue;
+        auto now = std::chrono::steady_clock::now();
+        int timeout_ms = 500;
+        pfds.clear();
+        for (auto &peer : pending)
+        {
+            pfds.push_back({peer.fd, POLLIN, 0});
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(peer.deadline - now).count();
+            timeout_ms = std::min<int>(timeout_ms, std::max<int>(left, 0));
+        }
+        if (accepting)
+            pfds.push_back({listen_fd, POLLIN, 0});
+        if (poll(pfds.data(), pfds.size(), timeout_ms) < 0 && errno != EINTR)
+        {
+            LOGE << "polling the listen socket, errno=" << errno;
+            break;
+        }
+        now = std::chrono::steady_clock::now();
+        for (size_t i = pending.size(); i-- > 0;)
+        {
+            bool timed_out = now >= pending[i].deadline;
+            if (!pfds[i].revents && !timed_out)
+                continue;
+            int peer_fd = pending[i].fd;
+            // the client's hello offers its transports, rdma wins when both ends have it
+            HelloMsg hello;
+            int ret = Transport::peekHello(peer_fd, hello);
+            if (ret == 0 && !timed_out)
+                continue;
+            pending.erase(pending.begin() + i);
+            if (ret <= 0)
+            {
+                if (ret == 0)
+                    LOGE << "no hello from the client in time.";
+                server_errors.add(SERVER_ERROR_HELLO);
+                closePeer(&server_ctx, peer_fd);
+                continue;
+            }
+            int lowat = 1;
+            setsockopt(peer_fd, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat));
+            dispatch(peer_fd, hello);
+        }
+        if (!accepting || !(pfds.back().revents & POLLIN))
+            continue;
+        struct sockaddr_in peer_addr;
+        socklen_t peer_addr_len = sizeof(struct sockaddr_in);
+        int peer_fd = accept(listen_fd, (struct sockaddr *)&peer_addr, &peer_addr_len);
+        if (peer_fd < 0)
+        {
+            LOGE << "Failed connection!  errno=" << errno;
+            server_errors.add(SERVER_ERROR_ACCEPT);
+            continue;
+        }
+        clients++;
+        int max_conn_num = maxConnections();
+        if (max_conn_num > 0 && client_list.getClientNum() >= max_conn_num)
+        {
+            close(peer_fd);
+            server_errors.add(SERVER_ERROR_REJECTED);
+            continue;
+        }
+        client_list.addClient(peer_fd, peer_addr.sin_addr.s_addr);
+        credit_scheduler->addConnection(peer_fd, peer_addr.sin_addr.s_addr);
+        LOGI << "Connection from " << inet_ntoa(peer_addr.sin_addr);
+        // poll reports the socket readable only once the whole hello is queued
+        int lowat = sizeof(HelloMsg);
+        setsockopt(peer_fd, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat));
+        pending.push_back({peer_fd, std::chrono::steady_clock::now() + std::chrono::milliseconds(1000)});
+    }
+    for (auto &peer : pending)
+        closePeer(&server_ctx, peer.fd);
+}
+
+int ReceiveServer::maxConnections() const
+{
+    if (local_conf->getMaxConnNum() > 0)
+        return local_conf->getMaxConnNum();
+    // without an SRQ every rdma connection registers its own window, there
+    // is memory for getConnSlots() of them; the pool waits for a slot before
+    if (rdma && !srq_pool)
+        return local_conf->getConnSlots();
+    return 0;
+}
+
+void ReceiveServer::dispatch(int peer_fd, const HelloMsg &hello)
+{
+    if (!rdma || !(ntohs(hello.transports) & TRANSPORT_RDMA))
+    {
+        // tcp connections always get their own thread, splice() blocks
+        startConnThread(peer_fd, [this, peer_fd]()
+                        { recvTcpData(peer_fd, local_conf, &server_ctx); });
+        return;
+    }
+    if (worker_pool)
+    {
+        std::unique_ptr<StreamControl> conn = spare_pool->take(peer_fd);
+        if (conn->setupReceiver())
+        {
+            server_errors.add(SERVER_ERROR_SETUP);
+            conn.reset();
+            closePeer(&server_ctx, peer_fd);
+            return;
+        }
+        worker_pool->attach(std::move(conn));
+        return;
+    }
+    if (!reactors.empty())
+    {
+        size_t index = 0;
+        for (size_t i = 1; i < reactors.size(); i++)
+            if (reactors[i]->getConnNum() < reactors[index]->getConnNum())
+                index = i;
+        Reactor *reactor = reactors[index].get();
+        std::unique_ptr<StreamControl> conn = spare_pool->take(peer_fd, index);
+        if (conn->setupReceiver(&reactor->getCqs()))
+        {
+            server_errors.add(SERVER_ERROR_SETUP);
+            conn.reset();
+            closePeer(&server_ctx, peer_fd);
+            return;
+        }
+        reactor->attach(std::move(conn));
+        return;
+    }
+    // a thread per connection polls its cq and writes the file
+    StreamControl *spare = spare_pool->take(peer_fd).release();
+    startConnThread(peer_fd, [this, peer_fd, spare]()
+                    {
+        hwrdma->placement.pinPollThread(pthread_self());
+        recvData(hwrdma, peer_fd, local_conf, &server_ctx, spare); });
+}
+
+void ReceiveServer::startConnThread(int peer_fd, std::function<void()> fn)
+{
+    std::lock_guard<std::mutex> lock(conn_mutex);
+    uint64_t id = next_conn_id++;
+    conn_fds[id] = peer_fd;
+    std::thread([this, id, fn]()
+                {
+        fn();
+        if (thread_exit_hook)
+            thread_exit_hook();
+        std::lock_guard<std::mutex> lock(conn_mutex);
+        conn_fds.erase(id);
+        conn_done.notify_all(); })
+        .detach();
+}
+
+void ReceiveServer::closeConnections()
+{
+    std::unique_lock<std::mutex> lock(conn_mutex);
+    if (conn_fds.empty())
+        return;
+    LOGI << "Waiting for " << conn_fds.size() << " connection threads ...";
+    for (auto &it : conn_fds)
+        shutdown(it.second, SHUT_RDWR);
+    conn_done.wait(lock, [this]()
+                   { return conn_fds.empty(); });
+}
+
+void ReceiveServer::stop()
+{
+    if (!started)
+        return;
+    started = false;
+    closeConnections();
+    if (spare_pool)
+        spare_pool->stop();
+    if (worker_pool)
+        worker_pool->stop();
+    for (auto &reactor : reactors)
+        reactor->stop();
+}
+
+void ReceiveServer::report(std::ostream &os)
+{
+    if (credit_scheduler)
+        credit_scheduler->report(os);
+    if (worker_pool)
+        worker_pool->report(os);
+    if (spare_pool)
+        spare_pool->report(os);
+    storage.report(os);
+}
@@ -0,0 +1,87 @@
+#ifndef RECEIVE_SERVER_H
+#define RECEIVE_SERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+#include "HwRdma.h"
+#include "StreamControl.h"
+#include "CreditScheduler.h"
+#include "SharedRecvPool.h"
+#include "Reactor.h"
+#include "WorkerPool.h"
+#include "SparePool.h"
+#include "StorageTargets.h"
+#include "ServerMetrics.h"
+#include "../utils/LocalConf.h"
+#include "../utils/ClientInfo.h"
+
+// Receiving side of FileUploadServer, also run by FileTransferBench so the
+// benchmark measures the code the server runs.
+// start() builds the ServerContext (client list, credit scheduler, SRQ,
+// storage targets, config snapshots) and the ServerMode: per connection
+// threads, reactors or the worker pool, plus the hot spares. serve() accepts
+// clients and hands each one to its transport and mode after the hello; the
+// hellos are waited for in the same poll as the listen socket, 1 s at most.
+// Per connection threads run detached; closeConnections() shuts their sockets
+// down, which fails their next socket call, and waits for all of them.
+class ReceiveServer
+{
+public:
+    // rdma false serves every client over tcp
+    ReceiveServer(HwRdma *hwrdma, LocalConf *local_conf, bool rdma);
+    ~ReceiveServer();
+
+    // -1 when a part failed to start, getFailedStage() names it
+    int start();
+    const char *getFailedStage() const { return failed_stage; }
+    // accepts on listen_fd until stopped is set or, with max_clients >= 0,
+    // that many clients were handed off
+    void serve(int listen_fd, const std::atomic<bool> &stopped, int max_clients = -1);
+    // shuts the per connection threads' sockets down and waits for them
+    void closeConnections();
+    // closeConnections(), then stops the spares, workers and reactors
+    void stop();
+
+    ServerContext *getContext() { return &server_ctx; }
+    // credit shares, workers, spares and storage targets
+    void report(std::ostream &os);
+    // runs at the end of every per connection thread
+    void setThreadExitHook(std::function<void()> hook) { thread_exit_hook = hook; }
+
+private:
+    HwRdma *hwrdma;
+    LocalConf *local_conf;
+    bool rdma;
+    const char *failed_stage = nullptr;
+    bool started = false;
+
+    ServerContext server_ctx;
+    ClientList client_list;
+    ServerErrors server_errors;
+    std::unique_ptr<SharedConf> shared_conf;
+    std::unique_ptr<SharedRecvPool> srq_pool;
+    std::unique_ptr<CreditScheduler> credit_scheduler;
+    StorageTargets storage;
+    std::vector<std::unique_ptr<Reactor>> reactors;
+    std::unique_ptr<WorkerPool> worker_pool;
+    std::unique_ptr<SparePool> spare_pool;
+
+    std::mutex conn_mutex;
+    std::condition_variable conn_done;
+    std::unordered_map<uint64_t, int> conn_fds; // sockets of the running connection threads
+    uint64_t next_conn_id = 0;
+    std::function<void()> thread_exit_hook;
+
+    // clients beyond this are refused at accept, 0 is no limit
+    int maxConnections() const;
+    void dispatch(int peer_fd, const HelloMsg &hello);
+    void startConnThread(int peer_fd, std::function<void()> fn);
+};
+
+#endif
@@ -0,0 +1,371 @@
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include "ServerMetrics.h"
+#include "StreamControl.h"
+#include "LatencyHistogram.h"
+#include "../utils/Logger.h"
+
+const char *ServerErrors::name(ServerError error)
+{
+    switch (error)
+    {
+    case SERVER_ERROR_ACCEPT:
+        return "accept";
+    case SERVER_ERROR_REJECTED:
+        return "rejected";
+    case SERVER_ERROR_HELLO:
+        return "hello";
+    case SERVER_ERROR_SETUP:
+        return "setup";
+    case SERVER_ERROR_FILE_OPEN:
+        return "file_open";
+    case SERVER_ERROR_NO_SPACE:
+        return "no_space";
+    case SERVER_ERROR_FILE_WRITE:
+        return "file_write";
+    case SERVER_ERROR_RECV_TIMEOUT:
+        return "recv_timeout";
+    case SERVER_ERROR_COMPLETION:
+        return "completion";
+    case SERVER_ERROR_LANE_DOWN:
+        return "lane_down";
+    default:
+        return "unknown";
+    }
+}
+
+MetricsServer::MetricsServer(ServerContext *server_ctx, HwRdma *hwrdma)
+{
+    this->server_ctx = server_ctx;
+    this->hwrdma = hwrdma;
+}
+
+MetricsServer::~MetricsServer()
+{
+    stop();
+}
+
+int MetricsServer::start(const std::string &listen_addr)
+{
+    std::string host = "127.0.0.1", port = listen_addr;
+    auto colon = listen_addr.rfind(':');
+    if (colon != std::string::npos)
+    {
+        host = listen_addr.substr(0, colon);
+        port = listen_addr.substr(colon + 1);
+    }
+    struct sockaddr_in addr;
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    int port_num = port.empty() || port.find_first_not_of("0123456789") != std::string::npos ? 0 : atoi(port.c_str());
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1 || port_num <= 0 || port_num > 65535)
+    {
+        LOGE << "invalid metrics address: " << listen_addr;
+        return -1;
+    }
+    addr.sin_port = htons(port_num);
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(int));
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0)
+    {
+        LOGE << "binding metrics socket " << listen_addr << ", errno: " << errno;
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    thr = std::thread(&MetricsServer::run, this);
+    pthread_setname_np(thr.native_handle(), "metrics");
+    LOGI << "Serving metrics on http://" << host << ":" << port_num << "/metrics";
+    return 0;
+}
+
+void MetricsServer::stop()
+{
+    stopped = true;
+    if (thr.joinable())
+        thr.join();
+    if (listen_fd >= 0)
+        close(listen_fd);
+    listen_fd = -1;
+}
+
+void MetricsServer::run()
+{
+    while (!stopped)
+    {
+        struct pollfd pfd;
+        pfd.fd = listen_fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 500) <= 0)
+            continue;
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        serve(fd);
+        close(fd);
+    }
+}
+
+void MetricsServer::serve(int fd)
+{
+    // a scraper sends its request at once, do not let a stuck one block the others
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    std::string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192)
+    {
+        int nb = recv(fd, buf, sizeof(buf), 0);
+        if (nb < 0 && errno == EINTR)
+            continue;
+        if (nb <= 0)
+            return;
+        request.append(buf, nb);
+    }
+    std::string status = "200 OK", body;
+    if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0)
+        body = render();
+    else if (request.compare(0, 13, "GET /clients ") == 0)
+        body = renderClients();
+    else if (request.compare(0, 4, "GET ") == 0)
+        status = "404 Not Found";
+    else
+        status = "405 Method Not Allowed";
+    std::ostringstream response;
+    response << "HTTP/1.1 " << status << "\r\n"
+             << "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+             << "Content-Length: " << body.size() << "\r\n"
+             << "Connection: close\r\n\r\n"
+             << body;
+    std::string out = response.str();
+    for (size_t sent = 0; sent < out.size();)
+    {
+        int nb = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if (nb < 0 && errno == EINTR)
+            continue;
+        if (nb <= 0)
+            return;
+        sent += nb;
+    }
+}
+
+static void metricHead(std::ostream &os, const char *name, const char *type, const char *help)
+{
+    os << "# HELP " << name << " " << help << "\n"
+       << "# TYPE " << name << " " << type << "\n";
+}
+
+std::string MetricsServer::render()
+{
+    std::ostringstream os;
+    os.precision(9);
+    std::vector<std::shared_ptr<CreditScheduler::Account>> accounts;
+    uint64_t closed_bytes = 0, closed_blocks = 0, closed_writes = 0;
+    CreditScheduler *credit_scheduler = server_ctx->credit_scheduler;
+    if (credit_scheduler != nullptr)
+        credit_scheduler->snapshot(accounts, closed_bytes, closed_blocks, closed_writes);
+
+    // connections
+    size_t receiving = 0;
+    for (auto &a : accounts)
+        receiving += a->receiving.load(std::memory_order_relaxed);
+    metricHead(os, "fileupload_connections", "gauge", "Connected clients.");
+    os << "fileupload_connections " << server_ctx->client_list->getClientNum() << "\n";
+    metricHead(os, "fileupload_connections_receiving", "gauge", "Clients with a file in progress.");
+    os << "fileupload_connections_receiving " << receiving << "\n";
+    int fd = accept_fd.load();
+    struct tcp_info info;
+    socklen_t info_len = sizeof(info);
+    // for a listening socket tcpi_unacked is the length of its accept queue
+    if (fd >= 0 && getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &info_len) == 0 && info.tcpi_state == TCP_LISTEN)
+    {
+        metricHead(os, "fileupload_connections_queued", "gauge", "Connections waiting in the accept backlog.");
+        os << "fileupload_connections_queued " << info.tcpi_unacked << "\n";
+    }
+
+    // per client
+    metricHead(os, "fileupload_client_received_bytes_total", "counter", "Payload bytes received from the client.");
+    for (auto &a : accounts)
+    {
+        struct in_addr in;
+        in.s_addr = a->ip;
+        os << "fileupload_client_received_bytes_total{client=\"" << inet_ntoa(in) << "\",fd=\"" << a->fd << "\"} "
+           << a->bytes.load(std::memory_order_relaxed) << "\n";
+    }
+    metricHead(os, "fileupload_client_received_blocks_total", "counter", "Blocks (tcp: chunks) received from the client.");
+    for (auto &a : accounts)
+    {
+        struct in_addr in;
+        in.s_addr = a->ip;
+        os << "fileupload_client_received_blocks_total{client=\"" << inet_ntoa(in) << "\",fd=\"" << a->fd << "\"} "
+           << a->blocks.load(std::memory_order_relaxed) << "\n";
+    }
+    metricHead(os, "fileupload_client_throughput_bits_per_second", "gauge", "Receive rate of the client over the last 2 seconds.");
+    for (auto &a : accounts)
+    {
+        struct in_addr in;
+        in.s_addr = a->ip;
+        os << "fileupload_client_throughput_bits_per_second{client=\"" << inet_ntoa(in) << "\",fd=\"" << a->fd << "\"} "
+           << a->meter.rate() * 8 << "\n";
+    }
+    metricHead(os, "fileupload_client_outstanding_credits", "gauge", "Receive credits granted to the client and not used yet.");
+    for (auto &a : accounts)
+    {
+        struct in_addr in;
+        in.s_addr = a->ip;
+        os << "fileupload_client_outstanding_credits{client=\"" << inet_ntoa(in) << "\",fd=\"" << a->fd << "\"} "
+           << a->outstanding.load(std::memory_order_relaxed) << "\n";
+    }
+    metricHead(os, "fileupload_client_credit_share", "gauge", "Credit share of the client in blocks, 0 when idle.");
+    for (auto &a : accounts)
+    {
+        struct in_addr in;
+        in.s_addr = a->ip;
+        os << "fileupload_client_credit_share{client=\"" << inet_ntoa(in) << "\",fd=\"" << a->fd << "\"} "
+           << a->share.load(std::memory_order_relaxed) << "\n";
+    }
+
+    // totals, closed connections included
+    uint64_t total_bytes = closed_bytes, total_blocks = closed_blocks, total_writes = closed_writes;
+    for (auto &a : accounts)
+    {
+        total_bytes += a->bytes.load(std::memory_order_relaxed);
+        total_blocks += a->blocks.load(std::memory_order_relaxed);
+        total_writes += a->writes.load(std::memory_order_relaxed);
+    }
+    metricHead(os, "fileupload_received_bytes_total", "counter", "Payload bytes received from all clients.");
+    os << "fileupload_received_bytes_total " << total_bytes << "\n";
+    metricHead(os, "fileupload_received_blocks_total", "counter", "Blocks received from all clients.");
+    os << "fileupload_received_blocks_total " << total_blocks << "\n";
+    metricHead(os, "fileupload_write_calls_total", "counter", "Write syscalls that stored the received data (WriteCoalesceSize batches them).");
+    os << "fileupload_write_calls_total " << total_writes << "\n";
+    if (credit_scheduler != nullptr)
+    {
+        metricHead(os, "fileupload_credit_budget_blocks", "gauge", "Receive credits shared by all clients.");
+        os << "fileupload_credit_budget_blocks " << credit_scheduler->getBudget() << "\n";
+    }
+
+    // registered memory
+    if (hwrdma != nullptr && hwrdma->buffer_size != uint64_t(-1))
+    {
+        uint64_t free_size = hwrdma->getFreeSize();
+        metricHead(os, "fileupload_registered_memory_bytes", "gauge", "Memory registered with the RDMA devices.");
+        os << "fileupload_registered_memory_bytes " << hwrdma->buffer_size - free_size << "\n";
+        metricHead(os, "fileupload_registered_memory_free_bytes", "gauge", "Registrable memory left (HwRdma::free_size).");
+        os << "fileupload_registered_memory_free_bytes " << free_size << "\n";
+        metricHead(os, "fileupload_registered_memory_limit_bytes", "gauge", "Registered memory limit (HwRdma::buffer_size).");
+        os << "fileupload_registered_memory_limit_bytes " << hwrdma->buffer_size << "\n";
+    }
+
+    // storage targets, one series per directory
+    StorageTargets *storage = server_ctx->storage;
+    if (storage != nullptr && !storage->empty())
+    {
+        metricHead(os, "fileupload_storage_written_bytes_total", "counter", "Bytes written to the storage target.");
+        for (size_t k = 0; k < storage->size(); k++)
+            os << "fileupload_storage_written_bytes_total{target=\"" << storage->get(k).path << "\"} "
+               << storage->get(k).bytes.load(std::memory_order_relaxed) << "\n";
+        metricHead(os, "fileupload_storage_write_seconds_total", "counter", "Time spent writing to the storage target.");
+        for (size_t k = 0; k < storage->size(); k++)
+            os << "fileupload_storage_write_seconds_total{target=\"" << storage->get(k).path << "\"} "
+               << storage->get(k).write_ns.load(std::memory_order_relaxed) / 1e9 << "\n";
+        metricHead(os, "fileupload_storage_throughput_bytes_per_second", "gauge", "Write rate of the storage target over the last 2 s.");
+        for (size_t k = 0; k < storage->size(); k++)
+            os << "fileupload_storage_throughput_bytes_per_second{target=\"" << storage->get(k).path << "\"} "
+               << (uint64_t)storage->get(k).meter.rate() << "\n";
+        metricHead(os, "fileupload_storage_write_seconds_per_mb", "gauge", "Recent write time per MB the placement ranks the target by.");
+        for (size_t k = 0; k < storage->size(); k++)
+            os << "fileupload_storage_write_seconds_per_mb{target=\"" << storage->get(k).path << "\"} "
+               << storage->get(k).ns_per_mb.load(std::memory_order_relaxed) / 1e9 << "\n";
+        metricHead(os, "fileupload_storage_active_files", "gauge", "Files being written to the storage target.");
+        for (size_t k = 0; k < storage->size(); k++)
+            os << "fileupload_storage_active_files{target=\"" << storage->get(k).path << "\"} "
+               << storage->get(k).active.load(std::memory_order_relaxed) << "\n";
+        metricHead(os, "fileupload_storage_files_total", "counter", "Files placed on the storage target.");
+        for (size_t k = 0; k < storage->size(); k++)
+            os << "fileupload_storage_files_total{target=\"" << storage->get(k).path << "\"} "
+               << storage->get(k).files.load(std::memory_order_relaxed) << "\n";
+        metricHead(os, "fileupload_storage_full_skips_total", "counter", "Placements that skipped the target for lack of space.");
+        for (size_t k = 0; k < storage->size(); k++)
+            os << "fileupload_storage_full_skips_total{target=\"" << storage->get(k).path << "\"} "
+               << storage->get(k).rejected.load(std::memory_order_relaxed) << "\n";
+        metricHead(os, "fileupload_storage_free_bytes", "gauge", "Free space of the file system under the storage target.");
+        for (size_t k = 0; k < storage->size(); k++)
+            os << "fileupload_storage_free_bytes{target=\"" << storage->get(k).path << "\"} " << storage->freeBytes(k) << "\n";
+    }
+
+    // block latencies, the receive write is the disk write latency
+    metricHead(os, "fileupload_block_latency_seconds", "summary", "Per block stage latency since the server started.");
+    const StageLatency &latency = StageLatency::global();
+    for (int s = 0; s < STAGE_NUM; s++)
+    {
+        const LatencyHistogram &h = latency.get((LatencyStage)s);
+        std::string stage = StageLatency::stageName((LatencyStage)s);
+        for (auto &c : stage)
+            if (c == ' ')
+                c = '_';
+        for (double q : {0.5, 0.99, 0.999})
+            os << "fileupload_block_latency_seconds{stage=\"" << stage << "\",quantile=\"" << q << "\"} "
+               << h.percentile(q) / 1e9 << "\n";
+        os << "fileupload_block_latency_seconds_sum{stage=\"" << stage << "\"} " << h.sumNs() / 1e9 << "\n"
+           << "fileupload_block_latency_seconds_count{stage=\"" << stage << "\"} " << h.count() << "\n";
+    }
+
+    if (server_ctx->errors != nullptr)
+    {
+        metricHead(os, "fileupload_errors_total", "counter", "Errors by kind.");
+        for (int e = 0; e < SERVER_ERROR_NUM; e++)
+            os << "fileupload_errors_total{kind=\"" << ServerErrors::name((ServerError)e) << "\"} "
+               << server_ctx->errors->get((ServerError)e) << "\n";
+    }
+    return os.str();
+}
+
+std::string MetricsServer::renderClients()
+{
+    std::vector<ClientInfo> clients;
+    server_ctx->client_list->snapshot(clients);
+    std::vector<std::shared_ptr<CreditScheduler::Account>> accounts;
+    uint64_t closed_bytes = 0, closed_blocks = 0, closed_writes = 0;
+    if (server_ctx->credit_scheduler != nullptr)
+        server_ctx->credit_scheduler->snapshot(accounts, closed_bytes, closed_blocks, closed_writes);
+    std::map<int, CreditScheduler::Account *> by_fd;
+    for (auto &a : accounts)
+        by_fd[a->fd] = a.get();
+    std::sort(clients.begin(), clients.end(), [](const ClientInfo &a, const ClientInfo &b)
+              { return a.fd < b.fd; });
+
+    std::ostringstream os;
+    int64_t now_ms = ClientState::nowMs();
+    os << "fd\tclient\tstage\tsecs\tfiles\tfile\tbytes\tsize\tgbps\tcredits\n";
+    for (auto &c : clients)
+    {
+        struct in_addr in;
+        in.s_addr = c.ip;
+        ClientState &st = *c.state;
+        auto a = by_fd.find(c.fd);
+        double rate = a != by_fd.end() ? a->second->meter.rate() : 0;
+        uint32_t credits = a != by_fd.end() ? a->second->outstanding.load(std::memory_order_relaxed) : 0;
+        std::string file = st.getFile();
+        os << c.fd << "\t" << inet_ntoa(in) << "\t" << ClientState::statusName(st.status.load(std::memory_order_relaxed))
+           << "\t" << (now_ms - st.sinceMs.load(std::memory_order_relaxed)) / 1000
+           << "\t" << st.filesDone.load(std::memory_order_relaxed)
+           << "\t" << (file.empty() ? "-" : file)
+           << "\t" << st.fileBytes.load(std::memory_order_relaxed)
+           << "\t" << st.fileSize.load(std::memory_order_relaxed)
+           << "\t" << rate * 8 / 1e9 << "\t" << credits << "\n";
+    }
+    return os.str();
+}
@@ -0,0 +1,73 @@
+#ifndef SERVER_METRICS_H
+#define SERVER_METRICS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+
+struct ServerContext;
+class HwRdma;
+
+// error kinds counted by the server, bumped where the error is reported
+enum ServerError
+{
+    SERVER_ERROR_ACCEPT,       // accept() failed
+    SERVER_ERROR_REJECTED,     // MaxConnNum reached
+    SERVER_ERROR_HELLO,        // no valid hello from the client
+    SERVER_ERROR_SETUP,        // transport setup after the hello failed
+    SERVER_ERROR_FILE_OPEN,    // the file to receive could not be created or has too many blocks
+    SERVER_ERROR_NO_SPACE,     // the file to receive could not be preallocated
+    SERVER_ERROR_FILE_WRITE,   // short or failed write of received data
+    SERVER_ERROR_RECV_TIMEOUT, // a file stopped arriving (RECV_IDLE_TIMEOUT_SEC)
+    SERVER_ERROR_COMPLETION,   // bad receive completion
+    SERVER_ERROR_LANE_DOWN,    // a lane went down
+    SERVER_ERROR_NUM
+};
+
+class ServerErrors
+{
+public:
+    void add(ServerError error) { counts[error].fetch_add(1, std::memory_order_relaxed); }
+    uint64_t get(ServerError error) const { return counts[error].load(std::memory_order_relaxed); }
+    static const char *name(ServerError error);
+
+private:
+    std::atomic<uint64_t> counts[SERVER_ERROR_NUM] = {};
+};
+
+// Embedded HTTP listener serving the Prometheus text format on GET /metrics
+// and a per-client status table on GET /clients
+// (MetricsListen = [addr:]port, addr defaults to 127.0.0.1).
+// The transfer path only bumps per-connection atomics (CreditScheduler::Account),
+// the global block latency histograms and ServerErrors; one thread sums them up
+// when a scrape comes in and answers it, one request per connection.
+class MetricsServer
+{
+public:
+    MetricsServer(ServerContext *server_ctx, HwRdma *hwrdma);
+    ~MetricsServer();
+    // -1 on a bad address or when the port cannot be bound
+    int start(const std::string &listen_addr);
+    void stop();
+    // the server's accept socket, its backlog is reported as queued connections
+    void setAcceptFd(int fd) { accept_fd.store(fd); }
+    // the text of one scrape
+    std::string render();
+    // one line per connection: stage, current file and its progress, rate, credits
+    std::string renderClients();
+
+private:
+    ServerContext *server_ctx;
+    HwRdma *hwrdma;
+    int listen_fd = -1;
+    std::atomic<int> accept_fd{-1};
+    std::atomic<bool> stopped{false};
+    std::thread thr;
+    void run();
+    void serve(int fd);
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include <iostream>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include "SharedRecvPool.h"
+#include "../utils/Logger.h"
+
+SharedRecvPool::SharedRecvPool(HwRdma *hwrdma, uint64_t block_size, uint32_t block_num)
+{
+    this->hwrdma = hwrdma;
+    this->block_size = block_size;
+    this->block_num = block_num;
+    this->limit = block_num / 2 > 0 ? block_num / 2 : 1;
+}
+
+SharedRecvPool::~SharedRecvPool()
+{
+    stopped = true;
+    if (refill_thread.joinable())
+        refill_thread.join();
+    if (srq != nullptr)
+        ibv_destroy_srq(srq);
+    if (mr != nullptr)
+        hwrdma->destroy_mr(mr);
+}
+
+int SharedRecvPool::init()
+{
+    if (hwrdma->create_mr(&this->mr, &this->buf_ptr, block_size * block_num))
+        return -1;
+    struct ibv_srq_init_attr srq_init_attr;
+    bzero(&srq_init_attr, sizeof(srq_init_attr));
+    srq_init_attr.attr.max_wr = block_num;
+    srq_init_attr.attr.max_sge = 1;
+    srq = ibv_create_srq(hwrdma->pd, &srq_init_attr);
+    if (!srq)
+    {
+        LOGE << "Unable to create SRQ!";
+        return -1;
+    }
+    std::vector<uint64_t> ids;
+    for (uint64_t i = 0; i < block_num; i++)
+        ids.push_back(i);
+    if (postBuffers(ids) || armLimit())
+        return -1;
+
+    // async events are only consumed here, poll the fd so the thread can stop
+    int flags = fcntl(hwrdma->ctx->async_fd, F_GETFL);
+    fcntl(hwrdma->ctx->async_fd, F_SETFL, flags | O_NONBLOCK);
+    refill_thread = std::thread(&SharedRecvPool::refillLoop, this);
+    LOGI << "SRQ created: " << block_num << " x " << block_size / 1024 << "KB buffers, limit " << limit;
+    return 0;
+}
+
+void SharedRecvPool::release(uint64_t id)
+{
+    std::lock_guard<std::mutex> lock(free_mutex);
+    free_ids.push_back(id);
+}
+
+int SharedRecvPool::postBuffers(const std::vector<uint64_t> &ids)
+{
+    if (ids.empty())
+        return 0;
+    std::vector<struct ibv_recv_wr> wrs(ids.size());
+    std::vector<struct ibv_sge> sges(ids.size());
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+        bzero(&wrs[i], sizeof(wrs[i]));
+        sges[i].addr = (uint64_t)getBuffer(ids[i]);
+        sges[i].length = block_size;
+        sges[i].lkey = mr->lkey;
+        wrs[i].wr_id = ids[i];
+        wrs[i].sg_list = &sges[i];
+        wrs[i].num_sge = 1;
+        wrs[i].next = i + 1 < ids.size() ? &wrs[i + 1] : nullptr;
+    }
+    struct ibv_recv_wr *bad_wr = nullptr;
+    auto ret = ibv_post_srq_recv(srq, &wrs[0], &bad_wr);
+    if (ret != 0)
+    {
+        LOGE << "ibv_post_srq_recv returned non zero value (" << ret << ")";
+        return -1;
+    }
+    return 0;
+}
+
+int SharedRecvPool::armLimit()
+{
+    struct ibv_srq_attr srq_attr;
+    bzero(&srq_attr, sizeof(srq_attr));
+    srq_attr.srq_limit = limit;
+    if (ibv_modify_srq(srq, &srq_attr, IBV_SRQ_LIMIT))
+    {
+        LOGE << "Unable to arm SRQ limit!";
+        return -1;
+    }
+    return 0;
+}
+
+void SharedRecvPool::refillLoop()
+{
+    struct pollfd pfd;
+    pfd.fd = hwrdma->ctx->async_fd;
+    pfd.events = POLLIN;
+    while (!stopped)
+    {
+        if (poll(&pfd, 1, 100) <= 0)
+        {
+            // quiet for a while: hand back what has been released so far
+            std::vector<uint64_t> ids;
+            {
+                std::lock_guard<std::mutex> lock(free_mutex);
+                ids.swap(free_ids);
+            }
+            postBuffers(ids);
+            continue;
+        }
+        struct ibv_async_event event;
+        if (ibv_get_async_event(hwrdma->ctx, &event))
+            continue;
+        auto event_type = event.event_type;
+        bool own_limit = event_type == IBV_EVENT_SRQ_LIMIT_REACHED && event.element.srq == srq;
+        ibv_ack_async_event(&event);
+        if (!own_limit)
+        {
+            LOGW << "async event: " << ibv_event_type_str(event_type);
+            continue;
+        }
+        std::vector<uint64_t> ids;
+        {
+            std::lock_guard<std::mutex> lock(free_mutex);
+            ids.swap(free_ids);
+        }
+        if (postBuffers(ids) == 0)
+            armLimit();
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef SHARED_RECV_POOL_H
+#define SHARED_RECV_POOL_H
+
+#include <infiniband/verbs.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "HwRdma.h"
+
+// Shared receive queue for the server (UseSrq = 1).
+// All connection QPs are created on one SRQ that owns SrqBlockNum receive
+// buffers. A receiver hands a buffer back with release() once it has been
+// written to disk; released buffers are re-posted in one batch when the SRQ
+// raises IBV_EVENT_SRQ_LIMIT_REACHED (fewer than SrqBlockNum/2 posted).
+//
+// Registered receive memory with BlockSize = 1MB, BlockNum = 256:
+//
+//     clients | per-connection buffers | SRQ (SrqBlockNum = 1024)
+//     --------+------------------------+-------------------------
+//          16 |                   4 GB |                     1 GB
+//         256 |                  64 GB |                     1 GB
+//        1024 |                 256 GB |                     1 GB
+//
+// plus a few KB of QP/CQ rings per connection in both models.
+class SharedRecvPool
+{
+public:
+    SharedRecvPool(HwRdma *hwrdma, uint64_t block_size, uint32_t block_num);
+    ~SharedRecvPool();
+    int init();
+
+    struct ibv_srq *getSrq() const { return srq; }
+    uint8_t *getBuffer(uint64_t id) const { return buf_ptr + id * block_size; }
+    uint64_t getBlockSize() const { return block_size; }
+    uint32_t getBlockNum() const { return block_num; }
+    uint32_t getLimit() const { return limit; }
+    // give a consumed buffer back, it is re-posted on the next limit event
+    void release(uint64_t id);
+
+private:
+    HwRdma *hwrdma;
+    uint64_t block_size;
+    uint32_t block_num;
+    uint32_t limit;
+    uint8_t *buf_ptr = nullptr;
+    struct ibv_mr *mr = nullptr;
+    struct ibv_srq *srq = nullptr;
+
+    std::vector<uint64_t> free_ids;
+    std::mutex free_mutex;
+    std::thread refill_thread;
+    std::atomic<bool> stopped{false};
+
+    int postBuffers(const std::vector<uint64_t> &ids);
+    int armLimit();
+    void refillLoop();
+};
+
+#endif
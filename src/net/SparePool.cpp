@@ -0,0 +1,145 @@
+#include <iostream>
+#include <chrono>
+#include <pthread.h>
+#include "SparePool.h"
+#include "../utils/Logger.h"
+
+SparePool::SparePool(HwRdma *hwrdma, LocalConf *local_conf, ServerContext *server_ctx, int spare_num, int max_conn_num,
+                     const std::vector<const std::vector<struct ibv_cq *> *> &cq_sets)
+{
+    this->hwrdma = hwrdma;
+    this->local_conf = local_conf;
+    this->server_ctx = server_ctx;
+    this->max_conn_num = max_conn_num;
+    this->cq_sets = cq_sets;
+    size_t set_num = cq_sets.empty() ? 1 : cq_sets.size();
+    this->per_set = spare_num > 0 ? (spare_num + set_num - 1) / set_num : 0;
+    this->spares.resize(set_num);
+}
+
+SparePool::~SparePool()
+{
+    stop();
+}
+
+void SparePool::start()
+{
+    if (per_set == 0)
+        return;
+    thr = std::thread(&SparePool::run, this);
+    pthread_setname_np(thr.native_handle(), "spare-pool");
+    LOGI << "Hot spares: " << per_set << " x " << spares.size() << " cq set(s)";
+}
+
+void SparePool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+    }
+    cond.notify_all();
+    if (thr.joinable())
+        thr.join();
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &set : spares)
+        set.clear();
+    spare_count = 0;
+}
+
+size_t SparePool::clientNum() const
+{
+    return server_ctx->client_list->getClientNum();
+}
+
+std::unique_ptr<StreamControl> SparePool::build(size_t cq_set)
+{
+    std::unique_ptr<StreamControl> conn(new StreamControl(hwrdma, -1, local_conf, server_ctx));
+    if (conn->createLucpContext(cq_sets.empty() ? nullptr : cq_sets[cq_set]) || conn->prepareLocal())
+        return nullptr;
+    return conn;
+}
+
+void SparePool::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopped)
+    {
+        size_t set = 0;
+        for (size_t i = 1; i < spares.size(); i++)
+            if (spares[i].size() < spares[set].size())
+                set = i;
+        // the spare under construction must fit next to the clients and the other spares
+        if (spares[set].size() >= per_set || clientNum() + spare_count + 1 > max_conn_num)
+        {
+            // clients leaving do not notify, look again from time to time
+            cond.wait_for(lock, std::chrono::milliseconds(100));
+            continue;
+        }
+        building = set;
+        lock.unlock();
+        auto conn = build(set);
+        lock.lock();
+        building = -1;
+        if (conn)
+        {
+            spares[set].push_back(std::move(conn));
+            spare_count++;
+        }
+        cond.notify_all();
+        // e.g. registered memory is used up, try again later
+        if (!conn)
+            cond.wait_for(lock, std::chrono::seconds(1));
+    }
+}
+
+std::unique_ptr<StreamControl> SparePool::take(int peer_fd, size_t cq_set)
+{
+    std::unique_ptr<StreamControl> conn;
+    std::vector<std::unique_ptr<StreamControl>> drop;
+    if (cq_set >= spares.size())
+        cq_set = 0;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        // a spare about to be finished is still faster than a new context
+        cond.wait(lock, [&]()
+                  { return stopped || !spares[cq_set].empty() || building != (int)cq_set; });
+        if (!spares[cq_set].empty())
+        {
+            conn = std::move(spares[cq_set].front());
+            spares[cq_set].pop_front();
+            spare_count--;
+            hits++;
+        }
+        else
+        {
+            misses++;
+            // the client is counted already, its buffers must fit next to the spares
+            while (spare_count > 0 && clientNum() + spare_count > max_conn_num)
+            {
+                size_t set = 0;
+                for (size_t i = 1; i < spares.size(); i++)
+                    if (spares[i].size() > spares[set].size())
+                        set = i;
+                drop.push_back(std::move(spares[set].back()));
+                spares[set].pop_back();
+                spare_count--;
+                dropped++;
+            }
+        }
+    }
+    cond.notify_all();
+    drop.clear();
+    if (conn)
+    {
+        conn->attachPeer(peer_fd);
+        return conn;
+    }
+    return std::unique_ptr<StreamControl>(new StreamControl(hwrdma, peer_fd, local_conf, server_ctx));
+}
+
+void SparePool::report(std::ostream &os)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    os << "  hot spares: ready=" << spare_count << "/" << per_set * spares.size()
+       << "  hits=" << hits << "  misses=" << misses << "  dropped=" << dropped << std::endl;
+}
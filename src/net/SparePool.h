@@ -0,0 +1,56 @@
+#ifndef SPARE_POOL_H
+#define SPARE_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+#include "StreamControl.h"
+
+// Hot spare receive contexts for the accept path (SpareNum of them).
+// A spare has its lanes created and moved to INIT, its buffers registered
+// and its receives posted (StreamControl::prepareLocal()), so an accepted
+// connection only runs the hello exchange. A refill thread replaces the
+// spares that were taken. Spares hold registered memory: together with the
+// clients they never exceed the connection slots (LocalConf::getConnSlots()),
+// spares are dropped for a client when needed.
+// In reactor mode every reactor's CQs form a cq set with its own spares.
+class SparePool
+{
+public:
+    // cq_sets: shared cqs per reactor, empty when connections own their cqs
+    SparePool(HwRdma *hwrdma, LocalConf *local_conf, ServerContext *server_ctx, int spare_num, int max_conn_num,
+              const std::vector<const std::vector<struct ibv_cq *> *> &cq_sets = {});
+    ~SparePool();
+    void start();
+    void stop();
+
+    // a ready context for peer_fd, built on the spot when no spare is left
+    std::unique_ptr<StreamControl> take(int peer_fd, size_t cq_set = 0);
+    void report(std::ostream &os);
+
+private:
+    HwRdma *hwrdma;
+    LocalConf *local_conf;
+    ServerContext *server_ctx;
+    size_t per_set; // spares kept per cq set
+    size_t max_conn_num;
+    std::vector<const std::vector<struct ibv_cq *> *> cq_sets;
+    std::vector<std::deque<std::unique_ptr<StreamControl>>> spares;
+    size_t spare_count = 0;
+    int building = -1; // cq set of the spare under construction
+    uint64_t hits = 0, misses = 0, dropped = 0;
+    bool stopped = false;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread thr;
+
+    void run();
+    std::unique_ptr<StreamControl> build(size_t cq_set);
+    size_t clientNum() const;
+};
+
+#endif
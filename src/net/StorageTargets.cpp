@@ -0,0 +1,99 @@
+#include <sys/statvfs.h>
+#include <algorithm>
+#include "StorageTargets.h"
+
+void StorageTargets::configure(const std::vector<std::string> &paths)
+{
+    targets.clear();
+    for (auto &path : paths)
+        targets.emplace_back(new Target(path));
+}
+
+int StorageTargets::pick(uint64_t size)
+{
+    // placements of files arriving at once see each other's active count
+    std::lock_guard<std::mutex> lock(pick_mutex);
+    std::vector<size_t> fits;
+    uint64_t known_min = 0;
+    for (size_t k = 0; k < targets.size(); k++)
+    {
+        Target &t = *targets[k];
+        struct statvfs st;
+        if (statvfs(t.path.c_str(), &st) != 0)
+            continue;
+        uint64_t free_bytes = (uint64_t)st.f_bavail * st.f_frsize;
+        uint64_t reserve = (uint64_t)st.f_blocks * st.f_frsize / 100;
+        if (free_bytes < size + reserve)
+        {
+            t.rejected.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        fits.push_back(k);
+        uint64_t ns = t.ns_per_mb.load(std::memory_order_relaxed);
+        if (ns > 0 && (known_min == 0 || ns < known_min))
+            known_min = ns;
+    }
+    // a target that wrote nothing yet costs as much as the fastest known one,
+    // so fresh targets are ranked by their active count instead of all tying at 0
+    int best = -1;
+    double best_score = 0;
+    for (size_t k : fits)
+    {
+        Target &t = *targets[k];
+        uint64_t ns = std::max(t.ns_per_mb.load(std::memory_order_relaxed), std::max<uint64_t>(known_min, 1));
+        double score = (t.active.load(std::memory_order_relaxed) + 1.0) * ns;
+        if (best < 0 || score < best_score)
+        {
+            best = k;
+            best_score = score;
+        }
+    }
+    if (best >= 0)
+    {
+        targets[best]->active.fetch_add(1, std::memory_order_relaxed);
+        targets[best]->files.fetch_add(1, std::memory_order_relaxed);
+    }
+    return best;
+}
+
+void StorageTargets::release(int k)
+{
+    targets[k]->active.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void StorageTargets::written(int k, uint64_t bytes, uint64_t ns)
+{
+    Target &t = *targets[k];
+    t.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    t.write_ns.fetch_add(ns, std::memory_order_relaxed);
+    t.meter.add(bytes);
+    if (bytes == 0)
+        return;
+    // moving average over the recent writes of all receivers, a lost update is harmless
+    uint64_t sample = ns * (1 << 20) / bytes;
+    uint64_t old = t.ns_per_mb.load(std::memory_order_relaxed);
+    t.ns_per_mb.store(old == 0 ? sample : old - old / 8 + sample / 8, std::memory_order_relaxed);
+}
+
+uint64_t StorageTargets::freeBytes(int k) const
+{
+    struct statvfs st;
+    if (statvfs(targets[k]->path.c_str(), &st) != 0)
+        return 0;
+    return (uint64_t)st.f_bavail * st.f_frsize;
+}
+
+void StorageTargets::report(std::ostream &os)
+{
+    if (targets.empty())
+        return;
+    os << "---------------- storage targets ----------------" << std::endl;
+    for (size_t k = 0; k < targets.size(); k++)
+    {
+        Target &t = *targets[k];
+        os << t.path << ": files " << t.active.load() << "/" << t.files.load()
+           << ", " << t.meter.rate() * 8 / 1e9 << " Gbps"
+           << ", " << t.ns_per_mb.load() / 1e3 << " us/MB"
+           << ", free " << freeBytes(k) / 1e9 << " GB" << std::endl;
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef STORAGE_TARGETS_H
+#define STORAGE_TARGETS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "ThroughputMeter.h"
+
+// Directories received files are spread over (StorageTargets = /a, /b, ...),
+// typically one per NVMe device, so the ingest is not bound to one device.
+// Every file goes whole to one target, picked when its header arrives:
+// targets without room for the file plus a 1% reserve are skipped, the rest
+// are ranked by (files being written + 1) * recent write time per MB, so a
+// slow or busy device gets new files only once the others are as loaded.
+// The write time per MB is fed by the receivers (pwritev plus the write-behind
+// waits); until a target wrote anything it counts as the fastest known one, so
+// new targets get tried and files arriving at once spread over them.
+class StorageTargets
+{
+public:
+    struct Target
+    {
+        std::string path;
+        std::atomic<uint32_t> active{0};       // files being written
+        std::atomic<uint64_t> files{0};        // files placed here
+        std::atomic<uint64_t> bytes{0};        // bytes written
+        std::atomic<uint64_t> write_ns{0};     // time spent in writes
+        std::atomic<uint64_t> ns_per_mb{0};    // recent write time per MB, 0 while unknown
+        std::atomic<uint64_t> rejected{0};     // files skipped because the target was full
+        ThroughputMeter meter;                 // bytes written over the last 2 s
+        explicit Target(const std::string &p) : path(p) {}
+    };
+
+    void configure(const std::vector<std::string> &paths);
+    bool empty() const { return targets.empty(); }
+    size_t size() const { return targets.size(); }
+    Target &get(int k) { return *targets[k]; }
+
+    // the target for a file of size bytes, marked active; -1 when none has room
+    int pick(uint64_t size);
+    // the file placed on target k is closed
+    void release(int k);
+    // bytes written to target k in ns
+    void written(int k, uint64_t bytes, uint64_t ns);
+    // free bytes of the file system under target k, 0 when unknown
+    uint64_t freeBytes(int k) const;
+    // one line per target: files, rate, write time per MB, free space
+    void report(std::ostream &os);
+
+private:
+    std::vector<std::unique_ptr<Target>> targets;
+    std::mutex pick_mutex;
+};
+
+#endif
@@ -2,57 +2,134 @@
 #include <chrono>
 #include <string>
 #include <sys/stat.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+#include <deque>
 #include "StreamControl.h"
+#include "../utils/Logger.h"
 using std::chrono::high_resolution_clock;
 using std::chrono::nanoseconds;
+using std::chrono::microseconds;
 using std::chrono::duration;
 using std::chrono::duration_cast;
+using std::endl;
 
-StreamControl::StreamControl(HwRdma *hwrdma, int peer_fd, LocalConf *local_conf, ClientList *client_list)
+// trace points of the pipeline, a qp number puts them on the QP's track
+static const TracePoint TP_CONNECT = {"connect peer", "lanes", "block_kb"};
+static const TracePoint TP_SEND_HELLO = {"send hello", "lanes", nullptr};
+static const TracePoint TP_PREPARE = {"prepare local", nullptr, nullptr};
+static const TracePoint TP_WAIT_HELLO = {"wait hello", nullptr, nullptr};
+static const TracePoint TP_TO_RTS = {"qp to rts", "lanes", nullptr};
+static const TracePoint TP_SEND_FILE = {"send file", "bytes", "blocks"};
+static const TracePoint TP_READ = {"read block", "seq", "bytes"};
+static const TracePoint TP_SEND = {"send block", "seq", "bytes"}; // qp: post to send completion
+static const TracePoint TP_CREDIT = {"credit", "lane", "credits"};
+static const TracePoint TP_RECV_FILE = {"recv file", "bytes", "blocks"};
+static const TracePoint TP_RECV = {"recv block", "seq", "bytes"}; // qp
+static const TracePoint TP_WRITE = {"write run", "seq", "bytes"};
+static const TracePoint TP_PUNCH = {"punch hole", "seq", "bytes"};
+static const TracePoint TP_GRANT = {"grant", "lane", "credits"};
+static const TracePoint TP_POST_RECV = {"post recv", "buffer", "lane"}; // qp
+
+StreamControl::StreamControl(HwRdma *hwrdma, int peer_fd, LocalConf *local_conf, ServerContext *server_ctx)
 {
     this->hwrdma = hwrdma;
     this->peer_fd = peer_fd;
     this->default_rate = local_conf->getDefaultRate();
     this->local_conf = local_conf;
-    this->client_list = client_list;
+    if (server_ctx != nullptr)
+    {
+        this->client_list = server_ctx->client_list;
+        this->credit_scheduler = server_ctx->credit_scheduler;
+        this->srq_pool = server_ctx->srq_pool;
+        this->errors = server_ctx->errors;
+        this->storage = server_ctx->storage;
+        this->shared_conf = server_ctx->conf;
+    }
+    if (credit_scheduler != nullptr && peer_fd >= 0)
+        this->credit_account = credit_scheduler->getAccount(peer_fd);
+    if (client_list != nullptr && peer_fd >= 0)
+        this->client_state = client_list->getState(peer_fd);
+    if (!local_conf->getTraceDir().empty())
+        Tracer::enable(local_conf->getTraceDir());
+}
+
+void StreamControl::attachPeer(int peer_fd)
+{
+    this->peer_fd = peer_fd;
+    if (credit_scheduler != nullptr)
+        this->credit_account = credit_scheduler->getAccount(peer_fd);
+    if (client_list != nullptr)
+        this->client_state = client_list->getState(peer_fd);
 }
 
 StreamControl::~StreamControl()
 {
-    if (qp != nullptr)
+    for (auto &lane : lanes)
+        destroyLane(lane);
+    if (mr != nullptr)
+        hwrdma->destroy_mr(mr);
+    if (recv_fd >= 0)
+        close(recv_fd);
+    if (recv_target >= 0)
+        storage->release(recv_target);
+}
+
+void StreamControl::destroyLane(Lane &lane)
+{
+    if (lane.qp != nullptr)
     {
         struct ibv_qp_attr qp_attr;
         bzero(&qp_attr, sizeof(qp_attr));
         qp_attr.qp_state = IBV_QPS_RESET;
-        ibv_modify_qp(qp, &qp_attr, IBV_QP_STATE);
-    }
-    if (qp != nullptr)
-        ibv_destroy_qp(qp);
-    if (cq != nullptr)
-        ibv_destroy_cq(cq);
-    if (comp_channel != nullptr)
-        ibv_destroy_comp_channel(comp_channel);
-    if (mr != nullptr)
-        hwrdma->destroy_mr(mr);
+        ibv_modify_qp(lane.qp, &qp_attr, IBV_QP_STATE);
+        ibv_destroy_qp(lane.qp);
+    }
+    if (lane.cq != nullptr && lane.own_cq)
+        ibv_destroy_cq(lane.cq);
+    lane.qp = nullptr;
+    lane.cq = nullptr;
 }
 int StreamControl::bindMemoryRegion()
 {
     size_t length = this->block_size * local_conf->getBlockNum();
+    // a prepared session may already hold buffers of the right size
+    if (this->mr != nullptr && this->mr->length == length)
+    {
+        setLaneKeys();
+        return 0;
+    }
+    if (this->mr != nullptr)
+    {
+        hwrdma->destroy_mr(this->mr);
+        this->mr = nullptr;
+        this->buf_ptr = nullptr;
+    }
     if (hwrdma->create_mr(&this->mr, &this->buf_ptr, length))
     {
         return -1;
     }
+    setLaneKeys();
     return 0;
 }
+// looked up once, the per block paths only read lane.lkey
+void StreamControl::setLaneKeys()
+{
+    if (this->mr == nullptr)
+        return;
+    for (auto &lane : lanes)
+        lane.lkey = hwrdma->portMr(this->mr, lane.port)->lkey;
+}
 int StreamControl::createBufferPool()
 {
     if (!this->buf_ptr || !this->mr)
     {
-        cout << "ERROR: NULL memory region." << endl;
+        LOGE << "NULL memory region.";
         return -1;
     }
     uint64_t loc = 0;
 
+    buffers.clear();
     while (loc + this->block_size <= this->mr->length)
     {
         buffers.emplace_back((uint8_t *)buf_ptr + loc, this->block_size);
@@ -60,139 +137,160 @@ int StreamControl::createBufferPool()
     }
     return 0;
 }
-int StreamControl::createLucpContext()
+std::vector<size_t> StreamControl::lanePorts() const
 {
-    // create cp_channel
-    comp_channel = ibv_create_comp_channel(hwrdma->ctx);
-    // create cq
-    cq = ibv_create_cq(hwrdma->ctx, local_conf->getBlockNum(), NULL, comp_channel, 0);
-    if (!cq)
+    std::vector<size_t> ports;
+    for (size_t i = 0; i < hwrdma->ports.size() && ports.size() < MAX_LANE_NUM; i++)
     {
-        cout << "ERROR: Unable to create Completion Queue" << endl;
-        return -1;
+        // the SRQ only exists on the primary device
+        if (srq_pool == nullptr || hwrdma->ports[i].ctx == hwrdma->ctx)
+            ports.push_back(i);
     }
-    // create qp
-    struct ibv_qp_init_attr qp_init_attr;
-    bzero(&qp_init_attr, sizeof(qp_init_attr));
-    qp_init_attr.send_cq = cq;
-    qp_init_attr.recv_cq = cq;
-    qp_init_attr.cap.max_send_wr = local_conf->getBlockNum();
-    qp_init_attr.cap.max_recv_wr = local_conf->getBlockNum();
-    qp_init_attr.cap.max_send_sge = 1;
-    qp_init_attr.cap.max_recv_sge = 1;
-    qp_init_attr.qp_type = IBV_QPT_RC;
-
-    local_qp_info.lid = hwrdma->port_attr.lid;
-    local_qp_info.block_num = local_conf->getBlockNum();
-    local_qp_info.block_size = local_conf->getBlockSize();
-    //local_qp_info.lucp_id = duration_cast<nanoseconds>(high_resolution_clock::now().time_since_epoch()).count(); //TODO
-    // local_qp_info.recv_depth = qp_init_attr.cap.max_recv_wr; //must before create qp,or max_recv_wr will change.
-    memcpy(local_qp_info.gid, &hwrdma->gid, 16);
-    // Create Queue Pair
-    qp = ibv_create_qp(hwrdma->pd, &qp_init_attr);
-    if (!qp)
-    {
-        cout << "ERROR: Unable to create QP!" << endl;
-        return -1;
-    }
-    local_qp_info.qp_num = qp->qp_num;
-    return 0;
+    return ports;
 }
 
-int StreamControl::sockSyncData(int xfer_size, char *local_data, char *remote_data)
+int StreamControl::createLucpContext(const std::vector<struct ibv_cq *> *shared_cqs)
 {
-    int rc;
-    int read_bytes = 0;
-    int total_read_bytes = 0;
-    while((rc = send(this->peer_fd, local_data, xfer_size, MSG_NOSIGNAL)) <= 0)
+    for (size_t port : lanePorts())
     {
-        if (rc == 0 || (rc < 0 && errno != EINTR))
+        auto &rdma_port = hwrdma->ports[port];
+        lanes.emplace_back();
+        Lane &lane = lanes.back();
+        lane.port = port;
+        if (shared_cqs != nullptr && port < shared_cqs->size() && (*shared_cqs)[port] != nullptr)
         {
-            cout << "ERROR: Failed writing data during sock_sync_data." << endl;
-            cout << "errno: " << errno << endl;
-            cout << "strerror: " << strerror(errno) << endl;
-            cout << "rc: " << rc << endl;
-            cout << "peer_fd: " << peer_fd << endl;
-            return -1;
+            // completions are polled and dispatched by the owner of the shared cq
+            lane.cq = (*shared_cqs)[port];
+            lane.own_cq = false;
         }
-    }
-
-    while (total_read_bytes < xfer_size)
-    {
-        read_bytes = read(this->peer_fd, remote_data, xfer_size);
-        if (read_bytes > 0)
+        else
         {
-            total_read_bytes += read_bytes;
+            // create cq, lane down notices may come on top of the blocks
+            lane.cq = ibv_create_cq(rdma_port.ctx, local_conf->getBlockNum() + MAX_LANE_NUM, NULL, NULL, 0);
+            if (!lane.cq)
+            {
+                LOGE << "Unable to create Completion Queue";
+                return -1;
+            }
         }
-        else if(read_bytes < 0 && errno == EINTR)
-            continue;
-        else 
+        // create qp
+        struct ibv_qp_init_attr qp_init_attr;
+        bzero(&qp_init_attr, sizeof(qp_init_attr));
+        qp_init_attr.send_cq = lane.cq;
+        qp_init_attr.recv_cq = lane.cq;
+        qp_init_attr.cap.max_send_wr = local_conf->getBlockNum() + MAX_LANE_NUM;
+        qp_init_attr.cap.max_recv_wr = local_conf->getBlockNum();
+        qp_init_attr.cap.max_send_sge = 1;
+        qp_init_attr.cap.max_recv_sge = 1;
+        qp_init_attr.qp_type = IBV_QPT_RC;
+        if (srq_pool != nullptr)
+        {
+            qp_init_attr.srq = srq_pool->getSrq();
+            qp_init_attr.cap.max_recv_wr = 0;
+        }
+
+        bzero(&lane.local_info, sizeof(lane.local_info));
+        lane.local_info.lid = rdma_port.port_attr.lid;
+        lane.local_info.block_num = local_conf->getBlockNum();
+        lane.local_info.block_size = local_conf->getBlockSize();
+        lane.local_info.rate_mbps = rdma_port.rate_mbps;
+        //local_qp_info.lucp_id = duration_cast<nanoseconds>(high_resolution_clock::now().time_since_epoch()).count(); //TODO
+        // local_qp_info.recv_depth = qp_init_attr.cap.max_recv_wr; //must before create qp,or max_recv_wr will change.
+        memcpy(lane.local_info.gid, &rdma_port.gid, 16);
+        // Create Queue Pair
+        lane.qp = ibv_create_qp(rdma_port.pd, &qp_init_attr);
+        if (!lane.qp)
         {
-            cout << "ERROR: Failed reading data during sock_sync_data." << endl;
-            cout << "errno: " << errno << endl;
-            cout << "strerror: " << strerror(errno) << endl;
-            cout << "read_bytes: " << read_bytes << endl;
-            cout << "peer_fd: " << this->peer_fd << endl;
+            LOGE << "Unable to create QP!";
             return -1;
         }
+        lane.local_info.qp_num = lane.qp->qp_num;
+    }
+    if (lanes.empty())
+    {
+        LOGE << "No RDMA port for the connection!";
+        return -1;
     }
+    setLaneKeys();
     return 0;
 }
 
 int StreamControl::changeQPState()
 {
+    for (auto &lane : lanes)
+    {
+        if (changeLaneState(lane))
+            return -1;
+    }
+    return 0;
+}
+
+int StreamControl::initLane(Lane &lane)
+{
+    if (lane.inited)
+        return 0;
+    auto &rdma_port = hwrdma->ports[lane.port];
     /* Change QP state to INIT */
     {
         struct ibv_qp_attr qp_attr;
         bzero(&qp_attr, sizeof(qp_attr));
         qp_attr.qp_state = IBV_QPS_INIT,
         qp_attr.pkey_index = 0,
-        qp_attr.port_num = hwrdma->port_num,
+        qp_attr.port_num = rdma_port.port_num,
         qp_attr.qp_access_flags = IBV_ACCESS_LOCAL_WRITE |
                                     IBV_ACCESS_REMOTE_READ |
                                     IBV_ACCESS_REMOTE_ATOMIC |
                                     IBV_ACCESS_REMOTE_WRITE;
 
-        auto ret = ibv_modify_qp(this->qp, &qp_attr,
+        auto ret = ibv_modify_qp(lane.qp, &qp_attr,
                                     IBV_QP_STATE | IBV_QP_PKEY_INDEX |
                                         IBV_QP_PORT | IBV_QP_ACCESS_FLAGS);
         if (ret != 0)
         {
-            cout << "ERROR: Unable to set QP to INIT state!" << endl;
+            LOGE << "Unable to set QP to INIT state!";
             return -1;
         }
     }
+    lane.inited = true;
+    return 0;
+}
+
+int StreamControl::changeLaneState(Lane &lane)
+{
+    if (initLane(lane))
+        return -1;
+    auto &rdma_port = hwrdma->ports[lane.port];
     /* Change QP state to RTR */
     {
         struct ibv_qp_attr qp_attr;
         bzero(&qp_attr, sizeof(qp_attr));
         qp_attr.qp_state = IBV_QPS_RTR,
-        qp_attr.path_mtu = hwrdma->port_attr.active_mtu,
-        qp_attr.dest_qp_num = this->remote_qp_info.qp_num,
+        qp_attr.path_mtu = rdma_port.port_attr.active_mtu,
+        qp_attr.dest_qp_num = lane.remote_info.qp_num,
         qp_attr.rq_psn = 0,
         qp_attr.max_dest_rd_atomic = 1,
         qp_attr.min_rnr_timer = 0x12,
         // qp_attr.ah_attr.is_global  = 0,
-        qp_attr.ah_attr.dlid = this->remote_qp_info.lid,
+        qp_attr.ah_attr.dlid = lane.remote_info.lid,
         qp_attr.ah_attr.sl = 0,
         qp_attr.ah_attr.src_path_bits = 0,
-        qp_attr.ah_attr.port_num = hwrdma->port_num,
+        qp_attr.ah_attr.port_num = rdma_port.port_num,
 
         qp_attr.ah_attr.is_global = 1,
-        memcpy(&qp_attr.ah_attr.grh.dgid, remote_qp_info.gid, 16),
+        memcpy(&qp_attr.ah_attr.grh.dgid, lane.remote_info.gid, 16),
         qp_attr.ah_attr.grh.flow_label = 0,
         qp_attr.ah_attr.grh.hop_limit = 3, // TODO modify
             qp_attr.ah_attr.grh.sgid_index = hwrdma->gid_idx,
         qp_attr.ah_attr.grh.traffic_class = 0;
 
-        auto ret = ibv_modify_qp(qp, &qp_attr,
+        auto ret = ibv_modify_qp(lane.qp, &qp_attr,
                                     IBV_QP_STATE | IBV_QP_AV |
                                         IBV_QP_PATH_MTU | IBV_QP_DEST_QPN |
                                         IBV_QP_RQ_PSN | IBV_QP_MAX_DEST_RD_ATOMIC |
                                         IBV_QP_MIN_RNR_TIMER);
         if (ret != 0)
         {
-            cout << "ERROR: Unable to set QP to RTR state!" << endl;
+            LOGE << "Unable to set QP to RTR state!";
             return -1;
         }
     }
@@ -204,17 +302,17 @@ int StreamControl::changeQPState()
         qp_attr.qp_state = IBV_QPS_RTS,
         qp_attr.timeout = 18,
         qp_attr.retry_cnt = 7,
-        qp_attr.rnr_retry = 0,
+        qp_attr.rnr_retry = 7, // infinite, a shared receive queue may run dry for a moment
         qp_attr.sq_psn = 0,
         qp_attr.max_rd_atomic = 1;
 
-        auto ret = ibv_modify_qp(qp, &qp_attr,
+        auto ret = ibv_modify_qp(lane.qp, &qp_attr,
                                     IBV_QP_STATE | IBV_QP_TIMEOUT |
                                         IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY |
                                         IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC);
         if (ret != 0)
         {
-            cout << "ERROR: Unable to set QP to RTS state!" << endl;
+            LOGE << "Unable to set QP to RTS state!";
             return -1;
         }
     }
@@ -222,72 +320,189 @@ int StreamControl::changeQPState()
 }
 int StreamControl::connectPeer()
 {
-    char remote_ready_char;
-    if(sockSyncData(1,"R",&remote_ready_char))
+    auto start = high_resolution_clock::now();
+    uint64_t start_tick = CycleClock::now();
+    // credits and sync chars are single bytes, do not let Nagle hold them back
+    int one = 1;
+    setsockopt(this->peer_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (sendHello() < 0)
     {
-        cout << "ERROR: connect failed when sync ready info." << endl;
+        LOGE << "connect failed when sending hello.";
         return -2;
     }
-    if(remote_ready_char != 'R')
+    Tracer::span(TP_SEND_HELLO, start_tick, lanes.size());
+    // register buffers and post receives while the hello is on the wire
+    uint64_t tick = CycleClock::now();
+    if (prepareLocal() < 0)
+        return -1;
+    Tracer::span(TP_PREPARE, tick);
+    tick = CycleClock::now();
+    HelloMsg remote_hello;
+    if (recvAll((char *)&remote_hello, sizeof(remote_hello)) < 0)
     {
-        cout << "ERROR: remote not ready to connect." << endl;
+        LOGE << "connect failed when receiving hello.";
+        return -2;
+    }
+    Tracer::span(TP_WAIT_HELLO, tick);
+    if (ntohl(remote_hello.magic) != HELLO_MAGIC || ntohs(remote_hello.version) != HELLO_VERSION)
+    {
+        LOGE << "remote not ready to connect (hello version " << ntohs(remote_hello.version) << ").";
         return -1;
     }
-    QPInfo net_local_qp_info, net_remote_qp_info;
-    net_local_qp_info.lid = htons(local_qp_info.lid);
-    //net_local_qp_info.lucp_id = htons(local_qp_info.lucp_id);
-    net_local_qp_info.qp_num = htonl(local_qp_info.qp_num);
-    net_local_qp_info.block_num = htonl(local_qp_info.block_num);
-    net_local_qp_info.block_size = htonl(local_qp_info.block_size);
-    //net_local_qp_info.recv_depth = htonl(local_qp_info.recv_depth);
-    memcpy(net_local_qp_info.gid, local_qp_info.gid, 16);
-
-    if (sockSyncData(sizeof(QPInfo), (char *)&net_local_qp_info, (char *)&net_remote_qp_info) < 0)
+    if (!(ntohs(remote_hello.transports) & TRANSPORT_RDMA))
     {
-        cout << "ERROR: connect failed when sync qpinfo." << endl;
-        return -2;
+        if (this->client_list == nullptr && ntohs(remote_hello.transports) == TRANSPORT_TCP)
+        {
+            LOGI << "Server picked the tcp transport.";
+            return CONNECT_USE_TCP;
+        }
+        LOGE << "remote does not use the rdma transport.";
+        return -1;
     }
-    remote_qp_info.lid = ntohs(net_remote_qp_info.lid);
-    //remote_qp_info.lucp_id = ntohs(net_remote_qp_info.lucp_id);
-    remote_qp_info.qp_num = ntohl(net_remote_qp_info.qp_num);
-    remote_qp_info.block_num = ntohl(net_remote_qp_info.block_num);
-    remote_qp_info.block_size = ntohl(net_remote_qp_info.block_size);
-    //remote_qp_info.recv_depth = ntohl(net_remote_qp_info.recv_depth);
-    memcpy(remote_qp_info.gid, net_remote_qp_info.gid, 16);
+    // both ends keep the first min(local, remote) lanes
+    size_t lane_num = ntohs(remote_hello.lane_num);
+    if (lane_num > lanes.size())
+        lane_num = lanes.size();
+    if (lane_num == 0)
+        lane_num = 1;
+    for (size_t k = 0; k < lane_num; k++)
+        decodeQPInfo(remote_hello.lanes[k], lanes[k].remote_info);
+    QPInfo &local_qp_info = lanes[0].local_info;
+    QPInfo &remote_qp_info = lanes[0].remote_info;
     //client apply block size from server
     if(this->client_list == nullptr)
         this->block_size = 1024UL * remote_qp_info.block_size;
     else
         this->block_size = 1024UL * local_conf->getBlockSize();
 #ifndef DEBUG
-    cout << "     local:" << endl
-    << "       lid:" << local_qp_info.lid << endl
-    << "    qp_num:" << local_qp_info.qp_num << endl
-    << " block_num:" << local_qp_info.block_num << endl
-    << "block_size:" << local_qp_info.block_size << "(KB)" << endl;
-    cout << "    local_gid:";
-    for(int i = 0; i < 16; i++)
-    {
-        cout << std::hex << (int)local_qp_info.gid[i];
-        if(i < 15) cout << ":";
-    }
-    cout << std::dec << endl;
-    // << "recv_depth:" << local_qp_info.recv_depth << endl
-    cout << "    remote:" << endl
-    << "       lid:" << remote_qp_info.lid << endl
-    << "    qp_num:" << remote_qp_info.qp_num << endl
-    << " block_num:" << remote_qp_info.block_num << endl
-    << "block_size:" << remote_qp_info.block_size << "(KB)" << endl;
-    cout << "    remote_gid:";
-    for(int i = 0; i < 16; i++)
-    {
-        cout << std::hex << (int)remote_qp_info.gid[i];
-        if(i < 15) cout << ":";
-    }
-    cout << std::dec << endl;
-    // << "recv_depth:" << remote_qp_info.recv_depth << endl;
+    {
+        Logger::Line line(LOG_LEVEL_INFO);
+        std::ostream &os = line.stream();
+        os << "     local:" << endl
+        << "       lid:" << local_qp_info.lid << endl
+        << "    qp_num:" << local_qp_info.qp_num << endl
+        << " block_num:" << local_qp_info.block_num << endl
+        << "block_size:" << local_qp_info.block_size << "(KB)" << endl;
+        os << "    local_gid:";
+        for(int i = 0; i < 16; i++)
+        {
+            os << std::hex << (int)local_qp_info.gid[i];
+            if(i < 15) os << ":";
+        }
+        os << std::dec << endl;
+        // << "recv_depth:" << local_qp_info.recv_depth << endl
+        os << "    remote:" << endl
+        << "       lid:" << remote_qp_info.lid << endl
+        << "    qp_num:" << remote_qp_info.qp_num << endl
+        << " block_num:" << remote_qp_info.block_num << endl
+        << "block_size:" << remote_qp_info.block_size << "(KB)" << endl;
+        os << "    remote_gid:";
+        for(int i = 0; i < 16; i++)
+        {
+            os << std::hex << (int)remote_qp_info.gid[i];
+            if(i < 15) os << ":";
+        }
+        // << "recv_depth:" << remote_qp_info.recv_depth << endl;
+    }
 #endif
-    return changeQPState();
+    // receives posted on the dropped lanes go away with their QPs, repost them
+    std::vector<uint64_t> repost;
+    for (size_t k = lane_num; k < lanes.size(); k++)
+        if (lanes[k].outstanding > 0)
+            for (uint64_t id = k; id < buffers.size(); id += lanes.size())
+                repost.push_back(id);
+    while (lanes.size() > lane_num)
+    {
+        destroyLane(lanes.back());
+        lanes.pop_back();
+    }
+    for (auto id : repost)
+    {
+        if (postRecvWr(id) < 0)
+            return -1;
+    }
+    for (size_t k = 0; k < lanes.size(); k++)
+    {
+        Lane &lane = lanes[k];
+        lane.rate_mbps = lane.local_info.rate_mbps < lane.remote_info.rate_mbps ? lane.local_info.rate_mbps : lane.remote_info.rate_mbps;
+        if (lane.rate_mbps == 0)
+            lane.rate_mbps = 1000;
+        LOGI << "      lane " << k << ": " << hwrdma->ports[lane.port].dev->name << ":" << hwrdma->ports[lane.port].port_num
+             << " qp " << lane.local_info.qp_num << " -> qp " << lane.remote_info.qp_num
+             << " (" << lane.rate_mbps / 1000.0 << "Gbps)";
+    }
+    tick = CycleClock::now();
+    if (changeQPState())
+        return -1;
+    Tracer::span(TP_TO_RTS, tick, lanes.size());
+    Tracer::span(TP_CONNECT, start_tick, lanes.size(), block_size / 1024);
+    LOGI << "connect to RTS: " << duration_cast<microseconds>(high_resolution_clock::now() - start).count() << "us";
+    return 0;
+}
+
+int StreamControl::sendHello()
+{
+    HelloMsg hello;
+    bzero(&hello, sizeof(hello));
+    hello.magic = htonl(HELLO_MAGIC);
+    hello.version = htons(HELLO_VERSION);
+    hello.lane_num = htons(lanes.size());
+    // the client could continue over tcp, the server answers with the one it picked
+    hello.transports = htons(this->client_list == nullptr ? (TRANSPORT_RDMA | TRANSPORT_TCP) : TRANSPORT_RDMA);
+    for (size_t k = 0; k < lanes.size(); k++)
+        encodeQPInfo(lanes[k].local_info, hello.lanes[k]);
+    return sendAll((char *)&hello, sizeof(hello));
+}
+
+int StreamControl::prepareLocal()
+{
+    for (auto &lane : lanes)
+    {
+        if (initLane(lane))
+            return -1;
+    }
+    if (this->client_list == nullptr)
+    {
+        // the sender learns the block size from the hello, expect the last one or ours
+        if (this->block_size == 0)
+            this->block_size = 1024UL * local_conf->getBlockSize();
+        if (bindMemoryRegion())
+            LOGW << "early buffer registration failed, retried after the handshake.";
+        return 0;
+    }
+    this->block_size = 1024UL * local_conf->getBlockSize();
+    // with a shared receive queue the buffers come from the SRQ pool
+    if (srq_pool != nullptr || recv_posted)
+        return 0;
+    if (bindMemoryRegion())
+        return -1;
+    if (createBufferPool())
+        return -1;
+    return prepareRecv();
+}
+
+void StreamControl::encodeQPInfo(const QPInfo &info, QPInfo &net_info)
+{
+    net_info.lid = htons(info.lid);
+    //net_local_qp_info.lucp_id = htons(local_qp_info.lucp_id);
+    net_info.qp_num = htonl(info.qp_num);
+    net_info.block_num = htonl(info.block_num);
+    net_info.block_size = htonl(info.block_size);
+    net_info.rate_mbps = htonl(info.rate_mbps);
+    //net_local_qp_info.recv_depth = htonl(local_qp_info.recv_depth);
+    memcpy(net_info.gid, info.gid, 16);
+}
+
+void StreamControl::decodeQPInfo(const QPInfo &net_info, QPInfo &info)
+{
+    info.lid = ntohs(net_info.lid);
+    //remote_qp_info.lucp_id = ntohs(net_remote_qp_info.lucp_id);
+    info.qp_num = ntohl(net_info.qp_num);
+    info.block_num = ntohl(net_info.block_num);
+    info.block_size = ntohl(net_info.block_size);
+    info.rate_mbps = ntohl(net_info.rate_mbps);
+    //remote_qp_info.recv_depth = ntohl(net_remote_qp_info.recv_depth);
+    memcpy(info.gid, net_info.gid, 16);
 }
 
 int StreamControl::prepareRecv()
@@ -298,121 +513,531 @@ int StreamControl::prepareRecv()
         auto ret = postRecvWr(i);
         if(ret < 0)
         {
-            cout << "ERROR: prepareRecv failed for buffer " << i << endl;
+            LOGE << "prepareRecv failed for buffer " << i;
             return -1;
         }
     }
+    recv_posted = true;
     return 0;
 }
-int StreamControl::postRecvFile()
+int StreamControl::startRecvFile()
 {
-    FileInfo file_info, remote_file_info;
+    FileInfo file_info;
     memcpy(file_info.file_path, "READY_TO_RECEIVE",256);
     file_info.file_size = 0;
-    if (sockSyncData(sizeof(file_info), (char *)&file_info, (char *)&remote_file_info) != 0)
+    if (sendAll((char *)&file_info, sizeof(file_info)) < 0)
     {
-        cout << "ERROR: synchronous failed before post file." << endl;
+        LOGE << "synchronous failed before post file.";
         return -2;
     }
-    cout << "sync receiving file: " << remote_file_info.file_path << "(" << (double)remote_file_info.file_size/1e9 << "GB)" << endl;
-    
-    local_conf->loadConf();
-    std::string save_path = local_conf->getSavedFolderPath().ToStdString() + char(wxFileName::GetPathSeparator()) + remote_file_info.file_path;
-    int recv_fd = open(save_path.c_str(), O_CREAT|O_WRONLY | O_TRUNC, 0777);
-    char sync_char = 'Y';
-    if (recv_fd < 0)
+    recv_msg_got = 0;
+    recv_stage = RECV_STAGE_FILE_INFO;
+    if (client_state != nullptr)
+        client_state->setStatus(CLIENT_STATUS_IDLE);
+    return 0;
+}
+
+int StreamControl::onRecvReadable()
+{
+    char *msg;
+    size_t msg_size;
+    if (recv_stage == RECV_STAGE_FILE_INFO)
     {
-        cout << "ERROR: Unable to create file \"" << save_path << "\"!"  << "errno = " << errno << endl;
-        sync_char = 'N';
-        if(sockSyncData(1, (char *)&sync_char, (char *)&sync_char) == -1)
+        msg = (char *)&recv_file_info;
+        msg_size = sizeof(recv_file_info);
+    }
+    else if (recv_stage == RECV_STAGE_SYNC)
+    {
+        msg = &remote_sync_char;
+        msg_size = 1;
+    }
+    else
+    {
+        // only a cancel is expected from the sender here, or a closed socket
+        char c;
+        int nb = recv(this->peer_fd, &c, 1, MSG_DONTWAIT);
+        if (nb == 0 || (nb < 0 && errno != EWOULDBLOCK && errno != EINTR))
             return -2;
+        if (nb == 1 && c == RECV_ABORT_CHAR)
+        {
+            LOGI << "sender cancelled \"" << recv_file_info.file_path << "\" after "
+                 << recv_bytes << " of " << recv_file_info.file_size << " bytes.";
+            return abortRecvFile();
+        }
+        if (nb == 1)
+            LOGW << "unexpected char from sender: " << c;
         return 0;
     }
-    struct ibv_wc *wc = new ibv_wc[buffers.size()];
-    std::shared_ptr<int> x(NULL, [&](int *){
+    while (recv_msg_got < msg_size)
+    {
+        int nb = recv(this->peer_fd, msg + recv_msg_got, msg_size - recv_msg_got, MSG_DONTWAIT);
+        if (nb > 0)
+            recv_msg_got += nb;
+        else if (nb < 0 && errno == EINTR)
+            continue;
+        else if (nb < 0 && errno == EWOULDBLOCK)
+            return 0;
+        else
+        {
+            LOGE << "Failed reading data during sync, errno: " << errno;
+            return -2;
+        }
+    }
+    recv_msg_got = 0;
+    if (recv_stage == RECV_STAGE_FILE_INFO)
+        return openRecvFile();
+    return beginRecvFile();
+}
+
+int StreamControl::openRecvFile()
+{
+    recv_file_info.file_path[sizeof(recv_file_info.file_path) - 1] = '\0';
+    LOGI << "sync receiving file: " << recv_file_info.file_path << "(" << (double)recv_file_info.file_size/1e9 << "GB)";
+    if (client_state != nullptr)
+        client_state->setFile(recv_file_info.file_path, recv_file_info.file_size);
+
+    if (shared_conf != nullptr)
+        recv_conf = shared_conf->reload();
+    std::string folder = recvConf().getSavedFolderPath().ToStdString();
+    if (storage != nullptr && !storage->empty())
+    {
+        recv_target = storage->pick(recv_file_info.file_size);
+        if (recv_target >= 0)
+            folder = storage->get(recv_target).path;
+    }
+    std::string save_path = folder + char(wxFileName::GetPathSeparator()) + recv_file_info.file_path;
+    recv_path = save_path;
+    recv_sync_char = 'Y';
+    if ((recv_file_info.file_size + block_size - 1) / block_size >= MAX_FILE_BLOCKS)
+    {
+        LOGE << "\"" << recv_file_info.file_path << "\" has too many blocks for BlockSize " << block_size / 1024 << "KB.";
+        countError(SERVER_ERROR_FILE_OPEN);
+        recv_sync_char = 'N';
+    }
+    else if (storage != nullptr && !storage->empty() && recv_target < 0)
+    {
+        LOGE << "No storage target has room for " << recv_file_info.file_size << " bytes of \"" << recv_file_info.file_path << "\"";
+        countError(SERVER_ERROR_NO_SPACE);
+        recv_sync_char = 'N';
+    }
+    else if ((recv_fd = open(save_path.c_str(), O_CREAT|O_WRONLY | O_TRUNC, 0777)) < 0)
+    {
+        LOGE << "Unable to create file \"" << save_path << "\"!"  << "errno = " << errno;
+        countError(SERVER_ERROR_FILE_OPEN);
+        recv_sync_char = 'N';
+    }
+    else if (WriteBehind::preallocate(recv_fd, recv_file_info.file_size, !recvConf().getSparseWrites()) < 0)
+    {
+        LOGE << "Unable to preallocate " << recv_file_info.file_size << " bytes for \"" << save_path << "\", errno = " << errno;
+        countError(SERVER_ERROR_NO_SPACE);
         close(recv_fd);
-        delete[] wc;
-    });
-    if(sockSyncData(1, (char *)&sync_char, (char *)&sync_char) == -1)
+        recv_fd = -1;
+        unlink(save_path.c_str());
+        recv_sync_char = 'N';
+    }
+    if (recv_sync_char != 'Y' && recv_target >= 0)
+    {
+        storage->release(recv_target);
+        recv_target = -1;
+    }
+    if (sendAll(&recv_sync_char, 1) < 0)
         return -2;
-    cout <<"start receiving file, sync_char: " << sync_char << endl;
-    if(sync_char != 'Y')
+    recv_stage = RECV_STAGE_SYNC;
+    return 0;
+}
+
+int StreamControl::beginRecvFile()
+{
+    LOGD << "start receiving file, sync_char: " << remote_sync_char;
+    if (recv_sync_char != 'Y')
     {
-        cout << "WARNING: remote not ready to send." << endl;
+        recv_stage = RECV_STAGE_IDLE;
         return 0;
     }
-    uint64_t recv_bytes = 0;
-    auto t = high_resolution_clock::now();
-    auto t_last_recv = t;
-    double delta_io = 0,delta = 0;
-    int recv_num = 0;
-    while(recv_bytes < remote_file_info.file_size)
+    if(remote_sync_char != 'Y')
     {
-        int n = ibv_poll_cq(cq, 1, wc);
-        if(n < 0)
-        {
-            cout << "ERROR: ibv_poll_cq returned " << n << " - closing connection";
+        LOGW << "remote not ready to send.";
+        closeRecvFile();
+        return 0;
+    }
+    if (credit_account != nullptr)
+    {
+        credit_scheduler->setActive(credit_account, true);
+        credit_account->receiving.store(true, std::memory_order_relaxed);
+    }
+    if (client_state != nullptr)
+        client_state->setStatus(CLIENT_STATUS_RECEIVING);
+    recv_bytes = 0;
+    recv_blocks.assign((recv_file_info.file_size + block_size - 1) / block_size, false);
+    recv_blocks_got = 0;
+    // hold at most half the window so the sender keeps the other half in flight
+    const LocalConf &conf = recvConf();
+    coalescer.configure(1024ULL * conf.getWriteCoalesceSize(), std::max<uint32_t>(1, recvWindow() / 2),
+                        (uint64_t)(conf.getWriteCoalesceUs() * 1e3 / CycleClock::nsPerTick()));
+    write_behind.start(recv_fd, (uint64_t)conf.getDirtyLimit() << 20);
+    sparse_writes = conf.getSparseWrites();
+    latency.reset();
+    recv_start_tick = CycleClock::now();
+    recv_start = high_resolution_clock::now();
+    recv_last = recv_start;
+    recv_stage = RECV_STAGE_RECEIVING;
+    if (recv_file_info.file_size == 0)
+        return finishRecvFile();
+    if (grantCredits() < 0)
+        return -2;
+    return 0;
+}
+
+size_t StreamControl::laneOf(const struct ibv_wc &wc) const
+{
+    if (srq_pool == nullptr)
+        return wc.wr_id >> 32;
+    // with an SRQ all lanes are on the primary device, qp numbers are unique
+    for (size_t k = 0; k < lanes.size(); k++)
+        if (lanes[k].local_info.qp_num == wc.qp_num)
+            return k;
+    return lanes.size();
+}
+
+int StreamControl::laneDown(size_t k)
+{
+    if (k >= lanes.size())
+        return -1;
+    Lane &lane = lanes[k];
+    if (lane.alive)
+    {
+        lane.alive = false;
+        granted_credits -= lane.credits;
+        lane.credits = 0;
+        countError(SERVER_ERROR_LANE_DOWN);
+        // flush the posted receives, they are reposted on the live lanes
+        struct ibv_qp_attr qp_attr;
+        bzero(&qp_attr, sizeof(qp_attr));
+        qp_attr.qp_state = IBV_QPS_ERR;
+        ibv_modify_qp(lane.qp, &qp_attr, IBV_QP_STATE);
+        LOGW << "lane " << k << " (" << hwrdma->ports[lane.port].dev->name << ":"
+             << hwrdma->ports[lane.port].port_num << ") is down.";
+    }
+    for (auto &live : lanes)
+        if (live.alive)
+            return 0;
+    LOGE << "all lanes are down.";
+    return -1;
+}
+
+int StreamControl::onRecvCompletion(const struct ibv_wc &wc)
+{
+    recv_last = high_resolution_clock::now();
+    uint64_t tick = CycleClock::now();
+    size_t k = laneOf(wc);
+    if (k >= lanes.size())
+    {
+        LOGE << "completion of unknown qp " << wc.qp_num;
+        return -1;
+    }
+    Lane &lane = lanes[k];
+    uint64_t id = srq_pool != nullptr ? wc.wr_id : (wc.wr_id & 0xffffffff);
+    if (srq_pool == nullptr)
+        lane.outstanding--;
+    if (wc.status != IBV_WC_SUCCESS)
+    {
+        // receives flushed from a lane that went down move to the live lanes
+        if (!lane.alive && wc.status == IBV_WC_WR_FLUSH_ERR)
+            return srq_pool != nullptr ? 0 : postRecvWr(id);
+        LOGE << "got bad completion with status: 0x" << std::hex << wc.status << ", vendor syndrome: 0x" << wc.vendor_err;
+        countError(SERVER_ERROR_COMPLETION);
+        if (laneDown(k) < 0)
             return -1;
+        return srq_pool != nullptr ? 0 : postRecvWr(id);
+    }
+    if (wc.opcode != IBV_WC_RECV || !(wc.wc_flags & IBV_WC_WITH_IMM))
+    {
+        LOGE << "got unexpected completion with opcode: 0x" << std::hex << wc.opcode;
+        return -1;
+    }
+    if (lane.credits > 0)
+    {
+        lane.credits--;
+        granted_credits--;
+    }
+    auto buff = srq_pool != nullptr ? srq_pool->getBuffer(id) : std::get<0>(buffers[id]);
+    uint32_t imm = ntohl(wc.imm_data);
+    int ret = 0;
+    bool held = false;
+    if (imm >= LANE_DOWN_IMM)
+        ret = laneDown(imm - LANE_DOWN_IMM);
+    else if (recv_stage != RECV_STAGE_RECEIVING)
+    {
+        // a block resent after a failover may trail the end of its file
+        LOGW << "ignored block " << imm << " received while no file is in progress.";
+    }
+    else if (imm < recv_blocks.size() && !recv_blocks[imm])
+    {
+        // lanes deliver out of order, every block knows its offset;
+        // the buffer stays with the coalescer until its run is written
+        Tracer::instant(TP_RECV, imm, wc.byte_len, lane.local_info.qp_num);
+        uint64_t offset = imm * block_size;
+        bool zero = sparse_writes && isZeroBlock(buff, wc.byte_len);
+        if (!coalescer.continues(offset, zero))
+        {
+            ret = flushWrites();
+            if (ret < 0)
+                return ret;
+            // a failed write dropped the file
+            if (recv_stage != RECV_STAGE_RECEIVING)
+                return releaseRecvBuffer(id);
         }
-        else if(n == 0) //std::this_thread::sleep_for(std::chrono::microseconds(1));
+        if (zero)
         {
-            if(t_last_recv != t && 
-                duration_cast<duration<double>>(high_resolution_clock::now() - t_last_recv).count() *1e9 > this->block_size)
-            {
-                cout << "ERROR: unfinished recv." << endl;
-                return 0;
-            }
+            coalescer.addHole(offset, wc.byte_len);
+            latency.record(STAGE_RECV_WRITE, CycleClock::now() - tick);
         }
-        else{
-            //cout << n << endl;
-            for (int i = 0; i < n; i++)
-            {
-                recv_num ++;
-                t_last_recv = high_resolution_clock::now();
-                if (wc[i].status != IBV_WC_SUCCESS || wc[i].opcode != IBV_WC_RECV)
-                {
-                    fprintf(stderr, "got bad completion with status: 0x%x, vendor syndrome: 0x%x\n",
-                            wc[i].status, wc[i].vendor_err);
-                }
-                auto &buffer = buffers[wc[i].wr_id];
-                auto buff = std::get<0>(buffer);
-                recv_bytes += wc[i].byte_len;
-                //cout << "receive rate: " << wc[i].byte_len * 8 /(delta * 1e9) <<"Gbps" <<endl;
-                // auto io_start = high_resolution_clock::now();
-                write(recv_fd, (const char*)buff, wc[i].byte_len);
-                postRecvWr(wc[i].wr_id);
-                // auto io_end = high_resolution_clock::now();
-                // double delta_io_ = duration_cast<duration<double>>(io_end - io_start).count();
-                //cout << "write rate: " << wc[i].byte_len * 8 /(delta_io_ * 1e9) <<"Gbps" <<endl;
-                // delta_io += delta_io_;
-                // delta += delta_;
-                // if(recv_num > 0 && (recv_num % local_qp_info.recv_depth == 0)) //all wqe is in free state
-                int rc;
-                char sync_char = 'A';
-                while((rc = send(this->peer_fd, (char*)&sync_char, 1, MSG_NOSIGNAL)) <= 0)
-                {
-                    if (rc == 0 || (rc < 0 && errno != EINTR))
-                        return -2;
-                }
+        else
+        {
+            coalescer.add({id, imm, tick}, buff, wc.byte_len, offset);
+            held = true;
+        }
+        recv_blocks[imm] = true;
+        recv_blocks_got++;
+        recv_bytes += wc.byte_len;
+        if (credit_account != nullptr)
+        {
+            credit_account->bytes.fetch_add(wc.byte_len, std::memory_order_relaxed);
+            credit_account->blocks.fetch_add(1, std::memory_order_relaxed);
+            credit_account->meter.add(wc.byte_len);
+        }
+        if (client_state != nullptr)
+            client_state->fileBytes.store(recv_bytes, std::memory_order_relaxed);
+    }
+    if (!held && releaseRecvBuffer(id) < 0)
+        return -1;
+    if (coalescer.due(CycleClock::now()))
+    {
+        int flushed = flushWrites();
+        if (flushed < 0)
+            return flushed;
+    }
+    if (credit_account != nullptr)
+        credit_account->outstanding.store(granted_credits, std::memory_order_relaxed);
+    if (ret < 0)
+        return ret;
+    if (recv_stage != RECV_STAGE_RECEIVING)
+        return 0;
+    if (recv_blocks_got >= recv_blocks.size())
+        return finishRecvFile();
+    if (grantCredits() < 0)
+        return -2;
+    return 0;
+}
 
-            }
+int StreamControl::releaseRecvBuffer(uint64_t id)
+{
+    if (srq_pool != nullptr)
+    {
+        srq_pool->release(id);
+        return 0;
+    }
+    return postRecvWr(id);
+}
+
+int StreamControl::flushWrites()
+{
+    if (coalescer.empty())
+        return 0;
+    uint64_t write_tick = CycleClock::now();
+    uint64_t bytes = coalescer.pendingBytes();
+    uint64_t offset = coalescer.pendingOffset();
+    bool hole = coalescer.pendingHole();
+    uint32_t calls = 0;
+    bool failed = coalescer.flush(recv_fd, flushed_blocks, calls) < 0;
+    if (failed)
+    {
+        LOGE << "Unable to " << (hole ? "punch a hole" : "write") << " at " << offset << " (" << bytes
+             << " bytes) of \"" << recv_file_info.file_path << "\", errno = " << errno;
+        countError(SERVER_ERROR_FILE_WRITE);
+    }
+    else if (!hole)
+        write_behind.written(offset, bytes);
+    uint64_t now = CycleClock::now();
+    // the write-behind waits belong to the device as much as the copy
+    if (recv_target >= 0 && !hole && !failed)
+        storage->written(recv_target, bytes, CycleClock::toNs(now - write_tick));
+    Tracer::span(hole ? TP_PUNCH : TP_WRITE, write_tick, offset / block_size, bytes);
+    if (credit_account != nullptr)
+        credit_account->writes.fetch_add(calls, std::memory_order_relaxed);
+    // only now the buffers may be filled again
+    for (auto &block : flushed_blocks)
+    {
+        latency.record(STAGE_RECV_WRITE, now - block.tick);
+        if (releaseRecvBuffer(block.id) < 0)
+            return -1;
+    }
+    // a file with a gap is of no use, the sender learns it was not stored
+    if (failed && recv_stage == RECV_STAGE_RECEIVING)
+        return abortRecvFile(true);
+    return 0;
+}
+
+int StreamControl::pollRecvCompletions(int batch)
+{
+    struct ibv_wc wcs[16];
+    if (batch > 16)
+        batch = 16;
+    int total = 0;
+    for (size_t k = 0; k < lanes.size(); k++)
+    {
+        int n = ibv_poll_cq(lanes[k].cq, batch, wcs);
+        if (n < 0)
+        {
+            LOGE << "ibv_poll_cq returned " << n << " - closing connection";
+            return -1;
         }
+        for (int i = 0; i < n; i++)
+        {
+            int ret = onRecvCompletion(wcs[i]);
+            if (ret < 0)
+                return ret;
+        }
+        total += n;
+    }
+    return total;
+}
+
+int StreamControl::onRecvIdle()
+{
+    if (recv_stage != RECV_STAGE_RECEIVING)
+        return 0;
+    if (coalescer.due(CycleClock::now()))
+    {
+        int ret = flushWrites();
+        if (ret < 0 || recv_stage != RECV_STAGE_RECEIVING)
+            return ret;
+    }
+    if(recv_last != recv_start && 
+        duration_cast<duration<double>>(high_resolution_clock::now() - recv_last).count() > RECV_IDLE_TIMEOUT_SEC)
+    {
+        LOGE << "unfinished recv.";
+        countError(SERVER_ERROR_RECV_TIMEOUT);
+        closeRecvFile();
+        if (finishCredits() < 0)
+            return -2;
+        return 0;
+    }
+    // share may have grown since another connection went idle
+    if (grantCredits() < 0)
+        return -2;
+    return 0;
+}
+
+int StreamControl::finishRecvFile()
+{
+    int ret = flushWrites();
+    if (ret < 0 || recv_stage != RECV_STAGE_RECEIVING)
+        return ret;
+    // a file ending in zero blocks is only as long as its last write
+    if (sparse_writes && ftruncate(recv_fd, recv_file_info.file_size) != 0)
+    {
+        LOGE << "Unable to extend \"" << recv_file_info.file_path << "\" to its size, errno = " << errno;
+        countError(SERVER_ERROR_FILE_WRITE);
+        return abortRecvFile(true);
+    }
+    write_behind.finish();
+    closeRecvFile();
+    if (client_state != nullptr)
+        client_state->filesDone.fetch_add(1, std::memory_order_relaxed);
+    if (finishCredits() < 0)
+        return -2;
+    double delta = duration_cast<duration<double>>(high_resolution_clock::now() - recv_start).count();
+    LOGI << "recv rate: " << recv_file_info.file_size * 8/(delta * 1e9) << "Gbps";
+    LOGI << "finish receive file:" << recv_file_info.file_path << "(" << (double)recv_file_info.file_size/1e9 << "GB)";
+    {
+        Logger::Line line(LOG_LEVEL_INFO);
+        latency.report(line.stream(), "block latency");
     }
-    delta = duration_cast<duration<double>>(high_resolution_clock::now() - t).count();
+    Tracer::span(TP_RECV_FILE, recv_start_tick, recv_file_info.file_size, recv_blocks_got);
+    Tracer::flush();
+    return 0;
+}
 
-    // cout << "I/O write rate: " << remote_file_info.file_size * 8/(delta_io * 1e9) << "Gbps" << endl;
-    cout << "recv rate: " << remote_file_info.file_size * 8/(delta * 1e9) << "Gbps" << endl;
-    cout << "finish receive file:" << remote_file_info.file_path << "(" << (double)remote_file_info.file_size/1e9 << "GB)" << endl;
+// the sender cancelled or the file could not be written, what arrived of
+// the file is of no use
+int StreamControl::abortRecvFile(bool failed)
+{
+    closeRecvFile();
+    if (!recv_path.empty() && unlink(recv_path.c_str()) != 0)
+        LOGW << "Unable to remove \"" << recv_path << "\", errno = " << errno;
+    if (failed && sendAll(&RECV_FAILED_CHAR, 1) < 0)
+        return -2;
+    if (finishCredits() < 0)
+        return -2;
     return 0;
 }
 
-int StreamControl::postSendFile(const char *file_path, const char *file_name, UploadThread*  upload_thread)
+void StreamControl::closeRecvFile()
+{
+    // the file is being closed anyway, a failed write here is only counted;
+    // a lane that failed while reposting shows up on the next completion
+    recv_stage = RECV_STAGE_IDLE;
+    flushWrites();
+    if (recv_fd >= 0)
+        close(recv_fd);
+    recv_fd = -1;
+    if (recv_target >= 0)
+        storage->release(recv_target);
+    recv_target = -1;
+    if (client_state != nullptr)
+        client_state->setStatus(CLIENT_STATUS_IDLE);
+}
+
+// blocking driver of the receive state machine, returns after one file
+int StreamControl::postRecvFile()
+{
+    if (startRecvFile() < 0)
+        return -2;
+    while (recv_stage != RECV_STAGE_IDLE)
+    {
+        int ret;
+        if (recv_stage != RECV_STAGE_RECEIVING)
+        {
+            struct pollfd pfd;
+            pfd.fd = this->peer_fd;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+                return -2;
+            ret = onRecvReadable();
+        }
+        else
+        {
+            int n = pollRecvCompletions(16);
+            ret = n;
+            // the sender may cancel while no block is coming
+            if (n == 0)
+                ret = onRecvReadable();
+            if (n == 0 && ret == 0 && recv_stage == RECV_STAGE_RECEIVING)
+                ret = onRecvIdle();
+        }
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+int StreamControl::postSendFile(const char *file_path, const char *file_name, TransferProgress *progress)
+{
+    int ret = sendFile(file_path, file_name, progress);
+    // a failed transfer leaves the control stream in an unknown state
+    if (ret < 0)
+        this->reusable = false;
+    Tracer::flush();
+    return ret;
+}
+int StreamControl::sendFile(const char *file_path, const char *file_name, TransferProgress *progress)
 {
     struct stat statbuf;
     auto ret = stat(file_path, &statbuf);
     if (ret != 0)
     {
-        cout << "ERROR: file not exist." << endl;
+        LOGE << "file not exist.";
         return -1;
     }
     FileInfo file_info, remote_file_info;
@@ -420,20 +1045,27 @@ int StreamControl::postSendFile(const char *file_path, const char *file_name, Up
     file_info.file_size = statbuf.st_size;
     if (sockSyncData(sizeof(file_info), (char *)&file_info, (char *)&remote_file_info) != 0)
     {
-        cout << "ERROR: synchronous failed before post file." << endl;
+        LOGE << "synchronous failed before post file.";
         return -2;
     }
     if (strcmp(remote_file_info.file_path, "READY_TO_RECEIVE") != 0)
     {
-        cout << "ERROR: remote not ready to receive." << endl;
+        LOGE << "remote not ready to receive.";
         return -1;
     }
 
     int fd = open(file_path, O_RDONLY);
     char sync_char = 'Y';
+    if (fd >= 0 && (file_info.file_size + block_size - 1) / block_size >= MAX_FILE_BLOCKS)
+    {
+        LOGE << "\"" << file_path << "\" has too many blocks for BlockSize " << block_size / 1024 << "KB.";
+        close(fd);
+        fd = -1;
+    }
+    else if (fd < 0)
+        LOGE << "Unable to open file \"" << file_path << "\"!";
     if (fd < 0)
     {
-        cout << "ERROR: Unable to open file \"" << file_path << "\"!" << endl;
         sync_char = 'N';
         if (sockSyncData(1, (char *)&sync_char, (char *)&sync_char) < 0)
         {        
@@ -447,257 +1079,486 @@ int StreamControl::postSendFile(const char *file_path, const char *file_name, Up
         delete[] wc;
         });
     double filesize_GB = (double)(file_info.file_size) * 1.0E-9;
-    cout << "Sending file: " << file_path << "(" << filesize_GB << " GB)" << endl;
+    LOGI << "Sending file: " << file_path << "(" << filesize_GB << " GB)";
     struct ibv_send_wr wr, *bad_wr = nullptr;
     struct ibv_sge sge;
     bzero(&wr, sizeof(wr));
     bzero(&sge, sizeof(sge));
-    wr.opcode = IBV_WR_SEND;
+    wr.opcode = IBV_WR_SEND_WITH_IMM;
     wr.sg_list = &sge;
     wr.num_sge = 1;
     wr.send_flags = IBV_SEND_SIGNALED,
-    wr.next = NULL,
-    sge.lkey = this->mr->lkey;
+    wr.next = NULL;
 
-    uint64_t bytes_left = file_info.file_size;
+    // blocks are read by offset and carry their sequence number, so a block
+    // lost with its lane is simply sent again on another one
+    uint64_t block_count = (file_info.file_size + block_size - 1) / block_size;
+    uint64_t next_seq = 0, acked_blocks = 0;
     uint64_t ack_bytes = 0;
-    uint32_t Noutstanding_writes = 0;
-    double delta_t_io = 0.0;
-    
-    uint64_t sendcnt = 0, compcnt = 0;
-    std::list<uint64_t> uncomplete_bytes;
-    uint64_t i = 0;
-
-    auto buff_size = std::get<1>(buffers[0]);
-    sge.addr = (uint64_t)std::get<0>(buffers[0]);
-    wr.wr_id = 0;
-    auto bytes_payload = buff_size < bytes_left ? buff_size : bytes_left;
-    sge.length = bytes_payload;
+    std::deque<uint64_t> resend;
+    std::vector<uint64_t> free_buffers;
+    std::vector<std::tuple<uint64_t, uint64_t>> inflight(buffers.size()); // seq, bytes
+    for (uint64_t id = buffers.size(); id-- > 0;)
+        free_buffers.push_back(id);
+    const uint64_t notice_wr_id = 1ULL << 63;
 
     // bool unread = false;
     //for(; j < buffers.size() && buff_size * j < file_info.file_size;)
         //readahead(fd,(j++) * buff_size, buff_size);
     if(sockSyncData(1, (char *)&sync_char, (char *)&sync_char))
         return -2;
-    cout <<"start sending file, sync_char: " << sync_char << endl;
+    LOGD << "start sending file, sync_char: " << sync_char;
     if(sync_char != 'Y')
     {
-        cout << "WARNING: remote not ready to receive." << endl;
+        LOGW << "remote not ready to receive.";
         return 0;
     }
-    int remaining_recv_wqe = remote_qp_info.block_num;
+    // the receiver announces credits for lane k with 'A' + k and ends the file with 'F'
+    for (auto &lane : lanes)
+    {
+        lane.credits = 0;
+        lane.credit_ticks.clear();
+    }
+    latency.reset();
+    uint64_t file_tick = CycleClock::now();
+    std::vector<uint64_t> post_ticks(buffers.size());
+    bool remote_finished = false;
     auto t1 = high_resolution_clock::now();
     auto t2 = t1, t_io = t1;
 
     double duration_time = 0, duration_io = 0;
-    while (1)
-    { 
-        // if (unread)
+    while (acked_blocks < block_count)
+    {
+        while(1)
         {
-            while(1)
+            int nb = recv(this->peer_fd, &sync_char, 1, MSG_DONTWAIT);
+            if(nb == 0) return -2;
+            else if(nb < 0 && errno == EWOULDBLOCK)
+                break;
+            else if(nb < 0 && errno == EINTR)
+                continue;
+            else if(nb < 0)
+                return -2;
+            else if (sync_char == 'F')
             {
-                int nb = recv(this->peer_fd, &sync_char, 1, MSG_DONTWAIT);
-                if(nb == 0) return -2;
-                else if(nb < 0 && errno == EWOULDBLOCK)
-                    break;
-                else if(nb < 0 && errno == EINTR)
-                    continue;
-                else if(nb < 0)
+                // fine once every block went out, the acks may have been lost with a lane
+                if (next_seq < block_count)
+                {
+                    LOGE << "remote finished receiving early.";
+                    return -1;
+                }
+                remote_finished = true;
+                break;
+            }
+            else if (sync_char == RECV_FAILED_CHAR)
+            {
+                LOGE << "remote could not write the file.";
+                if (waitCreditsEnd() < 0)
                     return -2;
-                else 
+                drainSends(wc);
+                return -1;
+            }
+            else if (sync_char >= 'A' && sync_char < 'A' + (int)lanes.size())
+            {
+                // a returned credit is matched with the oldest block still holding one
+                Lane &lane = lanes[sync_char - 'A'];
+                lane.credits++;
+                Tracer::instant(TP_CREDIT, sync_char - 'A', lane.credits);
+                if (!lane.credit_ticks.empty())
                 {
-                    cout << "sync_char: " << sync_char << endl;
-                    // assert(sync_char == 'A');
-                    remaining_recv_wqe++;
+                    latency.record(STAGE_CREDIT_RTT, CycleClock::now() - lane.credit_ticks.front());
+                    lane.credit_ticks.pop_front();
                 }
             }
+            else
+                LOGW << "unexpected sync_char: " << sync_char;
         }
-        //readahead(fd,file_info.file_size - bytes_left, sge.length);
-        if(remaining_recv_wqe > 0)
-        {
-            // Calculate bytes to be sent in this buffer
-            t_io = high_resolution_clock::now();
-            read(fd, (char *)sge.addr, bytes_payload);
-            duration_io += duration_cast<duration<double>>(high_resolution_clock::now() - t_io).count();
-
-            auto ret = ibv_post_send(qp, &wr, &bad_wr);
-            uncomplete_bytes.push_back(bytes_payload);
+        if (remote_finished)
+            break;
 
+        // post on the live lane with the least outstanding blocks per bandwidth
+        int k;
+        while ((k = pickSendLane()) >= 0)
+        {
+            Lane &lane = lanes[k];
+            int down = -1;
+            for (size_t d = 0; d < lanes.size() && down < 0; d++)
+                if (!lanes[d].alive && !lanes[d].notified)
+                    down = d;
+            if (down >= 0)
+            {
+                // zero length send so the receiver reclaims the lane's buffers
+                wr.wr_id = notice_wr_id | down;
+                wr.imm_data = htonl(LANE_DOWN_IMM + down);
+                wr.num_sge = 0;
+            }
+            else
+            {
+                if (free_buffers.empty() || (resend.empty() && next_seq >= block_count))
+                    break;
+                uint64_t seq = next_seq;
+                if (!resend.empty())
+                {
+                    seq = resend.front();
+                    resend.pop_front();
+                }
+                else
+                    next_seq++;
+                uint64_t id = free_buffers.back();
+                free_buffers.pop_back();
+                uint64_t bytes_payload = file_info.file_size - seq * block_size;
+                if (bytes_payload > block_size)
+                    bytes_payload = block_size;
+                // Calculate bytes to be sent in this buffer
+                t_io = high_resolution_clock::now();
+                uint64_t tick = CycleClock::now();
+                pread(fd, (char *)std::get<0>(buffers[id]), bytes_payload, seq * block_size);
+                latency.record(STAGE_DISK_READ, CycleClock::now() - tick);
+                Tracer::span(TP_READ, tick, seq, bytes_payload);
+                duration_io += duration_cast<duration<double>>(high_resolution_clock::now() - t_io).count();
+                inflight[id] = std::make_tuple(seq, bytes_payload);
+                sge.addr = (uint64_t)std::get<0>(buffers[id]);
+                sge.length = bytes_payload;
+                sge.lkey = lane.lkey;
+                wr.wr_id = id;
+                wr.imm_data = htonl(seq);
+                wr.num_sge = 1;
+                post_ticks[id] = CycleClock::now();
+            }
+            auto ret = ibv_post_send(lane.qp, &wr, &bad_wr);
             if (ret != 0)
             {
-                cout << "ERROR: ibv_post_send returned non zero value (" << ret << ")" << endl;
-                break;
+                LOGE << "ibv_post_send returned non zero value (" << ret << ") on lane " << k;
+                if (down < 0)
+                {
+                    resend.push_front(std::get<0>(inflight[wr.wr_id]));
+                    free_buffers.push_back(wr.wr_id);
+                }
+                lane.alive = false;
+                lane.credits = 0;
+                lane.credit_ticks.clear();
+                continue;
             }
-            bytes_left -= bytes_payload;
-            Noutstanding_writes++;
-            remaining_recv_wqe --;
-            sendcnt++;
-            
-            i++;
-            auto id = i % buffers.size();
-            auto &buffer = buffers[id];
-            auto buff = std::get<0>(buffer);
-            auto buff_size = std::get<1>(buffer);
-            sge.addr = (uint64_t)buff;
-            wr.wr_id = id;
-            bytes_payload = buff_size < bytes_left ? buff_size : bytes_left;
-            sge.length = bytes_payload;
-            // if((i % this->remote_qp_info.recv_depth) == 0) unread = true; //wait for sync
+            if (down >= 0)
+                lanes[down].notified = true;
+            else
+                lane.credit_ticks.push_back(post_ticks[wr.wr_id]);
+            lane.credits--;
+            lane.outstanding++;
         }
-        
-        do
+        bool any_alive = false;
+        for (auto &lane : lanes)
+            any_alive |= lane.alive;
+        if (!any_alive)
         {
-            int n = ibv_poll_cq(cq,1, wc);
-            // cout << Noutstanding_writes << endl;
-            // cout << n << endl;
+            LOGE << "all lanes are down.";
+            return -1;
+        }
+
+        for (k = 0; k < (int)lanes.size(); k++)
+        {
+            Lane &lane = lanes[k];
+            if (lane.outstanding == 0)
+                continue;
+            int n = ibv_poll_cq(lane.cq, buffers.size(), wc);
             if (n < 0)
             {
-                cout << "ERROR: ibv_poll_cq returned " << n << " - closing connection";
+                LOGE << "ibv_poll_cq returned " << n << " - closing connection";
                 return -1;
             }
-            else if (n > 0)
+            for (int i = 0; i < n; i++)
             {
-                for (int i = 0; i < n; i++)
+                lane.outstanding--;
+                bool notice = (wc[i].wr_id & notice_wr_id) != 0;
+                if (wc[i].status != IBV_WC_SUCCESS)
                 {
-                    if (wc[i].status != IBV_WC_SUCCESS)
-                    {
-                        fprintf(stderr, "got bad completion with status: 0x%x, vendor syndrome: 0x%x\n",
-                                wc[i].status, wc[i].vendor_err);
-                        return -1;
-                    }
-                    //if(j * buff_size < file_info.file_size);
-                        //readahead(fd,(j++) * buff_size, buff_size);
-
-                    // auto send_time = uncomplete_tp.front();
-                    // auto recv_time = high_resolution_clock::now();
-                    // cout << "FIRST WQE RTT is " << duration_cast<duration<double>>(recv_time - send_time).count() << endl;
-                    // uncomplete_tp.pop_front();
-                    compcnt++;
-                    Noutstanding_writes--;
-                    ack_bytes += uncomplete_bytes.front();
-                    t1 = t2;
-                    t2 = high_resolution_clock::now();
-                    auto period = duration_cast<duration<double>>(t2 - t1).count();
-                    duration_time += period;
-                    int ret = upload_thread->caculateTransferInfo(ack_bytes, period, uncomplete_bytes.front());
-                    uncomplete_bytes.pop_front();
-                    if(ret < 0)
+                    LOGE << "got bad completion with status: 0x" << std::hex << wc[i].status << ", vendor syndrome: 0x" << wc[i].vendor_err
+                         << std::dec << " on lane " << k;
+                    // the lane is in error now, its blocks go out again on the others
+                    if (lane.alive)
+                        LOGW << "lane " << k << " (" << hwrdma->ports[lane.port].dev->name << ":"
+                             << hwrdma->ports[lane.port].port_num << ") is down.";
+                    lane.alive = false;
+                    lane.credits = 0;
+                    lane.credit_ticks.clear();
+                    if (notice)
+                        lanes[wc[i].wr_id & ~notice_wr_id].notified = false;
+                    else
                     {
-                        printf("WARNING: caculateTransferInfo failed because thread cancelled.\n");
-                        while(remaining_recv_wqe < remote_qp_info.block_num)
-                        {
-                            int nb = recv(this->peer_fd, &sync_char, 1, MSG_DONTWAIT);
-                            if(nb == 0) return -2;
-                            else if(nb < 0 && (errno == EWOULDBLOCK || errno == EINTR))
-                                continue;
-                            else if(nb < 0)
-                                return -2;
-                            else 
-                            {
-                                remaining_recv_wqe++;
-                                 cout << "sync_char: " << sync_char << endl;
-                            }
-                        }
-                        //pop all from cq when exit this file stream
-                        while(Noutstanding_writes > 0)
-                        {
-                            int num = ibv_poll_cq(cq, 1, wc);
-                            if (wc[i].status != IBV_WC_SUCCESS)
-                            {
-                                fprintf(stderr, "got bad completion with status: 0x%x, vendor syndrome: 0x%x\n",
-                                        wc[i].status, wc[i].vendor_err);
-                            }
-                            Noutstanding_writes--;
-                        }
-                        return 1;
+                        resend.push_back(std::get<0>(inflight[wc[i].wr_id]));
+                        free_buffers.push_back(wc[i].wr_id);
                     }
+                    continue;
+                }
+                if (notice)
+                    continue;
+                //if(j * buff_size < file_info.file_size);
+                    //readahead(fd,(j++) * buff_size, buff_size);
+                latency.record(STAGE_SEND_COMPLETION, CycleClock::now() - post_ticks[wc[i].wr_id]);
+                uint64_t bytes = std::get<1>(inflight[wc[i].wr_id]);
+                Tracer::span(TP_SEND, post_ticks[wc[i].wr_id], std::get<0>(inflight[wc[i].wr_id]), bytes, lane.local_info.qp_num);
+                free_buffers.push_back(wc[i].wr_id);
+                acked_blocks++;
+                ack_bytes += bytes;
+                t1 = t2;
+                t2 = high_resolution_clock::now();
+                auto period = duration_cast<duration<double>>(t2 - t1).count();
+                duration_time += period;
+                int ret = progress->caculateTransferInfo(ack_bytes, period, bytes);
+                if(ret < 0)
+                {
+                    LOGW << "caculateTransferInfo failed because thread cancelled.";
+                    // the receiver drops the file and answers 'F' at once;
+                    // an 'F' of a file that completed meanwhile may already be
+                    // on its way, so the stream is not reused, like tcp
+                    this->reusable = false;
+                    if (sendAll(&RECV_ABORT_CHAR, 1) < 0 || waitCreditsEnd() < 0)
+                        return -2;
+                    // the rest of this batch is polled already
+                    lane.outstanding -= n - i - 1;
+                    //pop all from cq when exit this file stream
+                    drainSends(wc);
+                    return 1;
                 }
             }
-        } while (Noutstanding_writes >= buffers.size() || (bytes_left == 0 && Noutstanding_writes > 0));
-        if(bytes_left == 0) break;
+        }
     }
+    if (remote_finished)
+        drainSends(wc);
+    Tracer::span(TP_SEND_FILE, file_tick, file_info.file_size, block_count);
     t2 = high_resolution_clock::now();
-    cout << endl;
 
     // duration<double> delta_t = duration_cast<duration<double>>(t2 - t1);
     double rate_Gbps = (double)file_info.file_size/ duration_time * 8.0 / 1.0E9;
     double rate_io_Gbps = (double)file_info.file_size / duration_io * 8.0 / 1.0E9;
-    // cout << duration_cast<duration<double>>(t2 - t1).count() <<  "sec" << endl;
 #ifndef DEBUG
     if (file_info.file_size > 2E8)
     {
-        cout << "  Transferred " << (((double)file_info.file_size) * 1.0E-9) << " GB in " << duration_time << " sec  (" << rate_Gbps << " Gbps)" << endl;
-        cout << "  I/O rate reading from file: " << duration_io << " sec  (" << rate_io_Gbps << " Gbps)" << endl;
+        LOGI << "  Transferred " << (((double)file_info.file_size) * 1.0E-9) << " GB in " << duration_time << " sec  (" << rate_Gbps << " Gbps)";
+        LOGI << "  I/O rate reading from file: " << duration_io << " sec  (" << rate_io_Gbps << " Gbps)";
     }
     else
     {
-        cout << "  Transferred " << (((double)file_info.file_size) * 1.0E-6) << " MB in " << duration_time << " sec  (" << rate_Gbps * 1000.0 << " Mbps)" << endl;
-        cout << "  I/O rate reading from file: " << duration_io << " sec  (" << rate_io_Gbps * 1000.0 << " Mbps)" << endl;
+        LOGI << "  Transferred " << (((double)file_info.file_size) * 1.0E-6) << " MB in " << duration_time << " sec  (" << rate_Gbps * 1000.0 << " Mbps)";
+        LOGI << "  I/O rate reading from file: " << duration_io << " sec  (" << rate_io_Gbps * 1000.0 << " Mbps)";
+    }
+    {
+        Logger::Line line(LOG_LEVEL_INFO);
+        latency.report(line.stream(), "  Block latency");
     }
 #endif
 
-    while(remaining_recv_wqe < remote_qp_info.block_num)
+    // the last blocks may still fail to be written
+    int end = remote_finished ? 0 : waitCreditsEnd();
+    if (end < 0)
+        return -2;
+    if (end > 0)
     {
-        int nb = recv(this->peer_fd, &sync_char, 1, MSG_DONTWAIT);
-        if(nb == 0) return -2;
-        else if(nb < 0 && (errno == EWOULDBLOCK || errno == EINTR))
-            continue;
-        else if(nb < 0)
-            return -2;
-        else 
-            remaining_recv_wqe++;
+        LOGE << "remote could not write the file.";
+        return -1;
     }
-    if(upload_thread->checkCancel())
+    if(progress->checkCancel())
         return 1;
-    close(fd);
     return 0;
 }
 
+int StreamControl::pickSendLane() const
+{
+    int best = -1;
+    for (size_t k = 0; k < lanes.size(); k++)
+    {
+        const Lane &lane = lanes[k];
+        if (!lane.alive || lane.credits == 0)
+            continue;
+        // compare (outstanding + 1) / rate without dividing
+        if (best < 0 || (uint64_t)(lane.outstanding + 1) * lanes[best].rate_mbps <
+                            (uint64_t)(lanes[best].outstanding + 1) * lane.rate_mbps)
+            best = k;
+    }
+    return best;
+}
+
+// waits for every posted send, failed ones included
+int StreamControl::drainSends(struct ibv_wc *wc)
+{
+    for (auto &lane : lanes)
+    {
+        while (lane.outstanding > 0)
+        {
+            int n = ibv_poll_cq(lane.cq, 1, wc);
+            if (n < 0)
+                return -1;
+            if (n > 0 && wc[0].status != IBV_WC_SUCCESS)
+            {
+                LOGE << "got bad completion with status: 0x" << std::hex << wc[0].status << ", vendor syndrome: 0x" << wc[0].vendor_err;
+            }
+            lane.outstanding -= n;
+        }
+    }
+    return 0;
+}
+
+int StreamControl::sendCredits(char credit_char, uint32_t num)
+{
+    char credits[256];
+    memset(credits, credit_char, sizeof(credits));
+    while (num > 0)
+    {
+        uint32_t len = num < sizeof(credits) ? num : sizeof(credits);
+        if (sendAll(credits, len) < 0)
+            return -1;
+        num -= len;
+    }
+    return 0;
+}
+
+uint32_t StreamControl::recvWindow() const
+{
+    if (srq_pool != nullptr)
+        return local_conf->getBlockNum();
+    return this->buffers.size();
+}
+
+int StreamControl::grantCredits()
+{
+    uint32_t share = recvWindow();
+    if (credit_account != nullptr && credit_account->share.load(std::memory_order_relaxed) < share)
+        share = credit_account->share.load(std::memory_order_relaxed);
+    // split the share over the live lanes by bandwidth
+    uint64_t total_rate = 0;
+    for (auto &lane : lanes)
+        if (lane.alive)
+            total_rate += lane.rate_mbps;
+    if (total_rate == 0)
+        return 0;
+    for (size_t k = 0; k < lanes.size(); k++)
+    {
+        Lane &lane = lanes[k];
+        if (!lane.alive)
+            continue;
+        uint32_t target = (uint64_t)share * lane.rate_mbps / total_rate;
+        if (target == 0)
+            target = 1;
+        // without an SRQ a lane can only take what is posted on it
+        if (srq_pool == nullptr && target > lane.outstanding)
+            target = lane.outstanding;
+        if (lane.credits >= target)
+            continue;
+        if (sendCredits('A' + k, target - lane.credits) < 0)
+            return -1;
+        Tracer::instant(TP_GRANT, k, target - lane.credits);
+        granted_credits += target - lane.credits;
+        lane.credits = target;
+    }
+    if (credit_account != nullptr)
+        credit_account->outstanding.store(granted_credits, std::memory_order_relaxed);
+    return 0;
+}
+
+int StreamControl::finishCredits()
+{
+    granted_credits = 0;
+    for (auto &lane : lanes)
+        lane.credits = 0;
+    if (credit_account != nullptr)
+    {
+        credit_account->outstanding.store(0, std::memory_order_relaxed);
+        credit_account->receiving.store(false, std::memory_order_relaxed);
+        credit_scheduler->setActive(credit_account, false);
+    }
+    return sendCredits('F', 1);
+}
+
+// 1 when the receiver dropped the file
+int StreamControl::waitCreditsEnd()
+{
+    char sync_char = 0;
+    bool failed = false;
+    while (sync_char != 'F')
+    {
+        int nb = recv(this->peer_fd, &sync_char, 1, 0);
+        if (nb == 0)
+            return -1;
+        if (nb < 0 && errno != EINTR)
+            return -1;
+        if (nb == 1 && sync_char == RECV_FAILED_CHAR)
+            failed = true;
+    }
+    return failed ? 1 : 0;
+}
+
 int StreamControl::postRecvWr(uint64_t id)
 {
     auto &buffer = buffers[id];
     auto buff = std::get<0>(buffer);
     auto buff_size = std::get<1>(buffer);
 
+    // buffers are spread over the lanes, skipping the ones that are down
+    size_t k = id % lanes.size();
+    for (size_t i = 0; i < lanes.size() && !lanes[k].alive; i++)
+        k = (k + 1) % lanes.size();
+    if (!lanes[k].alive)
+        return -1;
+    Lane &lane = lanes[k];
+
     struct ibv_recv_wr wr, *bad_wr;
     struct ibv_sge sge;
     bzero(&wr, sizeof(wr));
     bzero(&sge, sizeof(sge));
-    wr.wr_id = id;
+    wr.wr_id = ((uint64_t)k << 32) | id;
     wr.sg_list = &sge;
     wr.num_sge = 1;
     sge.addr = (uint64_t)buff;
     sge.length = buff_size;
-    sge.lkey = mr->lkey;
-    auto ret = ibv_post_recv(qp, &wr, &bad_wr);
+    sge.lkey = lane.lkey;
+    auto ret = ibv_post_recv(lane.qp, &wr, &bad_wr);
     if (ret != 0)
     {
-        cout << "ERROR: ibv_post_recv returned non zero value (" << ret << ")" << endl;
+        LOGE << "ibv_post_recv returned non zero value (" << ret << ")";
         return -1;
     }
+    lane.outstanding++;
+    Tracer::instant(TP_POST_RECV, id, k, lane.local_info.qp_num);
+    return 0;
+}
+
+int StreamControl::setupReceiver(const std::vector<struct ibv_cq *> *shared_cqs)
+{
+    // a hot spare has its lanes already
+    if (lanes.empty() && createLucpContext(shared_cqs))
+        return -1;
+    // buffers are registered and receives posted inside the handshake
+    if (connectPeer())
+        return -1;
     return 0;
 }
 
-int recvData(HwRdma *hwrdma, int peer_fd,  LocalConf* local_conf, ClientList* client_list)
+void closePeer(ServerContext *server_ctx, int peer_fd)
+{
+    // the accept thread may get the same fd as soon as it is closed, so the
+    // entries keyed by it have to be gone before
+    server_ctx->credit_scheduler->removeConnection(peer_fd);
+    server_ctx->client_list->removeClient(peer_fd);
+    close(peer_fd);
+}
+
+int recvData(HwRdma *hwrdma, int peer_fd,  LocalConf* local_conf, ServerContext* server_ctx, StreamControl *spare)
 {
-    StreamControl stream_control(hwrdma, peer_fd, local_conf,  client_list);
+    // declared first so the peer is released after stream_control is destroyed
     std::shared_ptr<int> x(NULL, [&](int *)
                            {    
-                                printf("auto close\n");
-                                close(peer_fd); 
-                                client_list->removeClient(peer_fd);
+                                LOGI << "auto close";
+                                closePeer(server_ctx, peer_fd);
                             });
-    if (stream_control.createLucpContext())
-        return -1;
-    if (stream_control.connectPeer())
-        return -1;
-    if (stream_control.bindMemoryRegion())
-        return -1;
-    if (stream_control.createBufferPool())
-        return -1;
-    if( stream_control.prepareRecv())
+    // spare: context taken from the SparePool, owned from here on
+    std::unique_ptr<StreamControl> stream_control(spare != nullptr ? spare : new StreamControl(hwrdma, peer_fd, local_conf, server_ctx));
+    if (stream_control->setupReceiver())
+    {
+        if (server_ctx->errors != nullptr)
+            server_ctx->errors->add(SERVER_ERROR_SETUP);
         return -1;
-    while (!stream_control.postRecvFile());
+    }
+    while (!stream_control->postRecvFile());
         return -1;
     return 0;
-}
+}
\ No newline at end of file
@@ -7,69 +7,211 @@ class StreamControl;
 #include <tuple>
 #include <vector>
 #include <list>
+#include <deque>
 #include <errno.h>
 #include <exception>
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <memory>
+#include <chrono>
 
+#include "Transport.h"
 #include "HwRdma.h"
+#include "CreditScheduler.h"
+#include "SharedRecvPool.h"
+#include "LatencyHistogram.h"
+#include "ServerMetrics.h"
+#include "Tracer.h"
+#include "WriteCoalescer.h"
+#include "WriteBehind.h"
+#include "ZeroScan.h"
+#include "StorageTargets.h"
 #include "../utils/LocalConf.h"
 #include "../interface/UploadProgressDialog.h"
 #include "../utils/ClientInfo.h"
 
-struct QPInfo
-{
-    uint16_t lid;
-    // uint16_t lucp_id;
-    uint32_t qp_num;
-    uint32_t block_num;
-    uint32_t block_size;
-    uint8_t gid[16];
-} __attribute__((packed));
+// SEND_WITH_IMM carries the block sequence number, values from LANE_DOWN_IMM
+// up tell the receiver that lane (imm - LANE_DOWN_IMM) is down
+static const uint32_t LANE_DOWN_IMM = 0xFFFFFFF0;
+// so a file has fewer blocks than that, larger files are refused by both ends
+static const uint64_t MAX_FILE_BLOCKS = LANE_DOWN_IMM;
+// connectPeer() on the client: the server picked the tcp transport, the
+// socket continues as a TcpTransport
+static const int CONNECT_USE_TCP = 1;
+// a file without any block for this long is given up, a sender that is gone
+// closes the control connection long before and a cancelled one sends
+// RECV_ABORT_CHAR
+static const double RECV_IDLE_TIMEOUT_SEC = 10.0;
+// sender -> receiver while a file is in progress: drop the file, the receiver
+// answers 'F' like at the end of a file
+static const char RECV_ABORT_CHAR = 'C';
+// receiver -> sender right before that 'F': the file could not be written and
+// was dropped; outside of the 'A' + lane credit range for any lane count
+static const char RECV_FAILED_CHAR = '!';
 
-struct FileInfo
+// server wide objects shared by all connections
+struct ServerContext
 {
-    char file_path[256];
-    uint64_t file_size;
-} __attribute__((packed));
+    ClientList *client_list = nullptr;
+    CreditScheduler *credit_scheduler = nullptr;
+    SharedRecvPool *srq_pool = nullptr; // only with UseSrq
+    ServerErrors *errors = nullptr;
+    StorageTargets *storage = nullptr; // only with StorageTargets
+    SharedConf *conf = nullptr; // per file settings, re-read when the file changes
+};
 
+// stages of the resumable receive path on the server
+enum RecvStage
+{
+    RECV_STAGE_IDLE,      // between files, startRecvFile() begins the next one
+    RECV_STAGE_FILE_INFO, // waiting for the sender's FileInfo
+    RECV_STAGE_SYNC,      // waiting for the sender's sync char
+    RECV_STAGE_RECEIVING  // consuming block completions
+};
 
-class StreamControl
+class StreamControl : public Transport
 {
 private:
     uint8_t *buf_ptr = nullptr;
     struct ibv_mr *mr = nullptr;
     double default_rate;
-    uint64_t block_size;
+    uint64_t block_size = 0;
     HwRdma *hwrdma;
     std::vector<std::tuple<uint8_t *, uint64_t>> buffers;
 
-    struct ibv_comp_channel *comp_channel = nullptr;
-    struct ibv_cq *cq = nullptr;
-    struct ibv_qp *qp = nullptr;
-    QPInfo local_qp_info, remote_qp_info;
+    // one QP per RDMA port, blocks are striped over the live lanes by bandwidth
+    struct Lane
+    {
+        size_t port = 0; // index in hwrdma->ports
+        struct ibv_cq *cq = nullptr;
+        bool own_cq = true;
+        struct ibv_qp *qp = nullptr;
+        QPInfo local_info, remote_info;
+        uint32_t rate_mbps = 0; // slower end of the lane
+        uint32_t lkey = 0;      // of mr registered on this lane's device
+        bool alive = true;
+        bool inited = false;      // QP is in INIT, receives may be posted
+        bool notified = false;    // sender: the receiver was told the lane is down
+        uint32_t credits = 0;     // sender: usable credits, receiver: granted credits
+        uint32_t outstanding = 0; // sender: posted sends, receiver: posted receives
+        std::deque<uint64_t> credit_ticks; // sender: post time of blocks whose credit is still out
+    };
+    std::vector<Lane> lanes;
+    bool recv_posted = false;
     ClientList *client_list = nullptr;
     LocalConf *local_conf = nullptr;
+    SharedRecvPool *srq_pool = nullptr;
+    // receive credits announced to the sender for the current file
+    CreditScheduler *credit_scheduler = nullptr;
+    std::shared_ptr<CreditScheduler::Account> credit_account;
+    uint32_t granted_credits = 0;
+    ServerErrors *errors = nullptr;
+    // live state of the connection for the /clients page
+    std::shared_ptr<ClientState> client_state;
+    void countError(ServerError error) { if (errors != nullptr) errors->add(error); }
+    // per block stage latencies of the current file
+    StageLatency latency;
+    // adjacent received blocks written with one pwritev()
+    WriteCoalescer coalescer;
+    std::vector<WriteCoalescer::Block> flushed_blocks;
+    // bounded dirty page cache of the file being received (DirtyLimit)
+    WriteBehind write_behind;
+    // all-zero blocks become holes (SparseWrites)
+    bool sparse_writes = false;
+    // target directory of the file being received, -1 without StorageTargets
+    StorageTargets *storage = nullptr;
+    int recv_target = -1;
+    // config snapshot taken when the file header arrived
+    SharedConf *shared_conf = nullptr;
+    std::shared_ptr<const LocalConf> recv_conf;
+    const LocalConf &recvConf() const { return recv_conf ? *recv_conf : *local_conf; }
+
+    int sendCredits(char credit_char, uint32_t num);
+    int grantCredits();
+    int finishCredits();
+    int releaseRecvBuffer(uint64_t id);
+    int flushWrites();
+    int waitCreditsEnd();
+    uint32_t recvWindow() const;
+    std::vector<size_t> lanePorts() const;
+    int initLane(Lane &lane);
+    void setLaneKeys();
+    int changeLaneState(Lane &lane);
+    int sendHello();
+    static void encodeQPInfo(const QPInfo &info, QPInfo &net_info);
+    static void decodeQPInfo(const QPInfo &net_info, QPInfo &info);
+    void destroyLane(Lane &lane);
+    size_t laneOf(const struct ibv_wc &wc) const;
+    int laneDown(size_t lane);
+    int pickSendLane() const;
+    int drainSends(struct ibv_wc *wc);
+    int sendFile(const char *file_path, const char *file_name, TransferProgress *progress);
+    bool reusable = true;
+
+    // resumable receive state, driven by postRecvFile() or a Reactor
+    RecvStage recv_stage = RECV_STAGE_IDLE;
+    FileInfo recv_file_info;
+    char recv_sync_char = 0;
+    char remote_sync_char = 0;
+    size_t recv_msg_got = 0;
+    int recv_fd = -1;
+    std::string recv_path;
+    uint64_t recv_bytes = 0;
+    // blocks may arrive out of order and twice after a failover
+    std::vector<bool> recv_blocks;
+    uint64_t recv_blocks_got = 0;
+    std::chrono::high_resolution_clock::time_point recv_start, recv_last;
+    uint64_t recv_start_tick = 0;
+
+    int openRecvFile();
+    int beginRecvFile();
+    int finishRecvFile();
+    // drops the file in progress; failed tells the sender it was not stored
+    int abortRecvFile(bool failed = false);
+    void closeRecvFile();
 public:
-    int peer_fd;
-    StreamControl(HwRdma *hwrdma, int peer_fd, LocalConf *local_conf, ClientList *client_list = nullptr);
+    StreamControl(HwRdma *hwrdma, int peer_fd, LocalConf *local_conf, ServerContext *server_ctx = nullptr);
 
     ~StreamControl();
+    // hand a context built ahead of time (peer_fd -1) to an accepted connection
+    void attachPeer(int peer_fd);
+    // steps of connectPeer() that need no peer: QPs to INIT, buffers, receives
+    int prepareLocal();
     int bindMemoryRegion();
     int createBufferPool();
-    int createLucpContext();
+    // shared_cqs: per port cq owned by the caller, indexed like hwrdma->ports
+    int createLucpContext(const std::vector<struct ibv_cq *> *shared_cqs = nullptr);
 
-    int sockSyncData(int xfer_size, char *local_data, char *remote_data);
     int changeQPState();
     int connectPeer();
     int prepareRecv();
-    int postRecvFile();
-    int postSendFile(const char *file_path, const char *file_name, UploadThread*  upload_thread);
+    int setupReceiver(const std::vector<struct ibv_cq *> *shared_cqs = nullptr);
+    int postRecvFile() override;
+    int startRecvFile();
+    int onRecvReadable();
+    int onRecvCompletion(const struct ibv_wc &wc);
+    int onRecvIdle();
+    // polls the lanes' own cqs, returns the number of completions or < 0
+    int pollRecvCompletions(int batch);
+    RecvStage getRecvStage() const { return recv_stage; }
+    size_t getLaneNum() const { return lanes.size(); }
+    uint32_t getLaneQpNum(size_t lane) const { return lanes[lane].local_info.qp_num; }
+    size_t getLanePort(size_t lane) const { return lanes[lane].port; }
+    HwRdma *getHwRdma() const { return hwrdma; }
+    const char *getName() const override { return "rdma"; }
+    int pinIoThread(pthread_t thr) const override { return hwrdma->placement.pinIoThread(thr); }
+    // block size for buffers registered before connectPeer() learns it
+    void setBlockSize(uint64_t size) { block_size = size; }
+    uint64_t getBlockSize() const { return block_size; }
+    // stage latencies of the file in progress or the last one, safe to read from another thread
+    const StageLatency &getLatency() const { return latency; }
+    bool isReusable() const override { return reusable; }
+    int postSendFile(const char *file_path, const char *file_name, TransferProgress *progress) override;
     int postRecvWr(uint64_t id);        
 };
 
-int recvData(HwRdma *hwrdma, int peer_fd,  LocalConf* local_conf, ClientList* client_list);
+int recvData(HwRdma *hwrdma, int peer_fd,  LocalConf* local_conf, ServerContext* server_ctx, StreamControl *spare = nullptr);
+void closePeer(ServerContext *server_ctx, int peer_fd);
 
 #endif
\ No newline at end of file
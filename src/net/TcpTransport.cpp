@@ -0,0 +1,357 @@
+#include <iostream>
+#include <chrono>
+#include <memory>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <wx/filename.h>
+#include "TcpTransport.h"
+#include "StreamControl.h"
+#include "../utils/Logger.h"
+using std::chrono::high_resolution_clock;
+using std::chrono::duration;
+using std::chrono::duration_cast;
+
+TcpTransport::TcpTransport(int peer_fd, LocalConf *local_conf)
+{
+    this->peer_fd = peer_fd;
+    this->local_conf = local_conf;
+    this->chunk_size = 1024UL * local_conf->getBlockSize();
+    tuneSocket();
+}
+
+void TcpTransport::setServerContext(ServerContext *server_ctx)
+{
+    if (server_ctx->credit_scheduler != nullptr)
+        this->account = server_ctx->credit_scheduler->getAccount(this->peer_fd);
+    if (server_ctx->client_list != nullptr)
+        this->client_state = server_ctx->client_list->getState(this->peer_fd);
+    this->errors = server_ctx->errors;
+    this->storage = server_ctx->storage;
+    this->shared_conf = server_ctx->conf;
+}
+
+TcpTransport::~TcpTransport()
+{
+    if (pipe_fds[0] >= 0)
+        close(pipe_fds[0]);
+    if (pipe_fds[1] >= 0)
+        close(pipe_fds[1]);
+}
+
+void TcpTransport::tuneSocket()
+{
+    // the handshake messages are small, do not let Nagle hold them back
+    int one = 1;
+    setsockopt(this->peer_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+int TcpTransport::connectPeer()
+{
+    HelloMsg hello, remote_hello;
+    bzero(&hello, sizeof(hello));
+    hello.magic = htonl(HELLO_MAGIC);
+    hello.version = htons(HELLO_VERSION);
+    hello.transports = htons(TRANSPORT_TCP);
+    if (sendAll((char *)&hello, sizeof(hello)) < 0 || recvAll((char *)&remote_hello, sizeof(remote_hello)) < 0)
+    {
+        LOGE << "connect failed when sync hello.";
+        return -2;
+    }
+    if (ntohl(remote_hello.magic) != HELLO_MAGIC || ntohs(remote_hello.version) != HELLO_VERSION ||
+        ntohs(remote_hello.transports) != TRANSPORT_TCP)
+    {
+        LOGE << "remote does not accept the tcp transport.";
+        return -1;
+    }
+    LOGI << "Connected over the tcp transport.";
+    return 0;
+}
+
+int TcpTransport::acceptPeer()
+{
+    HelloMsg hello;
+    if (recvAll((char *)&hello, sizeof(hello)) < 0)
+        return -2;
+    if (ntohl(hello.magic) != HELLO_MAGIC || ntohs(hello.version) != HELLO_VERSION ||
+        !(ntohs(hello.transports) & TRANSPORT_TCP))
+    {
+        LOGE << "client does not offer the tcp transport.";
+        return -1;
+    }
+    // an rdma client that reaches this point has no usable port on the server's side
+    bzero(&hello, sizeof(hello));
+    hello.magic = htonl(HELLO_MAGIC);
+    hello.version = htons(HELLO_VERSION);
+    hello.transports = htons(TRANSPORT_TCP);
+    if (sendAll((char *)&hello, sizeof(hello)) < 0)
+        return -2;
+    LOGI << "Client connected over the tcp transport.";
+    return 0;
+}
+
+int TcpTransport::postSendFile(const char *file_path, const char *file_name, TransferProgress *progress)
+{
+    int ret = sendFile(file_path, file_name, progress);
+    // a failed transfer leaves the stream in an unknown state
+    if (ret < 0)
+        this->reusable = false;
+    return ret;
+}
+
+int TcpTransport::sendFile(const char *file_path, const char *file_name, TransferProgress *progress)
+{
+    struct stat statbuf;
+    if (stat(file_path, &statbuf) != 0)
+    {
+        LOGE << "file not exist.";
+        return -1;
+    }
+    FileInfo file_info, remote_file_info;
+    bzero(&file_info, sizeof(file_info));
+    strncpy(file_info.file_path, file_name, sizeof(file_info.file_path) - 1);
+    file_info.file_size = statbuf.st_size;
+    if (sockSyncData(sizeof(file_info), (char *)&file_info, (char *)&remote_file_info) != 0)
+    {
+        LOGE << "synchronous failed before post file.";
+        return -2;
+    }
+    if (strcmp(remote_file_info.file_path, "READY_TO_RECEIVE") != 0)
+    {
+        LOGE << "remote not ready to receive.";
+        return -1;
+    }
+    int fd = open(file_path, O_RDONLY);
+    char sync_char = fd < 0 ? 'N' : 'Y';
+    if (fd < 0)
+        LOGE << "Unable to open file \"" << file_path << "\"!";
+    std::shared_ptr<int> x(NULL, [&](int *)
+                           { if (fd >= 0) close(fd); });
+    if (sockSyncData(1, &sync_char, &sync_char) < 0)
+        return -2;
+    if (fd < 0 || sync_char != 'Y')
+    {
+        LOGE << "remote unable to receive file.";
+        return -1;
+    }
+    LOGI << "Sending file over tcp: " << file_path << "(" << (double)file_info.file_size * 1.0E-9 << " GB)";
+    // the kernel sends straight from the page cache
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    off_t offset = 0;
+    auto start = high_resolution_clock::now();
+    auto t1 = start, t2 = start;
+    while ((uint64_t)offset < file_info.file_size)
+    {
+        size_t len = std::min<uint64_t>(chunk_size, file_info.file_size - offset);
+        ssize_t n = sendfile(this->peer_fd, fd, &offset, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            LOGE << "sendfile failed, errno: " << errno;
+            return -2;
+        }
+        t1 = t2;
+        t2 = high_resolution_clock::now();
+        if (progress->caculateTransferInfo(offset, duration_cast<duration<double>>(t2 - t1).count(), n) < 0)
+        {
+            // the receiver expects the rest of the file, the stream cannot be reused
+            LOGW << "transfer cancelled, closing the tcp stream.";
+            shutdown(this->peer_fd, SHUT_RDWR);
+            this->reusable = false;
+            return 1;
+        }
+    }
+    char finish_char = 0;
+    if (recvAll(&finish_char, 1) < 0 || finish_char != 'F')
+    {
+        LOGE << "no finish notice from the receiver.";
+        return -2;
+    }
+    double delta = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+    if (delta > 0)
+        LOGI << "  Transferred " << (double)file_info.file_size * 1.0E-6 << " MB in " << delta << " sec  ("
+             << (double)file_info.file_size * 8.0 / delta / 1.0E9 << " Gbps)";
+    if (progress->checkCancel())
+        return 1;
+    return 0;
+}
+
+int TcpTransport::spliceToFile(int fd, uint64_t file_size, uint64_t dirty_limit)
+{
+    if (pipe_fds[0] < 0)
+    {
+        if (pipe(pipe_fds) < 0)
+        {
+            LOGE << "Unable to create pipe, errno: " << errno;
+            return -1;
+        }
+        // one chunk per splice() pair, the default pipe holds only 64KB
+        fcntl(pipe_fds[1], F_SETPIPE_SZ, (int)chunk_size);
+    }
+    uint64_t left = file_size;
+    write_behind.start(fd, dirty_limit);
+    while (left > 0)
+    {
+        ssize_t n = splice(this->peer_fd, NULL, pipe_fds[1], NULL, std::min<uint64_t>(left, chunk_size), SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            LOGE << "Failed reading file data, errno: " << errno;
+            return -2;
+        }
+        left -= n;
+        if (account != nullptr)
+        {
+            account->blocks.fetch_add(1, std::memory_order_relaxed);
+            account->meter.add(n);
+        }
+        uint64_t tick = CycleClock::now();
+        uint64_t chunk = n;
+        while (n > 0)
+        {
+            ssize_t written = splice(pipe_fds[0], NULL, fd, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+            {
+                LOGE << "Failed writing file data, errno: " << errno;
+                if (errors != nullptr)
+                    errors->add(SERVER_ERROR_FILE_WRITE);
+                return -1;
+            }
+            n -= written;
+            write_behind.written(file_size - left - n - written, written);
+            if (account != nullptr)
+            {
+                account->bytes.fetch_add(written, std::memory_order_relaxed);
+                account->writes.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        if (client_state != nullptr)
+            client_state->fileBytes.store(file_size - left, std::memory_order_relaxed);
+        uint64_t ticks = CycleClock::now() - tick;
+        latency.record(STAGE_RECV_WRITE, ticks);
+        if (recv_target >= 0)
+            storage->written(recv_target, chunk, CycleClock::toNs(ticks));
+    }
+    write_behind.finish();
+    return 0;
+}
+
+int TcpTransport::postRecvFile()
+{
+    FileInfo file_info, remote_file_info;
+    bzero(&file_info, sizeof(file_info));
+    strcpy(file_info.file_path, "READY_TO_RECEIVE");
+    if (client_state != nullptr)
+        client_state->setStatus(CLIENT_STATUS_IDLE);
+    if (sendAll((char *)&file_info, sizeof(file_info)) < 0 ||
+        recvAll((char *)&remote_file_info, sizeof(remote_file_info)) < 0)
+    {
+        LOGE << "synchronous failed before receiving file.";
+        return -2;
+    }
+    remote_file_info.file_path[sizeof(remote_file_info.file_path) - 1] = '\0';
+    LOGI << "sync receiving file: " << remote_file_info.file_path << "(" << (double)remote_file_info.file_size / 1e9 << "GB)";
+    if (client_state != nullptr)
+        client_state->setFile(remote_file_info.file_path, remote_file_info.file_size);
+
+    if (shared_conf != nullptr)
+        recv_conf = shared_conf->reload();
+    const LocalConf &conf = recv_conf ? *recv_conf : *local_conf;
+    std::string folder = conf.getSavedFolderPath().ToStdString();
+    if (storage != nullptr && !storage->empty())
+    {
+        recv_target = storage->pick(remote_file_info.file_size);
+        if (recv_target >= 0)
+            folder = storage->get(recv_target).path;
+    }
+    std::shared_ptr<int> release(NULL, [&](int *)
+                                 { if (recv_target >= 0) storage->release(recv_target); recv_target = -1; });
+    std::string save_path = folder + char(wxFileName::GetPathSeparator()) + remote_file_info.file_path;
+    int fd = -1;
+    char sync_char = 'Y', remote_sync_char = 0;
+    if (storage != nullptr && !storage->empty() && recv_target < 0)
+    {
+        LOGE << "No storage target has room for " << remote_file_info.file_size << " bytes of \"" << remote_file_info.file_path << "\"";
+        if (errors != nullptr)
+            errors->add(SERVER_ERROR_NO_SPACE);
+        sync_char = 'N';
+    }
+    else if ((fd = open(save_path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0777)) < 0)
+    {
+        LOGE << "Unable to create file \"" << save_path << "\"!" << "errno = " << errno;
+        if (errors != nullptr)
+            errors->add(SERVER_ERROR_FILE_OPEN);
+        sync_char = 'N';
+    }
+    else if (WriteBehind::preallocate(fd, remote_file_info.file_size) < 0)
+    {
+        LOGE << "Unable to preallocate " << remote_file_info.file_size << " bytes for \"" << save_path << "\", errno = " << errno;
+        if (errors != nullptr)
+            errors->add(SERVER_ERROR_NO_SPACE);
+        close(fd);
+        fd = -1;
+        unlink(save_path.c_str());
+        sync_char = 'N';
+    }
+    std::shared_ptr<int> x(NULL, [&](int *)
+                           { if (fd >= 0) close(fd); });
+    if (sockSyncData(1, &sync_char, &remote_sync_char) < 0)
+        return -2;
+    if (sync_char != 'Y')
+        return 0;
+    if (remote_sync_char != 'Y')
+    {
+        LOGW << "remote not ready to send.";
+        return 0;
+    }
+    auto start = high_resolution_clock::now();
+    if (account != nullptr)
+        account->receiving.store(true, std::memory_order_relaxed);
+    if (client_state != nullptr)
+        client_state->setStatus(CLIENT_STATUS_RECEIVING);
+    int ret = spliceToFile(fd, remote_file_info.file_size, (uint64_t)conf.getDirtyLimit() << 20);
+    if (account != nullptr)
+        account->receiving.store(false, std::memory_order_relaxed);
+    if (client_state != nullptr)
+        client_state->setStatus(CLIENT_STATUS_IDLE);
+    if (ret < 0)
+        return ret;
+    if (client_state != nullptr)
+        client_state->filesDone.fetch_add(1, std::memory_order_relaxed);
+    char finish_char = 'F';
+    if (sendAll(&finish_char, 1) < 0)
+        return -2;
+    double delta = duration_cast<duration<double>>(high_resolution_clock::now() - start).count();
+    if (delta > 0)
+        LOGI << "recv rate: " << remote_file_info.file_size * 8 / (delta * 1e9) << "Gbps";
+    LOGI << "finish receive file:" << remote_file_info.file_path << "(" << (double)remote_file_info.file_size / 1e9 << "GB)";
+    return 0;
+}
+
+int recvTcpData(int peer_fd, LocalConf *local_conf, ServerContext *server_ctx)
+{
+    // declared first so the peer is released after the transport is destroyed
+    std::shared_ptr<int> x(NULL, [&](int *)
+                           {
+                                LOGI << "auto close";
+                                closePeer(server_ctx, peer_fd);
+                            });
+    TcpTransport transport(peer_fd, local_conf);
+    transport.setServerContext(server_ctx);
+    if (transport.acceptPeer())
+    {
+        if (server_ctx->errors != nullptr)
+            server_ctx->errors->add(SERVER_ERROR_SETUP);
+        return -1;
+    }
+    while (!transport.postRecvFile());
+    return -1;
+}
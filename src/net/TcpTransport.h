@@ -0,0 +1,65 @@
+#ifndef TCP_TRANSPORT_H
+#define TCP_TRANSPORT_H
+
+#include <memory>
+#include "Transport.h"
+#include "CreditScheduler.h"
+#include "ServerMetrics.h"
+#include "LatencyHistogram.h"
+#include "WriteBehind.h"
+#include "StorageTargets.h"
+#include "../utils/LocalConf.h"
+#include "../utils/ClientInfo.h"
+
+struct ServerContext;
+
+// Transport over the control socket itself, for hosts without a usable RDMA
+// port on either end.
+// The file handshake is the one of the RDMA transport, then the sender pushes
+// the file with sendfile() and the receiver splice()s socket -> pipe -> file,
+// so the payload never passes through user space. The receiver answers 'F'
+// once the whole file is written.
+class TcpTransport : public Transport
+{
+public:
+    TcpTransport(int peer_fd, LocalConf *local_conf);
+    ~TcpTransport();
+    // client: offer only tcp, -1 when the server refuses, -2 network error
+    int connectPeer();
+    // server: consume the client's hello and answer with the tcp choice
+    int acceptPeer();
+    // server: account the received bytes and errors of this connection
+    void setServerContext(ServerContext *server_ctx);
+
+    const char *getName() const override { return "tcp"; }
+    int postSendFile(const char *file_path, const char *file_name, TransferProgress *progress) override;
+    int postRecvFile() override;
+    bool isReusable() const override { return reusable; }
+
+private:
+    LocalConf *local_conf;
+    bool reusable = true;
+    int pipe_fds[2] = {-1, -1};
+    // bytes per sendfile()/splice() call, progress is reported per chunk
+    size_t chunk_size;
+    std::shared_ptr<CreditScheduler::Account> account;
+    ServerErrors *errors = nullptr;
+    std::shared_ptr<ClientState> client_state;
+    // receiver: pipe -> file time of every chunk as STAGE_RECV_WRITE
+    StageLatency latency;
+    WriteBehind write_behind;
+    // target directory of the file being received, -1 without StorageTargets
+    StorageTargets *storage = nullptr;
+    int recv_target = -1;
+    // config snapshot taken when the file header arrived
+    SharedConf *shared_conf = nullptr;
+    std::shared_ptr<const LocalConf> recv_conf;
+
+    void tuneSocket();
+    int sendFile(const char *file_path, const char *file_name, TransferProgress *progress);
+    int spliceToFile(int fd, uint64_t file_size, uint64_t dirty_limit);
+};
+
+int recvTcpData(int peer_fd, LocalConf *local_conf, ServerContext *server_ctx);
+
+#endif
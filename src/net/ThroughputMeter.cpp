@@ -0,0 +1,72 @@
+#include <math.h>
+#include <algorithm>
+#include "ThroughputMeter.h"
+
+ThroughputMeter::ThroughputMeter(Mode mode, double window_sec)
+    : mode(mode)
+{
+    slot_ns = std::max<uint64_t>(1, (uint64_t)(window_sec * 1e9 / SLOT_NUM));
+    slot_decay = exp(-4.0 / SLOT_NUM);
+    for (auto &slot : slots)
+        slot.store(0, std::memory_order_relaxed);
+}
+
+void ThroughputMeter::add(uint64_t bytes, uint64_t now_ns)
+{
+    uint64_t zero = 0;
+    if (start_ns.load(std::memory_order_relaxed) == 0)
+        start_ns.compare_exchange_strong(zero, now_ns, std::memory_order_relaxed);
+    uint64_t index = now_ns / slot_ns;
+    uint64_t epoch = index & (UINT64_MAX >> EPOCH_SHIFT);
+    std::atomic<uint64_t> &slot = slots[index % SLOT_NUM];
+    uint64_t old = slot.load(std::memory_order_relaxed), now;
+    do
+    {
+        // a slot of an older epoch starts over
+        if ((old >> EPOCH_SHIFT) == epoch)
+            now = old + std::min(bytes, BYTES_MASK - (old & BYTES_MASK));
+        else
+            now = (epoch << EPOCH_SHIFT) | std::min(bytes, BYTES_MASK);
+    } while (!slot.compare_exchange_weak(old, now, std::memory_order_relaxed));
+}
+
+double ThroughputMeter::rate(uint64_t now_ns) const
+{
+    uint64_t start = start_ns.load(std::memory_order_relaxed);
+    if (start == 0 || now_ns <= start)
+        return 0;
+    uint64_t index = now_ns / slot_ns;
+    double bytes = 0, ns = 0, weight = 1;
+    for (uint64_t k = 0; k < SLOT_NUM && k <= index; k++)
+    {
+        uint64_t i = index - k;
+        if ((i + 1) * slot_ns <= start)
+            break;
+        // the current slot only counts up to now, the first one from start
+        uint64_t begin = std::max(i * slot_ns, start);
+        uint64_t end = k == 0 ? now_ns : (i + 1) * slot_ns;
+        if (end > begin)
+        {
+            uint64_t v = slots[i % SLOT_NUM].load(std::memory_order_relaxed);
+            if ((v >> EPOCH_SHIFT) == (i & (UINT64_MAX >> EPOCH_SHIFT)))
+                bytes += weight * (v & BYTES_MASK);
+            ns += weight * (end - begin);
+        }
+        if (mode == THROUGHPUT_EWMA)
+            weight *= slot_decay;
+    }
+    return ns > 0 ? bytes * 1e9 / ns : 0;
+}
+
+double ThroughputMeter::eta(uint64_t remaining) const
+{
+    double r = rate();
+    return r > 0 ? remaining / r : -1;
+}
+
+void ThroughputMeter::reset()
+{
+    for (auto &slot : slots)
+        slot.store(0, std::memory_order_relaxed);
+    start_ns.store(0, std::memory_order_relaxed);
+}
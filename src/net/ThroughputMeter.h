@@ -0,0 +1,49 @@
+#ifndef THROUGHPUT_METER_H
+#define THROUGHPUT_METER_H
+
+#include <stdint.h>
+#include <atomic>
+#include "LatencyHistogram.h"
+
+// Recent throughput of a byte stream, fed per completed block.
+// The window is split into SLOT_NUM time slots; a slot holds its epoch and the
+// bytes added during it in one word, so add() is a single CAS loop, memory is
+// constant and any number of threads may add and read at once.
+// WINDOW mode averages the whole window, EWMA mode weights every slot by
+// exp(-age / tau) with tau = window / 4, so it follows changes faster and
+// still smooths single blocks. Without adds for a window the rate drops to 0.
+class ThroughputMeter
+{
+public:
+    enum Mode
+    {
+        THROUGHPUT_WINDOW,
+        THROUGHPUT_EWMA
+    };
+    static const int SLOT_NUM = 32;
+
+    explicit ThroughputMeter(Mode mode = THROUGHPUT_WINDOW, double window_sec = 2.0);
+
+    void add(uint64_t bytes) { add(bytes, nowNs()); }
+    void add(uint64_t bytes, uint64_t now_ns);
+    // bytes per second
+    double rate() const { return rate(nowNs()); }
+    double rate(uint64_t now_ns) const;
+    // seconds to move remaining bytes at the current rate, < 0 while unknown
+    double eta(uint64_t remaining) const;
+    void reset();
+
+    static inline uint64_t nowNs() { return CycleClock::toNs(CycleClock::now()); }
+
+private:
+    static constexpr int EPOCH_SHIFT = 44;
+    static constexpr uint64_t BYTES_MASK = (1ULL << EPOCH_SHIFT) - 1;
+
+    Mode mode;
+    uint64_t slot_ns;
+    double slot_decay; // weight ratio of neighbouring slots in EWMA mode
+    std::atomic<uint64_t> start_ns{0};
+    std::atomic<uint64_t> slots[SLOT_NUM];
+};
+
+#endif
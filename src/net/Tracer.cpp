@@ -0,0 +1,199 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <set>
+#include <vector>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "Tracer.h"
+#include "../utils/Logger.h"
+
+std::atomic<bool> Tracer::enabled(false);
+
+namespace
+{
+struct TraceEvent
+{
+    uint64_t start, end;
+    const TracePoint *tp;
+    uint64_t a0, a1;
+    uint32_t qp;
+    char ph;
+};
+
+struct TraceRing
+{
+    int tid;
+    char name[16];
+    // written by the owner thread only, head is published after the event
+    std::atomic<uint64_t> head{0};
+    std::atomic<bool> dead{false};
+    uint64_t flushed = 0; // flush_mutex
+    TraceEvent events[Tracer::RING_SIZE];
+};
+
+std::mutex flush_mutex;
+std::vector<TraceRing *> rings; // flush_mutex
+std::string trace_dir;
+uint64_t base_tick = 0;
+int flush_seq = 0;
+
+// lets flush() free the ring of a thread that exited
+struct RingHolder
+{
+    TraceRing *ring = nullptr;
+    ~RingHolder()
+    {
+        if (ring != nullptr)
+            ring->dead.store(true, std::memory_order_release);
+    }
+};
+thread_local RingHolder holder;
+
+TraceRing *threadRing()
+{
+    if (holder.ring != nullptr)
+        return holder.ring;
+    TraceRing *ring = new TraceRing;
+    ring->tid = syscall(SYS_gettid);
+    if (pthread_getname_np(pthread_self(), ring->name, sizeof(ring->name)) != 0)
+        ring->name[0] = '\0';
+    std::lock_guard<std::mutex> lock(flush_mutex);
+    rings.push_back(ring);
+    holder.ring = ring;
+    return ring;
+}
+
+// qp tracks use tids no thread has
+const uint64_t QP_TRACK = 1ULL << 31;
+}
+
+void Tracer::enable(const std::string &dir)
+{
+    std::lock_guard<std::mutex> lock(flush_mutex);
+    if (enabled.load())
+        return;
+    trace_dir = dir;
+    base_tick = CycleClock::now();
+    enabled.store(true);
+    LOGI << "Tracing the transfer pipeline to " << dir;
+}
+
+void Tracer::record(const TracePoint &tp, char ph, uint64_t start, uint64_t end, uint64_t a0, uint64_t a1, uint32_t qp)
+{
+    TraceRing *ring = threadRing();
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    TraceEvent &ev = ring->events[head % RING_SIZE];
+    ev.start = start;
+    ev.end = end;
+    ev.tp = &tp;
+    ev.a0 = a0;
+    ev.a1 = a1;
+    ev.qp = qp;
+    ev.ph = ph;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+static void writeEvent(std::ostream &os, const TraceEvent &ev, uint64_t tid, bool &first)
+{
+    double ns_per_tick = CycleClock::nsPerTick();
+    uint64_t start = ev.start > base_tick ? ev.start - base_tick : 0;
+    os << (first ? "" : ",\n") << "{\"name\":\"" << ev.tp->name << "\",\"ph\":\"" << ev.ph
+       << "\",\"ts\":" << start * ns_per_tick / 1e3;
+    if (ev.ph == 'X')
+        os << ",\"dur\":" << (ev.end - ev.start) * ns_per_tick / 1e3;
+    else
+        os << ",\"s\":\"t\"";
+    os << ",\"pid\":" << getpid() << ",\"tid\":" << tid << ",\"args\":{";
+    if (ev.tp->arg0 != nullptr)
+        os << "\"" << ev.tp->arg0 << "\":" << ev.a0;
+    if (ev.tp->arg1 != nullptr)
+        os << (ev.tp->arg0 != nullptr ? "," : "") << "\"" << ev.tp->arg1 << "\":" << ev.a1;
+    os << "}}";
+    first = false;
+}
+
+void Tracer::flush()
+{
+    if (!on())
+        return;
+    std::lock_guard<std::mutex> lock(flush_mutex);
+    // take the new events of every ring first, nothing is written when there are none
+    struct Pending
+    {
+        int tid;
+        std::string name;
+        std::vector<TraceEvent> events;
+    };
+    std::vector<Pending> pending;
+    uint64_t events = 0, lost = 0;
+    for (auto it = rings.begin(); it != rings.end();)
+    {
+        TraceRing *ring = *it;
+        bool dead = ring->dead.load(std::memory_order_acquire);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t from = ring->flushed;
+        if (head - from > RING_SIZE)
+        {
+            lost += head - from - RING_SIZE;
+            from = head - RING_SIZE;
+        }
+        Pending p;
+        p.tid = ring->tid;
+        p.name = ring->name[0] ? ring->name : "thread";
+        for (uint64_t i = from; i < head; i++)
+            p.events.push_back(ring->events[i % RING_SIZE]);
+        // the owner kept going while we copied, drop what it may have overwritten
+        uint64_t now_head = ring->head.load(std::memory_order_acquire);
+        if (now_head > RING_SIZE && now_head - RING_SIZE > from)
+        {
+            size_t skip = std::min<uint64_t>(now_head - RING_SIZE - from, p.events.size());
+            p.events.erase(p.events.begin(), p.events.begin() + skip);
+            lost += skip;
+        }
+        ring->flushed = head;
+        events += p.events.size();
+        if (!p.events.empty())
+            pending.push_back(std::move(p));
+        if (dead)
+        {
+            delete ring;
+            it = rings.erase(it);
+        }
+        else
+            ++it;
+    }
+    if (events == 0)
+        return;
+
+    std::string path = trace_dir + "/fileupload-" + std::to_string(getpid()) + "-" + std::to_string(flush_seq++) + ".json";
+    std::ofstream out(path);
+    if (!out)
+    {
+        LOGE << "Unable to write trace \"" << path << "\"";
+        return;
+    }
+    out << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    bool first = true;
+    std::set<uint32_t> qps;
+    for (auto &p : pending)
+    {
+        out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << getpid() << ",\"tid\":" << p.tid
+            << ",\"args\":{\"name\":\"" << p.name << " " << p.tid << "\"}}";
+        first = false;
+        for (auto &ev : p.events)
+        {
+            writeEvent(out, ev, ev.qp ? QP_TRACK | ev.qp : p.tid, first);
+            if (ev.qp)
+                qps.insert(ev.qp);
+        }
+    }
+    for (auto qp : qps)
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << getpid() << ",\"tid\":" << (QP_TRACK | qp)
+            << ",\"args\":{\"name\":\"qp " << qp << "\"}}";
+    out << "\n]}\n";
+    LOGI << "Trace written to " << path << " (" << events << " events"
+         << (lost > 0 ? ", " + std::to_string(lost) + " overwritten" : "") << ")";
+}
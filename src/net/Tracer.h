@@ -0,0 +1,54 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "LatencyHistogram.h"
+
+// a kind of trace event, the arg names label a0/a1 in the trace (nullptr: unused)
+struct TracePoint
+{
+    const char *name;
+    const char *arg0;
+    const char *arg1;
+};
+
+// Opt-in timeline of the transfer pipeline (TraceDir in local.conf).
+// Every thread appends its events to its own ring (RING_SIZE events, the oldest
+// are overwritten) without locks; flush() writes what all threads recorded
+// since the previous flush to TraceDir/fileupload-<pid>-<n>.json in the Chrome
+// trace format, which chrome://tracing and ui.perfetto.dev open. Events given
+// a qp number go to a track of that QP instead of the thread's.
+// Turned off a trace point costs one relaxed load.
+class Tracer
+{
+public:
+    static const uint64_t RING_SIZE = 1 << 15;
+
+    static bool on() { return enabled.load(std::memory_order_relaxed); }
+    // first caller wins, later calls are ignored
+    static void enable(const std::string &dir);
+    // an event from start (CycleClock ticks) to now
+    static inline void span(const TracePoint &tp, uint64_t start, uint64_t a0 = 0, uint64_t a1 = 0, uint32_t qp = 0)
+    {
+        if (on())
+            record(tp, 'X', start, CycleClock::now(), a0, a1, qp);
+    }
+    static inline void instant(const TracePoint &tp, uint64_t a0 = 0, uint64_t a1 = 0, uint32_t qp = 0)
+    {
+        if (on())
+        {
+            uint64_t now = CycleClock::now();
+            record(tp, 'i', now, now, a0, a1, qp);
+        }
+    }
+    // called at the end of a transfer, safe from any thread
+    static void flush();
+
+private:
+    static std::atomic<bool> enabled;
+    static void record(const TracePoint &tp, char ph, uint64_t start, uint64_t end, uint64_t a0, uint64_t a1, uint32_t qp);
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include <iostream>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "Transport.h"
+#include "StreamControl.h"
+#include "TcpTransport.h"
+#include "../utils/Logger.h"
+
+int Transport::sockSyncData(int xfer_size, char *local_data, char *remote_data)
+{
+    int rc;
+    int read_bytes = 0;
+    int total_read_bytes = 0;
+    while((rc = send(this->peer_fd, local_data, xfer_size, MSG_NOSIGNAL)) <= 0)
+    {
+        if (rc == 0 || (rc < 0 && errno != EINTR))
+        {
+            LOGE << "Failed writing data during sock_sync_data. errno: " << errno << " (" << strerror(errno) << "), rc: " << rc
+                 << ", peer_fd: " << peer_fd;
+            return -1;
+        }
+    }
+
+    while (total_read_bytes < xfer_size)
+    {
+        read_bytes = read(this->peer_fd, remote_data + total_read_bytes, xfer_size - total_read_bytes);
+        if (read_bytes > 0)
+        {
+            total_read_bytes += read_bytes;
+        }
+        else if(read_bytes < 0 && errno == EINTR)
+            continue;
+        else 
+        {
+            LOGE << "Failed reading data during sock_sync_data. errno: " << errno << " (" << strerror(errno) << "), read_bytes: " << read_bytes
+                 << ", peer_fd: " << this->peer_fd;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int Transport::sendAll(const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        int rc = send(this->peer_fd, data, len, MSG_NOSIGNAL);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return -1;
+        data += rc;
+        len -= rc;
+    }
+    return 0;
+}
+
+int Transport::recvAll(char *data, size_t len)
+{
+    while (len > 0)
+    {
+        int rc = recv(this->peer_fd, data, len, 0);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            return -1;
+        data += rc;
+        len -= rc;
+    }
+    return 0;
+}
+
+int Transport::peekHello(int peer_fd, HelloMsg &hello)
+{
+    int n = recv(peer_fd, &hello, sizeof(hello), MSG_PEEK | MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        return -1;
+    if (n != (int)sizeof(hello))
+        return 0;
+    if (ntohl(hello.magic) != HELLO_MAGIC || ntohs(hello.version) != HELLO_VERSION)
+    {
+        LOGE << "client hello version " << ntohs(hello.version) << " is not supported.";
+        return -1;
+    }
+    return 1;
+}
+
+std::unique_ptr<Transport> Transport::negotiate(int peer_fd, std::unique_ptr<StreamControl> rdma_conn,
+                                                LocalConf *local_conf, int &ret)
+{
+    if (!rdma_conn)
+    {
+        std::unique_ptr<TcpTransport> conn(new TcpTransport(peer_fd, local_conf));
+        ret = conn->connectPeer();
+        if (ret != 0)
+            return nullptr;
+        return conn;
+    }
+    rdma_conn->peer_fd = peer_fd;
+    // registers the window while the hello is on the wire
+    ret = rdma_conn->connectPeer();
+    // re-registers only when the server changed its block size
+    if (ret == 0 && (rdma_conn->bindMemoryRegion() == -1 || rdma_conn->createBufferPool() == -1))
+        ret = -1;
+    if (ret == 0)
+        return rdma_conn;
+    rdma_conn->peer_fd = -1;
+    rdma_conn.reset();
+    if (ret != CONNECT_USE_TCP)
+        return nullptr;
+    // the server has no usable RDMA port, the hello exchange is done
+    ret = 0;
+    return std::unique_ptr<Transport>(new TcpTransport(peer_fd, local_conf));
+}
@@ -0,0 +1,97 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+
+class StreamControl;
+class LocalConf;
+
+// a connection opens one lane (QP) per usable RDMA port on both ends, up to
+// MAX_LANE_NUM; receive credits for lane k are announced with 'A' + k
+static const uint32_t MAX_LANE_NUM = 4;
+
+struct QPInfo
+{
+    uint16_t lid;
+    // uint16_t lucp_id;
+    uint32_t qp_num;
+    uint32_t block_num;
+    uint32_t block_size;
+    uint8_t gid[16];
+    uint32_t rate_mbps;
+} __attribute__((packed));
+
+// transports of a connection: the client's hello offers a set, the
+// server's hello names the one it picked
+static const uint16_t TRANSPORT_RDMA = 1;
+static const uint16_t TRANSPORT_TCP = 2;
+
+// the first message each way: protocol version, transports and, for RDMA,
+// the QPInfo of every lane, so the QPs reach RTS after a single round trip
+static const uint32_t HELLO_MAGIC = 0x4c554350; // "LUCP"
+static const uint16_t HELLO_VERSION = 2;
+struct HelloMsg
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t lane_num;
+    uint16_t transports;
+    QPInfo lanes[MAX_LANE_NUM];
+} __attribute__((packed));
+
+struct FileInfo
+{
+    char file_path[256];
+    uint64_t file_size;
+} __attribute__((packed));
+
+// progress and cancellation of one upload: UploadThread in the client,
+// anything else for headless senders
+class TransferProgress
+{
+public:
+    virtual ~TransferProgress() {}
+    // called per acknowledged block, < 0 cancels the transfer
+    virtual int caculateTransferInfo(unsigned long bytes_transferred, double duration, unsigned long piece_size) = 0;
+    virtual bool checkCancel() = 0;
+};
+
+// Data path of one connection, the file handshake runs on the control socket
+// peer_fd for every transport.
+// StreamControl moves the blocks over RDMA lanes, TcpTransport over the
+// control socket itself.
+class Transport
+{
+public:
+    int peer_fd = -1;
+    virtual ~Transport() {}
+    virtual const char *getName() const = 0;
+    // sender: 0 sent, 1 cancelled, -1 error, -2 network error
+    virtual int postSendFile(const char *file_path, const char *file_name, TransferProgress *progress) = 0;
+    // receiver: returns after one file, < 0 when the connection is unusable
+    virtual int postRecvFile() = 0;
+    // false once a transfer failed, the session must not be pooled again
+    virtual bool isReusable() const = 0;
+    // keep file I/O threads next to the device
+    virtual int pinIoThread(pthread_t /*thr*/) const { return 0; }
+
+    int sockSyncData(int xfer_size, char *local_data, char *remote_data);
+    // server: the client's hello without consuming it and without blocking,
+    // 1 with the hello, 0 while it is not all there, -1 on eof, error or a bad version
+    static int peekHello(int peer_fd, HelloMsg &hello);
+    // client: says hello on the connected socket peer_fd and returns the data
+    // path the server picked. With rdma_conn (lanes created) rdma is offered and
+    // a server without a usable RDMA port moves the socket to tcp, without it
+    // only tcp is offered. nullptr with ret -1 or -2 on failure; peer_fd stays
+    // the caller's to close either way
+    static std::unique_ptr<Transport> negotiate(int peer_fd, std::unique_ptr<StreamControl> rdma_conn,
+                                                LocalConf *local_conf, int &ret);
+
+protected:
+    int sendAll(const char *data, size_t len);
+    int recvAll(char *data, size_t len);
+};
+
+#endif
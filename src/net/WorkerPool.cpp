@@ -0,0 +1,290 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <poll.h>
+#include <pthread.h>
+#include "WorkerPool.h"
+#include "../utils/Logger.h"
+using std::chrono::steady_clock;
+using std::chrono::nanoseconds;
+using std::chrono::duration_cast;
+
+WorkerPool::WorkerPool(ServerContext *server_ctx, int worker_num, int max_conn_num, const NumaPlacement *placement)
+{
+    this->server_ctx = server_ctx;
+    this->placement = placement;
+    this->max_conn_num = max_conn_num;
+    for (int i = 0; i < worker_num; i++)
+    {
+        workers.emplace_back(new Worker());
+        workers.back()->id = i;
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+void WorkerPool::start()
+{
+    unsigned int cpu_num = std::thread::hardware_concurrency();
+    for (auto &w : workers)
+    {
+        w->thr = std::thread(&WorkerPool::run, this, w.get());
+        std::string name = "worker-" + std::to_string(w->id);
+        pthread_setname_np(w->thr.native_handle(), name.c_str());
+        int ret = 0;
+        if (!placement->getPollCores().empty())
+            ret = placement->pinPollThread(w->thr.native_handle(), w->id);
+        else if (cpu_num > 0) // numa node unknown: spread over all cpus
+            ret = NumaPlacement::pinThread(w->thr.native_handle(), std::vector<int>(1, w->id % cpu_num));
+        if (ret != 0)
+            LOGW << "unable to pin worker " << w->id;
+    }
+    LOGI << "Server mode: pool x " << workers.size() << ", at most " << max_conn_num << " connections";
+}
+
+void WorkerPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(slot_mutex);
+        stopped = true;
+    }
+    slot_cv.notify_all();
+    for (auto &w : workers)
+    {
+        if (w->thr.joinable())
+            w->thr.join();
+        // a StreamControl is destroyed before its peer is released
+        for (auto &conn : w->conns)
+        {
+            int fd = conn->peer_fd;
+            conn.reset();
+            closePeer(server_ctx, fd);
+        }
+        w->conns.clear();
+        std::lock_guard<std::mutex> lock(w->inbox_mutex);
+        for (auto &conn : w->inbox)
+        {
+            int fd = conn->peer_fd;
+            conn.reset();
+            closePeer(server_ctx, fd);
+        }
+        w->inbox.clear();
+    }
+}
+
+bool WorkerPool::waitForSlot(int timeout_ms, size_t reserved)
+{
+    std::unique_lock<std::mutex> lock(slot_mutex);
+    return slot_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this, reserved]()
+                            { return !stopped && conn_num.load() + reserved < (size_t)max_conn_num; });
+}
+
+void WorkerPool::attach(std::unique_ptr<StreamControl> conn)
+{
+    Worker *target = workers[0].get();
+    for (auto &w : workers)
+        if (w->load.load() < target->load.load())
+            target = w.get();
+    target->load++;
+    conn_num++;
+    std::lock_guard<std::mutex> lock(target->inbox_mutex);
+    target->inbox.push_back(std::move(conn));
+}
+
+// returns false when the connection has to be closed
+bool WorkerPool::handleResult(StreamControl *conn, int ret)
+{
+    if (ret >= 0 && conn->getRecvStage() == RECV_STAGE_IDLE)
+        ret = conn->startRecvFile();
+    return ret >= 0;
+}
+
+void WorkerPool::closeConn(Worker *worker, size_t index)
+{
+    int fd = worker->conns[index]->peer_fd;
+    worker->conns.erase(worker->conns.begin() + index);
+    closePeer(server_ctx, fd);
+    worker->load--;
+    {
+        std::lock_guard<std::mutex> lock(slot_mutex);
+        conn_num--;
+    }
+    slot_cv.notify_one();
+}
+
+void WorkerPool::requestSteal(Worker *worker)
+{
+    Worker *victim = nullptr;
+    for (auto &w : workers)
+    {
+        if (w.get() == worker || w->receiving.load() < 2)
+            continue;
+        if (victim == nullptr || w->receiving.load() > victim->receiving.load())
+            victim = w.get();
+    }
+    int expected = -1;
+    if (victim != nullptr)
+        victim->steal_request.compare_exchange_strong(expected, worker->id);
+}
+
+void WorkerPool::serveSteal(Worker *worker)
+{
+    int thief_id = worker->steal_request.exchange(-1);
+    if (thief_id < 0 || worker->receiving.load() < 2)
+        return;
+    for (size_t i = worker->conns.size(); i-- > 0;)
+    {
+        if (worker->conns[i]->getRecvStage() != RECV_STAGE_RECEIVING)
+            continue;
+        Worker *thief = workers[thief_id].get();
+        std::unique_ptr<StreamControl> conn = std::move(worker->conns[i]);
+        worker->conns.erase(worker->conns.begin() + i);
+        worker->load--;
+        worker->receiving--;
+        thief->load++;
+        thief->stolen++;
+        std::lock_guard<std::mutex> lock(thief->inbox_mutex);
+        thief->inbox.push_back(std::move(conn));
+        return;
+    }
+}
+
+void WorkerPool::run(Worker *worker)
+{
+    const int batch = 16;
+    std::vector<struct pollfd> pfds;
+    std::vector<size_t> pfd_conns;
+    int idle_loops = 0;
+    auto last_tick = steady_clock::now();
+    while (!stopped)
+    {
+        auto loop_start = steady_clock::now();
+        bool did_work = false;
+        {
+            std::lock_guard<std::mutex> lock(worker->inbox_mutex);
+            for (auto &conn : worker->inbox)
+            {
+                // new connections start a file, stolen ones are already receiving
+                if (conn->getRecvStage() == RECV_STAGE_IDLE && conn->startRecvFile() < 0)
+                {
+                    int fd = conn->peer_fd;
+                    conn.reset();
+                    closePeer(server_ctx, fd);
+                    worker->load--;
+                    {
+                        std::lock_guard<std::mutex> slot_lock(slot_mutex);
+                        conn_num--;
+                    }
+                    slot_cv.notify_one();
+                    continue;
+                }
+                worker->conns.push_back(std::move(conn));
+                did_work = true;
+            }
+            worker->inbox.clear();
+        }
+
+        // receiving connections: poll their cqs
+        pfds.clear();
+        pfd_conns.clear();
+        size_t receiving = 0;
+        for (size_t i = 0; i < worker->conns.size();)
+        {
+            StreamControl *conn = worker->conns[i].get();
+            // every control stream is watched, a receiving sender may cancel
+            struct pollfd pfd;
+            pfd.fd = conn->peer_fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if (conn->getRecvStage() != RECV_STAGE_RECEIVING)
+            {
+                pfds.push_back(pfd);
+                pfd_conns.push_back(i++);
+                continue;
+            }
+            int n = conn->pollRecvCompletions(batch);
+            int ret = n < 0 ? n : 0;
+            if (n > 0)
+            {
+                did_work = true;
+                worker->completions += n;
+            }
+            if (!handleResult(conn, ret))
+            {
+                closeConn(worker, i);
+                continue;
+            }
+            receiving += conn->getRecvStage() == RECV_STAGE_RECEIVING;
+            pfds.push_back(pfd);
+            pfd_conns.push_back(i++);
+        }
+
+        // wait for the sender's messages between files and for cancels
+        int timeout = (receiving > 0 || idle_loops < 1024) ? 0 : 1;
+        int ne = pfds.empty() ? 0 : poll(pfds.data(), pfds.size(), timeout);
+        if (pfds.empty() && timeout > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (ne > 0)
+        {
+            did_work = true;
+            // close from the back so the remaining indexes stay valid
+            for (size_t k = pfds.size(); k-- > 0;)
+            {
+                if (pfds[k].revents == 0)
+                    continue;
+                size_t i = pfd_conns[k];
+                StreamControl *conn = worker->conns[i].get();
+                if (!handleResult(conn, conn->onRecvReadable()))
+                    closeConn(worker, i);
+            }
+        }
+
+        // timeouts and credit regrants once per millisecond
+        auto now = steady_clock::now();
+        if (now - last_tick >= std::chrono::milliseconds(1))
+        {
+            last_tick = now;
+            for (size_t i = worker->conns.size(); i-- > 0;)
+            {
+                StreamControl *conn = worker->conns[i].get();
+                if (!handleResult(conn, conn->onRecvIdle()))
+                    closeConn(worker, i);
+            }
+        }
+
+        receiving = 0;
+        for (auto &conn : worker->conns)
+            receiving += conn->getRecvStage() == RECV_STAGE_RECEIVING;
+        worker->receiving.store(receiving);
+        serveSteal(worker);
+        if (receiving == 0)
+            requestSteal(worker);
+
+        idle_loops = did_work ? 0 : idle_loops + 1;
+        uint64_t loop_ns = duration_cast<nanoseconds>(steady_clock::now() - loop_start).count();
+        worker->total_ns += loop_ns;
+        if (did_work)
+            worker->busy_ns += loop_ns;
+    }
+}
+
+void WorkerPool::report(std::ostream &os)
+{
+    os << "---------------- worker pool (" << conn_num.load() << "/" << max_conn_num << " connections) ----------------" << std::endl;
+    for (auto &w : workers)
+    {
+        uint64_t busy = w->busy_ns.load(), total = w->total_ns.load();
+        double util = total > w->last_total_ns ? (double)(busy - w->last_busy_ns) / (total - w->last_total_ns) : 0;
+        w->last_busy_ns = busy;
+        w->last_total_ns = total;
+        os << "  worker " << std::setw(3) << w->id
+           << "  util=" << std::fixed << std::setprecision(1) << util * 100 << "%" << std::defaultfloat
+           << "  conns=" << w->load.load()
+           << "  receiving=" << w->receiving.load()
+           << "  completions=" << w->completions.load()
+           << "  stolen=" << w->stolen.load() << std::endl;
+    }
+}
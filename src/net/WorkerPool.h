@@ -0,0 +1,72 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+#include "StreamControl.h"
+
+// Fixed-size pool of worker threads for ServerMode = pool, pinned one per
+// poll core (the NIC's NUMA node by default).
+// Each connection (own QPs and CQs) is owned by exactly one worker which drives
+// its receive state machine. New connections go to the least loaded worker;
+// a worker without receiving connections asks the busiest worker to hand over
+// one of its receiving connections at the end of that worker's next pass.
+// The accept loop waits in waitForSlot() while getConnSlots() connections are in
+// the pool, so further clients wait in the listen backlog instead of being
+// rejected.
+class WorkerPool
+{
+public:
+    WorkerPool(ServerContext *server_ctx, int worker_num, int max_conn_num, const NumaPlacement *placement);
+    ~WorkerPool();
+    void start();
+    // join all workers and close their connections
+    void stop();
+
+    // waits up to timeout_ms for room for one more connection
+    bool waitForSlot(int timeout_ms, size_t reserved = 0);
+    void attach(std::unique_ptr<StreamControl> conn);
+    size_t getConnNum() const { return conn_num.load(); }
+    void report(std::ostream &os);
+
+private:
+    struct Worker
+    {
+        int id;
+        std::thread thr;
+        std::mutex inbox_mutex;
+        std::vector<std::unique_ptr<StreamControl>> inbox;
+        // owned by the worker thread
+        std::vector<std::unique_ptr<StreamControl>> conns;
+        std::atomic<int> steal_request{-1}; // id of the worker asking for a connection
+        std::atomic<size_t> load{0};        // attached connections
+        std::atomic<size_t> receiving{0};   // connections in RECV_STAGE_RECEIVING
+        // utilization
+        std::atomic<uint64_t> busy_ns{0};
+        std::atomic<uint64_t> total_ns{0};
+        std::atomic<uint64_t> completions{0};
+        std::atomic<uint64_t> stolen{0};
+        uint64_t last_busy_ns = 0, last_total_ns = 0;
+    };
+    ServerContext *server_ctx;
+    const NumaPlacement *placement;
+    int max_conn_num;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<bool> stopped{false};
+    std::atomic<size_t> conn_num{0};
+    std::mutex slot_mutex;
+    std::condition_variable slot_cv;
+
+    void run(Worker *worker);
+    static bool handleResult(StreamControl *conn, int ret);
+    void closeConn(Worker *worker, size_t index);
+    void requestSteal(Worker *worker);
+    void serveSteal(Worker *worker);
+};
+
+#endif
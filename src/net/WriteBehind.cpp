@@ -0,0 +1,65 @@
+#include <fcntl.h>
+#include <errno.h>
+#include <algorithm>
+#include "WriteBehind.h"
+
+int WriteBehind::preallocate(int fd, uint64_t size, bool keep_size)
+{
+    if (size == 0)
+        return 0;
+    // keep the size, a file that fails halfway is not padded with zeros
+    while (fallocate(fd, keep_size ? FALLOC_FL_KEEP_SIZE : 0, 0, size) != 0)
+    {
+        if (errno == EINTR)
+            continue;
+        if (errno == EOPNOTSUPP || errno == ENOSYS)
+            return 0;
+        return -1;
+    }
+    return 0;
+}
+
+void WriteBehind::start(int fd, uint64_t dirty_limit)
+{
+    this->fd = fd;
+    this->dirty_limit = dirty_limit;
+    dirty = 0;
+    current = Span();
+    kicked = Span();
+}
+
+void WriteBehind::written(uint64_t offset, uint64_t len)
+{
+    if (dirty_limit == 0 || fd < 0)
+        return;
+    // blocks arrive out of order over several lanes, a span covers them all
+    current.lo = std::min(current.lo, offset);
+    current.hi = std::max(current.hi, offset + len);
+    dirty += len;
+    if (dirty >= dirty_limit / 2)
+        kick();
+}
+
+void WriteBehind::kick()
+{
+    if (!current.empty())
+        sync_file_range(fd, current.lo, current.hi - current.lo, SYNC_FILE_RANGE_WRITE);
+    if (!kicked.empty())
+    {
+        sync_file_range(fd, kicked.lo, kicked.hi - kicked.lo,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fd, kicked.lo, kicked.hi - kicked.lo, POSIX_FADV_DONTNEED);
+    }
+    kicked = current;
+    current = Span();
+    dirty = 0;
+}
+
+void WriteBehind::finish()
+{
+    if (dirty_limit == 0 || fd < 0)
+        return;
+    // the last span is only started, the sender does not wait for the disk
+    kick();
+    fd = -1;
+}
@@ -0,0 +1,43 @@
+#ifndef WRITE_BEHIND_H
+#define WRITE_BEHIND_H
+
+#include <stdint.h>
+
+// Page cache use of a file being received.
+// preallocate() reserves the whole file before any data moves, so a full disk
+// fails the file at its start and the extents are laid out at once.
+// While the data is written, every DirtyLimit/2 bytes the span written since
+// the last kick is handed to writeback with sync_file_range(); the span kicked
+// before is waited for and dropped from the cache with POSIX_FADV_DONTNEED.
+// At most about DirtyLimit bytes of the stream are dirty or under writeback, so
+// the kernel never has gigabytes to flush in one burst.
+class WriteBehind
+{
+public:
+    // -1 with errno set when the space is not there; file systems without
+    // fallocate() only lose the preallocation. Holes can only be punched below
+    // the file size, sparse output sets the size at once (keep_size false).
+    static int preallocate(int fd, uint64_t size, bool keep_size = true);
+
+    // dirty_limit 0 leaves the writeback to the kernel
+    void start(int fd, uint64_t dirty_limit);
+    // [offset, offset + len) was written
+    void written(uint64_t offset, uint64_t len);
+    // end of the file: kicks the rest and drops what is already on disk
+    void finish();
+
+private:
+    struct Span
+    {
+        uint64_t lo = UINT64_MAX, hi = 0;
+        bool empty() const { return hi <= lo; }
+    };
+    int fd = -1;
+    uint64_t dirty_limit = 0;
+    uint64_t dirty = 0;
+    Span current, kicked;
+
+    void kick();
+};
+
+#endif
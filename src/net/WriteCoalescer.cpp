@@ -0,0 +1,85 @@
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <algorithm>
+#include "WriteCoalescer.h"
+
+void WriteCoalescer::configure(uint64_t max_bytes, uint32_t max_blocks, uint64_t max_ticks)
+{
+    this->max_bytes = max_bytes;
+    this->max_blocks = std::max<uint32_t>(1, std::min<uint32_t>(max_blocks, IOV_MAX));
+    this->max_ticks = max_ticks;
+    blocks.reserve(this->max_blocks);
+    iov.reserve(this->max_blocks);
+}
+
+void WriteCoalescer::add(const Block &block, const void *buf, uint32_t len, uint64_t offset)
+{
+    if (blocks.empty())
+        start_offset = end_offset = offset;
+    blocks.push_back(block);
+    iov.push_back({const_cast<void *>(buf), len});
+    end_offset += len;
+    bytes += len;
+}
+
+void WriteCoalescer::addHole(uint64_t offset, uint32_t len)
+{
+    if (!hole)
+        start_offset = end_offset = offset;
+    hole = true;
+    end_offset += len;
+    bytes += len;
+}
+
+bool WriteCoalescer::due(uint64_t now_tick) const
+{
+    if (blocks.empty())
+        return false;
+    return bytes >= max_bytes || blocks.size() >= max_blocks || now_tick - blocks.front().tick >= max_ticks;
+}
+
+int WriteCoalescer::flush(int fd, std::vector<Block> &flushed, uint32_t &calls)
+{
+    flushed.swap(blocks);
+    blocks.clear();
+    calls = 0;
+    if (hole)
+    {
+        // never written and preallocated ranges both read back as zeros, so a
+        // file system that cannot punch holes still gets the right content
+        calls++;
+        int ret = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start_offset, bytes);
+        bool failed = ret != 0 && errno != EOPNOTSUPP && errno != ENOSYS;
+        hole = false;
+        bytes = 0;
+        return failed ? -1 : 0;
+    }
+    bool failed = false;
+    // a short write continues from where it stopped
+    size_t first = 0;
+    uint64_t offset = start_offset;
+    while (first < iov.size() && !failed)
+    {
+        ssize_t n = pwritev(fd, &iov[first], iov.size() - first, offset);
+        calls++;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            failed = true;
+            break;
+        }
+        offset += n;
+        while (first < iov.size() && (size_t)n >= iov[first].iov_len)
+            n -= iov[first++].iov_len;
+        if (first < iov.size())
+        {
+            iov[first].iov_base = (char *)iov[first].iov_base + n;
+            iov[first].iov_len -= n;
+        }
+    }
+    iov.clear();
+    bytes = 0;
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,54 @@
+#ifndef WRITE_COALESCER_H
+#define WRITE_COALESCER_H
+
+#include <stdint.h>
+#include <vector>
+#include <sys/uio.h>
+
+// Receiver side batching of block writes.
+// Completed blocks that continue the pending run in file offset are collected
+// and written with one pwritev(); a block that does not continue it flushes the
+// run first. The caller flushes when due() (max_bytes, max_blocks or the age
+// of the oldest block reached) and when the connection goes idle, and only then
+// hands the buffers of the flushed blocks back to the receive queue.
+// All-zero blocks form runs of their own that hold no buffers; such a run
+// is flushed by punching a hole over it, so the output file is sparse.
+class WriteCoalescer
+{
+public:
+    struct Block
+    {
+        uint64_t id;   // receive buffer
+        uint64_t seq;  // block number in the file
+        uint64_t tick; // receive completion
+    };
+
+    // max_bytes 0 writes every block on its own
+    void configure(uint64_t max_bytes, uint32_t max_blocks, uint64_t max_ticks);
+    bool empty() const { return blocks.empty() && !hole; }
+    // whether a block at offset (all zero or not) extends the pending run
+    bool continues(uint64_t offset, bool zero = false) const { return !empty() && offset == end_offset && zero == hole; }
+    void add(const Block &block, const void *buf, uint32_t len, uint64_t offset);
+    // an all-zero block, its buffer may be reused at once
+    void addHole(uint64_t offset, uint32_t len);
+    bool due(uint64_t now_tick) const;
+    // writes the run, the flushed blocks are left in flushed (in order) and
+    // the pwritev() calls made in calls; -1 when the run could not be written
+    // or the hole not punched (a file system without hole punching is fine)
+    int flush(int fd, std::vector<Block> &flushed, uint32_t &calls);
+
+    uint64_t pendingBytes() const { return bytes; }
+    uint64_t pendingOffset() const { return start_offset; }
+    bool pendingHole() const { return hole; }
+
+private:
+    uint64_t max_bytes = 0;
+    uint32_t max_blocks = 1;
+    uint64_t max_ticks = 0;
+    std::vector<Block> blocks;
+    std::vector<struct iovec> iov;
+    uint64_t start_offset = 0, end_offset = 0, bytes = 0;
+    bool hole = false;
+};
+
+#endif
@@ -0,0 +1,140 @@
+#include <stdint.h>
+#include <string.h>
+#include "ZeroScan.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+// the bytes after the last full vector
+bool zeroTail(const uint8_t *p, size_t len)
+{
+    uint64_t acc = 0;
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        acc |= w;
+    }
+    for (; len > 0; p++, len--)
+        acc |= *p;
+    return acc == 0;
+}
+
+// every loop ORs four vectors before it tests, so the test is off the load path
+#if defined(__x86_64__)
+__attribute__((target("avx512f"))) bool zeroAvx512(const uint8_t *p, size_t len)
+{
+    size_t i = 0;
+    for (; i + 256 <= len; i += 256)
+    {
+        __m512i a = _mm512_loadu_si512(p + i);
+        __m512i b = _mm512_loadu_si512(p + i + 64);
+        __m512i c = _mm512_loadu_si512(p + i + 128);
+        __m512i d = _mm512_loadu_si512(p + i + 192);
+        __m512i x = _mm512_or_si512(_mm512_or_si512(a, b), _mm512_or_si512(c, d));
+        if (_mm512_test_epi64_mask(x, x) != 0)
+            return false;
+    }
+    return zeroTail(p + i, len - i);
+}
+
+__attribute__((target("avx2"))) bool zeroAvx2(const uint8_t *p, size_t len)
+{
+    size_t i = 0;
+    for (; i + 128 <= len; i += 128)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(p + i + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(p + i + 96));
+        __m256i x = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+        if (!_mm256_testz_si256(x, x))
+            return false;
+    }
+    return zeroTail(p + i, len - i);
+}
+
+bool zeroSse2(const uint8_t *p, size_t len)
+{
+    size_t i = 0;
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 64 <= len; i += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(p + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(p + i + 48));
+        __m128i x = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) != 0xffff)
+            return false;
+    }
+    return zeroTail(p + i, len - i);
+}
+#elif defined(__aarch64__)
+bool zeroNeon(const uint8_t *p, size_t len)
+{
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64)
+    {
+        uint8x16_t a = vld1q_u8(p + i);
+        uint8x16_t b = vld1q_u8(p + i + 16);
+        uint8x16_t c = vld1q_u8(p + i + 32);
+        uint8x16_t d = vld1q_u8(p + i + 48);
+        uint8x16_t x = vorrq_u8(vorrq_u8(a, b), vorrq_u8(c, d));
+        if (vmaxvq_u8(x) != 0)
+            return false;
+    }
+    return zeroTail(p + i, len - i);
+}
+#else
+bool zeroWords(const uint8_t *p, size_t len)
+{
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64)
+        if (!zeroTail(p + i, 64))
+            return false;
+    return zeroTail(p + i, len - i);
+}
+#endif
+
+struct ZeroScanImpl
+{
+    bool (*scan)(const uint8_t *, size_t);
+    const char *name;
+};
+
+const ZeroScanImpl &impl()
+{
+    static const ZeroScanImpl picked = []() -> ZeroScanImpl
+    {
+#if defined(__x86_64__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+            return {zeroAvx512, "avx512"};
+        if (__builtin_cpu_supports("avx2"))
+            return {zeroAvx2, "avx2"};
+        return {zeroSse2, "sse2"};
+#elif defined(__aarch64__)
+        return {zeroNeon, "neon"};
+#else
+        return {zeroWords, "generic"};
+#endif
+    }();
+    return picked;
+}
+}
+
+bool isZeroBlock(const void *buf, size_t len)
+{
+    return impl().scan((const uint8_t *)buf, len);
+}
+
+const char *zeroScanImpl()
+{
+    return impl().name;
+}
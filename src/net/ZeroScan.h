@@ -0,0 +1,14 @@
+#ifndef ZERO_SCAN_H
+#define ZERO_SCAN_H
+
+#include <stddef.h>
+
+// Whether the len bytes at buf are all zero.
+// The implementation is picked once at runtime: AVX-512, AVX2 or SSE2 on
+// x86-64, NEON on arm64, 64-bit words elsewhere. A zero block is read at
+// memory bandwidth; a data block usually stops at its first vector.
+bool isZeroBlock(const void *buf, size_t len);
+// the implementation in use, for the startup log
+const char *zeroScanImpl();
+
+#endif
@@ -0,0 +1,687 @@
+// Headless throughput benchmark: runs the real server (any mode) and N client
+// streams in one process and sweeps block size, window depth, file size,
+// stream count and I/O mode. Every run is one CSV row and one JSON object, so
+// results of two commits can be diffed.
+// Over a real device when one is present, rxe/soft-RoCE counts as one, or over
+// the mock verbs device when built with USE_MOCK_VERBS.
+#include <unistd.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <arpa/inet.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../utils/LocalConf.h"
+#include "../utils/ClientInfo.h"
+#include "../utils/Logger.h"
+#include "../net/HwRdma.h"
+#include "../net/StreamControl.h"
+#include "../net/LatencyHistogram.h"
+#include "../net/ThroughputMeter.h"
+#include "../net/ReceiveServer.h"
+#include "../net/ConnectionPool.h"
+using namespace std;
+
+#ifndef BENCH_REVISION
+#define BENCH_REVISION "unknown"
+#endif
+
+// one point of the sweep
+struct BenchConfig
+{
+    int block_kb;
+    int block_num;
+    uint64_t file_mb;
+    int streams;
+    std::string mode; // "thread", "reactor", "pool" or "tcp"
+    bool srq;
+    int rep;
+};
+
+struct BenchResult
+{
+    std::string status = "ok";
+    uint64_t bytes = 0;
+    double seconds = 0;
+    double gbps = 0;
+    double connect_us_p50 = 0;
+    double reg_mr_us = 0; // one window: mmap + ibv_reg_mr on every device + deregistration
+    double file_ms_p50 = 0, file_ms_p99 = 0, file_ms_max = 0;
+    double ack_us_p50 = 0, ack_us_p99 = 0, ack_us_p999 = 0, ack_us_max = 0;
+    // aggregate rate over 0.5 s windows sampled while sending (json only)
+    double window_gbps_p50 = 0, window_gbps_max = 0;
+    // cpu cycles per payload byte
+    double send_cpb = 0, recv_cpb = 0, nic_cpb = 0, total_cpb = 0;
+    // p50/p99/p999/max per block pipeline stage (rdma only, json only)
+    double stage_us[STAGE_NUM][4] = {};
+};
+
+// gaps between block acknowledgements, the sender side view of block latency;
+// all streams of a run feed one throughput meter
+class BenchProgress : public TransferProgress
+{
+public:
+    explicit BenchProgress(ThroughputMeter *meter) : meter(meter) {}
+    int caculateTransferInfo(unsigned long /*bytes_transferred*/, double duration, unsigned long piece_size) override
+    {
+        ack_us.push_back(duration * 1e6);
+        meter->add(piece_size);
+        return 0;
+    }
+    bool checkCancel() override { return false; }
+    std::vector<double> ack_us;
+
+private:
+    ThroughputMeter *meter;
+};
+
+static double percentile(std::vector<double> &values, double p)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    size_t index = std::min(values.size() - 1, (size_t)(values.size() * p));
+    return values[index];
+}
+
+static uint64_t threadCpuNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t processCpuNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// cpu time of the long lived threads we did not start ourselves, by thread name
+static std::map<std::string, uint64_t> namedThreadCpuNs()
+{
+    std::map<std::string, uint64_t> cpu;
+    DIR *dir = opendir("/proc/self/task");
+    if (dir == nullptr)
+        return cpu;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        std::string task = std::string("/proc/self/task/") + entry->d_name;
+        std::string name;
+        uint64_t ns = 0;
+        std::ifstream comm(task + "/comm");
+        std::ifstream schedstat(task + "/schedstat");
+        if (!std::getline(comm, name) || !(schedstat >> ns))
+            continue;
+        cpu[name + "/" + entry->d_name] += ns;
+    }
+    closedir(dir);
+    return cpu;
+}
+
+static uint64_t stageCpuNs(const std::map<std::string, uint64_t> &before, const std::map<std::string, uint64_t> &after,
+                           const std::vector<std::string> &prefixes)
+{
+    uint64_t ns = 0;
+    for (auto &it : after)
+    {
+        bool match = false;
+        for (auto &prefix : prefixes)
+            match |= it.first.compare(0, prefix.size(), prefix) == 0;
+        if (!match)
+            continue;
+        auto old = before.find(it.first);
+        ns += it.second - (old == before.end() ? 0 : old->second);
+    }
+    return ns;
+}
+
+// cycles per ns of the time stamp counter, 0 when there is none
+static double cyclesPerNs()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    auto start = chrono::steady_clock::now();
+    uint64_t c0 = __rdtsc();
+    std::this_thread::sleep_for(chrono::milliseconds(50));
+    uint64_t c1 = __rdtsc();
+    double ns = chrono::duration<double, std::nano>(chrono::steady_clock::now() - start).count();
+    return (c1 - c0) / ns;
+#else
+    return 0;
+#endif
+}
+
+static std::string cpuModel()
+{
+    std::ifstream in("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(in, line))
+        if (line.compare(0, 10, "model name") == 0 && line.find(':') != std::string::npos)
+            return line.substr(line.find(':') + 2);
+    return "unknown";
+}
+
+static std::vector<std::string> splitList(const std::string &value)
+{
+    std::vector<std::string> items;
+    std::stringstream ss(value);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+static bool writeSourceFile(const std::string &path, uint64_t size)
+{
+    struct stat statbuf;
+    if (stat(path.c_str(), &statbuf) == 0 && (uint64_t)statbuf.st_size == size)
+        return true;
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    std::vector<char> chunk(1 << 20);
+    uint32_t x = 2463534242u;
+    for (auto &c : chunk)
+    {
+        // xorshift, no block may be all zero
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        c = (char)x;
+    }
+    for (uint64_t done = 0; done < size && out; done += chunk.size())
+        out.write(chunk.data(), std::min<uint64_t>(chunk.size(), size - done));
+    return (bool)out;
+}
+
+static bool sameContent(const std::string &a, const std::string &b)
+{
+    std::ifstream fa(a, std::ios::binary), fb(b, std::ios::binary);
+    std::vector<char> ba(1 << 20), bb(1 << 20);
+    while (fa && fb)
+    {
+        fa.read(ba.data(), ba.size());
+        fb.read(bb.data(), bb.size());
+        if (fa.gcount() != fb.gcount() || memcmp(ba.data(), bb.data(), fa.gcount()) != 0)
+            return false;
+    }
+    return fa.eof() && fb.eof();
+}
+
+// the server side of one run is the ReceiveServer FileUploadServer runs
+static BenchResult runOne(const BenchConfig &cfg, HwRdma *hwrdma, LocalConf &local_conf, const std::string &dir,
+                          int files, bool verify, double cycles_per_ns)
+{
+    BenchResult result;
+    bool rdma = cfg.mode != "tcp";
+    local_conf.setBlockSize(cfg.block_kb);
+    local_conf.setBlockNum(cfg.block_num);
+    local_conf.setUseSrq(cfg.srq);
+    local_conf.setServerMode(rdma ? cfg.mode : "thread");
+    // buffers, cqs and credits are sized for the streams of the run
+    local_conf.setMaxConnNum(cfg.streams);
+    local_conf.setStorageTargets({});
+    // receivers reload the conf for every file
+    if (local_conf.saveConf() || local_conf.loadConf())
+    {
+        result.status = "conf";
+        return result;
+    }
+    uint64_t file_size = cfg.file_mb << 20;
+    std::string src_path = dir + "/source_" + std::to_string(cfg.file_mb) + "m.bin";
+    if (!writeSourceFile(src_path, file_size))
+    {
+        result.status = "source";
+        return result;
+    }
+
+    uint64_t block_size = 1024UL * cfg.block_kb;
+    if (rdma)
+    {
+        // connectPeer() overlaps registration with the handshake, time it on its own
+        struct ibv_mr *mr = nullptr;
+        uint8_t *buf = nullptr;
+        auto r0 = chrono::high_resolution_clock::now();
+        if (hwrdma->create_mr(&mr, &buf, block_size * cfg.block_num))
+        {
+            result.status = "reg_mr";
+            return result;
+        }
+        hwrdma->destroy_mr(mr);
+        result.reg_mr_us = chrono::duration<double, std::micro>(chrono::high_resolution_clock::now() - r0).count();
+    }
+    ReceiveServer receive_server(hwrdma, &local_conf, rdma);
+    if (receive_server.start())
+    {
+        result.status = receive_server.getFailedStage();
+        return result;
+    }
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = 0;
+    socklen_t addr_len = sizeof(addr);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, cfg.streams) != 0 ||
+        getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len) != 0)
+    {
+        cout << "ERROR: benchmark listen failed, errno: " << errno << endl;
+        close(listen_fd);
+        result.status = "listen";
+        return result;
+    }
+
+    // per connection threads are ours, reactors and workers are accounted by name
+    std::atomic<uint64_t> recv_cpu_ns(0);
+    receive_server.setThreadExitHook([&recv_cpu_ns]()
+                                     { recv_cpu_ns += threadCpuNs(); });
+    std::atomic<bool> accept_stopped(false);
+    std::thread acceptor([&]()
+                         { receive_server.serve(listen_fd, accept_stopped, cfg.streams); });
+
+    std::mutex result_mutex;
+    std::vector<double> connect_us, file_ms, ack_us;
+    std::atomic<uint64_t> send_cpu_ns(0);
+    std::atomic<int> failed(0);
+    StageLatency::global().reset();
+    auto named_before = namedThreadCpuNs();
+    uint64_t process_before = processCpuNs();
+    auto start = chrono::high_resolution_clock::now();
+    ThroughputMeter meter(ThroughputMeter::THROUGHPUT_WINDOW, 0.5);
+    std::atomic<bool> sending(true);
+    std::vector<double> window_gbps;
+    std::thread sampler([&]()
+                        {
+        while (sending)
+        {
+            std::this_thread::sleep_for(chrono::milliseconds(100));
+            double rate = meter.rate();
+            if (rate > 0)
+                window_gbps.push_back(rate * 8 / 1e9);
+        } });
+    std::vector<std::thread> senders;
+    for (int s = 0; s < cfg.streams; s++)
+    {
+        senders.emplace_back([&, s]()
+                             {
+            auto t0 = chrono::high_resolution_clock::now();
+            int peer_fd = socket(AF_INET, SOCK_STREAM, 0);
+            int ret = connect(peer_fd, (struct sockaddr *)&addr, sizeof(addr));
+            std::unique_ptr<Transport> transport;
+            std::unique_ptr<StreamControl> conn;
+            if (ret == 0 && rdma)
+            {
+                conn.reset(new StreamControl(hwrdma, peer_fd, &local_conf));
+                ret = conn->createLucpContext();
+            }
+            if (ret == 0)
+                transport = Transport::negotiate(peer_fd, std::move(conn), &local_conf, ret);
+            double conn_us = chrono::duration<double, std::micro>(chrono::high_resolution_clock::now() - t0).count();
+            BenchProgress progress(&meter);
+            std::vector<double> ms;
+            uint64_t cpu0 = threadCpuNs();
+            for (int f = 0; f < files && ret == 0; f++)
+            {
+                std::string name = "stream" + std::to_string(s) + "_" + std::to_string(f) + ".bin";
+                auto f0 = chrono::high_resolution_clock::now();
+                ret = transport->postSendFile(src_path.c_str(), name.c_str(), &progress);
+                ms.push_back(chrono::duration<double, std::milli>(chrono::high_resolution_clock::now() - f0).count());
+            }
+            send_cpu_ns += threadCpuNs() - cpu0;
+            // closing the control connection ends the server side of the stream
+            transport.reset();
+            close(peer_fd);
+            if (ret != 0)
+                failed++;
+            std::lock_guard<std::mutex> lock(result_mutex);
+            connect_us.push_back(conn_us);
+            file_ms.insert(file_ms.end(), ms.begin(), ms.end());
+            ack_us.insert(ack_us.end(), progress.ack_us.begin(), progress.ack_us.end()); });
+    }
+    for (auto &thr : senders)
+        thr.join();
+    result.seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+    sending = false;
+    sampler.join();
+    // a stream that never connected leaves the acceptor waiting
+    accept_stopped = true;
+    acceptor.join();
+    // the senders closed their connections, the receivers are ending
+    receive_server.closeConnections();
+    auto named_after = namedThreadCpuNs();
+    uint64_t process_cpu_ns = processCpuNs() - process_before;
+    close(listen_fd);
+    receive_server.stop();
+    // transfer logs go out before the result row
+    Logger::flush();
+
+    result.bytes = file_size * file_ms.size();
+    if (failed > 0)
+        result.status = "failed";
+    for (int s = 0; s < cfg.streams; s++)
+    {
+        for (int f = 0; f < files; f++)
+        {
+            std::string name = local_conf.getSavedFolderPath().ToStdString() + "/stream" + std::to_string(s) + "_" + std::to_string(f) + ".bin";
+            struct stat statbuf;
+            if (result.status == "ok" && (stat(name.c_str(), &statbuf) != 0 || (uint64_t)statbuf.st_size != file_size ||
+                                          (verify && !sameContent(src_path, name))))
+                result.status = "mismatch";
+            unlink(name.c_str());
+        }
+    }
+    if (result.seconds > 0)
+        result.gbps = result.bytes * 8.0 / result.seconds / 1e9;
+    result.connect_us_p50 = percentile(connect_us, 0.5);
+    result.file_ms_p50 = percentile(file_ms, 0.5);
+    result.file_ms_p99 = percentile(file_ms, 0.99);
+    result.file_ms_max = file_ms.empty() ? 0 : file_ms.back();
+    result.ack_us_p50 = percentile(ack_us, 0.5);
+    result.ack_us_p99 = percentile(ack_us, 0.99);
+    result.ack_us_p999 = percentile(ack_us, 0.999);
+    result.ack_us_max = ack_us.empty() ? 0 : ack_us.back();
+    result.window_gbps_p50 = percentile(window_gbps, 0.5);
+    result.window_gbps_max = window_gbps.empty() ? 0 : window_gbps.back();
+    for (int st = 0; st < STAGE_NUM; st++)
+    {
+        const LatencyHistogram &h = StageLatency::global().get((LatencyStage)st);
+        result.stage_us[st][0] = h.percentile(0.5) / 1e3;
+        result.stage_us[st][1] = h.percentile(0.99) / 1e3;
+        result.stage_us[st][2] = h.percentile(0.999) / 1e3;
+        result.stage_us[st][3] = h.max() / 1e3;
+    }
+    uint64_t recv_ns = recv_cpu_ns + stageCpuNs(named_before, named_after, {"reactor-", "worker-"});
+    uint64_t nic_ns = stageCpuNs(named_before, named_after, {"mock-fabric"});
+    if (result.bytes > 0)
+    {
+        // without a time stamp counter the columns hold ns per byte
+        double scale = (cycles_per_ns > 0 ? cycles_per_ns : 1.0) / result.bytes;
+        result.send_cpb = send_cpu_ns * scale;
+        result.recv_cpb = recv_ns * scale;
+        result.nic_cpb = nic_ns * scale;
+        result.total_cpb = process_cpu_ns * scale;
+    }
+    return result;
+}
+
+// the GUI's ConnectionPool has to hand a released session to the next
+// acquire: two files over one pool, the second on the same tcp connection
+static bool checkPoolReuse(HwRdma *hwrdma, LocalConf &local_conf, const std::string &dir, bool rdma)
+{
+    local_conf.setBlockSize(256);
+    local_conf.setBlockNum(16);
+    local_conf.setUseSrq(false);
+    local_conf.setServerMode("thread");
+    local_conf.setMaxConnNum(2);
+    local_conf.setStorageTargets({});
+    std::string src_path = dir + "/source_pool.bin";
+    if (local_conf.saveConf() || local_conf.loadConf() || !writeSourceFile(src_path, 4 << 20))
+        return false;
+    ReceiveServer receive_server(hwrdma, &local_conf, rdma);
+    if (receive_server.start())
+        return false;
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = 0;
+    socklen_t addr_len = sizeof(addr);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 2) != 0 ||
+        getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len) != 0)
+    {
+        close(listen_fd);
+        return false;
+    }
+    std::atomic<bool> accept_stopped(false);
+    std::thread acceptor([&]()
+                         { receive_server.serve(listen_fd, accept_stopped); });
+    int port = ntohs(addr.sin_port);
+    // a session is the same connection when its local port is
+    auto localPort = [](Transport *conn)
+    {
+        struct sockaddr_in local;
+        socklen_t len = sizeof(local);
+        if (conn == nullptr || getsockname(conn->peer_fd, (struct sockaddr *)&local, &len) != 0)
+            return -1;
+        return (int)ntohs(local.sin_port);
+    };
+    ThroughputMeter meter(ThroughputMeter::THROUGHPUT_WINDOW, 0.5);
+    BenchProgress progress(&meter);
+    int ports[2] = {-1, -1};
+    int ret = 0;
+    {
+        ConnectionPool pool(dir + "/local.conf");
+        for (int i = 0; i < 2 && ret == 0; i++)
+        {
+            int error_code = 0;
+            Transport *conn = pool.acquire("127.0.0.1", port, error_code);
+            ports[i] = localPort(conn);
+            ret = conn != nullptr ? conn->postSendFile(src_path.c_str(), "pool.bin", &progress) : -1;
+            pool.release(conn, "127.0.0.1", port);
+        }
+        pool.shutdown();
+    }
+    accept_stopped = true;
+    acceptor.join();
+    receive_server.closeConnections();
+    close(listen_fd);
+    receive_server.stop();
+    unlink(src_path.c_str());
+    unlink((local_conf.getSavedFolderPath().ToStdString() + "/pool.bin").c_str());
+    if (ret != 0 || ports[0] < 0 || ports[1] != ports[0])
+    {
+        cout << "ERROR: connection pool did not reuse its session (ret " << ret << ", ports "
+             << ports[0] << " " << ports[1] << ")" << endl;
+        return false;
+    }
+    return true;
+}
+
+static const char *CSV_HEADER =
+    "revision,device,mode,srq,block_kb,block_num,file_mb,streams,files,rep,status,gbps,seconds,"
+    "connect_us_p50,reg_mr_us,reg_mr_us_per_mb,file_ms_p50,file_ms_p99,file_ms_max,"
+    "ack_us_p50,ack_us_p99,ack_us_p999,ack_us_max,send_cpb,recv_cpb,nic_cpb,total_cpb";
+
+static void writeRow(std::ostream &os, const std::string &revision, const std::string &device, const BenchConfig &cfg,
+                     int files, const BenchResult &r, bool json)
+{
+    double mr_mb = (double)cfg.block_kb * cfg.block_num / 1024.0;
+    double per_mb = mr_mb > 0 ? r.reg_mr_us / mr_mb : 0;
+    if (!json)
+    {
+        os << revision << "," << device << "," << cfg.mode << "," << cfg.srq << "," << cfg.block_kb << "," << cfg.block_num
+           << "," << cfg.file_mb << "," << cfg.streams << "," << files << "," << cfg.rep << "," << r.status
+           << "," << r.gbps << "," << r.seconds << "," << r.connect_us_p50 << "," << r.reg_mr_us << "," << per_mb
+           << "," << r.file_ms_p50 << "," << r.file_ms_p99 << "," << r.file_ms_max
+           << "," << r.ack_us_p50 << "," << r.ack_us_p99 << "," << r.ack_us_p999 << "," << r.ack_us_max
+           << "," << r.send_cpb << "," << r.recv_cpb << "," << r.nic_cpb << "," << r.total_cpb << "\n";
+        return;
+    }
+    os << "    {\"mode\": \"" << cfg.mode << "\", \"srq\": " << (cfg.srq ? "true" : "false")
+       << ", \"block_kb\": " << cfg.block_kb << ", \"block_num\": " << cfg.block_num << ", \"file_mb\": " << cfg.file_mb
+       << ", \"streams\": " << cfg.streams << ", \"files\": " << files << ", \"rep\": " << cfg.rep
+       << ", \"status\": \"" << r.status << "\", \"gbps\": " << r.gbps << ", \"seconds\": " << r.seconds
+       << ", \"connect_us_p50\": " << r.connect_us_p50 << ", \"reg_mr_us\": " << r.reg_mr_us << ", \"reg_mr_us_per_mb\": " << per_mb
+       << ", \"file_ms\": {\"p50\": " << r.file_ms_p50 << ", \"p99\": " << r.file_ms_p99 << ", \"max\": " << r.file_ms_max << "}"
+       << ", \"ack_us\": {\"p50\": " << r.ack_us_p50 << ", \"p99\": " << r.ack_us_p99 << ", \"p999\": " << r.ack_us_p999 << ", \"max\": " << r.ack_us_max << "}"
+       << ", \"window_gbps\": {\"p50\": " << r.window_gbps_p50 << ", \"max\": " << r.window_gbps_max << "}"
+       << ", \"cycles_per_byte\": {\"send\": " << r.send_cpb << ", \"recv\": " << r.recv_cpb << ", \"nic\": " << r.nic_cpb << ", \"total\": " << r.total_cpb << "}"
+       << ", \"stage_us\": {";
+    for (int st = 0; st < STAGE_NUM; st++)
+        os << (st ? ", " : "") << "\"" << StageLatency::stageName((LatencyStage)st) << "\": {\"p50\": " << r.stage_us[st][0]
+           << ", \"p99\": " << r.stage_us[st][1] << ", \"p999\": " << r.stage_us[st][2] << ", \"max\": " << r.stage_us[st][3] << "}";
+    os << "}}";
+}
+
+static void usage(const char *prog)
+{
+    cout << "usage: " << prog << " [options], lists are comma separated\n"
+         << "  --block-kb 256,1024,4096  BlockSize values\n"
+         << "  --block-num 64,256        BlockNum values, the window depth\n"
+         << "  --file-mb 256             file sizes\n"
+         << "  --streams 1,4             concurrent client streams\n"
+         << "  --mode thread             thread, reactor, pool, tcp, an rdma mode with +srq uses the SRQ\n"
+         << "  --files 2                 files per stream and run\n"
+         << "  --repeat 1                runs per point\n"
+         << "  --max-mem-mb 4096         skip points whose buffers exceed this\n"
+         << "  --dir /tmp                where source and received files go\n"
+         << "  --csv FILE --json FILE    result files, CSV rows are appended\n"
+         << "  --label NAME              revision column, the build's git describe by default\n"
+         << "  --verify                  compare every received file with the source" << endl;
+}
+
+int main(int narg, char *argv[])
+{
+    std::map<std::string, std::string> opts = {
+        {"block-kb", "256,1024,4096"}, {"block-num", "64,256"}, {"file-mb", "256"}, {"streams", "1,4"},
+        {"mode", "thread"}, {"files", "2"}, {"repeat", "1"}, {"max-mem-mb", "4096"}, {"dir", "/tmp"},
+        {"csv", ""}, {"json", ""}, {"label", BENCH_REVISION}};
+    bool verify = false;
+    for (int i = 1; i < narg; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--verify")
+            verify = true;
+        else if (arg.compare(0, 2, "--") == 0 && opts.count(arg.substr(2)) && i + 1 < narg)
+            opts[arg.substr(2)] = argv[++i];
+        else
+        {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+    int files = std::max(1, atoi(opts["files"].c_str()));
+    int repeat = std::max(1, atoi(opts["repeat"].c_str()));
+    uint64_t max_mem = strtoull(opts["max-mem-mb"].c_str(), nullptr, 10) << 20;
+
+    std::string dir_template = opts["dir"] + "/FileTransferBench.XXXXXX";
+    std::vector<char> dir_buf(dir_template.begin(), dir_template.end());
+    dir_buf.push_back('\0');
+    if (!mkdtemp(dir_buf.data()))
+    {
+        cout << "ERROR: unable to create a directory in " << opts["dir"] << ", errno: " << errno << endl;
+        return -1;
+    }
+    std::string dir = dir_buf.data();
+    std::string recv_dir = dir + "/recv";
+    mkdir(recv_dir.c_str(), 0755);
+    int ret = 0;
+    {
+        // a private conf, the user's local.conf is only the starting point
+        std::ifstream user_conf(getConfigPath(), std::ios::binary);
+        std::ofstream bench_conf(dir + "/local.conf", std::ios::binary);
+        if (user_conf)
+            bench_conf << user_conf.rdbuf();
+    }
+    {
+        LocalConf local_conf(dir + "/local.conf");
+        local_conf.loadConf();
+        local_conf.setSavedFolderPath(recv_dir);
+        HwRdma hwrdma(local_conf.getRdmaGidIndex(), (uint64_t)-1);
+        hwrdma.placement.configure(local_conf.getNumaNode(), local_conf.getPollCores(), local_conf.getIoCores());
+        hwrdma.setPortFilter(local_conf.getRdmaPorts());
+        bool rdma_ready = hwrdma.init() == 0;
+        std::string device = rdma_ready ? std::string(hwrdma.dev->name) + "x" + std::to_string(hwrdma.ports.size()) : "none";
+        double cycles_per_ns = cyclesPerNs();
+        std::string revision = opts["label"];
+
+        std::ofstream csv, json;
+        if (!opts["csv"].empty())
+        {
+            struct stat statbuf;
+            bool fresh = stat(opts["csv"].c_str(), &statbuf) != 0 || statbuf.st_size == 0;
+            csv.open(opts["csv"], std::ios::app);
+            if (fresh)
+                csv << CSV_HEADER << "\n";
+        }
+        if (!opts["json"].empty())
+        {
+            struct utsname uts;
+            uname(&uts);
+            json.open(opts["json"], std::ios::trunc);
+            json << "{\n  \"revision\": \"" << revision << "\", \"device\": \"" << device << "\", \"cpu\": \"" << cpuModel()
+                 << "\", \"cpus\": " << std::thread::hardware_concurrency() << ", \"kernel\": \"" << uts.release
+                 << "\", \"tsc_ghz\": " << cycles_per_ns << ",\n  \"runs\": [\n";
+        }
+        cout << "benchmark " << revision << " on " << device << ", " << cpuModel() << endl;
+        if (!checkPoolReuse(&hwrdma, local_conf, dir, rdma_ready))
+            ret = -1;
+        cout << CSV_HEADER << endl;
+        bool first = true;
+        for (auto &mode_arg : splitList(opts["mode"]))
+            for (auto &streams : splitList(opts["streams"]))
+                for (auto &file_mb : splitList(opts["file-mb"]))
+                    for (auto &block_kb : splitList(opts["block-kb"]))
+                        for (auto &block_num : splitList(opts["block-num"]))
+                            for (int rep = 0; rep < repeat; rep++)
+                            {
+                                BenchConfig cfg;
+                                cfg.mode = mode_arg.substr(0, mode_arg.find('+'));
+                                cfg.srq = mode_arg.find("+srq") != std::string::npos;
+                                cfg.block_kb = atoi(block_kb.c_str());
+                                cfg.block_num = atoi(block_num.c_str());
+                                cfg.file_mb = strtoull(file_mb.c_str(), nullptr, 10);
+                                cfg.streams = atoi(streams.c_str());
+                                cfg.rep = rep;
+                                BenchResult result;
+                                // both ends of a stream register the window
+                                uint64_t mem = 2ULL * cfg.block_kb * 1024 * cfg.block_num * cfg.streams;
+                                if (cfg.mode != "thread" && cfg.mode != "reactor" && cfg.mode != "pool" && cfg.mode != "tcp")
+                                    result.status = "bad_mode";
+                                else if (cfg.block_kb <= 0 || cfg.block_num <= 0 || cfg.file_mb == 0 || cfg.streams <= 0)
+                                    result.status = "bad_value";
+                                else if (cfg.mode != "tcp" && !rdma_ready)
+                                    result.status = "no_rdma";
+                                else if (mem > max_mem)
+                                    result.status = "skipped";
+                                else
+                                    result = runOne(cfg, &hwrdma, local_conf, dir, files, verify, cycles_per_ns);
+                                if (result.status != "ok" && result.status != "skipped")
+                                    ret = -1;
+                                writeRow(cout, revision, device, cfg, files, result, false);
+                                if (csv.is_open())
+                                    writeRow(csv, revision, device, cfg, files, result, false);
+                                if (json.is_open())
+                                {
+                                    json << (first ? "" : ",\n");
+                                    writeRow(json, revision, device, cfg, files, result, true);
+                                }
+                                first = false;
+                            }
+        if (json.is_open())
+            json << "\n  ]\n}\n";
+        for (auto &file_mb : splitList(opts["file-mb"]))
+            unlink((dir + "/source_" + file_mb + "m.bin").c_str());
+    }
+    unlink((dir + "/local.conf").c_str());
+    rmdir(recv_dir.c_str());
+    rmdir(dir.c_str());
+    return ret;
+}
@@ -1,5 +1,6 @@
 #include <wx/wx.h>
 #include "../interface/MainFrame.h"
+#include "../net/ConnectionPool.h"
 
 /**
  * @brief 文件上传客户端应用程序
@@ -7,6 +8,7 @@
 class FileUploadApp : public wxApp {
 public:
     virtual bool OnInit() override;
+    virtual int OnExit() override;
 };
 
 bool FileUploadApp::OnInit() {
@@ -20,4 +22,10 @@ bool FileUploadApp::OnInit() {
     return true;
 }
 
+int FileUploadApp::OnExit() {
+    // 窗口都已销毁，在 wx 清理之前关闭缓存的连接并保存配置
+    ConnectionPool::instance().shutdown();
+    return wxApp::OnExit();
+}
+
 wxIMPLEMENT_APP(FileUploadApp);
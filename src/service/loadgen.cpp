@@ -0,0 +1,453 @@
+// Headless load generator for a running FileUploadServer: N concurrent clients
+// arrive at a given rate, send files drawn from a size distribution with think
+// times in between, and the run ends with aggregate and per-client throughput,
+// Jain's fairness index, connection setup latency, rejections and the server's
+// memory use when it runs on this host.
+// Each client speaks the transport the server picks, RDMA when both ends have
+// a usable port, tcp otherwise, exactly like the GUI client.
+#include <unistd.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <signal.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "../utils/LocalConf.h"
+#include "../utils/Logger.h"
+#include "../net/HwRdma.h"
+#include "../net/StreamControl.h"
+using namespace std;
+
+// a file size distribution in bytes: "fixed:64", "uniform:1-256", "exp:64" or
+// "lognormal:64,1.0", sizes in MB
+class SizeDistribution
+{
+public:
+    int parse(const std::string &spec)
+    {
+        size_t colon = spec.find(':');
+        if (colon == std::string::npos)
+            return -1;
+        kind = spec.substr(0, colon);
+        std::string args = spec.substr(colon + 1);
+        size_t sep = args.find_first_of("-,");
+        a = atof(args.c_str());
+        b = sep == std::string::npos ? a : atof(args.c_str() + sep + 1);
+        if (a <= 0 || b <= 0)
+            return -1;
+        if (kind == "fixed" || kind == "exp")
+            return 0;
+        if (kind == "uniform")
+            return b >= a ? 0 : -1;
+        if (kind == "lognormal")
+            return sep == std::string::npos ? -1 : 0;
+        return -1;
+    }
+    uint64_t draw(std::mt19937_64 &rng) const
+    {
+        double mb = a;
+        if (kind == "uniform")
+            mb = std::uniform_real_distribution<double>(a, b)(rng);
+        else if (kind == "exp")
+            mb = std::exponential_distribution<double>(1.0 / a)(rng);
+        else if (kind == "lognormal")
+            mb = std::lognormal_distribution<double>(std::log(a), b)(rng);
+        return std::max<uint64_t>(1, (uint64_t)(mb * 1048576.0));
+    }
+
+private:
+    std::string kind;
+    double a = 0, b = 0;
+};
+
+// source files are shared by all clients, sizes snap to 4 steps per octave
+// so a wide distribution needs a few dozen files rather than one per draw
+class SourceFiles
+{
+public:
+    explicit SourceFiles(const std::string &dir) : dir(dir) {}
+    ~SourceFiles()
+    {
+        for (auto &it : files)
+            unlink(it.second.c_str());
+    }
+    static uint64_t bucket(uint64_t size)
+    {
+        uint64_t unit = 1 << 16;
+        if (size <= unit)
+            return unit;
+        double steps = std::ceil(std::log2((double)size / unit) * 4);
+        return (uint64_t)(unit * std::pow(2.0, steps / 4)) & ~(uint64_t)4095;
+    }
+    // path of a file of exactly size bytes, "" when it cannot be written
+    std::string get(uint64_t size)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = files.find(size);
+        if (it != files.end())
+            return it->second;
+        std::string path = dir + "/loadgen_src_" + std::to_string(size) + ".bin";
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        std::vector<char> chunk(1 << 20);
+        for (auto &c : chunk)
+            c = (char)rng();
+        for (uint64_t done = 0; done < size && out; done += chunk.size())
+            out.write(chunk.data(), std::min<uint64_t>(chunk.size(), size - done));
+        if (!out)
+        {
+            cout << "ERROR: unable to write source file " << path << endl;
+            unlink(path.c_str());
+            return "";
+        }
+        files[size] = path;
+        return path;
+    }
+
+private:
+    std::string dir;
+    std::mutex mutex;
+    std::map<uint64_t, std::string> files;
+    std::mt19937 rng{12345};
+};
+
+class LoadProgress : public TransferProgress
+{
+public:
+    int caculateTransferInfo(unsigned long /*bytes_transferred*/, double /*duration*/, unsigned long /*piece_size*/) override { return 0; }
+    bool checkCancel() override { return false; }
+};
+
+enum ClientOutcome
+{
+    CLIENT_OK,
+    CLIENT_CONNECT_FAILED, // connect() itself failed, listen backlog full or server down
+    CLIENT_REJECTED,       // accepted and closed before the hello, MaxConnNum reached
+    CLIENT_SETUP_FAILED,
+    CLIENT_TRANSFER_FAILED,
+};
+
+struct ClientStats
+{
+    ClientOutcome outcome = CLIENT_OK;
+    std::string transport = "-";
+    double setup_ms = 0;
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+    double busy_sec = 0; // time spent in postSendFile
+    double alive_sec = 0;
+};
+
+static double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(values.size() * p))];
+}
+
+// resident memory of a process in KB, -1 when it cannot be read
+static long readRssKb(int pid)
+{
+    std::ifstream in("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(in, line))
+        if (line.compare(0, 6, "VmRSS:") == 0)
+            return atol(line.c_str() + 6);
+    return -1;
+}
+
+static int findServerPid()
+{
+    DIR *dir = opendir("/proc");
+    if (dir == nullptr)
+        return 0;
+    int pid = 0;
+    struct dirent *entry;
+    while (pid == 0 && (entry = readdir(dir)) != nullptr)
+    {
+        std::ifstream comm(std::string("/proc/") + entry->d_name + "/comm");
+        std::string name;
+        // comm is cut to 15 characters
+        if (std::getline(comm, name) && name == std::string("FileUploadServer").substr(0, 15))
+            pid = atoi(entry->d_name);
+    }
+    closedir(dir);
+    return pid;
+}
+
+struct LoadOptions
+{
+    std::string ip = "127.0.0.1";
+    int port = 0;
+    int clients = 16;
+    double arrival_rate = 0; // clients per second, 0 starts all at once
+    double think_ms = 0;     // mean of an exponential think time between files
+    int files = 4;           // per client, 0 sends until the duration ends
+    double duration = 0;     // seconds, 0 ends after the files
+    std::string transport = "auto";
+    SizeDistribution sizes;
+    uint64_t seed = 1;
+};
+
+static void runClient(int id, const LoadOptions &opt, HwRdma *hwrdma, LocalConf *local_conf, SourceFiles *sources,
+                      std::chrono::steady_clock::time_point deadline, ClientStats &stats)
+{
+    std::mt19937_64 rng(opt.seed * 1000003 + id);
+    auto start = chrono::steady_clock::now();
+    struct sockaddr_in addr;
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(opt.ip.c_str());
+    addr.sin_port = htons(opt.port);
+    int peer_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (peer_fd < 0 || connect(peer_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        if (peer_fd >= 0)
+            close(peer_fd);
+        stats.outcome = CLIENT_CONNECT_FAILED;
+        return;
+    }
+    std::unique_ptr<Transport> transport;
+    std::unique_ptr<StreamControl> conn;
+    int ret = 0;
+    if (hwrdma != nullptr && opt.transport != "tcp")
+    {
+        conn.reset(new StreamControl(hwrdma, peer_fd, local_conf));
+        ret = conn->createLucpContext();
+    }
+    if (ret == 0)
+        transport = Transport::negotiate(peer_fd, std::move(conn), local_conf, ret);
+    stats.setup_ms = chrono::duration<double, std::milli>(chrono::steady_clock::now() - start).count();
+    if (ret != 0)
+    {
+        // the server closes a connection over MaxConnNum before it says hello,
+        // with our hello unread that is a reset rather than an eof
+        char c;
+        ssize_t n = recv(peer_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        bool closed = n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+        stats.outcome = ret == -2 && closed ? CLIENT_REJECTED : CLIENT_SETUP_FAILED;
+        transport.reset();
+        close(peer_fd);
+        stats.alive_sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return;
+    }
+    stats.transport = transport->getName();
+    LoadProgress progress;
+    for (int n = 0; opt.files == 0 || n < opt.files; n++)
+    {
+        if (opt.duration > 0 && chrono::steady_clock::now() >= deadline)
+            break;
+        if (n > 0 && opt.think_ms > 0)
+        {
+            double think = std::exponential_distribution<double>(1.0 / opt.think_ms)(rng);
+            std::this_thread::sleep_for(chrono::microseconds((int64_t)(think * 1000)));
+        }
+        uint64_t size = SourceFiles::bucket(opt.sizes.draw(rng));
+        std::string path = sources->get(size);
+        if (path.empty())
+        {
+            stats.outcome = CLIENT_TRANSFER_FAILED;
+            break;
+        }
+        std::string name = "loadgen_" + std::to_string(id) + "_" + std::to_string(n) + ".bin";
+        auto t0 = chrono::steady_clock::now();
+        ret = transport->postSendFile(path.c_str(), name.c_str(), &progress);
+        stats.busy_sec += chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        if (ret != 0)
+        {
+            stats.outcome = CLIENT_TRANSFER_FAILED;
+            break;
+        }
+        stats.files++;
+        stats.bytes += size;
+    }
+    transport.reset();
+    close(peer_fd);
+    stats.alive_sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void usage(const char *prog)
+{
+    cout << "usage: " << prog << " --port PORT [options]\n"
+         << "  --ip 127.0.0.1            server address\n"
+         << "  --clients 16              concurrent clients\n"
+         << "  --arrival-rate 0          new clients per second (poisson), 0 starts all at once\n"
+         << "  --sizes fixed:64          file sizes in MB: fixed:S, uniform:A-B, exp:MEAN, lognormal:MEDIAN,SIGMA\n"
+         << "  --files 4                 files per client, 0 sends until --duration ends\n"
+         << "  --duration 0              seconds, stops new files after it\n"
+         << "  --think-ms 0              mean think time between two files of a client\n"
+         << "  --transport auto          auto (rdma when both ends can) or tcp\n"
+         << "  --block-num N             client window, default from local.conf\n"
+         << "  --server-pid 0            server to sample memory of, 0 looks for FileUploadServer\n"
+         << "  --seed 1                  random seed of sizes, arrivals and think times\n"
+         << "  --dir /tmp                where the source files are written\n"
+         << "  --csv FILE                per client rows" << endl;
+}
+
+int main(int narg, char *argv[])
+{
+    std::map<std::string, std::string> opts = {
+        {"ip", "127.0.0.1"}, {"port", ""}, {"clients", "16"}, {"arrival-rate", "0"}, {"sizes", "fixed:64"},
+        {"files", "4"}, {"duration", "0"}, {"think-ms", "0"}, {"transport", "auto"}, {"block-num", "0"},
+        {"server-pid", "0"}, {"seed", "1"}, {"dir", "/tmp"}, {"csv", ""}};
+    for (int i = 1; i < narg; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") == 0 && opts.count(arg.substr(2)) && i + 1 < narg)
+            opts[arg.substr(2)] = argv[++i];
+        else
+        {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    LoadOptions opt;
+    opt.ip = opts["ip"];
+    opt.port = atoi(opts["port"].c_str());
+    opt.clients = atoi(opts["clients"].c_str());
+    opt.arrival_rate = atof(opts["arrival-rate"].c_str());
+    opt.files = atoi(opts["files"].c_str());
+    opt.duration = atof(opts["duration"].c_str());
+    opt.think_ms = atof(opts["think-ms"].c_str());
+    opt.transport = opts["transport"];
+    opt.seed = strtoull(opts["seed"].c_str(), nullptr, 10);
+    if (opt.port <= 0 || opt.clients <= 0 || (opt.files <= 0 && opt.duration <= 0) || opt.sizes.parse(opts["sizes"]) ||
+        (opt.transport != "auto" && opt.transport != "tcp"))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // a private copy of the user's local.conf, the overrides never reach the file
+    LocalConf local_conf(getConfigPath());
+    local_conf.setSaveOnExit(false);
+    if (local_conf.loadConf())
+        return -1;
+    if (atoi(opts["block-num"].c_str()) > 0)
+        local_conf.setBlockNum(atoi(opts["block-num"].c_str()));
+    std::unique_ptr<HwRdma> hwrdma;
+    if (opt.transport != "tcp")
+    {
+        hwrdma.reset(new HwRdma(local_conf.getRdmaGidIndex(), (uint64_t)-1));
+        hwrdma->placement.configure(local_conf.getNumaNode(), local_conf.getPollCores(), local_conf.getIoCores());
+        hwrdma->setPortFilter(local_conf.getRdmaPorts());
+        if (hwrdma->init())
+        {
+            cout << "WARNING: no usable RDMA device, every client uses tcp." << endl;
+            hwrdma.reset();
+        }
+    }
+    int server_pid = atoi(opts["server-pid"].c_str());
+    if (server_pid == 0)
+        server_pid = findServerPid();
+    SourceFiles sources(opts["dir"]);
+
+    // server memory is sampled for the whole run
+    std::atomic<bool> finished(false);
+    long rss_start = server_pid > 0 ? readRssKb(server_pid) : -1, rss_peak = rss_start;
+    std::thread sampler([&]()
+                        {
+        while (!finished && server_pid > 0)
+        {
+            rss_peak = std::max(rss_peak, readRssKb(server_pid));
+            std::this_thread::sleep_for(chrono::milliseconds(100));
+        } });
+
+    std::vector<ClientStats> stats(opt.clients);
+    std::vector<std::thread> clients;
+    std::mt19937_64 arrivals(opt.seed);
+    auto start = chrono::steady_clock::now();
+    auto deadline = start + chrono::microseconds((int64_t)(opt.duration * 1e6));
+    auto next_arrival = start;
+    for (int i = 0; i < opt.clients; i++)
+    {
+        if (opt.arrival_rate > 0)
+        {
+            std::this_thread::sleep_until(next_arrival);
+            next_arrival += chrono::microseconds((int64_t)(std::exponential_distribution<double>(opt.arrival_rate)(arrivals) * 1e6));
+        }
+        clients.emplace_back(runClient, i, std::cref(opt), hwrdma.get(), &local_conf, &sources, deadline, std::ref(stats[i]));
+    }
+    for (auto &thr : clients)
+        thr.join();
+    double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    finished = true;
+    sampler.join();
+    // transfer logs go out before the summary
+    Logger::flush();
+    long rss_end = server_pid > 0 ? readRssKb(server_pid) : -1;
+
+    uint64_t total_bytes = 0, total_files = 0;
+    int outcomes[CLIENT_TRANSFER_FAILED + 1] = {0};
+    std::map<std::string, int> transports;
+    std::vector<double> setup_ms, gbps;
+    double sum = 0, sum_sq = 0;
+    for (auto &s : stats)
+    {
+        outcomes[s.outcome]++;
+        total_bytes += s.bytes;
+        total_files += s.files;
+        if (s.outcome == CLIENT_CONNECT_FAILED || s.outcome == CLIENT_REJECTED)
+            continue;
+        setup_ms.push_back(s.setup_ms);
+        transports[s.transport]++;
+        if (s.alive_sec <= 0 || s.files == 0)
+            continue;
+        // goodput over the client's whole life, think time included
+        double g = s.bytes * 8.0 / s.alive_sec / 1e9;
+        gbps.push_back(g);
+        sum += g;
+        sum_sq += g * g;
+    }
+    double jain = sum_sq > 0 ? sum * sum / (gbps.size() * sum_sq) : 0;
+
+    cout << "clients " << opt.clients << ", sizes " << opts["sizes"] << ", " << total_files << " files, "
+         << total_bytes / 1e9 << " GB in " << wall << " sec" << endl;
+    cout << "  aggregate " << total_bytes * 8.0 / wall / 1e9 << " Gbps" << endl;
+    cout << "  per client Gbps: min " << percentile(gbps, 0) << "  p50 " << percentile(gbps, 0.5)
+         << "  max " << percentile(gbps, 1) << "  jain " << jain << endl;
+    cout << "  setup ms: p50 " << percentile(setup_ms, 0.5) << "  p99 " << percentile(setup_ms, 0.99)
+         << "  max " << percentile(setup_ms, 1) << endl;
+    cout << "  transports:";
+    for (auto &it : transports)
+        cout << " " << it.first << "=" << it.second;
+    cout << endl;
+    cout << "  ok " << outcomes[CLIENT_OK] << ", connect failed " << outcomes[CLIENT_CONNECT_FAILED]
+         << ", rejected " << outcomes[CLIENT_REJECTED] << ", setup failed " << outcomes[CLIENT_SETUP_FAILED]
+         << ", transfer failed " << outcomes[CLIENT_TRANSFER_FAILED] << endl;
+    if (server_pid > 0 && rss_start >= 0)
+        cout << "  server " << server_pid << " rss MB: start " << rss_start / 1024.0 << "  peak " << rss_peak / 1024.0
+             << "  end " << rss_end / 1024.0 << endl;
+    else
+        cout << "  server memory not sampled, it does not run on this host" << endl;
+
+    if (!opts["csv"].empty())
+    {
+        static const char *outcome_names[] = {"ok", "connect_failed", "rejected", "setup_failed", "transfer_failed"};
+        std::ofstream csv(opts["csv"], std::ios::trunc);
+        csv << "client,outcome,transport,setup_ms,files,bytes,busy_sec,alive_sec,gbps\n";
+        for (int i = 0; i < opt.clients; i++)
+        {
+            ClientStats &s = stats[i];
+            csv << i << "," << outcome_names[s.outcome] << "," << s.transport << "," << s.setup_ms << "," << s.files
+                << "," << s.bytes << "," << s.busy_sec << "," << s.alive_sec << ","
+                << (s.alive_sec > 0 ? s.bytes * 8.0 / s.alive_sec / 1e9 : 0) << "\n";
+        }
+    }
+    return outcomes[CLIENT_OK] == opt.clients ? 0 : -1;
+}
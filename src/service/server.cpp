@@ -11,25 +11,70 @@
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <memory>
+#include <algorithm>
 
 #include "../utils/LocalConf.h"
 #include "../utils/ClientInfo.h"
+#include "../utils/Logger.h"
 #include "../net/HwRdma.h"
 #include "../net/StreamControl.h"
+#include "../net/ReceiveServer.h"
+#include "../net/ServerMetrics.h"
+#include <poll.h>
 using namespace std;
 
+static std::atomic<bool> server_stopped(false);
+
+static void onStopSignal(int)
+{
+    server_stopped = true;
+}
+
 int main(int narg, char *argv[])
 {
     LocalConf local_conf(getConfigPath());
     if(local_conf.loadConf())
         return -1;
     signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, onStopSignal);
+    signal(SIGTERM, onStopSignal);
     // Create an hdRDMA object
-    HwRdma hwrdma(local_conf.getRdmaGidIndex(), 1024UL * local_conf.getBlockSize() * local_conf.getBlockNum() * local_conf.getMaxThreadNum());
-    if(hwrdma.init())
-    {
-        cout << "ERROR: initializing hwrdma!" << endl;
+    uint64_t block_size = 1024UL * local_conf.getBlockSize();
+    uint64_t buffer_size = block_size * local_conf.getBlockNum() * local_conf.getConnSlots();
+    if (local_conf.getUseSrq())
+        buffer_size = block_size * local_conf.getSrqBlockNum();
+    HwRdma hwrdma(local_conf.getRdmaGidIndex(), buffer_size);
+    hwrdma.placement.configure(local_conf.getNumaNode(), local_conf.getPollCores(), local_conf.getIoCores());
+    hwrdma.setPortFilter(local_conf.getRdmaPorts());
+    // without a usable RDMA port every client is served over tcp
+    bool rdma_ready = hwrdma.init() == 0;
+    if (!rdma_ready)
+        LOGW << "no usable RDMA device, serving over the tcp transport only.";
+    ReceiveServer receive_server(&hwrdma, &local_conf, rdma_ready);
+    if (receive_server.start())
+        return -1;
+    // scrapes only read the counters of the transfer path
+    MetricsServer metrics(receive_server.getContext(), &hwrdma);
+    if (!local_conf.getMetricsListen().empty() && metrics.start(local_conf.getMetricsListen()))
         return -1;
+    std::thread reporter;
+    if (local_conf.getShareReportInterval() > 0)
+    {
+        int interval = local_conf.getShareReportInterval();
+        reporter = std::thread([&receive_server, interval]()
+                             {
+            auto last_report = std::chrono::steady_clock::now();
+            while (!server_stopped)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                if (std::chrono::steady_clock::now() - last_report < std::chrono::seconds(interval))
+                    continue;
+                last_report = std::chrono::steady_clock::now();
+                Logger::Line line(LOG_LEVEL_INFO);
+                receive_server.report(line.stream());
+                StageLatency::global().report(line.stream(), "Block latency since start");
+            } });
     }
     {
         struct sockaddr_in addr;
@@ -44,41 +89,23 @@ int main(int narg, char *argv[])
         auto ret = bind(server_sockfd, (struct sockaddr *)&addr, sizeof(addr));
         if (ret != 0)
         {
-            cout << "ERROR: binding server socket!" << endl;
+            LOGE << "binding server socket!";
             return -1;
         }
-        listen(server_sockfd, local_conf.getMaxThreadNum());
-
-        // Loop forever accepting connections
-        cout << "Listening for connections on port ... " << local_conf.getLocalPort() << endl;
-        ClientList client_list;
-        while (1)
-        {
-            int peer_sockfd = -1;
-            struct sockaddr_in peer_addr;
-            socklen_t peer_addr_len = sizeof(struct sockaddr_in);
-            peer_sockfd = accept(server_sockfd, (struct sockaddr *)&peer_addr, &peer_addr_len);
-            if (peer_sockfd < 0)
-            {
-                cout << "Failed connection!  errno=" << errno << endl;
-                continue;
-            }
-            {
-                if(client_list.getClientNum() >= local_conf.getMaxThreadNum())
-                {
-                    close(peer_sockfd);
-                    continue;
-                }
-                client_list.addClient(peer_sockfd, peer_addr.sin_addr.s_addr);
-                cout << "Connection from " << inet_ntoa(peer_addr.sin_addr) << endl;
-            }
+        listen(server_sockfd, local_conf.getConnSlots());
+        metrics.setAcceptFd(server_sockfd);
 
-            // Create a new thread to handle this connection
-            std::thread thr(recvData, &hwrdma, peer_sockfd, &local_conf, &client_list);
-            thr.detach();
-        }
+        // Loop accepting connections until SIGINT/SIGTERM
+        LOGI << "Listening for connections on port ... " << local_conf.getLocalPort();
+        receive_server.serve(server_sockfd, server_stopped);
+        metrics.setAcceptFd(-1);
+        close(server_sockfd);
     }
-
+    LOGI << "Shutting down ...";
+    if (reporter.joinable())
+        reporter.join();
+    metrics.stop();
+    receive_server.stop();
     return 0;
 }
 
@@ -0,0 +1,1158 @@
+// 模拟 verbs 设备的实现，见 MockVerbs.h
+#include <infiniband/verbs.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "MockVerbs.h"
+
+// verbs.h 把这几个函数包成了宏，这里定义的是真正的符号
+#undef ibv_reg_mr
+#undef ibv_query_port
+#undef ibv_get_device_list
+
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+const int MOCK_MAX_PORTS = 4;
+const int MOCK_GID_NUM = 16;
+const int MOCK_MAX_CQE = 4194303;
+const uint32_t MOCK_MAX_WR = 32768;
+const uint32_t MOCK_MAX_SGE = 16;
+// 距离下一个事件不到这么久就自旋等待，条件变量唤醒本身就要几十微秒
+const auto SPIN_WAIT = std::chrono::microseconds(50);
+
+Clock::duration usec(double us)
+{
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::micro>(us));
+}
+
+struct MockContext : ibv_context
+{
+    int async_pipe[2] = {-1, -1};
+    std::deque<struct ibv_async_event> events; // 由 Fabric::mutex 保护
+};
+
+struct MockCq : ibv_cq
+{
+    std::mutex mutex;
+    std::deque<struct ibv_wc> wcs;
+    bool overrun = false;
+};
+
+struct RecvWr
+{
+    uint64_t wr_id;
+    std::vector<struct ibv_sge> sges;
+};
+
+struct MockSrq : ibv_srq
+{
+    std::deque<RecvWr> wrs;
+    uint32_t max_wr = 0;
+    uint32_t max_sge = 0;
+    uint32_t limit = 0; // 0 表示未布防
+};
+
+struct MockQp : ibv_qp
+{
+    MockSrq *mock_srq = nullptr;
+    std::deque<RecvWr> rq;
+    struct ibv_qp_cap cap;
+    bool sq_sig_all = false;
+    uint8_t port_num = 1;
+    uint32_t dest_qp_num = 0;
+    uint8_t min_rnr_timer = 0;
+    uint8_t timeout = 0;
+    uint8_t retry_cnt = 0;
+    uint8_t rnr_retry = 0;
+    uint32_t send_outstanding = 0;
+    Clock::time_point last_arrival; // 保序消息里最晚的到达时间
+    int busy = 0;                   // 后台线程正在拷贝它的数据
+};
+
+enum EventKind
+{
+    EVENT_DELIVER, // 数据到达接收端
+    EVENT_ACK      // 确认回到发送端
+};
+
+struct Event
+{
+    EventKind kind = EVENT_DELIVER;
+    uint32_t src_qpn = 0;
+    uint32_t dst_qpn = 0;
+    uint64_t wr_id = 0;
+    bool signaled = false;
+    bool with_imm = false;
+    uint32_t imm_data = 0; // 网络字节序，原样交给接收端
+    std::vector<struct ibv_sge> sges;
+    uint32_t byte_len = 0;
+    enum ibv_wc_status status = IBV_WC_SUCCESS;
+    int rnr_tries = 0;
+    Clock::time_point at;
+};
+
+// 所有设备对象共享的状态与投递线程
+// 故意不析构：进程退出时静态对象里的 HwRdma 可能还要释放资源
+class Fabric
+{
+public:
+    static Fabric &instance()
+    {
+        static Fabric *fabric = new Fabric();
+        return *fabric;
+    }
+
+    std::mutex mutex;
+    // 同一时刻只有一个线程投递事件，保证同一 QP 的完成按序入队。
+    // 加锁顺序为 progress_mutex -> mutex
+    std::mutex progress_mutex;
+    MockLink link;
+    std::map<uint32_t, MockQp *> qps;
+    std::map<uint32_t, struct ibv_mr *> mrs;
+    uint32_t next_qpn = 0x100;
+    uint32_t next_key = 0x1000;
+
+    void configure(const MockLink &new_link)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        setLink(new_link);
+        configured = true;
+    }
+    void start()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (started)
+            return;
+        if (!configured)
+            setLink(MockFabric::linkFromEnv());
+        started = true;
+        std::thread thr(&Fabric::run, this);
+        pthread_setname_np(thr.native_handle(), "mock-fabric");
+        thr.detach();
+    }
+
+    // 以下都要求调用者持有 mutex
+    MockQp *findQp(uint32_t qpn)
+    {
+        auto it = qps.find(qpn);
+        return it == qps.end() ? nullptr : it->second;
+    }
+    int postSend(MockQp *qp, struct ibv_send_wr *wr, struct ibv_send_wr **bad_wr);
+    int postRecv(std::deque<RecvWr> &queue, uint32_t max_wr, uint32_t max_sge, struct ibv_recv_wr *wr, struct ibv_recv_wr **bad_wr);
+    void flushRecv(MockQp *qp, uint64_t wr_id);
+    void setError(MockQp *qp);
+    void reset(MockQp *qp);
+    void waitIdle(MockQp *qp, std::unique_lock<std::mutex> &lock)
+    {
+        idle_cond.wait(lock, [&]()
+                       { return qp->busy == 0; });
+    }
+    void pushWc(struct ibv_cq *cq, const struct ibv_wc &wc);
+    // 轮询 CQ 落空的调用者顺便投递到期的事件，不持有任何锁时调用
+    bool progress();
+    void pushAsync(struct ibv_context *ctx, const struct ibv_async_event &event);
+    void report(std::ostream &os);
+
+private:
+    std::condition_variable cond;      // 有了更早的事件
+    std::condition_variable idle_cond; // 某个 QP 的 busy 归零
+    std::map<std::pair<Clock::time_point, uint64_t>, Event> events;
+    uint64_t event_seq = 0;
+    Clock::time_point link_free[MOCK_MAX_PORTS + 1];
+    std::mt19937 rng;
+    std::uniform_real_distribution<double> uniform{0.0, 1.0};
+    bool configured = false;
+    bool started = false;
+
+    // 统计
+    uint64_t stat_msgs = 0;
+    uint64_t stat_bytes = 0;
+    uint64_t stat_rnr = 0;
+    uint64_t stat_reordered = 0;
+    uint64_t stat_errors = 0;
+    uint64_t stat_flushed = 0;
+    size_t stat_max_pending = 0;
+    double stat_lag_us = 0; // 实际投递时间比计划晚了多少，反映模拟器自身的开销
+    double stat_max_lag_us = 0;
+
+    void setLink(const MockLink &new_link)
+    {
+        link = new_link;
+        link.ports = std::max(1, std::min(MOCK_MAX_PORTS, link.ports));
+        rng.seed(link.seed);
+    }
+    void run();
+    int runDue(std::unique_lock<std::mutex> &lock);
+    void schedule(Event &&ev);
+    void resend(Event &&ev);
+    void deliver(Event &ev, std::unique_lock<std::mutex> &lock);
+    void complete(Event &ev);
+    void ack(Event &ev, enum ibv_wc_status status, Clock::time_point at);
+    bool checkSges(const std::vector<struct ibv_sge> &sges, struct ibv_pd *pd, uint64_t *total);
+    Clock::duration oneWay()
+    {
+        double us = link.rtt_us / 2;
+        if (link.jitter_us > 0)
+            us += link.jitter_us * uniform(rng);
+        return usec(us);
+    }
+    static Clock::duration rnrDelay(uint8_t timer);
+    static Clock::duration retryTimeout(const MockQp *qp);
+};
+
+// IB 规范里 min_rnr_timer 编码对应的等待时间（微秒）
+Clock::duration Fabric::rnrDelay(uint8_t timer)
+{
+    static const uint32_t table[32] = {655360, 10, 20, 30, 40, 60, 80, 120, 160, 240, 320, 480, 640, 960, 1280, 1920,
+                                       2560, 3840, 5120, 7680, 10240, 15360, 20480, 30720, 40960, 61440, 81920,
+                                       122880, 163840, 245760, 327680, 491520};
+    return std::chrono::microseconds(table[timer & 31]);
+}
+
+// 4.096us * 2^timeout，重传 retry_cnt 次后放弃，timeout 为 0 表示一直等
+Clock::duration Fabric::retryTimeout(const MockQp *qp)
+{
+    if (qp->timeout == 0)
+        return Clock::duration::max();
+    return usec(4.096 * (double)(1ULL << std::min<int>(qp->timeout, 31)) * (qp->retry_cnt + 1));
+}
+
+void Fabric::schedule(Event &&ev)
+{
+    auto key = std::make_pair(ev.at, event_seq++);
+    bool earliest = events.empty() || key < events.begin()->first;
+    events.emplace(key, std::move(ev));
+    stat_max_pending = std::max(stat_max_pending, events.size());
+    if (earliest)
+        cond.notify_one();
+}
+
+// RNR 之后发送端从这条消息开始重传，同一 QP 后面的消息排在它之后
+void Fabric::resend(Event &&ev)
+{
+    std::vector<Event> later;
+    for (auto it = events.begin(); it != events.end();)
+    {
+        if (it->second.kind == EVENT_DELIVER && it->second.src_qpn == ev.src_qpn)
+        {
+            later.push_back(std::move(it->second));
+            it = events.erase(it);
+        }
+        else
+            ++it;
+    }
+    Clock::time_point at = ev.at;
+    uint32_t src_qpn = ev.src_qpn;
+    schedule(std::move(ev));
+    for (auto &next : later)
+    {
+        next.at = std::max(next.at, at);
+        at = next.at;
+        schedule(std::move(next));
+    }
+    MockQp *src = findQp(src_qpn);
+    if (src != nullptr)
+        src->last_arrival = std::max(src->last_arrival, at);
+}
+
+int Fabric::postSend(MockQp *qp, struct ibv_send_wr *wr, struct ibv_send_wr **bad_wr)
+{
+    for (; wr != nullptr; wr = wr->next)
+    {
+        if (qp->state == IBV_QPS_ERR)
+        {
+            // 出错的 QP 上新发的请求直接 flush
+            struct ibv_wc wc;
+            bzero(&wc, sizeof(wc));
+            wc.wr_id = wr->wr_id;
+            wc.status = IBV_WC_WR_FLUSH_ERR;
+            wc.opcode = IBV_WC_SEND;
+            wc.qp_num = qp->qp_num;
+            pushWc(qp->send_cq, wc);
+            stat_flushed++;
+            continue;
+        }
+        int err = 0;
+        if (qp->state != IBV_QPS_RTS)
+            err = EINVAL;
+        else if (wr->opcode != IBV_WR_SEND && wr->opcode != IBV_WR_SEND_WITH_IMM)
+            err = EINVAL;
+        else if (wr->num_sge < 0 || (uint32_t)wr->num_sge > qp->cap.max_send_sge)
+            err = EINVAL;
+        else if (qp->send_outstanding >= qp->cap.max_send_wr)
+            err = ENOMEM;
+        if (err)
+        {
+            *bad_wr = wr;
+            return err;
+        }
+        Event ev;
+        ev.src_qpn = qp->qp_num;
+        ev.dst_qpn = qp->dest_qp_num;
+        ev.wr_id = wr->wr_id;
+        ev.signaled = (wr->send_flags & IBV_SEND_SIGNALED) || qp->sq_sig_all;
+        ev.with_imm = wr->opcode == IBV_WR_SEND_WITH_IMM;
+        ev.imm_data = wr->imm_data;
+        for (int i = 0; i < wr->num_sge; i++)
+        {
+            ev.sges.push_back(wr->sg_list[i]);
+            ev.byte_len += wr->sg_list[i].length;
+        }
+        qp->send_outstanding++;
+
+        // 消息在接收端口上排队，所有连接共享这个端口的带宽
+        MockQp *dst = findQp(qp->dest_qp_num);
+        int port = dst != nullptr ? dst->port_num : qp->port_num;
+        auto now = Clock::now();
+        auto begin = std::max(now, link_free[port]);
+        auto wire = link.gbps > 0 ? usec(ev.byte_len * 8.0 / (link.gbps * 1e3)) : Clock::duration::zero();
+        link_free[port] = begin + wire;
+        ev.at = link_free[port] + oneWay();
+        if (link.reorder > 0 && uniform(rng) < link.reorder)
+        {
+            // 默认让后面两条同样大小的消息先到
+            ev.at += link.reorder_us > 0 ? usec(link.reorder_us) : usec(std::max(link.rtt_us, 10.0)) + 2 * wire;
+            stat_reordered++;
+        }
+        else
+        {
+            ev.at = std::max(ev.at, qp->last_arrival);
+            qp->last_arrival = ev.at;
+        }
+        schedule(std::move(ev));
+    }
+    return 0;
+}
+
+int Fabric::postRecv(std::deque<RecvWr> &queue, uint32_t max_wr, uint32_t max_sge, struct ibv_recv_wr *wr, struct ibv_recv_wr **bad_wr)
+{
+    for (; wr != nullptr; wr = wr->next)
+    {
+        int err = 0;
+        if (wr->num_sge < 0 || (uint32_t)wr->num_sge > max_sge)
+            err = EINVAL;
+        else if (queue.size() >= max_wr)
+            err = ENOMEM;
+        if (err)
+        {
+            *bad_wr = wr;
+            return err;
+        }
+        RecvWr recv_wr;
+        recv_wr.wr_id = wr->wr_id;
+        recv_wr.sges.assign(wr->sg_list, wr->sg_list + wr->num_sge);
+        queue.push_back(std::move(recv_wr));
+    }
+    return 0;
+}
+
+void Fabric::flushRecv(MockQp *qp, uint64_t wr_id)
+{
+    struct ibv_wc wc;
+    bzero(&wc, sizeof(wc));
+    wc.wr_id = wr_id;
+    wc.status = IBV_WC_WR_FLUSH_ERR;
+    wc.opcode = IBV_WC_RECV;
+    wc.qp_num = qp->qp_num;
+    pushWc(qp->recv_cq, wc);
+    stat_flushed++;
+}
+
+// 接收队列和未完成的发送都以 WR_FLUSH_ERR 完成
+void Fabric::setError(MockQp *qp)
+{
+    if (qp->state == IBV_QPS_ERR)
+        return;
+    qp->state = IBV_QPS_ERR;
+    for (auto &recv_wr : qp->rq)
+        flushRecv(qp, recv_wr.wr_id);
+    qp->rq.clear();
+    for (auto it = events.begin(); it != events.end();)
+    {
+        if (it->second.src_qpn != qp->qp_num)
+        {
+            ++it;
+            continue;
+        }
+        struct ibv_wc wc;
+        bzero(&wc, sizeof(wc));
+        wc.wr_id = it->second.wr_id;
+        wc.status = IBV_WC_WR_FLUSH_ERR;
+        wc.opcode = IBV_WC_SEND;
+        wc.qp_num = qp->qp_num;
+        pushWc(qp->send_cq, wc);
+        stat_flushed++;
+        qp->send_outstanding--;
+        it = events.erase(it);
+    }
+}
+
+// 回到 RESET，什么完成都不产生
+void Fabric::reset(MockQp *qp)
+{
+    qp->state = IBV_QPS_RESET;
+    qp->rq.clear();
+    for (auto it = events.begin(); it != events.end();)
+    {
+        if (it->second.src_qpn == qp->qp_num)
+            it = events.erase(it);
+        else
+            ++it;
+    }
+    qp->send_outstanding = 0;
+    qp->last_arrival = Clock::time_point();
+}
+
+void Fabric::pushWc(struct ibv_cq *ibv_cq, const struct ibv_wc &wc)
+{
+    MockCq *cq = static_cast<MockCq *>(ibv_cq);
+    {
+        std::lock_guard<std::mutex> lock(cq->mutex);
+        if (cq->overrun)
+            return;
+        if ((int)cq->wcs.size() < cq->cqe)
+        {
+            cq->wcs.push_back(wc);
+            return;
+        }
+        cq->overrun = true;
+    }
+    std::cout << "WARNING: mock cq overrun, " << cq->cqe << " entries." << std::endl;
+    struct ibv_async_event event;
+    bzero(&event, sizeof(event));
+    event.event_type = IBV_EVENT_CQ_ERR;
+    event.element.cq = cq;
+    pushAsync(cq->context, event);
+}
+
+void Fabric::pushAsync(struct ibv_context *ctx, const struct ibv_async_event &event)
+{
+    MockContext *mock_ctx = static_cast<MockContext *>(ctx);
+    mock_ctx->events.push_back(event);
+    char c = 'e';
+    if (write(mock_ctx->async_pipe[1], &c, 1) != 1)
+        std::cout << "WARNING: mock async event lost." << std::endl;
+}
+
+bool Fabric::checkSges(const std::vector<struct ibv_sge> &sges, struct ibv_pd *pd, uint64_t *total)
+{
+    *total = 0;
+    for (auto &sge : sges)
+    {
+        auto it = mrs.find(sge.lkey);
+        if (it == mrs.end() || it->second->pd != pd)
+            return false;
+        uint64_t begin = (uint64_t)it->second->addr;
+        if (sge.addr < begin || sge.addr + sge.length > begin + it->second->length)
+            return false;
+        *total += sge.length;
+    }
+    return true;
+}
+
+void Fabric::ack(Event &ev, enum ibv_wc_status status, Clock::time_point at)
+{
+    ev.kind = EVENT_ACK;
+    ev.status = status;
+    ev.at = at;
+    schedule(std::move(ev));
+}
+
+void Fabric::deliver(Event &ev, std::unique_lock<std::mutex> &lock)
+{
+    MockQp *src = findQp(ev.src_qpn);
+    if (src == nullptr || src->state != IBV_QPS_RTS)
+        return;
+    auto now = Clock::now();
+    MockQp *dst = findQp(ev.dst_qpn);
+    if (dst == nullptr || (dst->state != IBV_QPS_RTR && dst->state != IBV_QPS_RTS) || dst->dest_qp_num != ev.src_qpn)
+    {
+        // 对端不应答，发送端重传到次数用完
+        auto timeout = retryTimeout(src);
+        if (timeout != Clock::duration::max())
+            ack(ev, IBV_WC_RETRY_EXC_ERR, now + timeout);
+        return;
+    }
+    std::deque<RecvWr> &rq = dst->mock_srq != nullptr ? dst->mock_srq->wrs : dst->rq;
+    if (rq.empty())
+    {
+        stat_rnr++;
+        if (src->rnr_retry != 7 && ev.rnr_tries++ >= src->rnr_retry)
+        {
+            ack(ev, IBV_WC_RNR_RETRY_EXC_ERR, now + usec(link.rtt_us / 2));
+            return;
+        }
+        // RNR NAK 回到发送端，等 min_rnr_timer 后重发
+        ev.at = now + usec(link.rtt_us) + rnrDelay(dst->min_rnr_timer);
+        resend(std::move(ev));
+        return;
+    }
+    uint64_t send_len = 0, room = 0;
+    if (!checkSges(ev.sges, src->pd, &send_len))
+    {
+        ack(ev, IBV_WC_LOC_PROT_ERR, now);
+        return;
+    }
+    RecvWr recv_wr = std::move(rq.front());
+    rq.pop_front();
+    MockSrq *srq = dst->mock_srq;
+    if (srq != nullptr && srq->limit > 0 && srq->wrs.size() < srq->limit)
+    {
+        struct ibv_async_event event;
+        bzero(&event, sizeof(event));
+        event.event_type = IBV_EVENT_SRQ_LIMIT_REACHED;
+        event.element.srq = srq;
+        srq->limit = 0;
+        pushAsync(srq->context, event);
+    }
+    struct ibv_wc wc;
+    bzero(&wc, sizeof(wc));
+    wc.wr_id = recv_wr.wr_id;
+    wc.opcode = IBV_WC_RECV;
+    wc.qp_num = dst->qp_num;
+    wc.src_qp = src->qp_num;
+    bool recv_ok = checkSges(recv_wr.sges, dst->pd, &room);
+    if (!recv_ok || ev.byte_len > room)
+    {
+        wc.status = recv_ok ? IBV_WC_LOC_LEN_ERR : IBV_WC_LOC_PROT_ERR;
+        pushWc(dst->recv_cq, wc);
+        stat_errors++;
+        setError(dst);
+        ack(ev, IBV_WC_REM_INV_REQ_ERR, now + usec(link.rtt_us / 2));
+        return;
+    }
+
+    // 拷贝时不持锁，busy 让 destroy_qp 等它结束
+    src->busy++;
+    dst->busy++;
+    lock.unlock();
+    size_t r = 0;
+    uint64_t r_off = 0;
+    for (auto &sge : ev.sges)
+    {
+        uint64_t s_off = 0;
+        while (s_off < sge.length)
+        {
+            while (recv_wr.sges[r].length == r_off)
+            {
+                r++;
+                r_off = 0;
+            }
+            uint64_t len = std::min<uint64_t>(sge.length - s_off, recv_wr.sges[r].length - r_off);
+            memcpy((char *)recv_wr.sges[r].addr + r_off, (const char *)sge.addr + s_off, len);
+            s_off += len;
+            r_off += len;
+        }
+    }
+    lock.lock();
+    src->busy--;
+    dst->busy--;
+    idle_cond.notify_all();
+
+    double lag = std::chrono::duration<double, std::micro>(now - ev.at).count();
+    stat_lag_us += lag;
+    stat_max_lag_us = std::max(stat_max_lag_us, lag);
+    stat_msgs++;
+    stat_bytes += ev.byte_len;
+    if (dst->state == IBV_QPS_ERR)
+        flushRecv(dst, recv_wr.wr_id);
+    else if (dst->state != IBV_QPS_RESET)
+    {
+        wc.status = IBV_WC_SUCCESS;
+        wc.byte_len = ev.byte_len;
+        if (ev.with_imm)
+        {
+            wc.wc_flags = IBV_WC_WITH_IMM;
+            wc.imm_data = ev.imm_data;
+        }
+        pushWc(dst->recv_cq, wc);
+    }
+    ack(ev, IBV_WC_SUCCESS, Clock::now() + usec(link.rtt_us / 2));
+}
+
+void Fabric::complete(Event &ev)
+{
+    MockQp *src = findQp(ev.src_qpn);
+    if (src == nullptr || src->state == IBV_QPS_RESET)
+        return;
+    src->send_outstanding--;
+    struct ibv_wc wc;
+    bzero(&wc, sizeof(wc));
+    wc.wr_id = ev.wr_id;
+    wc.opcode = IBV_WC_SEND;
+    wc.qp_num = src->qp_num;
+    if (src->state == IBV_QPS_ERR)
+    {
+        // 拷贝期间 QP 进入了 ERR
+        wc.status = IBV_WC_WR_FLUSH_ERR;
+        pushWc(src->send_cq, wc);
+        stat_flushed++;
+        return;
+    }
+    if (ev.status != IBV_WC_SUCCESS)
+    {
+        wc.status = ev.status;
+        pushWc(src->send_cq, wc);
+        stat_errors++;
+        setError(src);
+        return;
+    }
+    if (ev.signaled)
+    {
+        wc.status = IBV_WC_SUCCESS;
+        wc.byte_len = ev.byte_len;
+        pushWc(src->send_cq, wc);
+    }
+}
+
+void Fabric::run()
+{
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (events.empty())
+        {
+            cond.wait(lock);
+            continue;
+        }
+        auto at = events.begin()->first.first;
+        auto now = Clock::now();
+        if (at > now)
+        {
+            if (at - now < SPIN_WAIT)
+            {
+                lock.unlock();
+                std::this_thread::yield();
+            }
+            else
+                cond.wait_until(lock, at);
+            continue;
+        }
+        lock.unlock();
+        std::lock_guard<std::mutex> token(progress_mutex);
+        lock.lock();
+        runDue(lock);
+    }
+}
+
+int Fabric::runDue(std::unique_lock<std::mutex> &lock)
+{
+    int n = 0;
+    while (!events.empty() && events.begin()->first.first <= Clock::now())
+    {
+        auto it = events.begin();
+        Event ev = std::move(it->second);
+        events.erase(it);
+        if (ev.kind == EVENT_DELIVER)
+            deliver(ev, lock);
+        else
+            complete(ev);
+        n++;
+    }
+    return n;
+}
+
+bool Fabric::progress()
+{
+    std::unique_lock<std::mutex> token(progress_mutex, std::try_to_lock);
+    if (!token.owns_lock())
+        return false;
+    std::unique_lock<std::mutex> lock(mutex);
+    return runDue(lock) > 0;
+}
+
+void Fabric::report(std::ostream &os)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    os << "mock fabric: " << link.ports << " port(s), "
+       << (link.gbps > 0 ? std::to_string(link.gbps) + "Gbps" : std::string("unlimited"))
+       << ", rtt " << link.rtt_us << "us, jitter " << link.jitter_us << "us, reorder " << link.reorder << std::endl;
+    os << "  messages=" << stat_msgs << "  bytes=" << stat_bytes << "  rnr=" << stat_rnr
+       << "  reordered=" << stat_reordered << "  errors=" << stat_errors << "  flushed=" << stat_flushed << std::endl;
+    os << "  max pending=" << stat_max_pending
+       << "  delivery lag avg=" << (stat_msgs ? stat_lag_us / stat_msgs : 0) << "us max=" << stat_max_lag_us << "us" << std::endl;
+}
+
+int mockPollCq(struct ibv_cq *ibv_cq, int num_entries, struct ibv_wc *wc)
+{
+    MockCq *cq = static_cast<MockCq *>(ibv_cq);
+    int n;
+    {
+        std::lock_guard<std::mutex> lock(cq->mutex);
+        if (cq->overrun)
+            return -1;
+        n = std::min<int>(num_entries, cq->wcs.size());
+        for (int i = 0; i < n; i++)
+        {
+            wc[i] = cq->wcs.front();
+            cq->wcs.pop_front();
+        }
+    }
+    // 真网卡不占 CPU，这里的投递线程却要和忙轮询的调用者抢核：
+    // 空轮询时先替它投递到期的事件，没有可做的再让出 CPU
+    if (n == 0 && !Fabric::instance().progress())
+        std::this_thread::yield();
+    return n;
+}
+
+int mockPostSend(struct ibv_qp *qp, struct ibv_send_wr *wr, struct ibv_send_wr **bad_wr)
+{
+    Fabric &fabric = Fabric::instance();
+    std::lock_guard<std::mutex> lock(fabric.mutex);
+    return fabric.postSend(static_cast<MockQp *>(qp), wr, bad_wr);
+}
+
+int mockPostRecv(struct ibv_qp *ibv_qp, struct ibv_recv_wr *wr, struct ibv_recv_wr **bad_wr)
+{
+    Fabric &fabric = Fabric::instance();
+    std::lock_guard<std::mutex> lock(fabric.mutex);
+    MockQp *qp = static_cast<MockQp *>(ibv_qp);
+    if (qp->state == IBV_QPS_RESET || qp->mock_srq != nullptr)
+    {
+        *bad_wr = wr;
+        return EINVAL;
+    }
+    if (qp->state == IBV_QPS_ERR)
+    {
+        for (; wr != nullptr; wr = wr->next)
+            fabric.flushRecv(qp, wr->wr_id);
+        return 0;
+    }
+    return fabric.postRecv(qp->rq, qp->cap.max_recv_wr, qp->cap.max_recv_sge, wr, bad_wr);
+}
+
+int mockPostSrqRecv(struct ibv_srq *ibv_srq, struct ibv_recv_wr *wr, struct ibv_recv_wr **bad_wr)
+{
+    Fabric &fabric = Fabric::instance();
+    std::lock_guard<std::mutex> lock(fabric.mutex);
+    MockSrq *srq = static_cast<MockSrq *>(ibv_srq);
+    return fabric.postRecv(srq->wrs, srq->max_wr, srq->max_sge, wr, bad_wr);
+}
+
+struct ibv_device *mockDevice()
+{
+    static struct ibv_device dev;
+    static std::once_flag once;
+    std::call_once(once, []()
+                   {
+                       bzero(&dev, sizeof(dev));
+                       strcpy(dev.name, "mock0");
+                       strcpy(dev.dev_name, "uverbs_mock0");
+                       dev.node_type = IBV_NODE_CA;
+                       dev.transport_type = IBV_TRANSPORT_IB; });
+    return &dev;
+}
+
+// 按带宽给出 1x/4x 的宽度与速率编码
+void portSpeed(double gbps, uint8_t &width, uint8_t &speed)
+{
+    static const struct
+    {
+        double gbps;
+        uint8_t width;
+        uint8_t speed;
+    } speeds[] = {{400, 2, 128}, {200, 2, 64}, {100, 1, 128}, {50, 1, 64}, {25, 1, 32}, {14, 1, 16}, {10, 1, 8}, {5, 1, 2}};
+    width = 1;
+    speed = 1; // 2.5Gbps
+    if (gbps <= 0)
+        gbps = 100;
+    for (auto &entry : speeds)
+    {
+        if (gbps >= entry.gbps)
+        {
+            width = entry.width;
+            speed = entry.speed;
+            return;
+        }
+    }
+}
+
+double envDouble(const char *name, double value)
+{
+    const char *str = getenv(name);
+    return str != nullptr && *str ? atof(str) : value;
+}
+} // namespace
+
+void MockFabric::configure(const MockLink &link)
+{
+    Fabric::instance().configure(link);
+}
+
+MockLink MockFabric::linkFromEnv()
+{
+    MockLink link;
+    link.gbps = envDouble("MOCK_GBPS", link.gbps);
+    link.rtt_us = envDouble("MOCK_RTT_US", link.rtt_us);
+    link.jitter_us = envDouble("MOCK_JITTER_US", link.jitter_us);
+    link.reorder = envDouble("MOCK_REORDER", link.reorder);
+    link.reorder_us = envDouble("MOCK_REORDER_US", link.reorder_us);
+    link.ports = (int)envDouble("MOCK_PORTS", link.ports);
+    link.seed = (uint32_t)envDouble("MOCK_SEED", link.seed);
+    return link;
+}
+
+MockLink MockFabric::getLink()
+{
+    Fabric &fabric = Fabric::instance();
+    std::lock_guard<std::mutex> lock(fabric.mutex);
+    return fabric.link;
+}
+
+void MockFabric::report(std::ostream &os)
+{
+    Fabric::instance().report(os);
+}
+
+// ---- libibverbs 接口 ----
+
+struct ibv_device **ibv_get_device_list(int *num_devices)
+{
+    Fabric::instance().start();
+    struct ibv_device **list = (struct ibv_device **)calloc(2, sizeof(struct ibv_device *));
+    if (list == nullptr)
+        return nullptr;
+    list[0] = mockDevice();
+    if (num_devices != nullptr)
+        *num_devices = 1;
+    return list;
+}
+
+void ibv_free_device_list(struct ibv_device **list)
+{
+    free(list);
+}
+
+const char *ibv_node_type_str(enum ibv_node_type node_type)
+{
+    return node_type == IBV_NODE_CA ? "InfiniBand channel adapter" : "unknown";
+}
+
+const char *ibv_event_type_str(enum ibv_event_type event)
+{
+    switch (event)
+    {
+    case IBV_EVENT_CQ_ERR:
+        return "CQ error";
+    case IBV_EVENT_QP_FATAL:
+        return "local work queue catastrophic error";
+    case IBV_EVENT_SRQ_LIMIT_REACHED:
+        return "SRQ limit reached";
+    default:
+        return "unknown";
+    }
+}
+
+struct ibv_context *ibv_open_device(struct ibv_device *device)
+{
+    if (device != mockDevice())
+    {
+        errno = ENODEV;
+        return nullptr;
+    }
+    MockContext *ctx = new MockContext();
+    if (pipe(ctx->async_pipe) != 0)
+    {
+        delete ctx;
+        return nullptr;
+    }
+    ctx->device = device;
+    ctx->ops.poll_cq = mockPollCq;
+    ctx->ops.post_send = mockPostSend;
+    ctx->ops.post_recv = mockPostRecv;
+    ctx->ops.post_srq_recv = mockPostSrqRecv;
+    ctx->cmd_fd = -1;
+    ctx->async_fd = ctx->async_pipe[0];
+    ctx->num_comp_vectors = 1;
+    ctx->abi_compat = nullptr;
+    return ctx;
+}
+
+int ibv_close_device(struct ibv_context *context)
+{
+    MockContext *ctx = static_cast<MockContext *>(context);
+    close(ctx->async_pipe[0]);
+    close(ctx->async_pipe[1]);
+    delete ctx;
+    return 0;
+}
+
+int ibv_query_device(struct ibv_context * /*context*/, struct ibv_device_attr *device_attr)
+{
+    bzero(device_attr, sizeof(*device_attr));
+    strcpy(device_attr->fw_ver, "mock");
+    device_attr->max_mr_size = UINT64_MAX;
+    device_attr->page_size_cap = 4096;
+    device_attr->max_qp = 1 << 20;
+    device_attr->max_qp_wr = MOCK_MAX_WR;
+    device_attr->max_sge = MOCK_MAX_SGE;
+    device_attr->max_cq = 1 << 20;
+    device_attr->max_cqe = MOCK_MAX_CQE;
+    device_attr->max_mr = 1 << 20;
+    device_attr->max_pd = 1 << 20;
+    device_attr->max_srq = 1 << 20;
+    device_attr->max_srq_wr = MOCK_MAX_WR;
+    device_attr->max_srq_sge = MOCK_MAX_SGE;
+    device_attr->phys_port_cnt = MockFabric::getLink().ports;
+    return 0;
+}
+
+int ibv_query_port(struct ibv_context * /*context*/, uint8_t port_num, struct _compat_ibv_port_attr *port_attr)
+{
+    MockLink link = MockFabric::getLink();
+    if (port_num < 1 || port_num > link.ports)
+        return EINVAL;
+    // 调用者传进来的是完整的 ibv_port_attr，只写兼容结构里有的字段
+    struct ibv_port_attr *attr = (struct ibv_port_attr *)port_attr;
+    attr->state = IBV_PORT_ACTIVE;
+    attr->max_mtu = IBV_MTU_4096;
+    attr->active_mtu = IBV_MTU_4096;
+    attr->gid_tbl_len = MOCK_GID_NUM;
+    attr->max_msg_sz = 1U << 31;
+    attr->pkey_tbl_len = 1;
+    attr->lid = 0;
+    portSpeed(link.gbps, attr->active_width, attr->active_speed);
+    attr->phys_state = 5; // LinkUp
+    attr->link_layer = IBV_LINK_LAYER_ETHERNET;
+    return 0;
+}
+
+int ibv_query_gid(struct ibv_context * /*context*/, uint8_t port_num, int index, union ibv_gid *gid)
+{
+    if (port_num < 1 || port_num > MockFabric::getLink().ports || index < 0 || index >= MOCK_GID_NUM)
+        return -1;
+    // ::ffff:127.0.<index>.<port>
+    bzero(gid, sizeof(*gid));
+    gid->raw[10] = 0xff;
+    gid->raw[11] = 0xff;
+    gid->raw[12] = 127;
+    gid->raw[14] = index;
+    gid->raw[15] = port_num;
+    return 0;
+}
+
+int ibv_get_async_event(struct ibv_context *context, struct ibv_async_event *event)
+{
+    MockContext *ctx = static_cast<MockContext *>(context);
+    char c;
+    if (read(ctx->async_fd, &c, 1) != 1)
+        return -1;
+    Fabric &fabric = Fabric::instance();
+    std::lock_guard<std::mutex> lock(fabric.mutex);
+    if (ctx->events.empty())
+        return -1;
+    *event = ctx->events.front();
+    ctx->events.pop_front();
+    return 0;
+}
+
+void ibv_ack_async_event(struct ibv_async_event * /*event*/)
+{
+}
+
+struct ibv_pd *ibv_alloc_pd(struct ibv_context *context)
+{
+    struct ibv_pd *pd = new ibv_pd();
+    pd->context = context;
+    return pd;
+}
+
+int ibv_dealloc_pd(struct ibv_pd *pd)
+{
+    delete pd;
+    return 0;
+}
+
+struct ibv_mr *ibv_reg_mr(struct ibv_pd *pd, void *addr, size_t length, int /*access*/)
+{
+    if (addr == nullptr || length == 0)
+    {
+        errno = EINVAL;
+        return nullptr;
+    }
+    Fabric &fabric = Fabric::instance();
+    std::lock_guard<std::mutex> lock(fabric.mutex);
+    struct ibv_mr *mr = new ibv_mr();
+    mr->context = pd->context;
+    mr->pd = pd;
+    mr->addr = addr;
+    mr->length = length;
+    mr->lkey = mr->rkey = mr->handle = fabric.next_key++;
+    fabric.mrs[mr->lkey] = mr;
+    return mr;
+}
+
+struct ibv_mr *ibv_reg_mr_iova2(struct ibv_pd *pd, void *addr, size_t length, uint64_t /*iova*/, unsigned int access)
+{
+    return ibv_reg_mr(pd, addr, length, (int)access);
+}
+
+int ibv_dereg_mr(struct ibv_mr *mr)
+{
+    Fabric &fabric = Fabric::instance();
+    std::lock_guard<std::mutex> lock(fabric.mutex);
+    fabric.mrs.erase(mr->lkey);
+    delete mr;
+    return 0;
+}
+
+struct ibv_cq *ibv_create_cq(struct ibv_context *context, int cqe, void *cq_context,
+                             struct ibv_comp_channel *channel, int /*comp_vector*/)
+{
+    if (cqe < 1 || cqe > MOCK_MAX_CQE)
+    {
+        errno = EINVAL;
+        return nullptr;
+    }
+    MockCq *cq = new MockCq();
+    cq->context = context;
+    cq->channel = channel;
+    cq->cq_context = cq_context;
+    cq->cqe = cqe;
+    return cq;
+}
+
+int ibv_destroy_cq(struct ibv_cq *cq)
+{
+    delete static_cast<MockCq *>(cq);
+    return 0;
+}
+
+struct ibv_srq *ibv_create_srq(struct ibv_pd *pd, struct ibv_srq_init_attr *srq_init_attr)
+{
+    if (srq_init_attr->attr.max_wr > MOCK_MAX_WR || srq_init_attr->attr.max_sge > MOCK_MAX_SGE)
+    {
+        errno = EINVAL;
+        return nullptr;
+    }
+    MockSrq *srq = new MockSrq();
+    srq->context = pd->context;
+    srq->srq_context = srq_init_attr->srq_context;
+    srq->pd = pd;
+    srq->max_wr = srq_init_attr->attr.max_wr;
+    srq->max_sge = srq_init_attr->attr.max_sge;
+    srq->limit = srq_init_attr->attr.srq_limit;
+    return srq;
+}
+
+int ibv_modify_srq(struct ibv_srq *ibv_srq, struct ibv_srq_attr *srq_attr, int srq_attr_mask)
+{
+    if (srq_attr_mask & IBV_SRQ_MAX_WR)
+        return EINVAL;
+    Fabric &fabric = Fabric::instance();
+    std::lock_guard<std::mutex> lock(fabric.mutex);
+    // 布防后在接收 WR 被取走、数量低于 limit 时产生事件
+    if (srq_attr_mask & IBV_SRQ_LIMIT)
+        static_cast<MockSrq *>(ibv_srq)->limit = srq_attr->srq_limit;
+    return 0;
+}
+
+int ibv_destroy_srq(struct ibv_srq *srq)
+{
+    Fabric &fabric = Fabric::instance();
+    std::lock_guard<std::mutex> lock(fabric.mutex);
+    delete static_cast<MockSrq *>(srq);
+    return 0;
+}
+
+struct ibv_qp *ibv_create_qp(struct ibv_pd *pd, struct ibv_qp_init_attr *qp_init_attr)
+{
+    struct ibv_qp_cap &cap = qp_init_attr->cap;
+    if (qp_init_attr->qp_type != IBV_QPT_RC || qp_init_attr->send_cq == nullptr || qp_init_attr->recv_cq == nullptr ||
+        cap.max_send_wr > MOCK_MAX_WR || cap.max_recv_wr > MOCK_MAX_WR ||
+        cap.max_send_sge > MOCK_MAX_SGE || cap.max_recv_sge > MOCK_MAX_SGE)
+    {
+        errno = EINVAL;
+        return nullptr;
+    }
+    if (qp_init_attr->srq != nullptr)
+    {
+        cap.max_recv_wr = 0;
+        cap.max_recv_sge = 0;
+    }
+    cap.max_inline_data = 0;
+    Fabric &fabric = Fabric::instance();
+    std::lock_guard<std::mutex> lock(fabric.mutex);
+    MockQp *qp = new MockQp();
+    qp->context = pd->context;
+    qp->qp_context = qp_init_attr->qp_context;
+    qp->pd = pd;
+    qp->send_cq = qp_init_attr->send_cq;
+    qp->recv_cq = qp_init_attr->recv_cq;
+    qp->srq = qp_init_attr->srq;
+    qp->mock_srq = static_cast<MockSrq *>(qp_init_attr->srq);
+    qp->qp_num = qp->handle = fabric.next_qpn++;
+    qp->state = IBV_QPS_RESET;
+    qp->qp_type = IBV_QPT_RC;
+    qp->cap = cap;
+    qp->sq_sig_all = qp_init_attr->sq_sig_all != 0;
+    fabric.qps[qp->qp_num] = qp;
+    return qp;
+}
+
+int ibv_modify_qp(struct ibv_qp *ibv_qp, struct ibv_qp_attr *attr, int attr_mask)
+{
+    Fabric &fabric = Fabric::instance();
+    std::lock_guard<std::mutex> lock(fabric.mutex);
+    MockQp *qp = static_cast<MockQp *>(ibv_qp);
+    if ((attr_mask & IBV_QP_PORT) && (attr->port_num < 1 || attr->port_num > fabric.link.ports))
+        return EINVAL;
+    if (attr_mask & IBV_QP_STATE)
+    {
+        enum ibv_qp_state cur = qp->state, next = attr->qp_state;
+        bool ok = next == IBV_QPS_RESET || next == IBV_QPS_ERR ||
+                  (next == IBV_QPS_INIT && (cur == IBV_QPS_RESET || cur == IBV_QPS_INIT)) ||
+                  (next == IBV_QPS_RTR && cur == IBV_QPS_INIT && (attr_mask & IBV_QP_DEST_QPN)) ||
+                  (next == IBV_QPS_RTS && (cur == IBV_QPS_RTR || cur == IBV_QPS_RTS));
+        if (!ok)
+            return EINVAL;
+    }
+    if (attr_mask & IBV_QP_PORT)
+        qp->port_num = attr->port_num;
+    if (attr_mask & IBV_QP_DEST_QPN)
+        qp->dest_qp_num = attr->dest_qp_num;
+    if (attr_mask & IBV_QP_MIN_RNR_TIMER)
+        qp->min_rnr_timer = attr->min_rnr_timer;
+    if (attr_mask & IBV_QP_TIMEOUT)
+        qp->timeout = attr->timeout;
+    if (attr_mask & IBV_QP_RETRY_CNT)
+        qp->retry_cnt = attr->retry_cnt;
+    if (attr_mask & IBV_QP_RNR_RETRY)
+        qp->rnr_retry = attr->rnr_retry;
+    if (!(attr_mask & IBV_QP_STATE))
+        return 0;
+    if (attr->qp_state == IBV_QPS_RESET)
+        fabric.reset(qp);
+    else if (attr->qp_state == IBV_QPS_ERR)
+        fabric.setError(qp);
+    else
+        qp->state = attr->qp_state;
+    return 0;
+}
+
+int ibv_destroy_qp(struct ibv_qp *ibv_qp)
+{
+    Fabric &fabric = Fabric::instance();
+    std::unique_lock<std::mutex> lock(fabric.mutex);
+    MockQp *qp = static_cast<MockQp *>(ibv_qp);
+    fabric.reset(qp);
+    fabric.waitIdle(qp, lock);
+    fabric.qps.erase(qp->qp_num);
+    delete qp;
+    return 0;
+}
@@ -0,0 +1,50 @@
+// 进程内回环的模拟 verbs 设备：代替 -libverbs 链接 MockVerbs.cpp，
+// 未修改的 HwRdma/StreamControl 即可在没有 RDMA 网卡的机器上跑通完整的
+// 客户端 <-> 服务端路径（握手、credit、文件读写都是真实代码）。
+//
+// 模拟的语义（只覆盖本项目用到的部分）：
+//   - 一个设备 mock0，端口数可配，端口 ACTIVE、链路层为以太网
+//   - RC QP 的 RESET/INIT/RTR/RTS/ERR 状态，SEND 与 SEND_WITH_IMM
+//   - MR 的 lkey 校验、接收缓冲长度校验，出错时 QP 进入 ERR 并 flush
+//   - 没有接收 WR 时按 min_rnr_timer 做 RNR 重试，rnr_retry=7 为无限次
+//   - 对端 QP 不存在或不可接收时，按 timeout/retry_cnt 报 RETRY_EXC_ERR
+//   - SRQ 与 SRQ_LIMIT 异步事件，CQ 溢出后 poll 返回错误
+// 数据在投递时从发送缓冲直接拷到接收缓冲（同一进程），由一个后台线程按
+// 到达时间投递，模拟链路：
+//   - 带宽：按接收端口串行化，所有连接共享，用来复现服务端入口瓶颈
+//   - 时延：数据单向 rtt/2 后到达，再过 rtt/2 发送端得到完成
+//   - 抖动：单向时延额外加 [0, jitter] 均匀分布
+//   - 乱序：同一 QP 内的消息默认保序（RC 语义），reorder 为某条消息被
+//     额外延后、让后面消息先到的概率，用来压测接收端的乱序处理
+// 控制连接仍是真实的 TCP 回环，RTT 只作用于 verbs 数据路径。
+#ifndef MOCK_VERBS_H
+#define MOCK_VERBS_H
+
+#include <stdint.h>
+#include <ostream>
+
+struct MockLink
+{
+    double gbps = 0;       // 每个端口的带宽，0 表示不限速
+    double rtt_us = 0;     // 往返时延
+    double jitter_us = 0;  // 单向时延抖动上限
+    double reorder = 0;    // 0 ~ 1，消息被延后乱序的概率
+    double reorder_us = 0; // 乱序消息额外的延迟，0 表示 rtt 加两条消息的传输时间
+    int ports = 1;         // 端口数，即一个连接的通道数，最多 MAX_LANE_NUM
+    uint32_t seed = 1;     // 抖动与乱序的随机种子，便于复现
+};
+
+class MockFabric
+{
+public:
+    // 在第一次 ibv_get_device_list() 之前调用，否则读取环境变量：
+    // MOCK_GBPS, MOCK_RTT_US, MOCK_JITTER_US, MOCK_REORDER, MOCK_REORDER_US,
+    // MOCK_PORTS, MOCK_SEED
+    static void configure(const MockLink &link);
+    static MockLink linkFromEnv();
+    static MockLink getLink();
+    // 投递的消息数、字节数、RNR 重试、乱序、错误完成等统计
+    static void report(std::ostream &os);
+};
+
+#endif
@@ -0,0 +1,121 @@
+// 连接表并发微基准：多线程混合执行查找、计数、增删和状态页遍历，
+// 对比单锁的旧实现与按 fd 分片、读者不加锁的 ClientList 随线程数的扩展性
+// 用法: ./clientlistbench [每档秒数] [最大线程数]
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include "../utils/ClientInfo.h"
+
+// 旧实现：一把锁保护整个表
+class GlobalClientList
+{
+public:
+    void addClient(int fd, uint32_t ip)
+    {
+        std::lock_guard<std::mutex> lock(clientInfosMutex);
+        clientInfos.emplace(fd, ClientInfo(fd, ip));
+    }
+    void removeClient(int fd)
+    {
+        std::lock_guard<std::mutex> lock(clientInfosMutex);
+        clientInfos.erase(fd);
+    }
+    int getClientNum()
+    {
+        std::lock_guard<std::mutex> lock(clientInfosMutex);
+        return clientInfos.size();
+    }
+    std::shared_ptr<ClientState> getState(int fd)
+    {
+        std::lock_guard<std::mutex> lock(clientInfosMutex);
+        auto it = clientInfos.find(fd);
+        return it != clientInfos.end() ? it->second.state : nullptr;
+    }
+    void snapshot(std::vector<ClientInfo> &clients)
+    {
+        std::lock_guard<std::mutex> lock(clientInfosMutex);
+        clients.clear();
+        for (auto &it : clientInfos)
+            clients.push_back(it.second);
+    }
+
+private:
+    std::unordered_map<int, ClientInfo> clientInfos;
+    std::mutex clientInfosMutex;
+};
+
+const int BASE_CLIENTS = 256;   // 常驻连接
+const int CHURN_FDS = 64;       // 每个线程自己增删的 fd 数
+
+// 每个线程的操作比例：查找 90%，计数 5%，增删 4%，遍历 1%
+template <typename List>
+double run(int threads, double seconds)
+{
+    List list;
+    for (int fd = 0; fd < BASE_CLIENTS; fd++)
+        list.addClient(fd, 0x0100007f);
+    std::atomic<bool> stop(false);
+    std::vector<uint64_t> ops(threads, 0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+        workers.emplace_back([&, t]()
+                             {
+            std::mt19937 rng(t + 1);
+            std::vector<ClientInfo> clients;
+            int churn_base = BASE_CLIENTS + t * CHURN_FDS, churn_next = 0;
+            uint64_t n = 0, found = 0;
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                for (int i = 0; i < 100; i++)
+                {
+                    uint32_t r = rng() % 100;
+                    if (r < 90)
+                        found += list.getState(rng() % BASE_CLIENTS) != nullptr;
+                    else if (r < 95)
+                        found += list.getClientNum() > 0;
+                    else if (r < 99)
+                    {
+                        int fd = churn_base + churn_next++ % CHURN_FDS;
+                        list.addClient(fd, 0x0100007f);
+                        list.removeClient(fd);
+                    }
+                    else
+                    {
+                        list.snapshot(clients);
+                        found += clients.size() > 0;
+                    }
+                }
+                n += 100;
+            }
+            ops[t] = found > 0 ? n : 0; });
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop.store(true);
+    uint64_t total = 0;
+    for (int t = 0; t < threads; t++)
+    {
+        workers[t].join();
+        total += ops[t];
+    }
+    return total / seconds / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    int max_threads = argc > 2 ? atoi(argv[2]) : (int)std::thread::hardware_concurrency();
+    std::cout << "threads  global-mutex Mops/s  sharded Mops/s  speedup" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    for (int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        double global = run<GlobalClientList>(threads, seconds);
+        double sharded = run<ClientList>(threads, seconds);
+        std::cout << std::setw(7) << threads << std::setw(21) << global << std::setw(16) << sharded
+                  << std::setw(9) << sharded / global << std::endl;
+        if (threads < max_threads && threads * 2 > max_threads)
+            threads = max_threads / 2;
+    }
+    return 0;
+}
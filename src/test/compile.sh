@@ -1,2 +1,8 @@
 g++ -std=c++17 -pthread connClient.cpp -o connclient
 g++ -std=c++17 -pthread connServer.cpp -o connserver
+g++ -std=c++17 -pthread handshakeBench.cpp ../net/*.cpp ../utils/*.cpp ../interface/*.cpp `wx-config --cxxflags --libs` -libverbs -o handshakebench
+# 不需要网卡：MockVerbs.cpp 代替 -libverbs
+g++ -std=c++17 -pthread mockTransferBench.cpp MockVerbs.cpp ../net/*.cpp ../utils/*.cpp ../interface/*.cpp `wx-config --cxxflags --libs` -o mockbench
+g++ -std=c++17 -O2 -pthread clientListBench.cpp -o clientlistbench
+g++ -std=c++17 -O2 zeroScanBench.cpp ../net/ZeroScan.cpp -o zeroscanbench
+g++ -std=c++17 -O2 -pthread storageTargetsBench.cpp ../net/StorageTargets.cpp ../net/ThroughputMeter.cpp ../net/LatencyHistogram.cpp -o storagetargetsbench
@@ -0,0 +1,95 @@
+// 握手延迟微基准：在本机回环上反复建立连接，测量从 connect() 到 QP 进入 RTS 的耗时
+// 用法: ./handshakebench [次数]
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include "../net/HwRdma.h"
+#include "../net/StreamControl.h"
+#include "../utils/LocalConf.h"
+#include "../utils/ClientInfo.h"
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 100;
+    // 只读用户的 local.conf，退出时不写回
+    LocalConf local_conf(getConfigPath());
+    local_conf.setSaveOnExit(false);
+    if (local_conf.loadConf())
+        return -1;
+    // 客户端与服务端共用一个设备上下文，缓冲区按需注册
+    HwRdma hwrdma(local_conf.getRdmaGidIndex(), (uint64_t)-1);
+    hwrdma.placement.configure(local_conf.getNumaNode(), local_conf.getPollCores(), local_conf.getIoCores());
+    hwrdma.setPortFilter(local_conf.getRdmaPorts());
+    if (hwrdma.init())
+    {
+        std::cerr << "RDMA initialization failed" << std::endl;
+        return -1;
+    }
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = 0;
+    socklen_t addr_len = sizeof(addr);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0 ||
+        getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len) != 0)
+    {
+        std::cerr << "Failed to listen: " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    ClientList client_list;
+    ServerContext server_ctx;
+    server_ctx.client_list = &client_list;
+    std::vector<double> samples;
+    for (int i = 0; i < iterations; i++)
+    {
+        int server_ret = -1;
+        std::thread server([&]() {
+            int peer_fd = accept(listen_fd, nullptr, nullptr);
+            if (peer_fd < 0)
+                return;
+            StreamControl receiver(&hwrdma, peer_fd, &local_conf, &server_ctx);
+            server_ret = receiver.setupReceiver();
+            close(peer_fd);
+        });
+
+        auto start = std::chrono::high_resolution_clock::now();
+        int peer_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int ret = connect(peer_fd, (struct sockaddr *)&addr, sizeof(addr));
+        StreamControl sender(&hwrdma, peer_fd, &local_conf);
+        if (ret == 0)
+            ret = sender.createLucpContext();
+        if (ret == 0)
+            ret = sender.connectPeer();
+        auto end = std::chrono::high_resolution_clock::now();
+        server.join();
+        close(peer_fd);
+        if (ret != 0 || server_ret != 0)
+        {
+            std::cerr << "Handshake " << i << " failed" << std::endl;
+            return -1;
+        }
+        samples.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+    }
+    close(listen_fd);
+    if (samples.empty())
+        return 0;
+
+    std::sort(samples.begin(), samples.end());
+    std::cout << "connect to RTS over " << samples.size() << " handshakes (us):" << std::endl
+              << "  min " << samples.front() << std::endl
+              << "  p50 " << samples[samples.size() / 2] << std::endl
+              << "  p99 " << samples[samples.size() * 99 / 100] << std::endl
+              << "  max " << samples.back() << std::endl;
+    return 0;
+}
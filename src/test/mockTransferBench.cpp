@@ -0,0 +1,277 @@
+// 回环传输基准：链接 MockVerbs.cpp 代替 -libverbs，在一个进程里跑 thread 模式的服务端
+// 和若干客户端，走完整的握手、文件同步、credit 与读写盘路径，测量流水线与协议自身的开销。
+// 链路参数见 MockVerbs.h 中的环境变量，BlockSize/BlockNum 等取自给定的配置文件。
+// 用法: ./mockbench [文件大小MB] [每个客户端的文件数] [客户端数] [配置文件]
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include "MockVerbs.h"
+#include "../net/HwRdma.h"
+#include "../net/StreamControl.h"
+#include "../net/CreditScheduler.h"
+#include "../utils/LocalConf.h"
+#include "../utils/ClientInfo.h"
+#include "../utils/Logger.h"
+
+// 无界面的发送进度，只统计确认的块数，从不取消
+class BenchProgress : public TransferProgress
+{
+public:
+    int caculateTransferInfo(unsigned long /*bytes_transferred*/, double /*duration*/, unsigned long /*piece_size*/) override
+    {
+        blocks++;
+        return 0;
+    }
+    bool checkCancel() override { return false; }
+    uint64_t blocks = 0;
+};
+
+struct ClientResult
+{
+    int ret = 0;
+    double connect_us = 0;
+    double seconds = 0;
+    std::vector<double> file_ms;
+};
+
+static bool writeSourceFile(const std::string &path, uint64_t size)
+{
+    std::ofstream out(path, std::ios::binary);
+    std::vector<char> chunk(1 << 20);
+    uint32_t x = 2463534242u;
+    for (auto &c : chunk)
+    {
+        // xorshift 填充，避免全零块
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        c = (char)x;
+    }
+    for (uint64_t done = 0; done < size && out; done += chunk.size())
+        out.write(chunk.data(), std::min<uint64_t>(chunk.size(), size - done));
+    return (bool)out;
+}
+
+static bool sameContent(const std::string &a, const std::string &b)
+{
+    std::ifstream fa(a, std::ios::binary), fb(b, std::ios::binary);
+    std::vector<char> ba(1 << 20), bb(1 << 20);
+    while (fa && fb)
+    {
+        fa.read(ba.data(), ba.size());
+        fb.read(bb.data(), bb.size());
+        if (fa.gcount() != fb.gcount() || memcmp(ba.data(), bb.data(), fa.gcount()) != 0)
+            return false;
+    }
+    return fa.eof() && fb.eof();
+}
+
+static int runBench(const std::string &dir, uint64_t file_size, int files, int clients)
+{
+    // 收发两端共用一个配置，接收目录指向临时目录。
+    // 第一次读取时默认的接收目录可能不存在而报错，改写后再读一次才算数
+    LocalConf local_conf(dir + "/local.conf");
+    local_conf.loadConf();
+    std::string recv_dir = dir + "/recv";
+    mkdir(recv_dir.c_str(), 0755);
+    local_conf.setSavedFolderPath(recv_dir);
+    if (local_conf.saveConf() || local_conf.loadConf())
+        return -1;
+    std::string src_path = dir + "/source.bin";
+    if (!writeSourceFile(src_path, file_size))
+    {
+        std::cerr << "Failed to write " << src_path << std::endl;
+        return -1;
+    }
+
+    MockLink link = MockFabric::getLink();
+    HwRdma hwrdma(local_conf.getRdmaGidIndex(), (uint64_t)-1);
+    hwrdma.placement.configure(local_conf.getNumaNode(), local_conf.getPollCores(), local_conf.getIoCores());
+    if (hwrdma.init())
+    {
+        std::cerr << "RDMA initialization failed" << std::endl;
+        return -1;
+    }
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = 0;
+    socklen_t addr_len = sizeof(addr);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, clients) != 0 ||
+        getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len) != 0)
+    {
+        std::cerr << "Failed to listen: " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    // 与 server.cpp 的 thread 模式相同：每个连接一个 recvData 线程
+    ClientList client_list;
+    ServerContext server_ctx;
+    server_ctx.client_list = &client_list;
+    uint32_t credit_budget = local_conf.getCreditBudget();
+    if (credit_budget == 0)
+        credit_budget = (uint32_t)local_conf.getBlockNum() * clients;
+    CreditScheduler credit_scheduler(credit_budget, local_conf.getBlockNum(), local_conf.getClientWeights());
+    server_ctx.credit_scheduler = &credit_scheduler;
+    std::vector<std::thread> receivers;
+    std::thread acceptor([&]() {
+        for (int i = 0; i < clients; i++)
+        {
+            struct sockaddr_in peer_addr;
+            socklen_t peer_addr_len = sizeof(peer_addr);
+            int peer_fd = accept(listen_fd, (struct sockaddr *)&peer_addr, &peer_addr_len);
+            if (peer_fd < 0)
+                return;
+            client_list.addClient(peer_fd, peer_addr.sin_addr.s_addr);
+            credit_scheduler.addConnection(peer_fd, peer_addr.sin_addr.s_addr);
+            receivers.emplace_back(recvData, &hwrdma, peer_fd, &local_conf, &server_ctx, nullptr);
+        }
+    });
+
+    std::vector<ClientResult> results(clients);
+    std::vector<std::thread> senders;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int c = 0; c < clients; c++)
+    {
+        senders.emplace_back([&, c]() {
+            ClientResult &result = results[c];
+            auto t0 = std::chrono::high_resolution_clock::now();
+            int peer_fd = socket(AF_INET, SOCK_STREAM, 0);
+            int ret = connect(peer_fd, (struct sockaddr *)&addr, sizeof(addr));
+            StreamControl sender(&hwrdma, peer_fd, &local_conf);
+            if (ret == 0)
+                ret = sender.createLucpContext();
+            if (ret == 0)
+                ret = sender.connectPeer();
+            if (ret == 0 && (sender.bindMemoryRegion() || sender.createBufferPool()))
+                ret = -1;
+            auto t1 = std::chrono::high_resolution_clock::now();
+            result.connect_us = std::chrono::duration<double, std::micro>(t1 - t0).count();
+            BenchProgress progress;
+            for (int f = 0; f < files && ret == 0; f++)
+            {
+                std::string name = "client" + std::to_string(c) + "_" + std::to_string(f) + ".bin";
+                auto f0 = std::chrono::high_resolution_clock::now();
+                ret = sender.postSendFile(src_path.c_str(), name.c_str(), &progress);
+                auto f1 = std::chrono::high_resolution_clock::now();
+                result.file_ms.push_back(std::chrono::duration<double, std::milli>(f1 - f0).count());
+            }
+            result.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t1).count();
+            result.ret = ret;
+            // 关闭控制连接，服务端的 recvData 随之退出
+            close(peer_fd);
+        });
+    }
+    for (auto &thr : senders)
+        thr.join();
+    double wall = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    acceptor.join();
+    for (auto &thr : receivers)
+        thr.join();
+    close(listen_fd);
+    // 传输日志先输出，再打印统计
+    Logger::flush();
+
+    int failed = 0;
+    std::vector<double> connect_us, file_ms;
+    for (int c = 0; c < clients; c++)
+    {
+        if (results[c].ret != 0)
+        {
+            std::cerr << "Client " << c << " failed: " << results[c].ret << std::endl;
+            failed++;
+        }
+        connect_us.push_back(results[c].connect_us);
+        file_ms.insert(file_ms.end(), results[c].file_ms.begin(), results[c].file_ms.end());
+        if (results[c].seconds > 0)
+            std::cout << "client " << c << ": " << file_size * results[c].file_ms.size() * 8.0 / results[c].seconds / 1e9 << " Gbps" << std::endl;
+        for (int f = 0; f < (int)results[c].file_ms.size(); f++)
+        {
+            std::string name = recv_dir + "/client" + std::to_string(c) + "_" + std::to_string(f) + ".bin";
+            if (results[c].ret == 0 && !sameContent(src_path, name))
+            {
+                std::cerr << "Content mismatch: " << name << std::endl;
+                failed++;
+            }
+            unlink(name.c_str());
+        }
+    }
+    unlink(src_path.c_str());
+    rmdir(recv_dir.c_str());
+
+    std::sort(connect_us.begin(), connect_us.end());
+    std::sort(file_ms.begin(), file_ms.end());
+    double total_gbps = file_size * file_ms.size() * 8.0 / wall / 1e9;
+    std::cout << "block " << local_conf.getBlockSize() << " KB x " << local_conf.getBlockNum()
+              << ", " << clients << " client(s) x " << files << " file(s) of " << file_size / 1e6 << " MB" << std::endl
+              << "connect to buffers ready (us): min " << connect_us.front() << "  max " << connect_us.back() << std::endl;
+    if (!file_ms.empty())
+        std::cout << "per file (ms): min " << file_ms.front()
+                  << "  p50 " << file_ms[file_ms.size() / 2]
+                  << "  p99 " << file_ms[file_ms.size() * 99 / 100]
+                  << "  max " << file_ms.back() << std::endl;
+    std::cout << "aggregate " << total_gbps << " Gbps";
+    // 链路效率：实测吞吐占所有端口带宽之和的比例
+    if (link.gbps > 0)
+        std::cout << " (" << 100.0 * total_gbps / (link.gbps * link.ports) << "% of " << link.gbps * link.ports << " Gbps link)";
+    std::cout << std::endl;
+    // 落盘的写系统调用数，WriteCoalesceSize 把相邻的块合并成一次 pwritev
+    std::vector<std::shared_ptr<CreditScheduler::Account>> accounts;
+    uint64_t recv_bytes = 0, recv_blocks = 0, write_calls = 0;
+    credit_scheduler.snapshot(accounts, recv_bytes, recv_blocks, write_calls);
+    for (auto &a : accounts)
+    {
+        recv_bytes += a->bytes.load();
+        write_calls += a->writes.load();
+    }
+    std::cout << "write calls " << write_calls << " (coalesce " << local_conf.getWriteCoalesceSize() << " KB), "
+              << (recv_bytes > 0 ? write_calls * 1e9 / recv_bytes : 0) << " per GB" << std::endl;
+    MockFabric::report(std::cout);
+    StageLatency::global().report(std::cout, "block latency, all clients");
+    return failed ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t file_size = (argc > 1 ? atoll(argv[1]) : 256) << 20;
+    int files = argc > 2 ? atoi(argv[2]) : 4;
+    int clients = argc > 3 ? atoi(argv[3]) : 1;
+    if (file_size == 0 || files <= 0 || clients <= 0)
+    {
+        std::cerr << "usage: " << argv[0] << " [file MB] [files per client] [clients] [config]" << std::endl;
+        return -1;
+    }
+    char dir_template[] = "/tmp/mockbench.XXXXXX";
+    if (!mkdtemp(dir_template))
+    {
+        std::cerr << "Failed to create a temp dir: " << strerror(errno) << std::endl;
+        return -1;
+    }
+    std::string dir = dir_template;
+    if (argc > 4)
+    {
+        std::ifstream in(argv[4], std::ios::binary);
+        std::ofstream out(dir + "/local.conf", std::ios::binary);
+        out << in.rdbuf();
+    }
+    signal(SIGPIPE, SIG_IGN);
+    MockFabric::configure(MockFabric::linkFromEnv());
+    int ret = runBench(dir, file_size, files, clients);
+    // LocalConf 析构时会写回配置，等它析构后再删
+    unlink((dir + "/local.conf").c_str());
+    rmdir(dir.c_str());
+    return ret;
+}
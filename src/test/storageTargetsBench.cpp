@@ -0,0 +1,133 @@
+// 存储目标选择测试：多个线程同时放置文件，检查文件是否均匀分到各目标、
+// 慢目标是否被避开，再测量 pick() 的耗时
+// 用法: ./storagetargetsbench [目标数] [并发线程数]
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../net/StorageTargets.h"
+
+// 所有线程同时各放置 files 个文件，放置期间不释放，返回每个目标分到的文件数
+static std::vector<int> placeAtOnce(StorageTargets &storage, int threads, int files)
+{
+    std::vector<std::atomic<int>> placed(storage.size());
+    std::vector<std::vector<int>> picks(threads);
+    std::atomic<int> ready(0);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++)
+    {
+        workers.emplace_back([&, i]()
+                             {
+            ready++;
+            while (ready < threads)
+                ;
+            for (int f = 0; f < files; f++)
+            {
+                int k = storage.pick(1 << 20);
+                if (k >= 0)
+                {
+                    placed[k]++;
+                    picks[i].push_back(k);
+                }
+            } });
+    }
+    for (auto &thr : workers)
+        thr.join();
+    for (auto &p : picks)
+        for (int k : p)
+            storage.release(k);
+    std::vector<int> counts;
+    for (auto &n : placed)
+        counts.push_back(n.load());
+    return counts;
+}
+
+static void printCounts(const char *name, const std::vector<int> &counts)
+{
+    std::cout << name << ":";
+    for (int n : counts)
+        std::cout << " " << n;
+    std::cout << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int target_num = argc > 1 ? atoi(argv[1]) : 4;
+    int threads = argc > 2 ? atoi(argv[2]) : 8;
+    if (target_num < 2 || threads < 1)
+        return -1;
+    char dir_template[] = "/tmp/storagetargets.XXXXXX";
+    if (!mkdtemp(dir_template))
+        return -1;
+    std::vector<std::string> paths;
+    for (int k = 0; k < target_num; k++)
+    {
+        paths.push_back(std::string(dir_template) + "/t" + std::to_string(k));
+        mkdir(paths.back().c_str(), 0755);
+    }
+    StorageTargets storage;
+    storage.configure(paths);
+    int ret = 0;
+
+    // 1. 都还没写过：同时到达的文件按活动数摊开，各目标相差不超过一个
+    int files = target_num * 2;
+    std::vector<int> counts = placeAtOnce(storage, threads, files);
+    printCounts("fresh targets", counts);
+    for (int n : counts)
+        if (n < threads * files / target_num || n > threads * files / target_num + 1)
+        {
+            std::cerr << "fresh targets are not evenly used" << std::endl;
+            ret = -1;
+        }
+
+    // 2. 目标 0 写一次 MB 要 10 倍时间，其余目标相同：目标 0 只分到约 1/10
+    storage.written(0, 1 << 20, 10000000);
+    for (int k = 1; k < target_num; k++)
+        storage.written(k, 1 << 20, 1000000);
+    counts = placeAtOnce(storage, threads, files);
+    printCounts("target 0 slow", counts);
+    for (int k = 1; k < target_num; k++)
+        if (counts[0] > counts[k])
+        {
+            std::cerr << "the slow target got more files than target " << k << std::endl;
+            ret = -1;
+        }
+
+    // 3. 新加入的目标按最快的已知目标计，和其他目标一起分文件
+    paths.push_back(std::string(dir_template) + "/t" + std::to_string(target_num));
+    mkdir(paths.back().c_str(), 0755);
+    StorageTargets grown;
+    grown.configure(paths);
+    for (int k = 0; k < target_num; k++)
+        grown.written(k, 1 << 20, 1000000);
+    counts = placeAtOnce(grown, threads, files);
+    printCounts("one new target", counts);
+    if (counts.back() == 0 || counts.back() > threads * files / (target_num + 1) + 1)
+    {
+        std::cerr << "the new target is not ranked with the others" << std::endl;
+        ret = -1;
+    }
+
+    // 每次 pick() 都要对每个目标 statvfs()
+    int reps = 100000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < reps; i++)
+    {
+        int k = storage.pick(1 << 20);
+        if (k >= 0)
+            storage.release(k);
+    }
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / reps;
+    std::cout << "pick + release: " << us << " us with " << target_num << " targets" << std::endl;
+
+    for (auto &path : paths)
+        rmdir(path.c_str());
+    rmdir(dir_template);
+    std::cout << (ret == 0 ? "PASS" : "FAIL") << std::endl;
+    return ret;
+}
@@ -0,0 +1,54 @@
+// 全零块检测微基准：先逐字节校验检测结果，再测量全零块的扫描带宽
+// （数据块通常在第一个向量就返回，全零块才需要读完整块）
+// 用法: ./zeroscanbench [每档读取的GB数]
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <stdlib.h>
+#include "../net/ZeroScan.h"
+
+int main(int argc, char *argv[])
+{
+    double gb = argc > 1 ? atof(argv[1]) : 8;
+    std::cout << "implementation: " << zeroScanImpl() << std::endl;
+
+    // 每个长度、每个起始对齐下，任何一个非零字节都必须被发现
+    std::vector<unsigned char> buf(4096 + 64, 0);
+    for (size_t len : {0, 1, 7, 63, 64, 65, 127, 128, 255, 256, 257, 1000, 4096})
+        for (size_t off = 0; off < 3; off++)
+        {
+            if (!isZeroBlock(buf.data() + off, len))
+            {
+                std::cerr << "zero block of " << len << " bytes reported as data" << std::endl;
+                return -1;
+            }
+            for (size_t i = 0; i < len; i++)
+            {
+                buf[off + i] = 1;
+                if (isZeroBlock(buf.data() + off, len))
+                {
+                    std::cerr << "byte " << i << " of " << len << " missed" << std::endl;
+                    return -1;
+                }
+                buf[off + i] = 0;
+            }
+        }
+
+    std::cout << "block        GB/s" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    for (size_t block : {4UL << 10, 64UL << 10, 1UL << 20, 64UL << 20})
+    {
+        std::vector<unsigned char> zero(block, 0);
+        size_t reps = std::max<size_t>(1, (size_t)(gb * 1e9 / block));
+        size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < reps; r++)
+            found += isZeroBlock(zero.data(), block);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (found != reps)
+            return -1;
+        std::cout << std::setw(8) << block / 1024 << " KB" << std::setw(8) << reps * block / seconds / 1e9 << std::endl;
+    }
+    return 0;
+}
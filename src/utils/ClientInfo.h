@@ -5,13 +5,73 @@
 #include <stdint.h>
 #include <unordered_map>
 #include <mutex>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <algorithm>
 class ClientInfo;
 
 enum ClientStatus 
 {
     CLIENT_STATUS_INVALID = -1,
     CLIENT_STATUS_IDLE,
-    CLIENT_STATUS_RECEIVING
+    CLIENT_STATUS_RECEIVING,
+    CLIENT_STATUS_CONNECTING,  // 握手中，传输通道还没建好
+    CLIENT_STATUS_SYNC         // 收到文件信息，正在同步开始
+};
+
+// 连接的实时状态，由接收线程写、状态页随时读。
+// 热路径上只做 relaxed 原子写，不查连接表；
+// 按缓存行对齐，不同连接的计数不会互相伪共享。
+// 文件名每个文件只写一次，用自己的小锁。
+struct alignas(64) ClientState
+{
+    std::atomic<int> status{CLIENT_STATUS_CONNECTING};
+    std::atomic<int64_t> sinceMs{nowMs()};   // 进入当前状态的时间
+    std::atomic<uint64_t> fileSize{0};
+    std::atomic<uint64_t> fileBytes{0};      // 当前文件已写入的字节
+    std::atomic<uint64_t> filesDone{0};
+
+    void setStatus(ClientStatus s)
+    {
+        status.store(s, std::memory_order_relaxed);
+        sinceMs.store(nowMs(), std::memory_order_relaxed);
+    }
+    void setFile(const std::string &name, uint64_t size)
+    {
+        {
+            std::lock_guard<std::mutex> lock(fileMutex);
+            fileName = name;
+        }
+        fileSize.store(size, std::memory_order_relaxed);
+        fileBytes.store(0, std::memory_order_relaxed);
+        setStatus(CLIENT_STATUS_SYNC);
+    }
+    std::string getFile()
+    {
+        std::lock_guard<std::mutex> lock(fileMutex);
+        return fileName;
+    }
+    static const char *statusName(int s)
+    {
+        switch (s)
+        {
+        case CLIENT_STATUS_IDLE: return "idle";
+        case CLIENT_STATUS_RECEIVING: return "receiving";
+        case CLIENT_STATUS_CONNECTING: return "connecting";
+        case CLIENT_STATUS_SYNC: return "sync";
+        default: return "invalid";
+        }
+    }
+    static int64_t nowMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    std::mutex fileMutex;
+    std::string fileName;
 };
 // struct FileInfo
 // {
@@ -29,41 +89,217 @@ struct ClientInfo
 {
     int fd;
     uint32_t ip;
-    // 状态
-    ClientStatus clientStat;
+    // 状态，连接移除后持有者仍可安全写入
+    std::shared_ptr<ClientState> state;
     // FileInfo fileInfo;
     ClientInfo()
-    : fd(-1), ip(0), clientStat(CLIENT_STATUS_INVALID) {}
+    : fd(-1), ip(0) {}
     ClientInfo(int f, uint32_t i) 
-    : fd(f), ip(i), clientStat(CLIENT_STATUS_IDLE){}
+    : fd(f), ip(i), state(std::make_shared<ClientState>()){}
 };
 
-class ClientList{
+// 读者纪元：读者进入时把当前纪元登记在本线程的槽里，离开时清零，
+// 只有几次原子读写，不加锁、不等待（wait-free）。
+// 写者换下的旧对象记下换下时的纪元，等到没有槽还停在这个纪元或更早，
+// 就没有读者还拿着它，可以释放。
+// 槽按线程分配且永不释放，线程退出后留给以后的线程复用。
+class ReadEpoch
+{
+public:
+    struct alignas(64) Slot
+    {
+        std::atomic<uint64_t> epoch{0}; // 0 表示不在读
+        std::atomic<bool> used{true};
+        Slot *next = nullptr;
+    };
+
+    // 之后读写者发布的指针要用 seq_cst：acquire 的读可以提前到登记之前，
+    // 写者看不到这个槽，就会释放读者读到的对象
+    static Slot &enter()
+    {
+        Slot &slot = localSlot();
+        slot.epoch.store(current().load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        return slot;
+    }
+    static void leave(Slot &slot)
+    {
+        slot.epoch.store(0, std::memory_order_release);
+    }
+    // 写者发布新对象之后调用，返回换下的旧对象要等的纪元
+    static uint64_t retire()
+    {
+        return current().fetch_add(1, std::memory_order_seq_cst);
+    }
+    // 纪元 epoch 换下的对象已经没有读者
+    static bool quiescent(uint64_t epoch)
+    {
+        for (Slot *slot = head().load(std::memory_order_acquire); slot != nullptr; slot = slot->next)
+        {
+            uint64_t reading = slot->epoch.load(std::memory_order_seq_cst);
+            if (reading != 0 && reading <= epoch)
+                return false;
+        }
+        return true;
+    }
+
 private:
-    std::unordered_map<int, ClientInfo> clientInfos;
-    std::mutex clientInfosMutex;
+    struct Holder
+    {
+        Slot *slot;
+        ~Holder() { slot->used.store(false, std::memory_order_release); }
+    };
+    static std::atomic<uint64_t> &current()
+    {
+        static std::atomic<uint64_t> epoch{1};
+        return epoch;
+    }
+    static std::atomic<Slot *> &head()
+    {
+        static std::atomic<Slot *> slots{nullptr};
+        return slots;
+    }
+    static Slot &localSlot()
+    {
+        thread_local Holder holder{acquireSlot()};
+        return *holder.slot;
+    }
+    static Slot *acquireSlot()
+    {
+        for (Slot *slot = head().load(std::memory_order_acquire); slot != nullptr; slot = slot->next)
+        {
+            bool used = false;
+            if (!slot->used.load(std::memory_order_relaxed) &&
+                slot->used.compare_exchange_strong(used, true, std::memory_order_acquire))
+                return slot;
+        }
+        Slot *slot = new Slot;
+        Slot *next = head().load(std::memory_order_relaxed);
+        do
+            slot->next = next;
+        while (!head().compare_exchange_weak(next, slot, std::memory_order_release, std::memory_order_relaxed));
+        return slot;
+    }
+};
+
+// 按 fd 分片的连接表。每个分片发布一张只读的表：
+// 查找和遍历只在读者纪元里读当前的表，不加锁、不等待（wait-free）；
+// 增删锁住 fd 所在的分片，复制一张新表改好后整张替换，
+// 旧表等读者都离开后在之后的写入里释放。
+// 连接数是单独的原子计数，读取无需加锁。
+// 查找返回 ClientInfo 的拷贝，其中的 ClientState 由引用计数持有，
+// 连接被并发移除后拿到它的线程仍可安全使用。
+class ClientList{
 public:
-    ClientList(){
-        clientInfos.clear();
+    static const int SHARD_NUM = 16;
+
+    ClientList() = default;
+    ClientList(const ClientList &) = delete;
+    ClientList &operator=(const ClientList &) = delete;
+    ~ClientList()
+    {
+        for (auto &shard : shards)
+        {
+            delete shard.clientInfos.load(std::memory_order_relaxed);
+            for (auto &old : shard.retired)
+                delete old.second;
+        }
     }
+
     void addClient(int fd, uint32_t ip){
-        std::lock_guard<std::mutex> lock(clientInfosMutex);
-        clientInfos.emplace(fd, ClientInfo(fd, ip));
+        Shard &shard = shardOf(fd);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const Map *current = shard.clientInfos.load(std::memory_order_relaxed);
+        auto it = lowerBound(*current, fd);
+        if (it != current->end() && it->fd == fd)
+            return;
+        Map *next = new Map();
+        next->reserve(current->size() + 1);
+        next->insert(next->end(), current->begin(), it);
+        next->push_back(ClientInfo(fd, ip));
+        next->insert(next->end(), it, current->end());
+        publish(shard, next);
+        clientNum.fetch_add(1, std::memory_order_relaxed);
     }
     void removeClient(int fd){
-        std::lock_guard<std::mutex> lock(clientInfosMutex);
-        if(clientInfos.find(fd) != clientInfos.end())
-            clientInfos.erase(fd);
+        Shard &shard = shardOf(fd);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        const Map *current = shard.clientInfos.load(std::memory_order_relaxed);
+        auto it = lowerBound(*current, fd);
+        if (it == current->end() || it->fd != fd)
+            return;
+        Map *next = new Map();
+        next->reserve(current->size() - 1);
+        next->insert(next->end(), current->begin(), it);
+        next->insert(next->end(), it + 1, current->end());
+        publish(shard, next);
+        clientNum.fetch_sub(1, std::memory_order_relaxed);
     }
     int getClientNum()
     {
-        std::lock_guard<std::mutex> lock(clientInfosMutex);
-        return clientInfos.size();
+        return clientNum.load(std::memory_order_relaxed);
+    }
+    // fd 不在列表里时返回 fd 为 -1 的 ClientInfo
+    ClientInfo getClientInfo(int fd){
+        Shard &shard = shardOf(fd);
+        ReadEpoch::Slot &slot = ReadEpoch::enter();
+        const Map *current = shard.clientInfos.load(std::memory_order_seq_cst);
+        auto it = lowerBound(*current, fd);
+        ClientInfo info = it != current->end() && it->fd == fd ? *it : ClientInfo();
+        ReadEpoch::leave(slot);
+        return info;
+    }
+    // 传输开始时取一次，之后更新状态不再查表；fd 不在列表里时返回空
+    std::shared_ptr<ClientState> getState(int fd)
+    {
+        return getClientInfo(fd).state;
+    }
+    // 状态页用，逐个分片复制当前发布的表
+    void snapshot(std::vector<ClientInfo> &clients)
+    {
+        clients.clear();
+        ReadEpoch::Slot &slot = ReadEpoch::enter();
+        for (auto &shard : shards)
+        {
+            const Map *current = shard.clientInfos.load(std::memory_order_seq_cst);
+            clients.insert(clients.end(), current->begin(), current->end());
+        }
+        ReadEpoch::leave(slot);
+    }
+
+private:
+    // 按 fd 排序，复制一次只分配一块内存
+    typedef std::vector<ClientInfo> Map;
+    // 每个分片独占缓存行，避免相邻分片伪共享
+    struct alignas(64) Shard
+    {
+        std::mutex mutex; // 只在写者之间互斥
+        std::atomic<const Map *> clientInfos{new Map()};
+        std::vector<std::pair<uint64_t, const Map *>> retired; // 纪元, 换下的表；由 mutex 保护
+    };
+    Shard shards[SHARD_NUM];
+    alignas(64) std::atomic<int> clientNum{0};
+
+    Shard &shardOf(int fd) { return shards[(unsigned)fd % SHARD_NUM]; }
+    static Map::const_iterator lowerBound(const Map &map, int fd)
+    {
+        return std::lower_bound(map.begin(), map.end(), fd,
+                                [](const ClientInfo &info, int key) { return info.fd < key; });
     }
-    ClientInfo& getClientInfo(int fd){
-        std::lock_guard<std::mutex> lock(clientInfosMutex);
-        assert(clientInfos.find(fd) != clientInfos.end());
-        return clientInfos[fd];
+
+    // 调用时持有 shard.mutex
+    static void publish(Shard &shard, const Map *next)
+    {
+        const Map *old = shard.clientInfos.exchange(next, std::memory_order_seq_cst);
+        shard.retired.emplace_back(ReadEpoch::retire(), old);
+        size_t kept = 0;
+        for (auto &entry : shard.retired)
+        {
+            if (ReadEpoch::quiescent(entry.first))
+                delete entry.second;
+            else
+                shard.retired[kept++] = entry;
+        }
+        shard.retired.resize(kept);
     }
 };
 
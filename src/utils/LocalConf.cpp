@@ -1,7 +1,10 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <arpa/inet.h>
+#include <sys/stat.h>
 #include "LocalConf.h"
+#include "Logger.h"
 #define PROGRAM_NAME "FileUploadClient"
 std::string getConfigPath()
 {
@@ -36,15 +39,47 @@ int LocalConf::splitComma(const std::string& splitString, std::vector<std::strin
     return num;
 }
 
+// "0-3,8" style list, empty allowed
+bool LocalConf::isCpuList(const std::string& str) const {
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t first = item.find_first_not_of(" \t");
+        size_t last = item.find_last_not_of(" \t");
+        if (first == std::string::npos)
+            return false;
+        item = item.substr(first, last - first + 1);
+        size_t dash = item.find('-');
+        std::string low = item.substr(0, dash);
+        std::string high = dash == std::string::npos ? low : item.substr(dash + 1);
+        if (low.empty() || high.empty() || low.size() > 4 || high.size() > 4 ||
+            low.find_first_not_of("0123456789") != std::string::npos ||
+            high.find_first_not_of("0123456789") != std::string::npos ||
+            std::stoi(low) > std::stoi(high))
+            return false;
+    }
+    return true;
+}
+
+bool LocalConf::isListenAddr(const std::string& str) const {
+    size_t colon = str.rfind(':');
+    std::string port = colon == std::string::npos ? str : str.substr(colon + 1);
+    if (port.empty() || port.size() > 5 || port.find_first_not_of("0123456789") != std::string::npos ||
+        std::stoi(port) == 0 || std::stoi(port) > 65535)
+        return false;
+    struct in_addr addr;
+    return colon == std::string::npos || inet_pton(AF_INET, str.substr(0, colon).c_str(), &addr) == 1;
+}
+
 bool LocalConf::safeStringToInt(const std::string& str, int& result, const std::string& fieldName) {
     try {
         result = std::stoi(str);
         return true;
     } catch (const std::invalid_argument& e) {
-        std::cout << "[Error] Invalid " << fieldName << " value: " << str << " - not a valid number" << std::endl;
+        LOGE << "Invalid " << fieldName << " value: " << str << " - not a valid number";
         return false;
     } catch (const std::out_of_range& e) {
-        std::cout << "[Error] " << fieldName << " value out of range: " << str << std::endl;
+        LOGE << fieldName << " value out of range: " << str;
         return false;
     }
 }
@@ -56,10 +91,10 @@ bool LocalConf::safeStringToDouble(const std::string& str, double& result, const
         return true;
     }
     catch (const std::invalid_argument& e) {
-        std::cout << "[Error] Invalid " << fieldName << " value: " << str << " - not a valid number" << std::endl;
+        LOGE << "Invalid " << fieldName << " value: " << str << " - not a valid number";
         return false;
     }catch(const std::out_of_range& e){
-        std::cout << "[Error] " << fieldName << " value out of range: " << str << std::endl;
+        LOGE << fieldName << " value out of range: " << str;
         return false;
     }
 }
@@ -69,10 +104,10 @@ bool LocalConf::safeStringToULongLong(const std::string& str, unsigned long long
         result = std::stoull(str);
         return true;
     } catch (const std::invalid_argument& e) {
-        std::cout << "[Error] Invalid " << fieldName << " value: " << str << " - not a valid number" << std::endl;
+        LOGE << "Invalid " << fieldName << " value: " << str << " - not a valid number";
         return false;
     } catch (const std::out_of_range& e) {
-        std::cout << "[Error] " << fieldName << " value out of range: " << str << std::endl;
+        LOGE << fieldName << " value out of range: " << str;
         return false;
     }
 }
@@ -80,14 +115,14 @@ bool LocalConf::safeStringToULongLong(const std::string& str, unsigned long long
 int LocalConf::createDefaultConf() {
     int ret = saveConf();
     if(ret == 0)
-        std::cout << "Create default config file: " << this->configPath << std::endl;
+        LOGI << "Create default config file: " << this->configPath;
     return ret;
 }
 
 int LocalConf::saveConf() {
     std::ofstream file(this->configPath);
     if (!file.is_open()) {
-        std::cout << "Failed to create config file: " << this->configPath << std::endl;
+        LOGE << "Failed to create config file: " << this->configPath;
         return -1;
     }
 
@@ -99,7 +134,36 @@ int LocalConf::saveConf() {
          << "DefaultRate = " << this->defaultRate << "\n"
          << "BlockSize = " << this->blockSize << "\n"
          << "BlockNum = " << this->blockNum << "\n"
-         << "SavedFolderPath = " << this->savedFolderPath << "\n";
+         << "WriteCoalesceSize = " << this->writeCoalesceSize << "\n"
+         << "WriteCoalesceUs = " << this->writeCoalesceUs << "\n"
+         << "DirtyLimit = " << this->dirtyLimit << "\n"
+         << "SparseWrites = " << this->sparseWrites << "\n"
+         << "SavedFolderPath = " << this->savedFolderPath << "\n"
+         << "CreditBudget = " << this->creditBudget << "\n"
+         << "ClientWeights = ";
+    for (size_t i = 0; i < this->clientWeights.size(); i++)
+        file << (i ? ", " : "") << this->clientWeights[i];
+    file << "\n"
+         << "ShareReportInterval = " << this->shareReportInterval << "\n"
+         << "MetricsListen = " << this->metricsListen << "\n"
+         << "TraceDir = " << this->traceDir << "\n"
+         << "UseSrq = " << this->useSrq << "\n"
+         << "SrqBlockNum = " << this->srqBlockNum << "\n"
+         << "ServerMode = " << this->serverMode << "\n"
+         << "ReactorNum = " << this->reactorNum << "\n"
+         << "MaxConnNum = " << this->maxConnNum << "\n"
+         << "SpareNum = " << this->spareNum << "\n"
+         << "NumaNode = " << this->numaNode << "\n"
+         << "PollCores = " << this->pollCores << "\n"
+         << "IoCores = " << this->ioCores << "\n"
+         << "RdmaPorts = ";
+    for (size_t i = 0; i < this->rdmaPorts.size(); i++)
+        file << (i ? ", " : "") << this->rdmaPorts[i];
+    file << "\n";
+    file << "StorageTargets = ";
+    for (size_t i = 0; i < this->storageTargets.size(); i++)
+        file << (i ? ", " : "") << this->storageTargets[i];
+    file << "\n";
     file << "# End of Configuration File\n";
     file.close();
     return 0;
@@ -112,12 +176,12 @@ int LocalConf::loadConf() {
         createDefaultConf();
         file.open(this->configPath);
         if (!file.is_open()) {
-            std::cout << "Failed to open configuration file: " << this->configPath << std::endl;
+            LOGE << "Failed to open configuration file: " << this->configPath;
                 return -1;
         }
     }
     
-    std::cout << "loading config \"" <<this->configPath << "\"..." << std::endl;
+    LOGI << "loading config \"" <<this->configPath << "\"...";
     std::string line;
     bool error = false;
     
@@ -131,7 +195,7 @@ int LocalConf::loadConf() {
 
         size_t pos = line.find('=');
         if (pos == std::string::npos) {
-            std::cout << "[Error] Invalid config line: " << line << std::endl;
+            LOGE << "Invalid config line: " << line;
                 error = true;
             }
 
@@ -147,7 +211,7 @@ int LocalConf::loadConf() {
             }
             if(this->rdmaGidIndex < 0)
             {
-                std::cout << "[Error] Invalid RdmaGidIndex: " << value << std::endl;
+                LOGE << "Invalid RdmaGidIndex: " << value;
                 error = true;
                 this->rdmaGidIndex = 0;
             }
@@ -160,7 +224,7 @@ int LocalConf::loadConf() {
             }
             if(this->localPort <= 0 || this->localPort > 65535)
             {
-                std::cout << "[Error] Invalid ListenPort: " << value << std::endl;
+                LOGE << "Invalid ListenPort: " << value;
                 error = true;
                 this->localPort = 52025;
             }
@@ -173,8 +237,8 @@ int LocalConf::loadConf() {
             }
             if(this->maxThreadNum <= 0 || this->maxThreadNum > 1024)
             {
-                std::cout << "[Error] Invalid MaxThreadNum: " << value << std::endl;
-                std::cout << "Valid range: 1 ~ 1024" << std::endl;
+                LOGE << "Invalid MaxThreadNum: " << value;
+                LOGI << "Valid range: 1 ~ 1024";
                 error = true;
                 this->maxThreadNum = 16;
             }
@@ -188,7 +252,7 @@ int LocalConf::loadConf() {
             }
             if(this->defaultRate <= 0)
             {
-                std::cout << "[Error] Invalid DefaultRate: " << value << std::endl;
+                LOGE << "Invalid DefaultRate: " << value;
                 error = true;
                 this->defaultRate = 100.0;
             }
@@ -199,10 +263,10 @@ int LocalConf::loadConf() {
                 error = true;
                 this->blockSize = 1024;
             }
-            if(this->blockSize <= 4 || this->blockSize > 1024 * 1024)  //4k ~ 1G
+            if(this->blockSize < 4 || this->blockSize > 1024 * 1024)  //4k ~ 1G
             {
-                std::cout << "[Error] Invalid BlockSize: " << value << std::endl;
-                std::cout << "Valid range: 4 ~ 1048576" << std::endl;
+                LOGE << "Invalid BlockSize: " << value;
+                LOGI << "Valid range: 4 ~ 1048576";
                 error = true;
                 this->blockSize = 1024;
             }
@@ -215,12 +279,68 @@ int LocalConf::loadConf() {
             }
             if(this->blockNum <= 0 || this->blockNum > 65536) // 1 ~ 65536
             {
-                std::cout << "[Error] Invalid BlockNum: " << value << std::endl;
-                std::cout << "Valid range: 1 ~ 65536" << std::endl;
+                LOGE << "Invalid BlockNum: " << value;
+                LOGI << "Valid range: 1 ~ 65536";
                 error = true;
                 this->blockNum = 256;
             }
         }
+        else if (key == "WriteCoalesceSize")
+        {
+            if (!safeStringToInt(value, this->writeCoalesceSize, "WriteCoalesceSize")) {
+                error = true;
+                this->writeCoalesceSize = 1024;
+            }
+            if(this->writeCoalesceSize < 0 || this->writeCoalesceSize > 1024 * 1024)
+            {
+                LOGE << "Invalid WriteCoalesceSize: " << value;
+                LOGI << "Valid range: 0 ~ 1048576 (0 means disabled)";
+                error = true;
+                this->writeCoalesceSize = 1024;
+            }
+        }
+        else if (key == "WriteCoalesceUs")
+        {
+            if (!safeStringToInt(value, this->writeCoalesceUs, "WriteCoalesceUs")) {
+                error = true;
+                this->writeCoalesceUs = 200;
+            }
+            if(this->writeCoalesceUs < 0 || this->writeCoalesceUs > 1000000)
+            {
+                LOGE << "Invalid WriteCoalesceUs: " << value;
+                LOGI << "Valid range: 0 ~ 1000000";
+                error = true;
+                this->writeCoalesceUs = 200;
+            }
+        }
+        else if (key == "DirtyLimit")
+        {
+            if (!safeStringToInt(value, this->dirtyLimit, "DirtyLimit")) {
+                error = true;
+                this->dirtyLimit = 64;
+            }
+            if(this->dirtyLimit < 0 || this->dirtyLimit > 1024 * 1024)
+            {
+                LOGE << "Invalid DirtyLimit: " << value;
+                LOGI << "Valid range: 0 ~ 1048576 (0 means disabled)";
+                error = true;
+                this->dirtyLimit = 64;
+            }
+        }
+        else if (key == "SparseWrites")
+        {
+            if (!safeStringToInt(value, this->sparseWrites, "SparseWrites")) {
+                error = true;
+                this->sparseWrites = 0;
+            }
+            if(this->sparseWrites != 0 && this->sparseWrites != 1)
+            {
+                LOGE << "Invalid SparseWrites: " << value;
+                LOGI << "Valid value: 0 or 1";
+                error = true;
+                this->sparseWrites = 0;
+            }
+        }
         else if(key == "SavedFolderPath")
         {
             // wxString savedFolderPath = wxString::FromUTF8(value.c_str());
@@ -228,21 +348,190 @@ int LocalConf::loadConf() {
             this->savedFolderPath = wxString(value); // Assuming value is a valid path string
             if(this->savedFolderPath.IsEmpty() || !wxFileName::DirExists(this->savedFolderPath))
             {
-                std::cout << "[Error] Invalid SavedFolderPath: " << value << std::endl;
+                LOGE << "Invalid SavedFolderPath: " << value;
                 error = true;
                 this->savedFolderPath = wxStandardPaths::Get().GetDocumentsDir();
             }
         }
+        else if (key == "CreditBudget")
+        {
+            if (!safeStringToInt(value, this->creditBudget, "CreditBudget")) {
+                error = true;
+                this->creditBudget = 0;
+            }
+            if(this->creditBudget < 0)
+            {
+                LOGE << "Invalid CreditBudget: " << value;
+                LOGI << "Valid range: >= 0 (0 means auto)";
+                error = true;
+                this->creditBudget = 0;
+            }
+        }
+        else if (key == "ClientWeights")
+        {
+            this->clientWeights.clear();
+            if (!value.empty())
+                splitComma(value, this->clientWeights);
+        }
+        else if (key == "ShareReportInterval")
+        {
+            if (!safeStringToInt(value, this->shareReportInterval, "ShareReportInterval")) {
+                error = true;
+                this->shareReportInterval = 0;
+            }
+            if(this->shareReportInterval < 0)
+            {
+                LOGE << "Invalid ShareReportInterval: " << value;
+                error = true;
+                this->shareReportInterval = 0;
+            }
+        }
+        else if (key == "MetricsListen")
+        {
+            if (!value.empty() && !isListenAddr(value))
+            {
+                LOGE << "Invalid MetricsListen: " << value;
+                LOGI << "Valid value: [addr:]port like 127.0.0.1:9464, empty to disable";
+                error = true;
+                this->metricsListen.clear();
+            }
+            else
+                this->metricsListen = value;
+        }
+        else if (key == "TraceDir")
+            this->traceDir = value;
+        else if (key == "UseSrq")
+        {
+            if (!safeStringToInt(value, this->useSrq, "UseSrq")) {
+                error = true;
+                this->useSrq = 0;
+            }
+            if(this->useSrq != 0 && this->useSrq != 1)
+            {
+                LOGE << "Invalid UseSrq: " << value;
+                LOGI << "Valid value: 0 or 1";
+                error = true;
+                this->useSrq = 0;
+            }
+        }
+        else if (key == "SrqBlockNum")
+        {
+            if (!safeStringToInt(value, this->srqBlockNum, "SrqBlockNum")) {
+                error = true;
+                this->srqBlockNum = 1024;
+            }
+            if(this->srqBlockNum <= 0 || this->srqBlockNum > 65536)
+            {
+                LOGE << "Invalid SrqBlockNum: " << value;
+                LOGI << "Valid range: 1 ~ 65536";
+                error = true;
+                this->srqBlockNum = 1024;
+            }
+        }
+        else if (key == "ServerMode")
+        {
+            if (value != "thread" && value != "reactor" && value != "pool")
+            {
+                LOGE << "Invalid ServerMode: " << value;
+                LOGI << "Valid value: thread, reactor, pool";
+                error = true;
+                this->serverMode = "thread";
+            }
+            else
+                this->serverMode = value;
+        }
+        else if (key == "ReactorNum")
+        {
+            if (!safeStringToInt(value, this->reactorNum, "ReactorNum")) {
+                error = true;
+                this->reactorNum = 1;
+            }
+            if(this->reactorNum <= 0 || this->reactorNum > 256)
+            {
+                LOGE << "Invalid ReactorNum: " << value;
+                LOGI << "Valid range: 1 ~ 256";
+                error = true;
+                this->reactorNum = 1;
+            }
+        }
+        else if (key == "MaxConnNum")
+        {
+            if (!safeStringToInt(value, this->maxConnNum, "MaxConnNum")) {
+                error = true;
+                this->maxConnNum = 0;
+            }
+            if(this->maxConnNum < 0 || this->maxConnNum > 65536)
+            {
+                LOGE << "Invalid MaxConnNum: " << value;
+                LOGI << "Valid range: 0 ~ 65536, 0 means MaxThreadNum, no limit with UseSrq or tcp";
+                error = true;
+                this->maxConnNum = 0;
+            }
+        }
+        else if (key == "SpareNum")
+        {
+            if (!safeStringToInt(value, this->spareNum, "SpareNum")) {
+                error = true;
+                this->spareNum = 4;
+            }
+            if(this->spareNum < 0 || this->spareNum > 1024)
+            {
+                LOGE << "Invalid SpareNum: " << value;
+                LOGI << "Valid range: 0 ~ 1024";
+                error = true;
+                this->spareNum = 4;
+            }
+        }
+        else if (key == "NumaNode")
+        {
+            int node = -1;
+            if (value != "auto" && value != "off" &&
+                (value.empty() || value.find_first_not_of("0123456789") != std::string::npos ||
+                 !safeStringToInt(value, node, "NumaNode") || node > 1023))
+            {
+                LOGE << "Invalid NumaNode: " << value;
+                LOGI << "Valid value: auto, off, 0 ~ 1023";
+                error = true;
+                this->numaNode = "auto";
+            }
+            else
+                this->numaNode = value;
+        }
+        else if (key == "PollCores" || key == "IoCores")
+        {
+            std::string &cores = key == "PollCores" ? this->pollCores : this->ioCores;
+            if (!isCpuList(value))
+            {
+                LOGE << "Invalid " << key << ": " << value;
+                LOGI << "Valid value: cpu list like 0-7,16, empty for the nic's node";
+                error = true;
+                cores.clear();
+            }
+            else
+                cores = value;
+        }
+        else if (key == "RdmaPorts")
+        {
+            this->rdmaPorts.clear();
+            if (!value.empty())
+                splitComma(value, this->rdmaPorts);
+        }
+        else if (key == "StorageTargets")
+        {
+            this->storageTargets.clear();
+            if (!value.empty())
+                splitComma(value, this->storageTargets);
+        }
         else
         {
-            std::cout << "[Error] When parsing config_file, unknown key: " << key << std::endl;
+            LOGE << "When parsing config_file, unknown key: " << key;
             error = true;
         }
     }
     if(error)
         return -1;
     file.close();
-    std::cout << "Configuration loaded successfully from: " << this->configPath << std::endl;
+    LOGI << "Configuration loaded successfully from: " << this->configPath;
     return 0; 
 }
 
@@ -253,5 +542,56 @@ int LocalConf::initNewConf() {
     this->defaultRate = 100.0;
     this->blockSize = 1024; //in kbytes
     this->blockNum = 256;
+    this->writeCoalesceSize = 1024;
+    this->writeCoalesceUs = 200;
+    this->dirtyLimit = 64;
+    this->sparseWrites = 0;
     this->savedFolderPath = wxStandardPaths::Get().GetDocumentsDir();
-}
\ No newline at end of file
+    this->creditBudget = 0;
+    this->clientWeights.clear();
+    this->shareReportInterval = 0;
+    this->useSrq = 0;
+    this->srqBlockNum = 1024;
+    this->serverMode = "thread";
+    this->reactorNum = 1;
+    this->maxConnNum = 0;
+    this->spareNum = 4;
+    this->numaNode = "auto";
+    this->pollCores.clear();
+    this->ioCores.clear();
+    this->rdmaPorts.clear();
+    this->storageTargets.clear();
+}
+
+SharedConf::SharedConf(const LocalConf& conf)
+    : configPath(conf.getConfPath())
+{
+    LocalConf *copy = new LocalConf(conf);
+    copy->setSaveOnExit(false);
+    current.reset(copy);
+    struct stat st;
+    if (stat(configPath.c_str(), &st) == 0)
+        mtime = st.st_mtim;
+}
+
+std::shared_ptr<const LocalConf> SharedConf::get() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return current;
+}
+
+std::shared_ptr<const LocalConf> SharedConf::reload() {
+    std::lock_guard<std::mutex> lock(mutex);
+    struct stat st;
+    if (stat(configPath.c_str(), &st) != 0 ||
+        (st.st_mtim.tv_sec == mtime.tv_sec && st.st_mtim.tv_nsec == mtime.tv_nsec))
+        return current;
+    // keys missing from the file keep their value, as with loadConf() on one object
+    LocalConf *next = new LocalConf(*current);
+    next->setSaveOnExit(false);
+    if (next->loadConf() == 0)
+        current.reset(next);
+    else
+        delete next;
+    mtime = st.st_mtim;
+    return current;
+}
@@ -3,7 +3,10 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <mutex>
 #include <stdint.h>
+#include <time.h>
 #include <wx/wx.h>
 #include <wx/stdpaths.h>
 #include <wx/filename.h>
@@ -23,13 +26,30 @@ public:
         rdmaGidIndex(0),
         defaultRate(100.0),
         blockSize(1024), //in kbytes
-        blockNum(256)
+        blockNum(256),
+        writeCoalesceSize(1024),
+        writeCoalesceUs(200),
+        dirtyLimit(64),
+        sparseWrites(0),
+        creditBudget(0),
+        shareReportInterval(0),
+        useSrq(0),
+        srqBlockNum(1024),
+        serverMode("thread"),
+        reactorNum(1),
+        maxConnNum(0),
+        spareNum(4),
+        numaNode("auto")
     {
         this->savedFolderPath = wxStandardPaths::Get().GetDocumentsDir();
     }
     ~LocalConf(){
-        saveConf();
+        if (saveOnExit)
+            saveConf();
     }
+    // snapshots and private copies must not write the file back
+    void setSaveOnExit(bool save) { saveOnExit = save; }
+    const std::string& getConfPath() const { return configPath; }
 
     int getMaxThreadNum() const { return maxThreadNum; }
     int getLocalPort() const { return localPort; }
@@ -37,11 +57,43 @@ public:
     double getDefaultRate() const { return defaultRate; }
     int getBlockSize() const { return blockSize; }
     int getBlockNum() const { return blockNum; }
+    int getWriteCoalesceSize() const { return writeCoalesceSize; }
+    int getWriteCoalesceUs() const { return writeCoalesceUs; }
+    int getDirtyLimit() const { return dirtyLimit; }
+    bool getSparseWrites() const { return sparseWrites != 0; }
     wxString getSavedFolderPath() const { return savedFolderPath; }
     void setSavedFolderPath(const wxString& path) { savedFolderPath = path; }
+    // for headless benchmarks, saveConf() keeps them across loadConf()
+    void setBlockSize(int size) { blockSize = size; }
+    void setBlockNum(int num) { blockNum = num; }
+    void setWriteCoalesceSize(int size) { writeCoalesceSize = size; }
+    void setUseSrq(bool use) { useSrq = use ? 1 : 0; }
+    void setServerMode(const std::string& mode) { serverMode = mode; }
+    void setMaxConnNum(int num) { maxConnNum = num; }
+    void setStorageTargets(const std::vector<std::string>& targets) { storageTargets = targets; }
+    int getCreditBudget() const { return creditBudget; }
+    const std::vector<std::string>& getClientWeights() const { return clientWeights; }
+    int getShareReportInterval() const { return shareReportInterval; }
+    const std::string& getMetricsListen() const { return metricsListen; }
+    const std::string& getTraceDir() const { return traceDir; }
+    bool getUseSrq() const { return useSrq != 0; }
+    int getSrqBlockNum() const { return srqBlockNum; }
+    const std::string& getServerMode() const { return serverMode; }
+    int getReactorNum() const { return reactorNum; }
+    int getMaxConnNum() const { return maxConnNum; }
+    // connections the registered memory, cqs and spares are sized for; also
+    // the limit for MaxConnNum 0 unless the memory is shared (UseSrq, tcp)
+    int getConnSlots() const { return maxConnNum > 0 ? maxConnNum : maxThreadNum; }
+    int getSpareNum() const { return spareNum; }
+    const std::string& getNumaNode() const { return numaNode; }
+    const std::string& getPollCores() const { return pollCores; }
+    const std::string& getIoCores() const { return ioCores; }
+    const std::vector<std::string>& getRdmaPorts() const { return rdmaPorts; }
+    const std::vector<std::string>& getStorageTargets() const { return storageTargets; }
 
 private:
     std::string configPath;
+    bool saveOnExit = true;
 
     //for conn listen
     int maxThreadNum;
@@ -55,9 +107,49 @@ private:
     int blockSize;
     int blockNum;
 
+    //for receiver write batching: adjacent blocks are written together up to
+    //writeCoalesceSize kbytes (0 means one write per block) or writeCoalesceUs old
+    int writeCoalesceSize;
+    int writeCoalesceUs;
+    //dirty page cache allowed per received file, in mbytes, 0 means left to the kernel
+    int dirtyLimit;
+    //all-zero received blocks are punched as holes instead of written (rdma transport)
+    int sparseWrites;
+
     //for file save
     wxString savedFolderPath;
 
+    //for receive credit scheduling
+    int creditBudget; //in blocks, 0 means derived from registered memory
+    std::vector<std::string> clientWeights; //"ip[/prefix]:weight"
+    int shareReportInterval; //in seconds, 0 means disabled
+
+    //for the prometheus metrics endpoint: "[addr:]port", addr defaults to 127.0.0.1, empty means disabled
+    std::string metricsListen;
+    //for the pipeline timeline: directory of the chrome trace files, empty means disabled
+    std::string traceDir;
+
+    //for shared receive queue on the server
+    int useSrq;
+    int srqBlockNum;
+
+    //for server connection handling: "thread", "reactor" or "pool"
+    std::string serverMode;
+    int reactorNum;
+    int maxConnNum; //0 means no limit, buffers are then sized for MaxThreadNum connections; MaxThreadNum sizes the worker pool in "pool" mode
+    int spareNum; //ready made connection contexts kept for the accept path, 0 means disabled
+
+    //for numa placement: "auto", "off" or a node number; cpu lists like "0-7,16"
+    std::string numaNode;
+    std::string pollCores; //empty means the cpus of the nic's node
+    std::string ioCores;
+
+    //for multi-port transfers: "dev" or "dev:port", empty means every active port
+    std::vector<std::string> rdmaPorts;
+
+    //for the server: directories files are placed over, empty means SavedFolderPath only
+    std::vector<std::string> storageTargets;
+
     bool isCommentOrEmpty(const std::string& line) const;
     std::string& trim(std::string& str);
     int splitComma(const std::string& splitString, std::vector<std::string>& splitArray);
@@ -66,7 +158,27 @@ private:
     bool safeStringToInt(const std::string& str, int& result, const std::string& fieldName);
     bool safeStringToULongLong(const std::string& str, unsigned long long& result, const std::string& fieldName);
     bool safeStringToDouble(const std::string& str, double& result, const std::string& fieldName);
+    bool isCpuList(const std::string& str) const;
+    bool isListenAddr(const std::string& str) const;
     int createDefaultConf();
 };
 
+// The server's view of the config file, read by many connection threads.
+// reload() parses a changed file into a new LocalConf and swaps it in; a
+// receiver keeps the snapshot it got for the whole file, so no thread ever
+// reads members another thread is rewriting.
+class SharedConf {
+public:
+    explicit SharedConf(const LocalConf& conf);
+    std::shared_ptr<const LocalConf> get() const;
+    // the current snapshot, re-read first when the file changed since
+    std::shared_ptr<const LocalConf> reload();
+
+private:
+    std::string configPath;
+    mutable std::mutex mutex;
+    std::shared_ptr<const LocalConf> current;
+    struct timespec mtime = {0, 0};
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Logger.h"
+
+std::atomic<int> Logger::min_level(LOG_LEVEL_DEBUG);
+
+namespace
+{
+struct RecordHeader
+{
+    uint32_t len;
+    uint32_t level;
+    uint64_t ns;
+};
+
+struct LogRing
+{
+    // head is written by the owner thread only, tail by the flusher (drain_mutex)
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> tail{0};
+    std::atomic<bool> dead{false};
+    char data[Logger::RING_SIZE];
+
+    void copyIn(uint64_t pos, const void *src, size_t n)
+    {
+        size_t off = pos % Logger::RING_SIZE;
+        size_t first = std::min<size_t>(n, Logger::RING_SIZE - off);
+        memcpy(data + off, src, first);
+        memcpy(data, (const char *)src + first, n - first);
+    }
+    void copyOut(uint64_t pos, void *dst, size_t n) const
+    {
+        size_t off = pos % Logger::RING_SIZE;
+        size_t first = std::min<size_t>(n, Logger::RING_SIZE - off);
+        memcpy(dst, data + off, first);
+        memcpy((char *)dst + first, data, n - first);
+    }
+};
+
+struct Entry
+{
+    uint64_t ns;
+    std::string text;
+};
+
+// owns the ring list and the flusher thread, never destroyed so detached
+// threads can log while the process exits
+struct Flusher
+{
+    std::mutex drain_mutex;
+    std::vector<LogRing *> rings; // drain_mutex
+    std::mutex wait_mutex;
+    std::condition_variable wake_cv;
+    std::atomic<bool> running{false};
+    std::atomic<bool> wake_pending{false};
+    std::thread thread;
+
+    void drain()
+    {
+        std::lock_guard<std::mutex> lock(drain_mutex);
+        std::vector<Entry> entries;
+        for (auto it = rings.begin(); it != rings.end();)
+        {
+            LogRing *ring = *it;
+            bool dead = ring->dead.load(std::memory_order_acquire);
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+            while (tail < head)
+            {
+                RecordHeader hdr;
+                ring->copyOut(tail, &hdr, sizeof(hdr));
+                Entry entry;
+                entry.ns = hdr.ns;
+                entry.text.resize(hdr.len);
+                ring->copyOut(tail + sizeof(hdr), &entry.text[0], hdr.len);
+                entries.push_back(std::move(entry));
+                tail += sizeof(hdr) + hdr.len;
+            }
+            ring->tail.store(tail, std::memory_order_release);
+            if (dead)
+            {
+                delete ring;
+                it = rings.erase(it);
+            }
+            else
+                ++it;
+        }
+        if (entries.empty())
+            return;
+        // every ring is in order already, interleave the threads by time
+        std::stable_sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b)
+                         { return a.ns < b.ns; });
+        std::string out;
+        for (auto &entry : entries)
+        {
+            out += entry.text;
+            out += '\n';
+        }
+        fwrite(out.data(), 1, out.size(), stdout);
+        fflush(stdout);
+    }
+
+    void run()
+    {
+        while (running.load())
+        {
+            {
+                std::unique_lock<std::mutex> lock(wait_mutex);
+                wake_cv.wait_for(lock, std::chrono::milliseconds(50), [this]
+                                 { return wake_pending.load() || !running.load(); });
+                wake_pending.store(false);
+            }
+            drain();
+        }
+    }
+
+    void wake()
+    {
+        if (wake_pending.exchange(true))
+            return;
+        std::lock_guard<std::mutex> lock(wait_mutex);
+        wake_cv.notify_one();
+    }
+
+    void stop()
+    {
+        if (running.exchange(false))
+        {
+            wake();
+            thread.join();
+        }
+        drain();
+    }
+};
+
+Flusher *theFlusher()
+{
+    static Flusher *flusher = []
+    {
+        Flusher *f = new Flusher;
+        f->running.store(true);
+        f->thread = std::thread(&Flusher::run, f);
+        pthread_setname_np(f->thread.native_handle(), "logger");
+        atexit([]
+               { theFlusher()->stop(); });
+        return f;
+    }();
+    return flusher;
+}
+
+// marks the ring of an exited thread so the flusher frees it after the last lines
+struct RingHolder
+{
+    LogRing *ring = nullptr;
+    ~RingHolder()
+    {
+        if (ring != nullptr)
+            ring->dead.store(true, std::memory_order_release);
+    }
+};
+thread_local RingHolder holder;
+
+LogRing *threadRing()
+{
+    if (holder.ring != nullptr)
+        return holder.ring;
+    Flusher *flusher = theFlusher();
+    LogRing *ring = new LogRing;
+    std::lock_guard<std::mutex> lock(flusher->drain_mutex);
+    flusher->rings.push_back(ring);
+    holder.ring = ring;
+    return ring;
+}
+
+void publish(LogLevel level, const std::string &text)
+{
+    Flusher *flusher = theFlusher();
+    LogRing *ring = threadRing();
+    RecordHeader hdr;
+    hdr.len = std::min<size_t>(text.size(), Logger::RING_SIZE / 2 - sizeof(hdr));
+    hdr.level = level;
+    hdr.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    uint64_t need = sizeof(hdr) + hdr.len;
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    while (head + need - ring->tail.load(std::memory_order_acquire) > Logger::RING_SIZE)
+    {
+        // full: wait for the flusher, or drain ourselves once it stopped at exit
+        if (flusher->running.load())
+        {
+            flusher->wake();
+            std::this_thread::yield();
+        }
+        else
+            flusher->drain();
+    }
+    ring->copyIn(head, &hdr, sizeof(hdr));
+    ring->copyIn(head + sizeof(hdr), text.data(), hdr.len);
+    ring->head.store(head + need, std::memory_order_release);
+    if (level >= LOG_LEVEL_WARN || head + need - ring->tail.load(std::memory_order_relaxed) > Logger::RING_SIZE / 4)
+        flusher->wake();
+}
+
+class LineBuf : public std::streambuf
+{
+public:
+    std::string text;
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        if (c != traits_type::eof())
+            text.push_back((char)c);
+        return c;
+    }
+    std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+        text.append(s, n);
+        return n;
+    }
+};
+
+// a line may be built while another one of the thread is still open
+// (a stream argument that logs itself), each depth has its own buffer
+const int MAX_DEPTH = 4;
+struct LineStream
+{
+    LineBuf buf;
+    std::ostream os{&buf};
+};
+thread_local LineStream line_streams[MAX_DEPTH];
+thread_local int line_depth = 0;
+}
+
+Logger::Line::Line(LogLevel level)
+    : level(level)
+{
+    LineStream &ls = line_streams[std::min(line_depth, MAX_DEPTH - 1)];
+    line_depth++;
+    ls.buf.text.clear();
+    ls.os.clear();
+    ls.os.flags(std::ios::dec | std::ios::skipws);
+    ls.os.precision(6);
+    ls.os.fill(' ');
+    ls.os.width(0);
+    if (level == LOG_LEVEL_WARN)
+        ls.buf.text = "WARNING: ";
+    else if (level == LOG_LEVEL_ERROR)
+        ls.buf.text = "ERROR: ";
+    os = &ls.os;
+}
+
+Logger::Line::~Line()
+{
+    line_depth--;
+    std::string &text = static_cast<LineBuf *>(os->rdbuf())->text;
+    // the logger ends the line, a report that printed nothing leaves no blank line
+    if (!text.empty() && text.back() == '\n')
+        text.pop_back();
+    if (!text.empty())
+        publish(level, text);
+}
+
+void Logger::flush()
+{
+    theFlusher()->drain();
+}
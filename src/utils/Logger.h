@@ -0,0 +1,69 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <ostream>
+
+enum LogLevel
+{
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR
+};
+
+// calls below LOG_MIN_LEVEL are compiled out, build with -DLOG_MIN_LEVEL=0 for debug lines
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Leveled console log of the transfer path.
+// A line is formatted into a thread local buffer and copied into the calling
+// thread's ring without locks; a background thread moves the lines of all
+// threads to stdout in time order and flushes once per batch, so logging never
+// waits on the terminal. WARN and ERROR lines get the "WARNING: " / "ERROR: "
+// prefix and wake the flusher at once. A thread whose ring is full waits for
+// the flusher, lines are never dropped.
+class Logger
+{
+public:
+    static const uint64_t RING_SIZE = 1 << 16;
+
+    static bool enabled(LogLevel level) { return level >= min_level.load(std::memory_order_relaxed); }
+    static void setLevel(LogLevel level) { min_level.store(level, std::memory_order_relaxed); }
+    // returns when everything logged so far is on stdout
+    static void flush();
+
+    // one log line, published when it goes out of scope
+    class Line
+    {
+    public:
+        explicit Line(LogLevel level);
+        ~Line();
+        std::ostream &stream() { return *os; }
+
+    private:
+        LogLevel level;
+        std::ostream *os;
+    };
+
+private:
+    static std::atomic<int> min_level;
+};
+
+// turns the stream expression into void so it fits the conditional below
+struct LogVoidify
+{
+    void operator&(std::ostream &) {}
+};
+
+// an expression, safe in an unbraced if; the operands are not evaluated when the level is off
+#define LOG_AT(level) \
+    !((level) >= LOG_MIN_LEVEL && Logger::enabled(level)) ? (void)0 : LogVoidify() & Logger::Line(level).stream()
+#define LOGD LOG_AT(LOG_LEVEL_DEBUG)
+#define LOGI LOG_AT(LOG_LEVEL_INFO)
+#define LOGW LOG_AT(LOG_LEVEL_WARN)
+#define LOGE LOG_AT(LOG_LEVEL_ERROR)
+
+#endif